@@ -209,11 +209,11 @@ static int gic_suspend(struct sys_device *sysdev, pm_message_t state)
 	return 0;
 }
 
-void gic_show_resume_irq(unsigned int gic_nr)
+static void gic_pending_wakeup_irqs(unsigned int gic_nr,
+				    unsigned long *pending)
 {
 	unsigned int i;
 	u32 enabled;
-	unsigned long pending[32];
 	void __iomem *base = gic_data[gic_nr].dist_base;
 
 	spin_lock(&irq_controller_lock);
@@ -223,6 +223,27 @@ void gic_show_resume_irq(unsigned int gic_nr)
 		pending[i] &= enabled;
 	}
 	spin_unlock(&irq_controller_lock);
+}
+
+/* Returns the lowest pending wakeup irq, or -1 if none is pending */
+int gic_first_resume_irq(unsigned int gic_nr)
+{
+	unsigned int i;
+	unsigned long pending[32];
+
+	gic_pending_wakeup_irqs(gic_nr, pending);
+	i = find_first_bit(pending, gic_data[gic_nr].max_irq);
+	if (i >= gic_data[gic_nr].max_irq)
+		return -1;
+	return i + gic_data[gic_nr].irq_offset;
+}
+
+void gic_show_resume_irq(unsigned int gic_nr)
+{
+	unsigned int i;
+	unsigned long pending[32];
+
+	gic_pending_wakeup_irqs(gic_nr, pending);
 
 	for (i = find_first_bit(pending, gic_data[gic_nr].max_irq);
 	     i < gic_data[gic_nr].max_irq;
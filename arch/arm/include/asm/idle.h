@@ -0,0 +1,16 @@
+#ifndef __ASM_ARM_IDLE_H
+#define __ASM_ARM_IDLE_H
+
+/*
+ * Idle notifier, same interface as x86. The chain is called by the idle
+ * loop of each cpu with IDLE_START when it stops the tick to idle, and
+ * with IDLE_END when it is about to run a task again.
+ */
+#define IDLE_START 1
+#define IDLE_END 2
+
+struct notifier_block;
+void idle_notifier_register(struct notifier_block *n);
+void idle_notifier_unregister(struct notifier_block *n);
+
+#endif /* __ASM_ARM_IDLE_H */
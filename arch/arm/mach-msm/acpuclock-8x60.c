@@ -24,9 +24,14 @@
 #include <linux/errno.h>
 #include <linux/cpufreq.h>
 #include <linux/cpu.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/regulator/consumer.h>
 
 #include <asm/cpu.h>
+#include <asm/div64.h>
 
 #include <mach/board.h>
 #include <mach/msm_iomap.h>
@@ -157,6 +162,9 @@ struct clkctl_acpu_speed {
 	struct clkctl_l2_speed *l2_level;
 	unsigned int     vdd_sc;
 	unsigned int     avsdscr_setting;
+	/* Derived by build_transitions(). */
+	unsigned int     vdd_mem;
+	unsigned int     vdd_dig;
 };
 
 /* Instantaneous bandwidth requests in MB/s. */
@@ -188,6 +196,11 @@ static struct msm_bus_scale_pdata bus_client_pdata = {
 
 static uint32_t bus_perf_client;
 
+/* Bus level last voted (-1: none yet) and a lower one not yet voted. */
+static int bus_bw_cur = -1;
+static int bus_bw_lower = -1;
+static DEFINE_MUTEX(bus_bw_lock);
+
 /* L2 frequencies = 2 * 27 MHz * L_VAL */
 static struct clkctl_l2_speed l2_freq_tbl_v2[] = {
 	[0]  = { MAX_AXI, 0, 0,    1000000, 1100000, 0},
@@ -244,14 +257,118 @@ static struct clkctl_acpu_speed *acpu_freq_tbl;
 static struct clkctl_l2_speed *l2_freq_tbl = l2_freq_tbl_v2;
 static unsigned int l2_freq_tbl_size = ARRAY_SIZE(l2_freq_tbl_v2);
 
+/*
+ * What switching between two acpu_freq_tbl rows has to do, worked out
+ * from the tables once so that acpuclk_set_rate() only touches the
+ * rails, the L2 and the bus when they change. The votes applied before
+ * the switch are the max of both rows: no rail may drop while the old
+ * configuration is still running.
+ */
+#define TRANS_VDD_UP	BIT(0)
+#define TRANS_VDD_DOWN	BIT(1)
+#define TRANS_L2	BIT(2)
+
+struct acpu_transition {
+	unsigned int flags;
+	unsigned int vdd_sc;
+	unsigned int vdd_mem;
+	unsigned int vdd_dig;
+	/* Measured CPUFREQ and HOTPLUG switches, in us. */
+	unsigned int count;
+	unsigned int max_us;
+	u64 total_us;
+};
+
+static struct acpu_transition transitions[TABLE_SIZE][TABLE_SIZE];
+
+/* All measured switches, bucket n counts [2^n, 2^(n+1)) us. */
+#define SWITCH_HIST_BUCKETS 12
+static unsigned int switch_hist[SWITCH_HIST_BUCKETS];
+static unsigned int switch_hist_count;
+
+/* Call with drv_state.lock held once the tables are set up. */
+static void build_transitions(void)
+{
+	struct clkctl_acpu_speed *s, *t;
+	struct acpu_transition *tr;
+	unsigned int pll_vdd_dig;
+
+	for (s = acpu_freq_tbl; s->acpuclk_khz != 0; s++) {
+		BUG_ON(s - acpu_freq_tbl >= TABLE_SIZE);
+
+		/* vdd_mem must be >= vdd_sc */
+		s->vdd_mem = max(s->vdd_sc, s->l2_level->vdd_mem);
+		/* Factor-in PLL vdd_dig requirements. */
+		if ((s->l2_level->khz > SCPLL_LOW_VDD_FMAX) ||
+		    (s->pll == ACPU_SCPLL
+		     && s->acpuclk_khz > SCPLL_LOW_VDD_FMAX))
+			pll_vdd_dig = SCPLL_NOMINAL_VDD;
+		else
+			pll_vdd_dig = SCPLL_LOW_VDD;
+		s->vdd_dig = max(s->l2_level->vdd_dig, pll_vdd_dig);
+	}
+
+	for (s = acpu_freq_tbl; s->acpuclk_khz != 0; s++) {
+		for (t = acpu_freq_tbl; t->acpuclk_khz != 0; t++) {
+			tr = &transitions[s - acpu_freq_tbl][t - acpu_freq_tbl];
+			tr->flags = 0;
+			if (t->vdd_sc > s->vdd_sc || t->vdd_mem > s->vdd_mem
+			    || t->vdd_dig > s->vdd_dig)
+				tr->flags |= TRANS_VDD_UP;
+			if (t->vdd_sc < s->vdd_sc || t->vdd_mem < s->vdd_mem
+			    || t->vdd_dig < s->vdd_dig)
+				tr->flags |= TRANS_VDD_DOWN;
+			if (t->l2_level != s->l2_level)
+				tr->flags |= TRANS_L2;
+			tr->vdd_sc = max(s->vdd_sc, t->vdd_sc);
+			tr->vdd_mem = max(s->vdd_mem, t->vdd_mem);
+			tr->vdd_dig = max(s->vdd_dig, t->vdd_dig);
+		}
+	}
+}
+
+/* Call with drv_state.lock held. */
+static void record_switch_time(struct acpu_transition *tr, ktime_t start)
+{
+	unsigned int us = ktime_to_us(ktime_sub(ktime_get(), start));
+	int bucket = us ? min(fls(us) - 1, SWITCH_HIST_BUCKETS - 1) : 0;
+
+	tr->count++;
+	tr->total_us += us;
+	if (us > tr->max_us)
+		tr->max_us = us;
+	switch_hist[bucket]++;
+	switch_hist_count++;
+}
+
 unsigned long acpuclk_get_rate(int cpu)
 {
 	return drv_state.current_speed[cpu]->acpuclk_khz;
 }
 
+/*
+ * The 90th percentile of the measured switches once there are enough of
+ * them, the platform figure until then.
+ */
 uint32_t acpuclk_get_switch_time(void)
 {
-	return drv_state.acpu_switch_time_us;
+	uint32_t us = drv_state.acpu_switch_time_us;
+	unsigned int seen = 0;
+	int i;
+
+	mutex_lock(&drv_state.lock);
+	if (switch_hist_count >= 32) {
+		for (i = 0; i < SWITCH_HIST_BUCKETS; i++) {
+			seen += switch_hist[i];
+			if (seen * 10 >= switch_hist_count * 9) {
+				us = 2U << i;
+				break;
+			}
+		}
+	}
+	mutex_unlock(&drv_state.lock);
+
+	return us;
 }
 
 unsigned long clk_get_max_axi_khz(void)
@@ -398,23 +515,53 @@ static void set_l2_speed(struct clkctl_l2_speed *tgt_s)
 	drv_state.current_l2_speed = tgt_s;
 }
 
-/* Update the bus bandwidth request. */
-static void set_bus_bw(unsigned int bw)
+/* Call with bus_bw_lock held. This may sleep. */
+static void bus_bw_update(int bw)
 {
 	int ret;
 
+	ret = msm_bus_scale_client_update_request(bus_perf_client, bw);
+	if (ret)
+		pr_err("%s: bandwidth request failed (%d)\n", __func__, ret);
+	else
+		bus_bw_cur = bw;
+}
+
+static void bus_bw_lower_fn(struct work_struct *work)
+{
+	mutex_lock(&bus_bw_lock);
+	if (bus_bw_lower >= 0)
+		bus_bw_update(bus_bw_lower);
+	bus_bw_lower = -1;
+	mutex_unlock(&bus_bw_lock);
+}
+
+static DECLARE_WORK(bus_bw_lower_work, bus_bw_lower_fn);
+
+/* Update the bus bandwidth request. */
+static void set_bus_bw(unsigned int bw)
+{
 	/* Bounds check. */
 	if (bw >= ARRAY_SIZE(bw_level_tbl)) {
 		pr_err("%s: invalid bandwidth request (%d)\n", __func__, bw);
 		return;
 	}
 
-	/* Update bandwidth if requst has changed. This may sleep. */
-	ret = msm_bus_scale_client_update_request(bus_perf_client, bw);
-	if (ret)
-		pr_err("%s: bandwidth request failed (%d)\n", __func__, ret);
-
-	return;
+	/*
+	 * Raise the request before returning, the new speed may need it.
+	 * Nothing waits on a lower request, so leave that to a worker and
+	 * do not hold up the switch on the bus arbitration and RPM.
+	 */
+	mutex_lock(&bus_bw_lock);
+	if (bus_bw_cur >= 0 && bw < bus_bw_cur) {
+		bus_bw_lower = bw;
+		schedule_work(&bus_bw_lower_work);
+	} else {
+		bus_bw_lower = -1;
+		if (bw != bus_bw_cur)
+			bus_bw_update(bw);
+	}
+	mutex_unlock(&bus_bw_lock);
 }
 
 /* Apply any per-cpu voltage increases. */
@@ -526,8 +673,9 @@ static void switch_sc_speed(int cpu, struct clkctl_acpu_speed *tgt_s)
 int acpuclk_set_rate(int cpu, unsigned long rate, enum setrate_reason reason)
 {
 	struct clkctl_acpu_speed *tgt_s, *strt_s;
-	struct clkctl_l2_speed *tgt_l2;
-	unsigned int vdd_mem, vdd_dig, pll_vdd_dig;
+	struct clkctl_l2_speed *tgt_l2 = NULL;
+	struct acpu_transition *tr;
+	ktime_t start = ktime_set(0, 0);
 	unsigned long flags;
 	int rc = 0;
 
@@ -536,8 +684,10 @@ int acpuclk_set_rate(int cpu, unsigned long rate, enum setrate_reason reason)
 		goto out;
 	}
 
-	if (reason == SETRATE_CPUFREQ || reason == SETRATE_HOTPLUG)
+	if (reason == SETRATE_CPUFREQ || reason == SETRATE_HOTPLUG) {
 		mutex_lock(&drv_state.lock);
+		start = ktime_get();
+	}
 
 	strt_s = drv_state.current_speed[cpu];
 
@@ -553,6 +703,7 @@ int acpuclk_set_rate(int cpu, unsigned long rate, enum setrate_reason reason)
 		rc = -EINVAL;
 		goto out;
 	}
+	tr = &transitions[strt_s - acpu_freq_tbl][tgt_s - acpu_freq_tbl];
 
 	/* AVS needs SAW_VCTL to be intitialized correctly, before enable,
 	 * and is not initialized at acpuclk_init().
@@ -560,23 +711,11 @@ int acpuclk_set_rate(int cpu, unsigned long rate, enum setrate_reason reason)
 	if (reason == SETRATE_CPUFREQ)
 		AVS_DISABLE(cpu);
 
-	/* Calculate vdd_mem and vdd_dig requirements.
-	 * vdd_mem must be >= vdd_sc */
-	vdd_mem = max(tgt_s->vdd_sc, tgt_s->l2_level->vdd_mem);
-	/* Factor-in PLL vdd_dig requirements. */
-	if ((tgt_s->l2_level->khz > SCPLL_LOW_VDD_FMAX) ||
-	    (tgt_s->pll == ACPU_SCPLL
-	     && tgt_s->acpuclk_khz > SCPLL_LOW_VDD_FMAX))
-		pll_vdd_dig = SCPLL_NOMINAL_VDD;
-	else
-		pll_vdd_dig = SCPLL_LOW_VDD;
-	vdd_dig = max(tgt_s->l2_level->vdd_dig, pll_vdd_dig);
-
 	/* Increase VDD levels if needed. */
 	if ((reason == SETRATE_CPUFREQ || reason == SETRATE_HOTPLUG
-	  || reason == SETRATE_INIT)
-			&& (tgt_s->acpuclk_khz > strt_s->acpuclk_khz)) {
-		rc = increase_vdd(cpu, tgt_s->vdd_sc, vdd_mem, vdd_dig, reason);
+	  || reason == SETRATE_INIT) && (tr->flags & TRANS_VDD_UP)) {
+		rc = increase_vdd(cpu, tr->vdd_sc, tr->vdd_mem, tr->vdd_dig,
+				  reason);
 		if (rc)
 			goto out;
 	}
@@ -588,10 +727,12 @@ int acpuclk_set_rate(int cpu, unsigned long rate, enum setrate_reason reason)
 	switch_sc_speed(cpu, tgt_s);
 
 	/* Update the L2 vote and apply the rate change. */
-	spin_lock_irqsave(&drv_state.l2_lock, flags);
-	tgt_l2 = compute_l2_speed(cpu, tgt_s->l2_level);
-	set_l2_speed(tgt_l2);
-	spin_unlock_irqrestore(&drv_state.l2_lock, flags);
+	if (tr->flags & TRANS_L2) {
+		spin_lock_irqsave(&drv_state.l2_lock, flags);
+		tgt_l2 = compute_l2_speed(cpu, tgt_s->l2_level);
+		set_l2_speed(tgt_l2);
+		spin_unlock_irqrestore(&drv_state.l2_lock, flags);
+	}
 
 	/* Nothing else to do for SWFI. */
 	if (reason == SETRATE_SWFI)
@@ -601,12 +742,14 @@ int acpuclk_set_rate(int cpu, unsigned long rate, enum setrate_reason reason)
 	if (reason == SETRATE_PC)
 		goto out;
 
-	/* Update bus bandwith request. */
-	set_bus_bw(tgt_l2->bw_level);
+	/* Update bus bandwith request, only the L2 speed changes it. */
+	if (tgt_l2)
+		set_bus_bw(tgt_l2->bw_level);
 
 	/* Drop VDD levels if we can. */
-	if (tgt_s->acpuclk_khz < strt_s->acpuclk_khz)
-		decrease_vdd(cpu, tgt_s->vdd_sc, vdd_mem, vdd_dig, reason);
+	if (tr->flags & TRANS_VDD_DOWN)
+		decrease_vdd(cpu, tgt_s->vdd_sc, tgt_s->vdd_mem,
+			     tgt_s->vdd_dig, reason);
 
 	dprintk("ACPU%d speed change complete\n", cpu);
 
@@ -614,6 +757,9 @@ int acpuclk_set_rate(int cpu, unsigned long rate, enum setrate_reason reason)
 	if (reason == SETRATE_CPUFREQ)
 		AVS_ENABLE(cpu, tgt_s->avsdscr_setting);
 
+	if (reason == SETRATE_CPUFREQ || reason == SETRATE_HOTPLUG)
+		record_switch_time(tr, start);
+
 out:
 	if (reason == SETRATE_CPUFREQ || reason == SETRATE_HOTPLUG)
 		mutex_unlock(&drv_state.lock);
@@ -660,6 +806,7 @@ void acpuclk_set_cpu_l2(unsigned int cpu_khz, int l2_khz) {
 		acpu_freq_tbl[i].l2_level->l_val = (new_l2_khz/SCPLL_STEP);
 		//pr_err("Would have set CPU KHz %d to L2 KHz: %u l_val: %x\n", acpu_freq_tbl[i].acpuclk_khz, new_l2_khz, (new_l2_khz/SCPLL_STEP));
 	}
+	build_transitions();
 
 	mutex_unlock(&drv_state.lock);
 }
@@ -711,6 +858,7 @@ void acpuclk_set_l2(unsigned int khz, int vdd_uv_dig, int vdd_uv_mem) {
 		l2_freq_tbl[i].vdd_mem = new_vdd_uv_mem;
 		//pr_err("Would have set L2 khz %d to vdd_dig: %u vdd_mem: %u\n", l2_freq_tbl_v2[i].khz, new_vdd_uv_dig, new_vdd_uv_mem);
 	}
+	build_transitions();
 
 	mutex_unlock(&drv_state.lock);
 }
@@ -759,6 +907,7 @@ void acpuclk_set_vdd(unsigned int khz, int vdd_uv) {
 
 		acpu_freq_tbl[i].vdd_sc = new_vdd_uv;
 	}
+	build_transitions();
 
 	mutex_unlock(&drv_state.lock);
 }
@@ -963,6 +1112,7 @@ void __init msm_acpu_clock_init(struct msm_acpu_clock_platform_data *clkdata)
 
 	/* Configure hardware. */
 	acpu_freq_tbl = acpu_freq_tbl_fast;
+	build_transitions();
 	unselect_scplls();
 	scpll_set_refs();
 	for_each_possible_cpu(cpu)
@@ -982,3 +1132,83 @@ void __init msm_acpu_clock_init(struct msm_acpu_clock_platform_data *clkdata)
 	cpufreq_table_init();
 	register_hotcpu_notifier(&acpuclock_cpu_notifier);
 }
+
+static int acpuclk_switch_time_show(struct seq_file *m, void *unused)
+{
+	struct clkctl_acpu_speed *s, *t;
+	struct acpu_transition *tr;
+	int i;
+
+	if (!acpu_freq_tbl)
+		return 0;
+
+	mutex_lock(&drv_state.lock);
+	seq_printf(m, "switches: %u\n", switch_hist_count);
+	for (i = 0; i < SWITCH_HIST_BUCKETS; i++)
+		seq_printf(m, "%6u us: %u\n", 1U << i, switch_hist[i]);
+
+	seq_printf(m, "\n%8s %8s %8s %8s %8s\n",
+		   "from", "to", "count", "avg_us", "max_us");
+	for (s = acpu_freq_tbl; s->acpuclk_khz != 0; s++) {
+		for (t = acpu_freq_tbl; t->acpuclk_khz != 0; t++) {
+			u64 avg;
+
+			tr = &transitions[s - acpu_freq_tbl][t - acpu_freq_tbl];
+			if (!tr->count)
+				continue;
+			avg = tr->total_us;
+			do_div(avg, tr->count);
+			seq_printf(m, "%8u %8u %8u %8llu %8u\n",
+				   s->acpuclk_khz, t->acpuclk_khz, tr->count,
+				   avg, tr->max_us);
+		}
+	}
+	mutex_unlock(&drv_state.lock);
+
+	return 0;
+}
+
+static int acpuclk_switch_time_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, acpuclk_switch_time_show, NULL);
+}
+
+/* Any write clears the measurements. */
+static ssize_t acpuclk_switch_time_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	int i, j;
+
+	mutex_lock(&drv_state.lock);
+	for (i = 0; i < TABLE_SIZE; i++) {
+		for (j = 0; j < TABLE_SIZE; j++) {
+			transitions[i][j].count = 0;
+			transitions[i][j].max_us = 0;
+			transitions[i][j].total_us = 0;
+		}
+	}
+	memset(switch_hist, 0, sizeof(switch_hist));
+	switch_hist_count = 0;
+	mutex_unlock(&drv_state.lock);
+
+	return count;
+}
+
+static const struct file_operations acpuclk_switch_time_fops = {
+	.open		= acpuclk_switch_time_open,
+	.read		= seq_read,
+	.write		= acpuclk_switch_time_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init acpuclk_debug_init(void)
+{
+	if (!acpu_freq_tbl)
+		return 0;
+
+	debugfs_create_file("acpuclk_switch_time", 0644, NULL, NULL,
+			    &acpuclk_switch_time_fops);
+	return 0;
+}
+late_initcall(acpuclk_debug_init);
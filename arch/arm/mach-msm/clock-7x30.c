@@ -1352,5 +1352,6 @@ struct clk_ops soc_clk_ops_7x30 = {
 	.reset = soc_clk_reset,
 	.set_flags = soc_clk_set_flags,
 	.measure_rate = soc_clk_measure_rate,
+	.get_stats = local_clk_get_stats,
 };
 
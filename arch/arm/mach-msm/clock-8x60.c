@@ -361,7 +361,8 @@ static void set_rate_mnd_banked(struct clk_local *clk, struct clk_freq_tbl *nf)
 	cc_reg_val = readl(clk->cc_reg);
 	bank_sel = !!(cc_reg_val & banks->bank_sel_mask);
 	 /* If clock isn't running, don't switch banks. */
-	bank_sel ^= (clk->count == 0 || clk->current_freq->freq_hz == 0);
+	bank_sel ^= (atomic_read(&clk->count) == 0 ||
+		     clk->current_freq->freq_hz == 0);
 	if (bank_sel == 0) {
 		new_bank_masks = &banks->bank1_mask;
 		old_bank_masks = &banks->bank0_mask;
@@ -379,7 +380,7 @@ static void set_rate_mnd_banked(struct clk_local *clk, struct clk_freq_tbl *nf)
 	/* Program NS only if the clock is enabled, since the NS will be set
 	 * as part of the enable procedure and should remain with a low-power
 	 * MUX input selected until then. */
-	if (clk->count) {
+	if (atomic_read(&clk->count)) {
 		ns_reg_val &= ~(new_bank_masks->ns_mask);
 		ns_reg_val |= (nf->ns_val & new_bank_masks->ns_mask);
 		writel(ns_reg_val, clk->ns_reg);
@@ -388,7 +389,7 @@ static void set_rate_mnd_banked(struct clk_local *clk, struct clk_freq_tbl *nf)
 	writel(nf->md_val, new_bank_masks->md_reg);
 
 	/* Enable counter only if clock is enabled. */
-	if (clk->count)
+	if (atomic_read(&clk->count))
 		cc_reg_val |= new_bank_masks->mnd_en_mask;
 	else
 		cc_reg_val &= ~(new_bank_masks->mnd_en_mask);
@@ -403,7 +404,7 @@ static void set_rate_mnd_banked(struct clk_local *clk, struct clk_freq_tbl *nf)
 
 	/* Switch to the new bank if clock is running.  If it isn't, then
 	 * no switch is necessary since we programmed the active bank. */
-	if (clk->count && clk->current_freq->freq_hz) {
+	if (atomic_read(&clk->count) && clk->current_freq->freq_hz) {
 		cc_reg_val ^= banks->bank_sel_mask;
 		writel(cc_reg_val, clk->cc_reg);
 		/* Wait at least 6 cycles of slowest bank's clock
@@ -441,7 +442,8 @@ static void set_rate_div_banked(struct clk_local *clk, struct clk_freq_tbl *nf)
 	ns_reg_val = readl(clk->ns_reg);
 	bank_sel = !!(ns_reg_val & banks->bank_sel_mask);
 	 /* If clock isn't running, don't switch banks. */
-	bank_sel ^= (clk->count == 0 || clk->current_freq->freq_hz == 0);
+	bank_sel ^= (atomic_read(&clk->count) == 0 ||
+		     clk->current_freq->freq_hz == 0);
 	if (bank_sel == 0) {
 		new_bank_masks = &banks->bank1_mask;
 		old_bank_masks = &banks->bank0_mask;
@@ -453,7 +455,7 @@ static void set_rate_div_banked(struct clk_local *clk, struct clk_freq_tbl *nf)
 	/* Program NS only if the clock is enabled, since the NS will be set
 	 * as part of the enable procedure and should remain with a low-power
 	 * MUX input selected until then. */
-	if (clk->count) {
+	if (atomic_read(&clk->count)) {
 		ns_reg_val &= ~(new_bank_masks->ns_mask);
 		ns_reg_val |= (nf->ns_val & new_bank_masks->ns_mask);
 		writel(ns_reg_val, clk->ns_reg);
@@ -461,7 +463,7 @@ static void set_rate_div_banked(struct clk_local *clk, struct clk_freq_tbl *nf)
 
 	/* Switch to the new bank if clock is running.  If it isn't, then
 	 * no switch is necessary since we programmed the active bank. */
-	if (clk->count && clk->current_freq->freq_hz) {
+	if (atomic_read(&clk->count) && clk->current_freq->freq_hz) {
 		ns_reg_val ^= banks->bank_sel_mask;
 		writel(ns_reg_val, clk->ns_reg);
 		/* Wait at least 6 cycles of slowest bank's clock
@@ -2670,4 +2672,5 @@ struct clk_ops soc_clk_ops_8x60 = {
 	.reset = soc_clk_reset,
 	.set_flags = soc_clk_set_flags,
 	.measure_rate = soc_clk_measure_rate,
+	.get_stats = local_clk_get_stats,
 };
@@ -98,6 +98,35 @@ static int clock_debug_local_get(void *data, u64 *val)
 DEFINE_SIMPLE_ATTRIBUTE(clock_local_fops, clock_debug_local_get,
 			NULL, "%llu\n");
 
+static int clock_stats_show(struct seq_file *m, void *unused)
+{
+	struct clk *clock = m->private;
+	struct clk_stats stats;
+	int rc;
+
+	rc = clock->ops->get_stats(clock->id, &stats);
+	if (rc)
+		return rc;
+
+	seq_printf(m, "enables: %lu\n", stats.enables);
+	seq_printf(m, "disables: %lu\n", stats.disables);
+	seq_printf(m, "rate_changes: %lu\n", stats.rate_changes);
+
+	return 0;
+}
+
+static int clock_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, clock_stats_show, inode->i_private);
+}
+
+static const struct file_operations clock_stats_fops = {
+	.open		= clock_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static struct dentry *debugfs_base;
 static u32 debug_suspend;
 static struct list_head *clocks_ptr;
@@ -215,6 +244,11 @@ int __init clock_debug_add(struct clk *clock)
 				S_IRUGO, clk_dir, clock, &list_rates_fops))
 			goto error;
 
+	if (clock->ops->get_stats)
+		if (!debugfs_create_file("stats",
+				S_IRUGO, clk_dir, clock, &clock_stats_fops))
+			goto error;
+
 	return 0;
 error:
 	debugfs_remove_recursive(clk_dir);
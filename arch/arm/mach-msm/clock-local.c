@@ -31,6 +31,9 @@
 #include "clock.h"
 #include "clock-local.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/clock_local.h>
+
 #ifdef CONFIG_MSM_SECURE_IO
 #undef readl
 #undef writel
@@ -47,13 +50,37 @@
 DEFINE_SPINLOCK(local_clock_reg_lock);
 struct clk_freq_tbl local_dummy_freq = F_END;
 
+/*
+ * Clock, source and voltage votes are atomic counts. Votes that don't take
+ * a count to or from zero don't touch the hardware and are made without
+ * taking any lock. Transitions through zero are serialized by the locks,
+ * and a count only becomes non-zero once the hardware has been set up.
+ */
 #define MAX_SOURCES 20
-static int src_votes[MAX_SOURCES];
+static atomic_t src_votes[MAX_SOURCES];
 static DEFINE_SPINLOCK(src_vote_lock);
 
-unsigned local_sys_vdd_votes[NUM_SYS_VDD_LEVELS];
+static atomic_t local_sys_vdd_votes[NUM_SYS_VDD_LEVELS];
 static DEFINE_SPINLOCK(sys_vdd_vote_lock);
 
+/*
+ * Drop a vote without locking, but only while others remain. The last vote,
+ * and an unbalanced one, go through the locked path and its checks.
+ */
+static int local_vote_drop_unless_last(atomic_t *v)
+{
+	int c = atomic_read(v), old;
+
+	while (c > 1) {
+		old = atomic_cmpxchg(v, c, c - 1);
+		if (old == c)
+			return 1;
+		c = old;
+	}
+
+	return 0;
+}
+
 static int local_clk_enable_nolock(unsigned id);
 static int local_clk_disable_nolock(unsigned id);
 static int local_src_enable_nolock(int src);
@@ -101,17 +128,19 @@ void set_rate_nop(struct clk_local *clk, struct clk_freq_tbl *nf)
  * SYS_VDD voting functions
  */
 
-/* Update system voltage level given the current votes. */
-static int local_update_sys_vdd(void)
+/* Update system voltage level given the current votes, plus a vote for
+ * level 'pending' that has not been counted yet. */
+static int local_update_sys_vdd(int pending)
 {
 	static int cur_level = NUM_SYS_VDD_LEVELS;
 	int level, rc = 0;
 
-	if (local_sys_vdd_votes[HIGH])
+	if (atomic_read(&local_sys_vdd_votes[HIGH]) || pending == HIGH)
 		level = HIGH;
-	else if (local_sys_vdd_votes[NOMINAL])
+	else if (atomic_read(&local_sys_vdd_votes[NOMINAL]) ||
+			pending == NOMINAL)
 		level = NOMINAL;
-	else if (local_sys_vdd_votes[LOW])
+	else if (atomic_read(&local_sys_vdd_votes[LOW]) || pending == LOW)
 		level = LOW;
 	else
 		level = NONE;
@@ -136,11 +165,14 @@ int local_vote_sys_vdd(unsigned level)
 	if (level >= ARRAY_SIZE(local_sys_vdd_votes))
 		return -EINVAL;
 
+	/* The level already has votes, so the rail is already there. */
+	if (atomic_add_unless(&local_sys_vdd_votes[level], 1, 0))
+		return 0;
+
 	spin_lock_irqsave(&sys_vdd_vote_lock, flags);
-	local_sys_vdd_votes[level]++;
-	rc = local_update_sys_vdd();
-	if (rc)
-		local_sys_vdd_votes[level]--;
+	rc = local_update_sys_vdd(level);
+	if (!rc)
+		atomic_inc(&local_sys_vdd_votes[level]);
 	spin_unlock_irqrestore(&sys_vdd_vote_lock, flags);
 
 	return rc;
@@ -156,18 +188,22 @@ int local_unvote_sys_vdd(unsigned level)
 	if (level >= ARRAY_SIZE(local_sys_vdd_votes))
 		return -EINVAL;
 
+	/* Other votes remain for the level, so the rail stays. */
+	if (local_vote_drop_unless_last(&local_sys_vdd_votes[level]))
+		return 0;
+
 	spin_lock_irqsave(&sys_vdd_vote_lock, flags);
-	if (local_sys_vdd_votes[level])
-		local_sys_vdd_votes[level]--;
-	else {
+	if (!atomic_read(&local_sys_vdd_votes[level])) {
 		pr_warning("%s: Reference counts are incorrect for level %d!\n",
 			__func__, level);
 		goto out;
 	}
 
-	rc = local_update_sys_vdd();
-	if (rc)
-		local_sys_vdd_votes[level]++;
+	if (atomic_dec_and_test(&local_sys_vdd_votes[level])) {
+		rc = local_update_sys_vdd(NONE);
+		if (rc)
+			atomic_inc(&local_sys_vdd_votes[level]);
+	}
 out:
 	spin_unlock_irqrestore(&sys_vdd_vote_lock, flags);
 	return rc;
@@ -182,7 +218,7 @@ static int local_src_enable_nolock(int src)
 {
 	int rc = 0;
 
-	if (!src_votes[src]) {
+	if (!atomic_read(&src_votes[src])) {
 		if (soc_clk_sources[src].par != SRC_NONE)
 			rc = local_src_enable_nolock(soc_clk_sources[src].par);
 			if (rc)
@@ -193,7 +229,7 @@ static int local_src_enable_nolock(int src)
 			if (rc)
 				goto err_enable;
 	}
-	src_votes[src]++;
+	atomic_inc(&src_votes[src]);
 
 	return rc;
 
@@ -215,6 +251,10 @@ int local_src_enable(int src)
 	if (src < 0 || src >= MAX_SOURCES)
 		return -EINVAL;
 
+	/* The source is already running, just count the vote. */
+	if (atomic_add_unless(&src_votes[src], 1, 0))
+		return 0;
+
 	spin_lock_irqsave(&src_vote_lock, flags);
 	rc = local_src_enable_nolock(src);
 	spin_unlock_irqrestore(&src_vote_lock, flags);
@@ -227,15 +267,13 @@ static int local_src_disable_nolock(int src)
 {
 	int rc = 0;
 
-	if (src_votes[src] > 0)
-		src_votes[src]--;
-	else {
+	if (!atomic_read(&src_votes[src])) {
 		pr_warning("%s: Reference counts are incorrect for "
 			   "src %d!\n", __func__, src);
 		return rc;
 	}
 
-	if (src_votes[src] == 0) {
+	if (atomic_dec_and_test(&src_votes[src])) {
 		/* Perform source-specific disable operations. */
 		if (soc_clk_sources[src].enable_func)
 			rc = soc_clk_sources[src].enable_func(src, 0);
@@ -253,7 +291,7 @@ static int local_src_disable_nolock(int src)
 err_disable_par:
 	soc_clk_sources[src].enable_func(src, 1);
 err_disable:
-	src_votes[src]++;
+	atomic_inc(&src_votes[src]);
 	return rc;
 }
 
@@ -268,6 +306,10 @@ int local_src_disable(int src)
 	if (src < 0 || src >= MAX_SOURCES)
 		return -EINVAL;
 
+	/* Other votes keep the source running. */
+	if (local_vote_drop_unless_last(&src_votes[src]))
+		return 0;
+
 	spin_lock_irqsave(&src_vote_lock, flags);
 	rc = local_src_disable_nolock(src);
 	spin_unlock_irqrestore(&src_vote_lock, flags);
@@ -413,7 +455,7 @@ static int local_clk_enable_nolock(unsigned id)
 	if (clk->type == NOENABLE)
 		return -EPERM;
 
-	if (!clk->count) {
+	if (!atomic_read(&clk->count)) {
 		rc = local_vote_sys_vdd(clk->current_freq->sys_vdd);
 		if (rc)
 			goto err_vdd;
@@ -434,8 +476,10 @@ static int local_clk_enable_nolock(unsigned id)
 		rc = soc_set_pwr_rail(id, 1);
 		if (rc)
 			goto err_pwr;
+		clk->hw_enables++;
+		trace_clock_local_enable(id);
 	}
-	clk->count++;
+	atomic_inc(&clk->count);
 
 	return rc;
 
@@ -456,17 +500,17 @@ static int local_clk_disable_nolock(unsigned id)
 	struct clk_local *clk = &soc_clk_local_tbl[id];
 	int rc = 0;
 
-	if (clk->count > 0)
-		clk->count--;
-	else {
+	if (!atomic_read(&clk->count)) {
 		pr_warning("%s: Reference counts are incorrect for clock %d!\n",
 			__func__, id);
 		return rc;
 	}
 
-	if (clk->count == 0) {
+	if (atomic_dec_and_test(&clk->count)) {
 		soc_set_pwr_rail(id, 0);
 		local_clk_disable_reg(id);
+		clk->hw_disables++;
+		trace_clock_local_disable(id);
 		rc = local_src_disable(clk->current_freq->src);
 		if (rc)
 			goto err_src;
@@ -489,7 +533,7 @@ err_par:
 	local_src_enable(clk->current_freq->src);
 err_src:
 	local_clk_enable_reg(id);
-	clk->count++;
+	atomic_inc(&clk->count);
 
 	return rc;
 }
@@ -500,6 +544,10 @@ int local_clk_enable(unsigned id)
 	int rc = 0;
 	unsigned long flags;
 
+	/* The clock is already running, just take a reference. */
+	if (atomic_add_unless(&soc_clk_local_tbl[id].count, 1, 0))
+		return 0;
+
 	spin_lock_irqsave(&local_clock_reg_lock, flags);
 	rc = local_clk_enable_nolock(id);
 	spin_unlock_irqrestore(&local_clock_reg_lock, flags);
@@ -512,6 +560,10 @@ void local_clk_disable(unsigned id)
 {
 	unsigned long flags;
 
+	/* Not the last reference, the clock keeps running. */
+	if (local_vote_drop_unless_last(&soc_clk_local_tbl[id].count))
+		return;
+
 	spin_lock_irqsave(&local_clock_reg_lock, flags);
 	local_clk_disable_nolock(id);
 	spin_unlock_irqrestore(&local_clock_reg_lock, flags);
@@ -527,7 +579,7 @@ void local_clk_auto_off(unsigned id)
 		return;
 
 	spin_lock_irqsave(&local_clock_reg_lock, flags);
-	if (clk->count == 0)
+	if (!atomic_read(&clk->count))
 		local_clk_disable_reg(id);
 	spin_unlock_irqrestore(&local_clock_reg_lock, flags);
 }
@@ -560,14 +612,14 @@ static int _local_clk_set_rate(unsigned id, struct clk_freq_tbl *nf)
 			/* Don't bother turning off if it is already off.
 			 * Checking ch->count is cheaper (cache) than reading
 			 * and writing to a register (uncached/unbuffered). */
-			if (ch->count)
+			if (atomic_read(&ch->count))
 				local_clk_disable_reg(chld[i]);
 		}
-		if (clk->count)
+		if (atomic_read(&clk->count))
 			local_clk_disable_reg(id);
 	}
 
-	if (clk->count) {
+	if (atomic_read(&clk->count)) {
 		/* Vote for voltage and source for new freq. */
 		rc = local_vote_sys_vdd(nf->sys_vdd);
 		if (rc)
@@ -584,7 +636,7 @@ static int _local_clk_set_rate(unsigned id, struct clk_freq_tbl *nf)
 	clk->set_rate(clk, nf);
 
 	/* Release requirements of the old freq. */
-	if (clk->count) {
+	if (atomic_read(&clk->count)) {
 		local_src_disable(cf->src);
 		local_unvote_sys_vdd(cf->sys_vdd);
 	}
@@ -592,17 +644,19 @@ static int _local_clk_set_rate(unsigned id, struct clk_freq_tbl *nf)
 	/* Current freq must be updated before local_clk_enable_reg()
 	 * is called to make sure the MNCNTR_EN bit is set correctly. */
 	clk->current_freq = nf;
+	clk->rate_changes++;
+	trace_clock_local_set_rate(id, cf->freq_hz, nf->freq_hz);
 
 src_enable_failed:
 sys_vdd_vote_failed:
 	/* Enable any clocks that were disabled. */
 	if (clk->bank_masks == NULL) {
-		if (clk->count)
+		if (atomic_read(&clk->count))
 			local_clk_enable_reg(id);
 		/* Enable only branches that were ON before. */
 		for (i = 0; chld && chld[i] != C(NONE); i++) {
 			struct clk_local *ch = &soc_clk_local_tbl[chld[i]];
-			if (ch->count)
+			if (atomic_read(&ch->count))
 				local_clk_enable_reg(chld[i]);
 		}
 	}
@@ -686,7 +740,22 @@ int local_clk_is_enabled(unsigned id)
 	if (clk->type == NOENABLE)
 		return -EPERM;
 
-	return !!(soc_clk_local_tbl[id].count);
+	return !!atomic_read(&soc_clk_local_tbl[id].count);
+}
+
+/* Report how often a clock was switched on, off and to another rate. */
+int local_clk_get_stats(unsigned id, struct clk_stats *stats)
+{
+	struct clk_local *clk = &soc_clk_local_tbl[id];
+	unsigned long flags;
+
+	spin_lock_irqsave(&local_clock_reg_lock, flags);
+	stats->enables = clk->hw_enables;
+	stats->disables = clk->hw_disables;
+	stats->rate_changes = clk->rate_changes;
+	spin_unlock_irqrestore(&local_clock_reg_lock, flags);
+
+	return 0;
 }
 
 /* Return a supported rate that's at least the specified rate. */
@@ -31,6 +31,7 @@
 #define __ARCH_ARM_MACH_MSM_CLOCK_LOCAL_H
 
 #include <linux/spinlock.h>
+#include <asm/atomic.h>
 #include "clock.h"
 
 /*
@@ -117,7 +118,7 @@ struct bank_masks {
  * Generic clock-definition struct and macros
  */
 struct clk_local {
-	int		count;
+	atomic_t	count;
 	const uint32_t	type;
 	void		*const ns_reg;
 	void		*const cc_reg;
@@ -138,6 +139,10 @@ struct clk_local {
 	void		(*set_rate)(struct clk_local *, struct clk_freq_tbl *);
 	struct clk_freq_tbl *const freq_tbl;
 	struct clk_freq_tbl *current_freq;
+	/* Statistics, protected by local_clock_reg_lock */
+	unsigned long	hw_enables;
+	unsigned long	hw_disables;
+	unsigned long	rate_changes;
 };
 
 #define C(x)		L_##x##_CLK
@@ -228,6 +233,7 @@ unsigned local_clk_get_rate(unsigned id);
 int local_clk_list_rate(unsigned id, unsigned n);
 int local_clk_is_enabled(unsigned id);
 long local_clk_round_rate(unsigned id, unsigned rate);
+int local_clk_get_stats(unsigned id, struct clk_stats *stats);
 
 /*
  * Required SoC-specific functions, implemented for every supported SoC
@@ -33,6 +33,13 @@
 #define CLKFLAG_MIN			0x00000400
 #define CLKFLAG_MAX			0x00000800
 
+/* Hardware transitions of a clock since boot */
+struct clk_stats {
+	unsigned long enables;
+	unsigned long disables;
+	unsigned long rate_changes;
+};
+
 struct clk_ops {
 	int (*enable)(unsigned id);
 	void (*disable)(unsigned id);
@@ -48,6 +55,7 @@ struct clk_ops {
 	int (*is_enabled)(unsigned id);
 	long (*round_rate)(unsigned id, unsigned rate);
 	int (*set_parent)(unsigned id, struct clk *parent);
+	int (*get_stats)(unsigned id, struct clk_stats *stats);
 };
 
 struct clk {
@@ -86,6 +86,12 @@ struct msm_rpm_notification {
 	uint32_t sel_masks[MSM_RPM_SEL_MASK_SIZE];  /* reserved for RPM use */
 };
 
+struct msm_rpm_async {
+	struct list_head list;  /* reserved for RPM use */
+	int rc;  /* reserved for RPM use */
+	void (*done)(struct msm_rpm_async *a, int rc);
+};
+
 struct msm_rpm_map_data {
 	uint32_t id;
 	uint32_t sel;
@@ -113,6 +119,8 @@ int msm_rpm_local_request_is_outstanding(void);
 int msm_rpm_get_status(struct msm_rpm_iv_pair *status, int count);
 int msm_rpm_set(int ctx, struct msm_rpm_iv_pair *req, int count);
 int msm_rpm_set_noirq(int ctx, struct msm_rpm_iv_pair *req, int count);
+int msm_rpm_set_async(int ctx, struct msm_rpm_iv_pair *req, int count,
+	struct msm_rpm_async *a);
 
 static inline int msm_rpm_set_nosleep(
 	int ctx, struct msm_rpm_iv_pair *req, int count)
@@ -27,6 +27,8 @@
 #include <linux/platform_device.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
+#include <linux/jhash.h>
+#include <linux/rculist.h>
 
 #include <asm/uaccess.h>
 #include <asm/byteorder.h>
@@ -87,6 +89,13 @@ if (msm_ipc_router_debug_mask & R2R_RAW_HDR) \
 #define IPC_ROUTER_LOG_EVENT_TX         0x11
 #define IPC_ROUTER_LOG_EVENT_RX         0x12
 
+/*
+ * Port, server and routing table lookups are RCU readers. The table
+ * mutexes only serialize updates, and removed entries are freed after
+ * a grace period. Local and remote port lookups return a reference, as
+ * their users sleep; servers are only used under rcu_read_lock or
+ * server_list_lock. Routing table entries are never removed.
+ */
 static LIST_HEAD(control_ports);
 static DEFINE_MUTEX(control_ports_lock);
 
@@ -94,7 +103,9 @@ static DEFINE_MUTEX(control_ports_lock);
 static struct list_head local_ports[LP_HASH_SIZE];
 static DEFINE_MUTEX(local_ports_lock);
 
-#define SRV_HASH_SIZE 32
+#define SRV_HASH_SIZE 64
+#define SRV_HASH(service, instance) \
+	(jhash_2words(service, instance, 0) & (SRV_HASH_SIZE - 1))
 static struct list_head server_list[SRV_HASH_SIZE];
 static DEFINE_MUTEX(server_list_lock);
 static wait_queue_head_t newserver_wait;
@@ -103,11 +114,17 @@ struct msm_ipc_server {
 	struct list_head list;
 	struct msm_ipc_port_name name;
 	struct list_head server_port_list;
+	struct rcu_head rcu;
 };
 
 struct msm_ipc_server_port {
 	struct list_head list;
 	struct msm_ipc_port_addr server_addr;
+	struct rcu_head rcu;
+
+	/* message count at the last stats dump, for the rate */
+	unsigned long last_msgs;
+	unsigned long last_jiffies;
 };
 
 #define RP_HASH_SIZE 32
@@ -118,6 +135,11 @@ struct msm_ipc_router_remote_port {
 	wait_queue_head_t quota_wait;
 	uint32_t tx_quota_cnt;
 	struct mutex quota_lock;
+	atomic_t ref;
+	struct rcu_head rcu;
+
+	unsigned long num_tx;
+	unsigned long num_tx_bytes;
 };
 
 struct msm_ipc_router_xprt_info {
@@ -227,18 +249,21 @@ static int add_routing_table_entry(
 		return -EINVAL;
 
 	key = (rt_entry->node_id % RT_HASH_SIZE);
-	list_add_tail(&rt_entry->list, &routing_table[key]);
+	list_add_tail_rcu(&rt_entry->list, &routing_table[key]);
 	return 0;
 }
 
-/*Please take routing_table_lock before calling this function*/
+/*
+ * Take routing_table_lock or rcu_read_lock before calling this function.
+ * Entries are never freed, so the result stays valid after either.
+ */
 static struct msm_ipc_routing_table_entry *lookup_routing_table(
 	uint32_t node_id)
 {
 	uint32_t key = (node_id % RT_HASH_SIZE);
 	struct msm_ipc_routing_table_entry *rt_entry;
 
-	list_for_each_entry(rt_entry, &routing_table[key], list) {
+	list_for_each_entry_rcu(rt_entry, &routing_table[key], list) {
 		if (rt_entry->node_id == node_id)
 			return rt_entry;
 	}
@@ -308,6 +333,27 @@ fail_clone:
 	return NULL;
 }
 
+/*
+ * Takes over the fragments of a packet handed in by a transport, which
+ * keeps only the empty shell to release. No sk_buff is cloned or copied.
+ */
+static struct rr_packet *take_pkt(struct rr_packet *pkt)
+{
+	struct rr_packet *new_pkt;
+
+	new_pkt = kzalloc(sizeof(struct rr_packet), GFP_KERNEL);
+	if (!new_pkt) {
+		pr_err("%s: failure\n", __func__);
+		return NULL;
+	}
+
+	new_pkt->pkt_fragment_q = pkt->pkt_fragment_q;
+	new_pkt->length = pkt->length;
+	pkt->pkt_fragment_q = NULL;
+	pkt->length = 0;
+	return new_pkt;
+}
+
 struct rr_packet *create_pkt(struct sk_buff_head *data)
 {
 	struct rr_packet *pkt;
@@ -346,6 +392,69 @@ void release_pkt(struct rr_packet *pkt)
 	return;
 }
 
+static void msm_ipc_router_account_tx(struct msm_ipc_port *port_ptr,
+				      uint32_t len)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&port_ptr->port_lock, flags);
+	port_ptr->num_tx++;
+	port_ptr->num_tx_bytes += len;
+	spin_unlock_irqrestore(&port_ptr->port_lock, flags);
+}
+
+static void msm_ipc_router_account_rx(struct msm_ipc_port *port_ptr,
+				      uint32_t len)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&port_ptr->port_lock, flags);
+	port_ptr->num_rx++;
+	port_ptr->num_rx_bytes += len;
+	spin_unlock_irqrestore(&port_ptr->port_lock, flags);
+}
+
+/* Queues a received packet on a local port and wakes up its reader */
+static void post_pkt_to_port(struct msm_ipc_port *port_ptr,
+			     struct rr_packet *pkt)
+{
+	msm_ipc_router_account_rx(port_ptr, pkt->length);
+
+	mutex_lock(&port_ptr->port_rx_q_lock);
+	wake_lock(&port_ptr->port_rx_wake_lock);
+	list_add_tail(&pkt->list, &port_ptr->port_rx_q);
+	port_ptr->rx_q_len++;
+	if (port_ptr->rx_q_len > port_ptr->rx_q_max)
+		port_ptr->rx_q_max = port_ptr->rx_q_len;
+	wake_up(&port_ptr->port_rx_wait_q);
+	mutex_unlock(&port_ptr->port_rx_q_lock);
+}
+
+static void msm_ipc_router_free_port(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct msm_ipc_port, rcu));
+}
+
+/* Drops a local port reference, the last one frees the port */
+static void msm_ipc_port_put(struct msm_ipc_port *port_ptr)
+{
+	struct rr_packet *pkt, *temp_pkt;
+
+	if (!atomic_dec_and_test(&port_ptr->ref))
+		return;
+
+	mutex_lock(&port_ptr->port_rx_q_lock);
+	list_for_each_entry_safe(pkt, temp_pkt, &port_ptr->port_rx_q, list) {
+		list_del(&pkt->list);
+		release_pkt(pkt);
+	}
+	port_ptr->rx_q_len = 0;
+	mutex_unlock(&port_ptr->port_rx_q_lock);
+
+	wake_lock_destroy(&port_ptr->port_rx_wake_lock);
+	call_rcu(&port_ptr->rcu, msm_ipc_router_free_port);
+}
+
 static int post_control_ports(struct rr_packet *pkt)
 {
 	struct msm_ipc_port *port_ptr;
@@ -356,12 +465,11 @@ static int post_control_ports(struct rr_packet *pkt)
 
 	mutex_lock(&control_ports_lock);
 	list_for_each_entry(port_ptr, &control_ports, list) {
-		mutex_lock(&port_ptr->port_rx_q_lock);
+		/* clones share the fragment data, readers only pull */
 		cloned_pkt = clone_pkt(pkt);
-		wake_lock(&port_ptr->port_rx_wake_lock);
-		list_add_tail(&cloned_pkt->list, &port_ptr->port_rx_q);
-		wake_up(&port_ptr->port_rx_wait_q);
-		mutex_unlock(&port_ptr->port_rx_q_lock);
+		if (!cloned_pkt)
+			continue;
+		post_pkt_to_port(port_ptr, cloned_pkt);
 	}
 	mutex_unlock(&control_ports_lock);
 	return 0;
@@ -412,7 +520,7 @@ void msm_ipc_router_add_local_port(struct msm_ipc_port *port_ptr)
 
 	key = (port_ptr->this_port.port_id & (LP_HASH_SIZE - 1));
 	mutex_lock(&local_ports_lock);
-	list_add_tail(&port_ptr->list, &local_ports[key]);
+	list_add_tail_rcu(&port_ptr->list, &local_ports[key]);
 	mutex_unlock(&local_ports_lock);
 }
 
@@ -435,6 +543,7 @@ struct msm_ipc_port *msm_ipc_router_create_raw_port(void *endpoint,
 		return NULL;
 	}
 
+	atomic_set(&port_ptr->ref, 1);
 	spin_lock_init(&port_ptr->port_lock);
 	INIT_LIST_HEAD(&port_ptr->incomplete);
 	mutex_init(&port_ptr->incomplete_lock);
@@ -452,22 +561,41 @@ struct msm_ipc_port *msm_ipc_router_create_raw_port(void *endpoint,
 	return port_ptr;
 }
 
+/* Returns the port with a reference, drop it with msm_ipc_port_put() */
 static struct msm_ipc_port *msm_ipc_router_lookup_local_port(uint32_t port_id)
 {
 	int key = (port_id & (LP_HASH_SIZE - 1));
 	struct msm_ipc_port *port_ptr;
 
-	mutex_lock(&local_ports_lock);
-	list_for_each_entry(port_ptr, &local_ports[key], list) {
+	rcu_read_lock();
+	list_for_each_entry_rcu(port_ptr, &local_ports[key], list) {
 		if (port_ptr->this_port.port_id == port_id) {
-			mutex_unlock(&local_ports_lock);
+			/* a port being closed is still seen until unlinked */
+			if (!atomic_inc_not_zero(&port_ptr->ref))
+				break;
+			rcu_read_unlock();
 			return port_ptr;
 		}
 	}
-	mutex_unlock(&local_ports_lock);
+	rcu_read_unlock();
 	return NULL;
 }
 
+static void msm_ipc_router_free_remote_port(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct msm_ipc_router_remote_port, rcu));
+}
+
+static void msm_ipc_router_put_remote_port(
+	struct msm_ipc_router_remote_port *rport_ptr)
+{
+	if (atomic_dec_and_test(&rport_ptr->ref))
+		call_rcu(&rport_ptr->rcu, msm_ipc_router_free_remote_port);
+}
+
+/* Returns the remote port with a reference, drop it with
+ * msm_ipc_router_put_remote_port().
+ */
 static struct msm_ipc_router_remote_port *msm_ipc_router_lookup_remote_port(
 						uint32_t node_id,
 						uint32_t port_id)
@@ -476,25 +604,24 @@ static struct msm_ipc_router_remote_port *msm_ipc_router_lookup_remote_port(
 	struct msm_ipc_routing_table_entry *rt_entry;
 	int key = (port_id & (RP_HASH_SIZE - 1));
 
-	mutex_lock(&routing_table_lock);
+	rcu_read_lock();
 	rt_entry = lookup_routing_table(node_id);
 	if (!rt_entry) {
-		mutex_unlock(&routing_table_lock);
+		rcu_read_unlock();
 		pr_err("%s: Node is not up\n", __func__);
 		return NULL;
 	}
 
-	mutex_lock(&rt_entry->lock);
-	list_for_each_entry(rport_ptr,
-			    &rt_entry->remote_port_list[key], list) {
+	list_for_each_entry_rcu(rport_ptr,
+				&rt_entry->remote_port_list[key], list) {
 		if (rport_ptr->port_id == port_id) {
-			mutex_unlock(&rt_entry->lock);
-			mutex_unlock(&routing_table_lock);
+			if (!atomic_inc_not_zero(&rport_ptr->ref))
+				break;
+			rcu_read_unlock();
 			return rport_ptr;
 		}
 	}
-	mutex_unlock(&rt_entry->lock);
-	mutex_unlock(&routing_table_lock);
+	rcu_read_unlock();
 	return NULL;
 }
 
@@ -515,7 +642,15 @@ static struct msm_ipc_router_remote_port *msm_ipc_router_create_remote_port(
 	}
 
 	mutex_lock(&rt_entry->lock);
-	rport_ptr = kmalloc(sizeof(struct msm_ipc_router_remote_port),
+	list_for_each_entry(rport_ptr, &rt_entry->remote_port_list[key],
+			    list) {
+		if (rport_ptr->port_id == port_id) {
+			atomic_inc(&rport_ptr->ref);
+			goto out;
+		}
+	}
+
+	rport_ptr = kzalloc(sizeof(struct msm_ipc_router_remote_port),
 			    GFP_KERNEL);
 	if (!rport_ptr) {
 		mutex_unlock(&rt_entry->lock);
@@ -528,23 +663,23 @@ static struct msm_ipc_router_remote_port *msm_ipc_router_create_remote_port(
 	rport_ptr->tx_quota_cnt = 0;
 	init_waitqueue_head(&rport_ptr->quota_wait);
 	mutex_init(&rport_ptr->quota_lock);
-	list_add_tail(&rport_ptr->list,
-		      &rt_entry->remote_port_list[key]);
+	/* one for the list, one for the caller */
+	atomic_set(&rport_ptr->ref, 2);
+	list_add_tail_rcu(&rport_ptr->list,
+			  &rt_entry->remote_port_list[key]);
+out:
 	mutex_unlock(&rt_entry->lock);
 	mutex_unlock(&routing_table_lock);
 	return rport_ptr;
 }
 
-static void msm_ipc_router_destroy_remote_port(
-	struct msm_ipc_router_remote_port *rport_ptr)
+static void msm_ipc_router_destroy_remote_port(uint32_t node_id,
+					       uint32_t port_id)
 {
-	uint32_t node_id;
+	struct msm_ipc_router_remote_port *rport_ptr;
 	struct msm_ipc_routing_table_entry *rt_entry;
+	int key = (port_id & (RP_HASH_SIZE - 1));
 
-	if (!rport_ptr)
-		return;
-
-	node_id = rport_ptr->node_id;
 	mutex_lock(&routing_table_lock);
 	rt_entry = lookup_routing_table(node_id);
 	if (!rt_entry) {
@@ -554,13 +689,23 @@ static void msm_ipc_router_destroy_remote_port(
 	}
 
 	mutex_lock(&rt_entry->lock);
-	list_del(&rport_ptr->list);
-	kfree(rport_ptr);
+	list_for_each_entry(rport_ptr, &rt_entry->remote_port_list[key],
+			    list) {
+		if (rport_ptr->port_id == port_id) {
+			list_del_rcu(&rport_ptr->list);
+			msm_ipc_router_put_remote_port(rport_ptr);
+			break;
+		}
+	}
 	mutex_unlock(&rt_entry->lock);
 	mutex_unlock(&routing_table_lock);
 	return;
 }
 
+/*
+ * Take server_list_lock or rcu_read_lock before calling this function,
+ * and keep it for as long as the result is used.
+ */
 static struct msm_ipc_server *msm_ipc_router_lookup_server(
 				uint32_t service,
 				uint32_t instance,
@@ -569,30 +714,46 @@ static struct msm_ipc_server *msm_ipc_router_lookup_server(
 {
 	struct msm_ipc_server *server;
 	struct msm_ipc_server_port *server_port;
-	int key = (instance & (SRV_HASH_SIZE - 1));
+	int key = SRV_HASH(service, instance);
 
-	mutex_lock(&server_list_lock);
-	list_for_each_entry(server, &server_list[key], list) {
+	list_for_each_entry_rcu(server, &server_list[key], list) {
 		if ((server->name.service != service) ||
 		    (server->name.instance != instance))
 			continue;
-		if ((node_id == 0) && (port_id == 0)) {
-			mutex_unlock(&server_list_lock);
+		if ((node_id == 0) && (port_id == 0))
 			return server;
-		}
-		list_for_each_entry(server_port, &server->server_port_list,
-				    list) {
+		list_for_each_entry_rcu(server_port,
+					&server->server_port_list, list) {
 			if ((server_port->server_addr.node_id == node_id) &&
-			    (server_port->server_addr.port_id == port_id)) {
-				mutex_unlock(&server_list_lock);
+			    (server_port->server_addr.port_id == port_id))
 				return server;
-			}
 		}
 	}
-	mutex_unlock(&server_list_lock);
 	return NULL;
 }
 
+static int msm_ipc_router_server_exists(uint32_t service, uint32_t instance,
+					uint32_t node_id, uint32_t port_id)
+{
+	int ret;
+
+	rcu_read_lock();
+	ret = msm_ipc_router_lookup_server(service, instance,
+					   node_id, port_id) != NULL;
+	rcu_read_unlock();
+	return ret;
+}
+
+static void msm_ipc_router_free_server(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct msm_ipc_server, rcu));
+}
+
+static void msm_ipc_router_free_server_port(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct msm_ipc_server_port, rcu));
+}
+
 static struct msm_ipc_server *msm_ipc_router_create_server(
 					uint32_t service,
 					uint32_t instance,
@@ -601,7 +762,7 @@ static struct msm_ipc_server *msm_ipc_router_create_server(
 {
 	struct msm_ipc_server *server = NULL;
 	struct msm_ipc_server_port *server_port;
-	int key = (instance & (SRV_HASH_SIZE - 1));
+	int key = SRV_HASH(service, instance);
 
 	mutex_lock(&server_list_lock);
 	list_for_each_entry(server, &server_list[key], list) {
@@ -619,14 +780,14 @@ static struct msm_ipc_server *msm_ipc_router_create_server(
 	server->name.service = service;
 	server->name.instance = instance;
 	INIT_LIST_HEAD(&server->server_port_list);
-	list_add_tail(&server->list, &server_list[key]);
+	list_add_tail_rcu(&server->list, &server_list[key]);
 
 create_srv_port:
-	server_port = kmalloc(sizeof(struct msm_ipc_server_port), GFP_KERNEL);
+	server_port = kzalloc(sizeof(struct msm_ipc_server_port), GFP_KERNEL);
 	if (!server_port) {
 		if (list_empty(&server->server_port_list)) {
-			list_del(&server->list);
-			kfree(server);
+			list_del_rcu(&server->list);
+			call_rcu(&server->rcu, msm_ipc_router_free_server);
 		}
 		mutex_unlock(&server_list_lock);
 		pr_err("%s: Server Port allocation failed\n", __func__);
@@ -634,36 +795,43 @@ create_srv_port:
 	}
 	server_port->server_addr.node_id = node_id;
 	server_port->server_addr.port_id = port_id;
-	list_add_tail(&server_port->list, &server->server_port_list);
+	server_port->last_jiffies = jiffies;
+	list_add_tail_rcu(&server_port->list, &server->server_port_list);
 	mutex_unlock(&server_list_lock);
 
 	return server;
 }
 
-static void msm_ipc_router_destroy_server(struct msm_ipc_server *server,
-					  uint32_t node_id, uint32_t port_id)
+/* Returns -ENODEV when node_id:port_id does not serve the name */
+static int msm_ipc_router_destroy_server(uint32_t service, uint32_t instance,
+					 uint32_t node_id, uint32_t port_id)
 {
+	struct msm_ipc_server *server;
 	struct msm_ipc_server_port *server_port;
 
-	if (!server)
-		return;
-
 	mutex_lock(&server_list_lock);
+	server = msm_ipc_router_lookup_server(service, instance,
+					      node_id, port_id);
+	if (!server) {
+		mutex_unlock(&server_list_lock);
+		return -ENODEV;
+	}
+
 	list_for_each_entry(server_port, &server->server_port_list, list) {
 		if ((server_port->server_addr.node_id == node_id) &&
-		    (server_port->server_addr.port_id == port_id))
+		    (server_port->server_addr.port_id == port_id)) {
+			list_del_rcu(&server_port->list);
+			call_rcu(&server_port->rcu,
+				 msm_ipc_router_free_server_port);
 			break;
-	}
-	if (server_port) {
-		list_del(&server_port->list);
-		kfree(server_port);
+		}
 	}
 	if (list_empty(&server->server_port_list)) {
-		list_del(&server->list);
-		kfree(server);
+		list_del_rcu(&server->list);
+		call_rcu(&server->rcu, msm_ipc_router_free_server);
 	}
 	mutex_unlock(&server_list_lock);
-	return;
+	return 0;
 }
 
 static int msm_ipc_router_send_control_msg(
@@ -919,10 +1087,10 @@ static int forward_msg(struct msm_ipc_router_xprt_info *xprt_info,
 
 	hdr = (struct rr_header *)head_pkt->data;
 	dst_node_id = hdr->dst_node_id;
-	mutex_lock(&routing_table_lock);
+	rcu_read_lock();
 	rt_entry = lookup_routing_table(dst_node_id);
+	rcu_read_unlock();
 	if (!(rt_entry) || !(rt_entry->xprt_info)) {
-		mutex_unlock(&routing_table_lock);
 		pr_err("%s: Routing table not initialized\n", __func__);
 		return -ENODEV;
 	}
@@ -933,7 +1101,6 @@ static int forward_msg(struct msm_ipc_router_xprt_info *xprt_info,
 	if (xprt_info->remote_node_id == fwd_xprt_info->remote_node_id) {
 		mutex_unlock(&fwd_xprt_info->tx_lock);
 		mutex_unlock(&rt_entry->lock);
-		mutex_unlock(&routing_table_lock);
 		pr_err("%s: Discarding Command to route back\n", __func__);
 		return -EINVAL;
 	}
@@ -941,14 +1108,12 @@ static int forward_msg(struct msm_ipc_router_xprt_info *xprt_info,
 	if (xprt_info->xprt->link_id == fwd_xprt_info->xprt->link_id) {
 		mutex_unlock(&fwd_xprt_info->tx_lock);
 		mutex_unlock(&rt_entry->lock);
-		mutex_unlock(&routing_table_lock);
 		pr_err("%s: DST in the same cluster\n", __func__);
 		return 0;
 	}
 	fwd_xprt_info->xprt->write(pkt, pkt->length, 0);
 	mutex_unlock(&fwd_xprt_info->tx_lock);
 	mutex_unlock(&rt_entry->lock);
-	mutex_unlock(&routing_table_lock);
 
 	return 0;
 }
@@ -991,11 +1156,13 @@ static int process_control_msg(struct msm_ipc_router_xprt_info *xprt_info,
 					__func__);
 				return -ENOMEM;
 			}
+			rt_entry->xprt_info = xprt_info;
+			add_routing_table_entry(rt_entry);
+		} else {
+			mutex_lock(&rt_entry->lock);
+			rt_entry->xprt_info = xprt_info;
+			mutex_unlock(&rt_entry->lock);
 		}
-		mutex_lock(&rt_entry->lock);
-		rt_entry->xprt_info = xprt_info;
-		mutex_unlock(&rt_entry->lock);
-		add_routing_table_entry(rt_entry);
 		mutex_unlock(&routing_table_lock);
 
 		memset(&ctl, 0, sizeof(ctl));
@@ -1027,6 +1194,7 @@ static int process_control_msg(struct msm_ipc_router_xprt_info *xprt_info,
 		rport_ptr->tx_quota_cnt = 0;
 		mutex_unlock(&rport_ptr->quota_lock);
 		wake_up(&rport_ptr->quota_wait);
+		msm_ipc_router_put_remote_port(rport_ptr);
 		break;
 
 	case IPC_ROUTER_CTRL_CMD_NEW_SERVER:
@@ -1058,11 +1226,10 @@ static int process_control_msg(struct msm_ipc_router_xprt_info *xprt_info,
 		}
 		mutex_unlock(&routing_table_lock);
 
-		server = msm_ipc_router_lookup_server(msg->srv.service,
-						      msg->srv.instance,
-						      msg->srv.node_id,
-						      msg->srv.port_id);
-		if (!server) {
+		if (!msm_ipc_router_server_exists(msg->srv.service,
+						  msg->srv.instance,
+						  msg->srv.node_id,
+						  msg->srv.port_id)) {
 			server = msm_ipc_router_create_server(
 				msg->srv.service, msg->srv.instance,
 				msg->srv.node_id, msg->srv.port_id);
@@ -1071,14 +1238,13 @@ static int process_control_msg(struct msm_ipc_router_xprt_info *xprt_info,
 				return -ENOMEM;
 			}
 
-			if (!msm_ipc_router_lookup_remote_port(
-					msg->srv.node_id, msg->srv.port_id)) {
-				rport_ptr = msm_ipc_router_create_remote_port(
-					msg->srv.node_id, msg->srv.port_id);
-				if (!rport_ptr)
-					pr_err("%s: Remote port create "
-					       "failed\n", __func__);
-			}
+			rport_ptr = msm_ipc_router_create_remote_port(
+				msg->srv.node_id, msg->srv.port_id);
+			if (rport_ptr)
+				msm_ipc_router_put_remote_port(rport_ptr);
+			else
+				pr_err("%s: Remote port create failed\n",
+				       __func__);
 			wake_up(&newserver_wait);
 		}
 
@@ -1088,14 +1254,10 @@ static int process_control_msg(struct msm_ipc_router_xprt_info *xprt_info,
 	case IPC_ROUTER_CTRL_CMD_REMOVE_SERVER:
 		RR("o REMOVE_SERVER service=%08x:%d\n",
 		   msg->srv.service, msg->srv.instance);
-		server = msm_ipc_router_lookup_server(msg->srv.service,
-						      msg->srv.instance,
-						      msg->srv.node_id,
-						      msg->srv.port_id);
-		if (server) {
-			msm_ipc_router_destroy_server(server,
-						      msg->srv.node_id,
-						      msg->srv.port_id);
+		if (!msm_ipc_router_destroy_server(msg->srv.service,
+						   msg->srv.instance,
+						   msg->srv.node_id,
+						   msg->srv.port_id)) {
 			relay_msg(xprt_info, pkt);
 			post_control_ports(pkt);
 		}
@@ -1103,10 +1265,8 @@ static int process_control_msg(struct msm_ipc_router_xprt_info *xprt_info,
 	case IPC_ROUTER_CTRL_CMD_REMOVE_CLIENT:
 		RR("o REMOVE_CLIENT id=%d:%08x\n",
 		    msg->cli.node_id, msg->cli.port_id);
-		rport_ptr = msm_ipc_router_lookup_remote_port(msg->cli.node_id,
-							msg->cli.port_id);
-		if (rport_ptr)
-			msm_ipc_router_destroy_remote_port(rport_ptr);
+		msm_ipc_router_destroy_remote_port(msg->cli.node_id,
+						   msg->cli.port_id);
 
 		relay_msg(xprt_info, pkt);
 		post_control_ports(pkt);
@@ -1214,12 +1374,9 @@ static void do_read_data(struct work_struct *work)
 	}
 
 	if (!port_ptr->notify) {
-		mutex_lock(&port_ptr->port_rx_q_lock);
-		wake_lock(&port_ptr->port_rx_wake_lock);
-		list_add_tail(&pkt->list, &port_ptr->port_rx_q);
-		wake_up(&port_ptr->port_rx_wait_q);
-		mutex_unlock(&port_ptr->port_rx_q_lock);
+		post_pkt_to_port(port_ptr, pkt);
 	} else {
+		msm_ipc_router_account_rx(port_ptr, pkt->length);
 		src_addr = kmalloc(sizeof(struct msm_ipc_port_addr),
 				   GFP_KERNEL);
 		if (src_addr) {
@@ -1233,6 +1390,7 @@ static void do_read_data(struct work_struct *work)
 		src_addr = NULL;
 		release_pkt(pkt);
 	}
+	msm_ipc_port_put(port_ptr);
 
 process_done:
 	if (resume_tx) {
@@ -1270,11 +1428,10 @@ int msm_ipc_router_register_server(struct msm_ipc_port *port_ptr,
 	if (name->addrtype != MSM_IPC_ADDR_NAME)
 		return -EINVAL;
 
-	server = msm_ipc_router_lookup_server(name->addr.port_name.service,
-					      name->addr.port_name.instance,
-					      IPC_ROUTER_NID_LOCAL,
-					      port_ptr->this_port.port_id);
-	if (server) {
+	if (msm_ipc_router_server_exists(name->addr.port_name.service,
+					 name->addr.port_name.instance,
+					 IPC_ROUTER_NID_LOCAL,
+					 port_ptr->this_port.port_id)) {
 		pr_err("%s: Server already present\n", __func__);
 		return -EINVAL;
 	}
@@ -1289,22 +1446,21 @@ int msm_ipc_router_register_server(struct msm_ipc_port *port_ptr,
 	}
 
 	ctl.cmd = IPC_ROUTER_CTRL_CMD_NEW_SERVER;
-	ctl.srv.service = server->name.service;
-	ctl.srv.instance = server->name.instance;
+	ctl.srv.service = name->addr.port_name.service;
+	ctl.srv.instance = name->addr.port_name.instance;
 	ctl.srv.node_id = IPC_ROUTER_NID_LOCAL;
 	ctl.srv.port_id = port_ptr->this_port.port_id;
 	broadcast_ctl_msg(&ctl);
 	spin_lock_irqsave(&port_ptr->port_lock, flags);
 	port_ptr->type = SERVER_PORT;
-	port_ptr->port_name.service = server->name.service;
-	port_ptr->port_name.instance = server->name.instance;
+	port_ptr->port_name.service = name->addr.port_name.service;
+	port_ptr->port_name.instance = name->addr.port_name.instance;
 	spin_unlock_irqrestore(&port_ptr->port_lock, flags);
 	return 0;
 }
 
 int msm_ipc_router_unregister_server(struct msm_ipc_port *port_ptr)
 {
-	struct msm_ipc_server *server;
 	unsigned long flags;
 	union rr_control_msg ctl;
 
@@ -1323,23 +1479,20 @@ int msm_ipc_router_unregister_server(struct msm_ipc_port *port_ptr)
 		return -EINVAL;
 	}
 
-	server = msm_ipc_router_lookup_server(port_ptr->port_name.service,
-					      port_ptr->port_name.instance,
-					      port_ptr->this_port.node_id,
-					      port_ptr->this_port.port_id);
-	if (!server) {
+	if (msm_ipc_router_destroy_server(port_ptr->port_name.service,
+					  port_ptr->port_name.instance,
+					  port_ptr->this_port.node_id,
+					  port_ptr->this_port.port_id)) {
 		pr_err("%s: Server lookup failed\n", __func__);
 		return -ENODEV;
 	}
 
 	ctl.cmd = IPC_ROUTER_CTRL_CMD_REMOVE_SERVER;
-	ctl.srv.service = server->name.service;
-	ctl.srv.instance = server->name.instance;
+	ctl.srv.service = port_ptr->port_name.service;
+	ctl.srv.instance = port_ptr->port_name.instance;
 	ctl.srv.node_id = IPC_ROUTER_NID_LOCAL;
 	ctl.srv.port_id = port_ptr->this_port.port_id;
 	broadcast_ctl_msg(&ctl);
-	msm_ipc_router_destroy_server(server, port_ptr->this_port.node_id,
-				      port_ptr->this_port.port_id);
 	spin_lock_irqsave(&port_ptr->port_lock, flags);
 	port_ptr->type = CLIENT_PORT;
 	spin_unlock_irqrestore(&port_ptr->port_lock, flags);
@@ -1354,6 +1507,7 @@ static int loopback_data(struct msm_ipc_port *src,
 	struct rr_header *hdr;
 	struct msm_ipc_port *port_ptr;
 	struct rr_packet *pkt;
+	int ret;
 
 	if (!data) {
 		pr_err("%s: Invalid pkt pointer\n", __func__);
@@ -1390,13 +1544,12 @@ static int loopback_data(struct msm_ipc_port *src,
 		return -ENODEV;
 	}
 
-	mutex_lock(&port_ptr->port_rx_q_lock);
-	wake_lock(&port_ptr->port_rx_wake_lock);
-	list_add_tail(&pkt->list, &port_ptr->port_rx_q);
-	wake_up(&port_ptr->port_rx_wait_q);
-	mutex_unlock(&port_ptr->port_rx_q_lock);
+	ret = pkt->length;
+	msm_ipc_router_account_tx(src, ret);
+	post_pkt_to_port(port_ptr, pkt);
+	msm_ipc_port_put(port_ptr);
 
-	return pkt->length;
+	return ret;
 }
 
 static int msm_ipc_router_write_pkt(struct msm_ipc_port *src,
@@ -1450,12 +1603,14 @@ static int msm_ipc_router_write_pkt(struct msm_ipc_port *src,
 	rport_ptr->tx_quota_cnt++;
 	if (rport_ptr->tx_quota_cnt == IPC_ROUTER_DEFAULT_RX_QUOTA)
 		hdr->confirm_rx = 1;
+	rport_ptr->num_tx++;
+	rport_ptr->num_tx_bytes += pkt->length;
 	mutex_unlock(&rport_ptr->quota_lock);
 
-	mutex_lock(&routing_table_lock);
+	rcu_read_lock();
 	rt_entry = lookup_routing_table(hdr->dst_node_id);
+	rcu_read_unlock();
 	if (!rt_entry || !rt_entry->xprt_info) {
-		mutex_unlock(&routing_table_lock);
 		pr_err("%s: Remote node %d not up\n",
 			__func__, hdr->dst_node_id);
 		return -ENODEV;
@@ -1466,12 +1621,12 @@ static int msm_ipc_router_write_pkt(struct msm_ipc_port *src,
 	ret = xprt_info->xprt->write(pkt, pkt->length, 0);
 	mutex_unlock(&xprt_info->tx_lock);
 	mutex_unlock(&rt_entry->lock);
-	mutex_unlock(&routing_table_lock);
 
 	if (ret < 0) {
 		pr_err("%s: Write on XPRT failed\n", __func__);
 		return ret;
 	}
+	msm_ipc_router_account_tx(src, pkt->length);
 
 	RAW_HDR("[w rr_h] "
 		"ver=%i,type=%s,src_nid=%08x,src_port_id=%08x,"
@@ -1521,21 +1676,28 @@ int msm_ipc_router_send_to(struct msm_ipc_port *src,
 		dst_node_id = dest->addr.port_addr.node_id;
 		dst_port_id = dest->addr.port_addr.port_id;
 	} else if (dest->addrtype == MSM_IPC_ADDR_NAME) {
+		ret = -ENODEV;
+		rcu_read_lock();
 		server = msm_ipc_router_lookup_server(
 					dest->addr.port_name.service,
 					dest->addr.port_name.instance,
 					0, 0);
-		if (!server) {
+		if (server) {
+			/* first port of the server */
+			list_for_each_entry_rcu(server_port,
+						&server->server_port_list,
+						list) {
+				dst_node_id = server_port->server_addr.node_id;
+				dst_port_id = server_port->server_addr.port_id;
+				ret = 0;
+				break;
+			}
+		}
+		rcu_read_unlock();
+		if (ret) {
 			pr_err("%s: Destination not reachable\n", __func__);
-			return -ENODEV;
+			return ret;
 		}
-		mutex_lock(&server_list_lock);
-		server_port = list_first_entry(&server->server_port_list,
-					       struct msm_ipc_server_port,
-					       list);
-		dst_node_id = server_port->server_addr.node_id;
-		dst_port_id = server_port->server_addr.port_id;
-		mutex_unlock(&server_list_lock);
 	}
 	if (dst_node_id == IPC_ROUTER_NID_LOCAL) {
 		ret = loopback_data(src, dst_port_id, data);
@@ -1556,12 +1718,14 @@ int msm_ipc_router_send_to(struct msm_ipc_port *src,
 
 	pkt = create_pkt(data);
 	if (!pkt) {
+		msm_ipc_router_put_remote_port(rport_ptr);
 		pr_err("%s: Pkt creation failed\n", __func__);
 		return -ENOMEM;
 	}
 
 	ret = msm_ipc_router_write_pkt(src, rport_ptr, pkt);
 	release_pkt(pkt);
+	msm_ipc_router_put_remote_port(rport_ptr);
 
 	return ret;
 }
@@ -1588,6 +1752,7 @@ int msm_ipc_router_read(struct msm_ipc_port *port_ptr,
 		return -ETOOSMALL;
 	}
 	list_del(&pkt->list);
+	port_ptr->rx_q_len--;
 	if (list_empty(&port_ptr->port_rx_q))
 		wake_unlock(&port_ptr->port_rx_wake_lock);
 	*data = pkt->pkt_fragment_q;
@@ -1674,8 +1839,6 @@ struct msm_ipc_port *msm_ipc_router_create_port(
 int msm_ipc_router_close_port(struct msm_ipc_port *port_ptr)
 {
 	union rr_control_msg msg;
-	struct rr_packet *pkt, *temp_pkt;
-	struct msm_ipc_server *server;
 
 	if (!port_ptr)
 		return -EINVAL;
@@ -1701,30 +1864,17 @@ int msm_ipc_router_close_port(struct msm_ipc_port *port_ptr)
 		broadcast_ctl_msg_locally(&msg);
 	}
 
-	mutex_lock(&port_ptr->port_rx_q_lock);
-	list_for_each_entry_safe(pkt, temp_pkt, &port_ptr->port_rx_q, list) {
-		list_del(&pkt->list);
-		release_pkt(pkt);
-	}
-	mutex_unlock(&port_ptr->port_rx_q_lock);
-
-	wake_lock_destroy(&port_ptr->port_rx_wake_lock);
 	if (port_ptr->type == SERVER_PORT) {
-		server = msm_ipc_router_lookup_server(
-				port_ptr->port_name.service,
-				port_ptr->port_name.instance,
-				port_ptr->this_port.node_id,
-				port_ptr->this_port.port_id);
-		if (server)
-			msm_ipc_router_destroy_server(server,
-				port_ptr->this_port.node_id,
-				port_ptr->this_port.port_id);
+		msm_ipc_router_destroy_server(port_ptr->port_name.service,
+					      port_ptr->port_name.instance,
+					      port_ptr->this_port.node_id,
+					      port_ptr->this_port.port_id);
 		mutex_lock(&local_ports_lock);
-		list_del(&port_ptr->list);
+		list_del_rcu(&port_ptr->list);
 		mutex_unlock(&local_ports_lock);
 	} else if (port_ptr->type == CLIENT_PORT) {
 		mutex_lock(&local_ports_lock);
-		list_del(&port_ptr->list);
+		list_del_rcu(&port_ptr->list);
 		mutex_unlock(&local_ports_lock);
 	} else if (port_ptr->type == CONTROL_PORT) {
 		mutex_lock(&control_ports_lock);
@@ -1732,7 +1882,11 @@ int msm_ipc_router_close_port(struct msm_ipc_port *port_ptr)
 		mutex_unlock(&control_ports_lock);
 	}
 
-	kfree(port_ptr);
+	/*
+	 * Senders that looked the port up keep it until they are done, the
+	 * rx queue is flushed and the memory freed after the last of them.
+	 */
+	msm_ipc_port_put(port_ptr);
 	return 0;
 }
 
@@ -1761,8 +1915,10 @@ int msm_ipc_router_bind_control_port(struct msm_ipc_port *port_ptr)
 		return -EINVAL;
 
 	mutex_lock(&local_ports_lock);
-	list_del(&port_ptr->list);
+	list_del_rcu(&port_ptr->list);
 	mutex_unlock(&local_ports_lock);
+	/* the list node is reused, let lookups walking it finish first */
+	synchronize_rcu();
 	port_ptr->type = CONTROL_PORT;
 	mutex_lock(&control_ports_lock);
 	list_add_tail(&port_ptr->list, &control_ports);
@@ -1784,20 +1940,23 @@ int msm_ipc_router_lookup_server_name(struct msm_ipc_port_name *srv_name,
 		return -EINVAL;
 	}
 
+	rcu_read_lock();
 	server = msm_ipc_router_lookup_server(srv_name->service,
 					srv_name->instance, 0, 0);
-	if (!server)
+	if (!server) {
+		rcu_read_unlock();
 		return -ENODEV;
+	}
 
-	mutex_lock(&server_list_lock);
-	list_for_each_entry(server_port, &server->server_port_list, list) {
+	list_for_each_entry_rcu(server_port, &server->server_port_list,
+				list) {
 		if (i < num_entries_in_array) {
 			srv_addr[i].node_id = server_port->server_addr.node_id;
 			srv_addr[i].port_id = server_port->server_addr.port_id;
 		}
 		i++;
 	}
-	mutex_unlock(&server_list_lock);
+	rcu_read_unlock();
 
 	return i;
 }
@@ -1979,6 +2138,9 @@ static int dump_local_ports(char *buf, int max)
 			i += scnprintf(buf + i, max - i, "# bytes rx'd %ld\n",
 				       port_ptr->num_rx_bytes);
 			spin_unlock_irqrestore(&port_ptr->port_lock, flags);
+			i += scnprintf(buf + i, max - i, "Rx queue: %u "
+				       "(max %u)\n", port_ptr->rx_q_len,
+				       port_ptr->rx_q_max);
 			i += scnprintf(buf + i, max - i, "\n");
 		}
 	}
@@ -1987,6 +2149,81 @@ static int dump_local_ports(char *buf, int max)
 	return i;
 }
 
+/*
+ * Per service traffic: messages handled by local servers, or sent to
+ * remote ones, and the rate since the previous read of this file.
+ */
+static int dump_services(char *buf, int max)
+{
+	int i = 0, j;
+	unsigned long now = jiffies, msgs, rate, flags;
+	uint32_t q_len, q_max;
+	struct msm_ipc_server *server;
+	struct msm_ipc_server_port *server_port;
+	struct msm_ipc_port *port_ptr;
+	struct msm_ipc_router_remote_port *rport_ptr;
+
+	i += scnprintf(buf + i, max - i, "Service:Instance    Node:Port"
+		       "            Msgs   Rate/s  RxQ/Max\n");
+	mutex_lock(&server_list_lock);
+	for (j = 0; j < SRV_HASH_SIZE; j++) {
+		list_for_each_entry(server, &server_list[j], list) {
+			list_for_each_entry(server_port,
+					    &server->server_port_list,
+					    list) {
+				msgs = 0;
+				q_len = q_max = 0;
+				if (server_port->server_addr.node_id ==
+				    IPC_ROUTER_NID_LOCAL) {
+					port_ptr =
+					msm_ipc_router_lookup_local_port(
+					server_port->server_addr.port_id);
+					if (port_ptr) {
+						spin_lock_irqsave(
+						&port_ptr->port_lock, flags);
+						msgs = port_ptr->num_rx +
+						       port_ptr->num_tx;
+						spin_unlock_irqrestore(
+						&port_ptr->port_lock, flags);
+						q_len = port_ptr->rx_q_len;
+						q_max = port_ptr->rx_q_max;
+						msm_ipc_port_put(port_ptr);
+					}
+				} else {
+					rport_ptr =
+					msm_ipc_router_lookup_remote_port(
+					server_port->server_addr.node_id,
+					server_port->server_addr.port_id);
+					if (rport_ptr) {
+						msgs = rport_ptr->num_tx;
+						msm_ipc_router_put_remote_port(
+							rport_ptr);
+					}
+				}
+
+				rate = 0;
+				if (time_after(now, server_port->last_jiffies))
+					rate = (msgs - server_port->last_msgs) *
+					       HZ / (now -
+					       server_port->last_jiffies);
+				server_port->last_msgs = msgs;
+				server_port->last_jiffies = now;
+
+				i += scnprintf(buf + i, max - i,
+					"%08x:%08x  %08x:%08x  %8lu %8lu"
+					"  %u/%u\n", server->name.service,
+					server->name.instance,
+					server_port->server_addr.node_id,
+					server_port->server_addr.port_id,
+					msgs, rate, q_len, q_max);
+			}
+		}
+	}
+	mutex_unlock(&server_list_lock);
+
+	return i;
+}
+
 #define DEBUG_BUFMAX 4096
 static char debug_buffer[DEBUG_BUFMAX];
 
@@ -2036,6 +2273,8 @@ static void debugfs_init(void)
 		      dump_xprt_info);
 	debug_create("dump_routing_table", 0444, dent,
 		      dump_routing_table);
+	debug_create("dump_services", 0444, dent,
+		      dump_services);
 }
 
 #else
@@ -2117,7 +2356,7 @@ void msm_ipc_router_xprt_notify(struct msm_ipc_router_xprt *xprt,
 		xprt_info = xprt->priv;
 	}
 
-	pkt = clone_pkt((struct rr_packet *)data);
+	pkt = take_pkt((struct rr_packet *)data);
 	if (!pkt)
 		return;
 
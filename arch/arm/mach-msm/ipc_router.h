@@ -104,6 +104,8 @@ struct rr_packet {
 
 struct msm_ipc_port {
 	struct list_head list;
+	atomic_t ref;
+	struct rcu_head rcu;
 
 	struct msm_ipc_port_addr this_port;
 	struct msm_ipc_port_name port_name;
@@ -118,6 +120,8 @@ struct msm_ipc_port {
 	struct mutex port_rx_q_lock;
 	struct wake_lock port_rx_wake_lock;
 	wait_queue_head_t port_rx_wait_q;
+	uint32_t rx_q_len;
+	uint32_t rx_q_max;
 
 	int restart_state;
 	spinlock_t restart_lock;
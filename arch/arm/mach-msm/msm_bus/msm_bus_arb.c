@@ -16,6 +16,8 @@
 #include <linux/mutex.h>
 #include <linux/radix-tree.h>
 #include <linux/clk.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include <mach/msm_bus_board.h>
 #include <mach/msm_bus.h>
 #include "msm_bus_core.h"
@@ -47,6 +49,19 @@
 
 static DEFINE_MUTEX(msm_bus_lock);
 
+/*
+ * Requests that only lower bandwidth or clocks are not committed to RPM
+ * right away. They are held for up to commit_delay_ms so that the votes
+ * of several clients go out in a single commit. Any request that raises
+ * a vote commits synchronously, flushing the held ones with it.
+ * 0 commits every request synchronously.
+ */
+static unsigned int commit_delay_ms = 5;
+module_param(commit_delay_ms, uint, S_IRUGO | S_IWUSR);
+
+/* Number of lowering requests not yet committed, under msm_bus_lock */
+static int msm_bus_pending_votes;
+
 /**
  * add_path_node: Adds the path information to the current node
  * @info: Internal node info structure
@@ -259,12 +274,89 @@ static int getpath(int src, int dest)
 	return CREATE_PNODE_ID(src, pnode_num);
 }
 
+/**
+ * cache_path() - Record the hops of a path found by getpath()
+ * @curr: Source node, as specified in the client vector (master)
+ * @pnode: The first-hop node on the path, as returned by getpath()
+ * @path: Client path entry to fill in
+ *
+ * The node infos, and the fabric each of them is reached through, do not
+ * change once a path has been set up. Resolving them once at registration
+ * saves the board id and radix tree lookups on every update request. Only
+ * pnode indices are cached, as the pnode arrays may be reallocated when
+ * other clients register.
+ */
+static int cache_path(int curr, int pnode, struct msm_bus_path *path)
+{
+	struct msm_bus_inode_info *info, *hop;
+	struct msm_bus_fabric_device *fabdev;
+	struct msm_bus_hop *hops;
+	int index, next_pnode;
+
+	fabdev = msm_bus_get_fabric_device(GET_FABID(curr));
+	if (!fabdev) {
+		MSM_BUS_ERR("Fabric not found\n");
+		return -ENXIO;
+	}
+	index = GET_INDEX(pnode);
+	info = fabdev->algo->find_node(fabdev, curr);
+	if (!info) {
+		MSM_BUS_ERR("Cannot find node info!\n");
+		return -ENXIO;
+	}
+	path->src = info;
+	path->index = index;
+	path->nhops = 0;
+	path->hops = NULL;
+
+	do {
+		fabdev = msm_bus_get_fabric_device(GET_FABID(curr));
+		if (!fabdev) {
+			MSM_BUS_ERR("Fabric not found\n");
+			goto err;
+		}
+
+		next_pnode = info->pnode[index].next;
+		curr = GET_NODE(next_pnode);
+		index = GET_INDEX(next_pnode);
+		if (IS_NODE(curr))
+			hop = fabdev->algo->find_node(fabdev, curr);
+		else
+			hop = fabdev->algo->find_gw_node(fabdev, curr);
+		if (!hop) {
+			MSM_BUS_ERR("Null Info found for hop\n");
+			goto err;
+		}
+
+		hops = krealloc(path->hops, (path->nhops + 1) *
+			sizeof(struct msm_bus_hop), GFP_KERNEL);
+		if (!hops) {
+			MSM_BUS_ERR("Error caching path hop!\n");
+			goto err;
+		}
+		path->hops = hops;
+		hops[path->nhops].fabdev = fabdev;
+		hops[path->nhops].info = hop;
+		hops[path->nhops].index = index;
+		path->nhops++;
+		MSM_BUS_DBG("cached hop %d: %d[%d] fab: %d\n", path->nhops,
+			hop->node_info->priv_id, index, fabdev->id);
+		info = hop;
+	} while (GET_NODE(info->pnode[index].next) != info->node_info->priv_id);
+
+	return 0;
+err:
+	kfree(path->hops);
+	path->hops = NULL;
+	path->nhops = 0;
+	return -ENXIO;
+}
+
 /**
  * update_path() - Update the path with the bandwidth and clock values, as
  * requested by the client.
  *
- * @curr: Current source node, as specified in the client vector (master)
- * @pnode: The first-hop node on the path, stored in the internal client struct
+ * @path: The path cached for this vector at registration
  * @req_clk: Requested clock value from the vector
  * @req_bw: Requested bandwidth value from the vector
  * @curr_clk: Current clock frequency
@@ -275,30 +367,27 @@ static int getpath(int src, int dest)
  * frequencies is calculated at each node on the path. Commit data to be sent
  * to RPM for each master and slave is also calculated here.
  */
-static int update_path(int curr, int pnode, unsigned req_clk, unsigned req_bw,
-		unsigned curr_clk, unsigned curr_bw, unsigned int active_ctx,
-		unsigned int cl_active_flag)
+static int update_path(struct msm_bus_path *path, unsigned req_clk,
+		unsigned req_bw, unsigned curr_clk, unsigned curr_bw,
+		unsigned int active_ctx, unsigned int cl_active_flag)
 {
-	int index, ret = 0;
+	int i, index, ret = 0;
 	struct msm_bus_inode_info *info;
-	int next_pnode;
 	int add_bw = req_bw - curr_bw;
 	unsigned bwsum = 0;
-	unsigned req_clk_hz, curr_clk_hz, bwsum_hz;
+	unsigned req_clk_hz = 0, curr_clk_hz = 0, bwsum_hz = 0;
 	int master_tier = 0;
-	struct msm_bus_fabric_device *fabdev = msm_bus_get_fabric_device
-		(GET_FABID(curr));
+	struct msm_bus_fabric_device *fabdev = NULL;
 
-	MSM_BUS_DBG("args: %d %d %d %u %u %u %u %u\n",
-		curr, GET_NODE(pnode), GET_INDEX(pnode), req_clk, req_bw,
-		curr_clk, curr_bw, active_ctx);
-	index = GET_INDEX(pnode);
-	MSM_BUS_DBG("Client passed index :%d\n", index);
-	info = fabdev->algo->find_node(fabdev, curr);
-	if (!info) {
-		MSM_BUS_ERR("Cannot find node info!\n");
+	if (!path->nhops) {
+		MSM_BUS_ERR("Path not cached!\n");
 		return -ENXIO;
 	}
+	MSM_BUS_DBG("args: %d %d %u %u %u %u %u\n",
+		path->src->node_info->priv_id, path->index, req_clk, req_bw,
+		curr_clk, curr_bw, active_ctx);
+	info = path->src;
+	index = path->index;
 
 	SELECT_BW_CLK(active_ctx, info->link_info);
 	SELECT_BW_CLK(active_ctx, info->pnode[index]);
@@ -307,33 +396,10 @@ static int update_path(int curr, int pnode, unsigned req_clk, unsigned req_bw,
 	info->link_info.tier = info->node_info->tier;
 	master_tier = info->node_info->tier;
 
-	do {
-		struct msm_bus_inode_info *hop;
-		fabdev = msm_bus_get_fabric_device(GET_FABID(curr));
-		if (!fabdev) {
-			MSM_BUS_ERR("Fabric not found\n");
-			return -ENXIO;
-		}
-		MSM_BUS_DBG("id: %d\n", info->node_info->priv_id);
-
-		/* find next node and index */
-		next_pnode = info->pnode[index].next;
-		curr = GET_NODE(next_pnode);
-		index = GET_INDEX(next_pnode);
-		MSM_BUS_DBG("id:%d, next: %d\n", info->
-		    node_info->priv_id, curr);
-
-		/* Get hop */
-		/* check if we are here as gateway, or does the hop belong to
-		 * this fabric */
-		if (IS_NODE(curr))
-			hop = fabdev->algo->find_node(fabdev, curr);
-		else
-			hop = fabdev->algo->find_gw_node(fabdev, curr);
-		if (!hop) {
-			MSM_BUS_ERR("Null Info found for hop\n");
-			return -ENXIO;
-		}
+	for (i = 0; i < path->nhops; i++) {
+		struct msm_bus_inode_info *hop = path->hops[i].info;
+		fabdev = path->hops[i].fabdev;
+		index = path->hops[i].index;
 
 		SELECT_BW_CLK(active_ctx, hop->link_info);
 		SELECT_BW_CLK(active_ctx, hop->pnode[index]);
@@ -364,13 +430,9 @@ static int update_path(int curr, int pnode, unsigned req_clk, unsigned req_bw,
 		if (ret)
 			MSM_BUS_WARN("Failed to update clk\n");
 		info = hop;
-	} while (GET_NODE(info->pnode[index].next) != info->node_info->priv_id);
+	}
 
 	/* Update BW, clk after exiting the loop for the last one */
-	if (!info) {
-		MSM_BUS_ERR("Cannot find node info!\n");
-		return -ENXIO;
-	}
 	/* Update slave clocks */
 	ret = fabdev->algo->update_clks(fabdev, info, index, curr_clk_hz,
 	    req_clk_hz, bwsum_hz, SEL_SLAVE_CLK, active_ctx, cl_active_flag);
@@ -393,6 +455,40 @@ static int msm_bus_commit_fn(struct device *dev, void *data)
 	return ret;
 }
 
+/**
+ * msm_bus_commit_all() - Commit the active context of all fabrics
+ * @batched: Called from the deferred commit work
+ *
+ * Called with msm_bus_lock held. Fabrics that were not touched since the
+ * last commit are skipped by the fabric driver.
+ */
+static void msm_bus_commit_all(int batched)
+{
+	bus_for_each_dev(&msm_bus_type, NULL, (void *)ACTIVE_CTX,
+		msm_bus_commit_fn);
+	msm_bus_dbg_commit_stats(msm_bus_pending_votes, batched);
+	msm_bus_pending_votes = 0;
+}
+
+static void msm_bus_commit_work_fn(struct work_struct *work)
+{
+	mutex_lock(&msm_bus_lock);
+	if (msm_bus_pending_votes)
+		msm_bus_commit_all(true);
+	mutex_unlock(&msm_bus_lock);
+}
+
+static DECLARE_DELAYED_WORK(msm_bus_commit_work, msm_bus_commit_work_fn);
+
+static void msm_bus_free_paths(struct msm_bus_client *client, int npaths)
+{
+	int i;
+
+	for (i = 0; i < npaths; i++)
+		kfree(client->paths[i].hops);
+	kfree(client->paths);
+}
+
 /**
  * msm_bus_scale_register_client() - Register the clients with the msm bus
  * driver
@@ -420,6 +516,13 @@ uint32_t msm_bus_scale_register_client(struct msm_bus_scale_pdata *pdata)
 		MSM_BUS_ERR("Error allocating client\n");
 		goto err;
 	}
+	client->paths = kzalloc(pdata->usecase->num_paths *
+		sizeof(struct msm_bus_path), GFP_KERNEL);
+	if (!client->paths) {
+		MSM_BUS_ERR("Error allocating client paths\n");
+		kfree(client);
+		goto err;
+	}
 	mutex_lock(&msm_bus_lock);
 	client->pdata = pdata;
 	client->curr = -1;
@@ -440,8 +543,10 @@ uint32_t msm_bus_scale_register_client(struct msm_bus_scale_pdata *pdata)
 		srcfab->visited = true;
 		pnode[i] = getpath(src, dest);
 		bus_for_each_dev(&msm_bus_type, NULL, NULL, clearvisitedflag);
-		if (pnode[i] < 0) {
+		if (pnode[i] < 0 || cache_path(src, pnode[i],
+			&client->paths[i])) {
 			MSM_BUS_ERR("Cannot register client now! Try again!\n");
+			msm_bus_free_paths(client, i);
 			kfree(client->src_pnode);
 			kfree(client);
 			mutex_unlock(&msm_bus_lock);
@@ -472,9 +577,9 @@ int msm_bus_scale_client_update_request(uint32_t cl, unsigned index)
 	int i, ret = 0;
 	struct msm_bus_scale_pdata *pdata;
 	unsigned int req_clk, req_bw, curr_clk, curr_bw;
-	int pnode, src, curr;
+	int curr, raise;
 	struct msm_bus_client *client = (struct msm_bus_client *)cl;
-	int context;
+	ktime_t start;
 	if (IS_ERR(client)) {
 		MSM_BUS_ERR("msm_bus_scale_client update req error %d\n",
 				(uint32_t)client);
@@ -482,20 +587,19 @@ int msm_bus_scale_client_update_request(uint32_t cl, unsigned index)
 		goto err;
 	}
 
+	start = ktime_get();
 	mutex_lock(&msm_bus_lock);
 	if (client->curr == index)
 		goto err;
 
 	curr = client->curr;
 	pdata = client->pdata;
+	raise = (curr < 0);
 	MSM_BUS_DBG("cl: %u index: %d curr: %d"
 			" num_paths: %d\n", cl, index, client->curr,
 			client->pdata->usecase->num_paths);
 
 	for (i = 0; i < pdata->usecase->num_paths; i++) {
-		src = msm_bus_board_get_iid(client->pdata->usecase[index].
-			vectors[i].src);
-		pnode = client->src_pnode[i];
 		req_clk = client->pdata->usecase[index].vectors[i].ib;
 		req_bw = MSM_BUS_BW_VAL_FROM_BYTES(client->pdata->
 				usecase[index].vectors[i].ab);
@@ -508,9 +612,11 @@ int msm_bus_scale_client_update_request(uint32_t cl, unsigned index)
 					usecase[curr].vectors[i].ab);
 			MSM_BUS_DBG("ab: %d ib: %d\n", curr_bw, curr_clk);
 		}
+		if (req_clk > curr_clk || req_bw > curr_bw)
+			raise = true;
 
 		if (!pdata->active_only) {
-			ret = update_path(src, pnode, req_clk, req_bw,
+			ret = update_path(&client->paths[i], req_clk, req_bw,
 				curr_clk, curr_bw, 0, pdata->active_only);
 			if (ret) {
 				MSM_BUS_ERR("Update path failed! %d\n", ret);
@@ -518,8 +624,9 @@ int msm_bus_scale_client_update_request(uint32_t cl, unsigned index)
 			}
 		}
 
-		ret = update_path(src, pnode, req_clk, req_bw, curr_clk,
-				curr_bw, ACTIVE_CTX, pdata->active_only);
+		ret = update_path(&client->paths[i], req_clk, req_bw,
+				curr_clk, curr_bw, ACTIVE_CTX,
+				pdata->active_only);
 		if (ret) {
 			MSM_BUS_ERR("Update Path failed! %d\n", ret);
 			goto err;
@@ -527,10 +634,17 @@ int msm_bus_scale_client_update_request(uint32_t cl, unsigned index)
 	}
 
 	client->curr = index;
-	context = ACTIVE_CTX;
 	msm_bus_dbg_client_data(client->pdata, index, cl);
-	bus_for_each_dev(&msm_bus_type, NULL, (void *)context,
-		msm_bus_commit_fn);
+	msm_bus_pending_votes++;
+	if (raise || !commit_delay_ms) {
+		cancel_delayed_work(&msm_bus_commit_work);
+		msm_bus_commit_all(false);
+	} else if (msm_bus_pending_votes == 1) {
+		schedule_delayed_work(&msm_bus_commit_work,
+			msecs_to_jiffies(commit_delay_ms));
+	}
+	msm_bus_dbg_vote_stats(ktime_to_us(ktime_sub(ktime_get(), start)),
+		!raise && commit_delay_ms);
 
 err:
 	mutex_unlock(&msm_bus_lock);
@@ -621,6 +735,7 @@ void msm_bus_scale_unregister_client(uint32_t cl)
 	msm_bus_scale_client_reset_pnodes(cl);
 	msm_bus_dbg_client_data(client->pdata, MSM_BUS_DBG_UNREGISTER, cl);
 	mutex_unlock(&msm_bus_lock);
+	msm_bus_free_paths(client, client->pdata->usecase->num_paths);
 	kfree(client->src_pnode);
 	kfree(client);
 }
@@ -164,10 +164,30 @@ struct msm_bus_fabnodeinfo {
 	struct msm_bus_inode_info *info;
 };
 
+/**
+ * Hops of a client path, resolved once at registration.
+ * @fabdev: Fabric through which the hop is reached
+ * @info: Node info of the hop
+ * @index: Index of the pnode for this path at the hop
+ */
+struct msm_bus_hop {
+	struct msm_bus_fabric_device *fabdev;
+	struct msm_bus_inode_info *info;
+	int index;
+};
+
+struct msm_bus_path {
+	struct msm_bus_inode_info *src;
+	int index;
+	int nhops;
+	struct msm_bus_hop *hops;
+};
+
 struct msm_bus_client {
 	int id;
 	struct msm_bus_scale_pdata *pdata;
 	int *src_pnode;
+	struct msm_bus_path *paths;
 	int curr;
 };
 
@@ -181,6 +201,8 @@ void msm_bus_dbg_client_data(struct msm_bus_scale_pdata *pdata, int index,
 	uint32_t cl);
 void msm_bus_dbg_commit_data(const char *fabname, struct commit_data *cdata,
 	int nmasters, int nslaves, int ntslaves, int op);
+void msm_bus_dbg_vote_stats(s64 latency_us, int deferred);
+void msm_bus_dbg_commit_stats(int nvotes, int batched);
 #else
 static inline void msm_bus_dbg_client_data(struct msm_bus_scale_pdata *pdata,
 	int index, uint32_t cl)
@@ -191,6 +213,12 @@ static inline void msm_bus_dbg_commit_data(const char *fabname,
 	int op)
 {
 }
+static inline void msm_bus_dbg_vote_stats(s64 latency_us, int deferred)
+{
+}
+static inline void msm_bus_dbg_commit_stats(int nvotes, int batched)
+{
+}
 #endif
 
 #endif /*_ARCH_ARM_MACH_MSM_BUS_CORE_H*/
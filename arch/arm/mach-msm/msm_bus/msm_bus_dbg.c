@@ -23,12 +23,15 @@
 #include <linux/string.h>
 #include <linux/uaccess.h>
 #include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <asm/div64.h>
 #include <mach/msm_bus_board.h>
 #include <mach/msm_bus.h>
 #include "msm_bus_core.h"
 
 #define MAX_BUFF_SIZE 4096
 #define FILL_LIMIT 128
+#define VOTE_HIST_BUCKETS 10
 
 static struct dentry *clients;
 static struct dentry *dir;
@@ -623,6 +626,124 @@ void msm_bus_dbg_commit_data(const char *fabname, struct commit_data *cdata,
 }
 EXPORT_SYMBOL(msm_bus_dbg_commit_data);
 
+/**
+ * The following functions keep the latency of update requests, and how
+ * many of them were folded into each RPM commit.
+ */
+
+static DEFINE_SPINLOCK(msm_bus_dbg_stats_lock);
+static struct msm_bus_vote_stats {
+	unsigned long votes;
+	unsigned long deferred;
+	u64 total_us;
+	s64 max_us;
+	/* bucket n counts latencies below 2^n * 10us, the last one the rest */
+	unsigned long hist[VOTE_HIST_BUCKETS];
+	unsigned long sync_commits;
+	unsigned long batched_commits;
+	unsigned long committed_votes;
+} vstats;
+
+/**
+ * msm_bus_dbg_vote_stats() - Account for one update request
+ * @latency_us: Time taken by the request, including any commit
+ * @deferred: The commit was left to the batching work
+ */
+void msm_bus_dbg_vote_stats(s64 latency_us, int deferred)
+{
+	unsigned long flags;
+	int bucket = 0;
+
+	while (bucket < VOTE_HIST_BUCKETS - 1 &&
+		latency_us >= (10LL << bucket))
+		bucket++;
+
+	spin_lock_irqsave(&msm_bus_dbg_stats_lock, flags);
+	vstats.votes++;
+	if (deferred)
+		vstats.deferred++;
+	vstats.total_us += latency_us;
+	if (latency_us > vstats.max_us)
+		vstats.max_us = latency_us;
+	vstats.hist[bucket]++;
+	spin_unlock_irqrestore(&msm_bus_dbg_stats_lock, flags);
+}
+EXPORT_SYMBOL(msm_bus_dbg_vote_stats);
+
+/**
+ * msm_bus_dbg_commit_stats() - Account for one commit of all fabrics
+ * @nvotes: Number of update requests covered by the commit
+ * @batched: The commit was issued by the batching work
+ */
+void msm_bus_dbg_commit_stats(int nvotes, int batched)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&msm_bus_dbg_stats_lock, flags);
+	if (batched)
+		vstats.batched_commits++;
+	else
+		vstats.sync_commits++;
+	vstats.committed_votes += nvotes;
+	spin_unlock_irqrestore(&msm_bus_dbg_stats_lock, flags);
+}
+EXPORT_SYMBOL(msm_bus_dbg_commit_stats);
+
+static int vote_stats_show(struct seq_file *m, void *unused)
+{
+	struct msm_bus_vote_stats st;
+	unsigned long flags, commits;
+	u64 avg;
+	int i;
+
+	spin_lock_irqsave(&msm_bus_dbg_stats_lock, flags);
+	st = vstats;
+	spin_unlock_irqrestore(&msm_bus_dbg_stats_lock, flags);
+
+	avg = st.total_us;
+	if (st.votes)
+		do_div(avg, st.votes);
+	commits = st.sync_commits + st.batched_commits;
+
+	seq_printf(m, "votes: %lu deferred: %lu\n", st.votes, st.deferred);
+	seq_printf(m, "latency avg: %llu us max: %lld us\n", avg, st.max_us);
+	for (i = 0; i < VOTE_HIST_BUCKETS - 1; i++)
+		seq_printf(m, "  < %5d us: %lu\n", 10 << i, st.hist[i]);
+	seq_printf(m, "  >=%5d us: %lu\n", 10 << (VOTE_HIST_BUCKETS - 2),
+		st.hist[VOTE_HIST_BUCKETS - 1]);
+	seq_printf(m, "commits: %lu sync: %lu batched: %lu\n", commits,
+		st.sync_commits, st.batched_commits);
+	seq_printf(m, "votes per commit: %lu.%02lu\n",
+		commits ? st.committed_votes / commits : 0,
+		commits ? (st.committed_votes % commits) * 100 / commits : 0);
+	return 0;
+}
+
+static int vote_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, vote_stats_show, NULL);
+}
+
+/* Any write clears the statistics */
+static ssize_t vote_stats_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&msm_bus_dbg_stats_lock, flags);
+	memset(&vstats, 0, sizeof(vstats));
+	spin_unlock_irqrestore(&msm_bus_dbg_stats_lock, flags);
+	return count;
+}
+
+static const struct file_operations vote_stats_fops = {
+	.open		= vote_stats_open,
+	.read		= seq_read,
+	.write		= vote_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int __init msm_bus_debugfs_init(void)
 {
 	struct dentry *commit, *shell_client;
@@ -672,6 +793,9 @@ static int __init msm_bus_debugfs_init(void)
 	if (debugfs_create_file("update-request", S_IRUGO | S_IWUSR,
 		clients, NULL, &msm_bus_dbg_update_request_fops) == NULL)
 		goto err;
+	if (debugfs_create_file("vote-stats", S_IRUGO | S_IWUSR, dir,
+		NULL, &vote_stats_fops) == NULL)
+		goto err;
 
 	list_for_each_entry(cldata, &cl_list, list) {
 		if (cldata->pdata->name == NULL) {
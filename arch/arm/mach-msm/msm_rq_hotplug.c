@@ -0,0 +1,214 @@
+/* Copyright (c) 2011, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/*
+ * Qualcomm MSM in kernel CPU hotplug from run queue averages
+ *
+ * msm_rq_stats hands every sample to msm_rq_hotplug_sample(). Samples
+ * are smoothed, and with n cpus online cpu n is brought up once the
+ * average has stayed at or above up_threshold + (n - 1) tasks for
+ * up_delay_ms. The last cpu is taken down once it has stayed below
+ * down_threshold + (n - 2) tasks for down_delay_ms, and not before it
+ * has been online for min_online_ms. Thresholds are in tenths of a task.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/rq_stats.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/rq_hotplug.h>
+
+static int msm_rq_hotplug_enable_set(const char *val, struct kernel_param *kp);
+
+/*
+ * Use /sys/module/msm_rq_hotplug/parameters/enabled to hand hotplug
+ * back to userspace.
+ */
+static int enabled = 1;
+module_param_call(enabled, msm_rq_hotplug_enable_set, param_get_int,
+		  &enabled, S_IRUGO | S_IWUSR);
+
+static unsigned int poll_ms = 50;
+module_param(poll_ms, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int up_threshold = 19;
+module_param(up_threshold, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int down_threshold = 11;
+module_param(down_threshold, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int up_delay_ms = 100;
+module_param(up_delay_ms, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int down_delay_ms = 2000;
+module_param(down_delay_ms, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int min_online_ms = 1000;
+module_param(min_online_ms, uint, S_IRUGO | S_IWUSR);
+
+static struct {
+	spinlock_t lock;
+	int initialized;
+	unsigned int avg;
+	unsigned long above_since;
+	unsigned long below_since;
+	unsigned long online_at;
+	/* -1 nothing to do, 0 take a cpu down, 1 bring one up */
+	int pending;
+	ktime_t decided;
+} hp = {
+	.lock = __SPIN_LOCK_UNLOCKED(hp.lock),
+	.pending = -1,
+};
+
+static struct workqueue_struct *hotplug_wq;
+
+static void msm_rq_hotplug_work_fn(struct work_struct *work)
+{
+	unsigned int cpu, i;
+	unsigned long flags;
+	ktime_t decided;
+	int up, ret;
+
+	spin_lock_irqsave(&hp.lock, flags);
+	up = hp.pending;
+	decided = hp.decided;
+	hp.pending = -1;
+	spin_unlock_irqrestore(&hp.lock, flags);
+
+	if (up < 0)
+		return;
+
+	if (up) {
+		cpu = cpumask_next_zero(0, cpu_online_mask);
+		if (cpu >= nr_cpu_ids || !cpu_present(cpu))
+			return;
+		ret = cpu_up(cpu);
+	} else {
+		cpu = 0;
+		for_each_online_cpu(i)
+			cpu = i;
+		if (!cpu)
+			return;
+		ret = cpu_down(cpu);
+	}
+
+	trace_rq_hotplug_done(cpu, up, ret,
+			      ktime_to_us(ktime_sub(ktime_get(), decided)));
+
+	spin_lock_irqsave(&hp.lock, flags);
+	if (!ret && up)
+		hp.online_at = jiffies;
+	hp.above_since = 0;
+	hp.below_since = 0;
+	spin_unlock_irqrestore(&hp.lock, flags);
+}
+
+static DECLARE_WORK(msm_rq_hotplug_work, msm_rq_hotplug_work_fn);
+
+void msm_rq_hotplug_sample(unsigned int nr)
+{
+	unsigned int online = num_online_cpus();
+	unsigned long now = jiffies;
+	unsigned long flags;
+	int up = -1;
+
+	if (!enabled)
+		return;
+
+	spin_lock_irqsave(&hp.lock, flags);
+	if (!hp.initialized || hp.pending >= 0)
+		goto out;
+
+	hp.avg = (hp.avg * 3 + nr + 2) / 4;
+
+	if (online < num_present_cpus() &&
+	    hp.avg >= up_threshold + (online - 1) * 10) {
+		hp.below_since = 0;
+		if (!hp.above_since)
+			hp.above_since = now;
+		if (time_after_eq(now, hp.above_since +
+				  msecs_to_jiffies(up_delay_ms)))
+			up = 1;
+	} else if (online > 1 &&
+		   hp.avg < down_threshold + (online - 2) * 10) {
+		hp.above_since = 0;
+		if (!hp.below_since)
+			hp.below_since = now;
+		if (time_after_eq(now, hp.below_since +
+				  msecs_to_jiffies(down_delay_ms)) &&
+		    time_after_eq(now, hp.online_at +
+				  msecs_to_jiffies(min_online_ms)))
+			up = 0;
+	} else {
+		hp.above_since = 0;
+		hp.below_since = 0;
+	}
+
+	if (up >= 0) {
+		hp.pending = up;
+		hp.decided = ktime_get();
+		trace_rq_hotplug_decision(up, hp.avg, online);
+		queue_work(hotplug_wq, &msm_rq_hotplug_work);
+	}
+out:
+	spin_unlock_irqrestore(&hp.lock, flags);
+}
+
+static int msm_rq_hotplug_enable_set(const char *val, struct kernel_param *kp)
+{
+	int ret;
+	unsigned long flags;
+
+	ret = param_set_int(val, kp);
+	if (ret)
+		return ret;
+
+	spin_lock_irqsave(&hp.lock, flags);
+	if (!hp.initialized) {
+		spin_unlock_irqrestore(&hp.lock, flags);
+		return 0;
+	}
+	hp.above_since = 0;
+	hp.below_since = 0;
+	spin_unlock_irqrestore(&hp.lock, flags);
+
+	rq_stats_kernel_poll(enabled ? poll_ms : 0);
+	return 0;
+}
+
+static int __init msm_rq_hotplug_init(void)
+{
+	unsigned long flags;
+
+	hotplug_wq = create_singlethread_workqueue("rq_hotplug");
+	if (!hotplug_wq)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&hp.lock, flags);
+	hp.online_at = jiffies;
+	hp.initialized = 1;
+	spin_unlock_irqrestore(&hp.lock, flags);
+
+	if (enabled)
+		rq_stats_kernel_poll(poll_ms);
+	return 0;
+}
+/* after msm_rq_stats_init, which is linked first */
+late_initcall(msm_rq_hotplug_init);
@@ -31,10 +31,13 @@
 #include <linux/workqueue.h>
 #include <linux/sched.h>
 #include <linux/spinlock.h>
+#include <linux/rq_stats.h>
 
 struct rq_data {
 	unsigned int rq_avg;
+	unsigned int kernel_rq_avg;
 	unsigned int rq_poll_ms;
+	unsigned int kernel_poll_ms;
 	unsigned int def_timer_ms;
 	unsigned int def_interval;
 	int64_t last_time;
@@ -54,6 +57,7 @@ static void rq_work_fn(struct work_struct *work)
 {
 	int64_t time_diff = 0;
 	int64_t rq_avg = 0;
+	unsigned int nr, poll_ms;
 	unsigned long flags = 0;
 
 	spin_lock_irqsave(&rq_lock, flags);
@@ -63,7 +67,8 @@ static void rq_work_fn(struct work_struct *work)
 	if (!rq_info.rq_avg)
 		rq_info.total_time = 0;
 
-	rq_avg = nr_running() * 10;
+	nr = nr_running() * 10;
+	rq_avg = nr;
 	time_diff = ktime_to_ns(ktime_get()) - rq_info.last_time;
 	do_div(time_diff, (1000 * 1000));
 
@@ -75,15 +80,25 @@ static void rq_work_fn(struct work_struct *work)
 
 	rq_info.rq_avg =  (unsigned int)rq_avg;
 
+	/*
+	 * rq_avg only restarts when userspace reads it, so in kernel users
+	 * get their own average that decays on every poll instead.
+	 */
+	rq_info.kernel_rq_avg = (rq_info.kernel_rq_avg * 3 + nr + 2) / 4;
+
 	/* Set the next poll */
-	if (rq_info.rq_poll_ms)
+	poll_ms = rq_info.rq_poll_ms ? rq_info.rq_poll_ms :
+		rq_info.kernel_poll_ms;
+	if (poll_ms)
 		queue_delayed_work(rq_wq, &rq_info.rq_work,
-			msecs_to_jiffies(rq_info.rq_poll_ms));
+			msecs_to_jiffies(poll_ms));
 
 	rq_info.total_time += time_diff;
 	rq_info.last_time = ktime_to_ns(ktime_get());
 
 	spin_unlock_irqrestore(&rq_lock, flags);
+
+	msm_rq_hotplug_sample(nr);
 }
 
 static void def_work_fn(struct work_struct *work)
@@ -98,6 +113,46 @@ static void def_work_fn(struct work_struct *work)
 	sysfs_notify(rq_info.kobj, NULL, "def_timer_ms");
 }
 
+/*
+ * For in kernel users: a decaying average of the polled samples, so it
+ * follows the load whether or not userspace reads the sysfs file. Without
+ * userspace or kernel polling there is no average, so the current count is
+ * returned.
+ */
+unsigned int rq_stats_avg(void)
+{
+	unsigned int val;
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&rq_lock, flags);
+	if (rq_info.rq_poll_ms || rq_info.kernel_poll_ms)
+		val = rq_info.kernel_rq_avg;
+	else
+		val = nr_running() * 10;
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	return val;
+}
+EXPORT_SYMBOL(rq_stats_avg);
+
+void rq_stats_kernel_poll(unsigned int ms)
+{
+	unsigned long flags = 0;
+
+	spin_lock_irqsave(&rq_lock, flags);
+	/* Don't start from whatever was left by an earlier polling period */
+	if (ms && !rq_info.kernel_poll_ms && !rq_info.rq_poll_ms)
+		rq_info.kernel_rq_avg = nr_running() * 10;
+	rq_info.kernel_poll_ms = ms;
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	if (ms)
+		queue_delayed_work(rq_wq, &rq_info.rq_work,
+				msecs_to_jiffies(ms));
+	else if (!rq_info.rq_poll_ms)
+		cancel_delayed_work(&rq_info.rq_work);
+}
+
 static ssize_t show_run_queue_avg(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
@@ -140,9 +195,10 @@ static ssize_t store_run_queue_poll_ms(struct kobject *kobj,
 	rq_info.rq_poll_ms = val;
 	spin_unlock_irqrestore(&rq_lock, flags);
 
-	if (val <= 0)
-		cancel_delayed_work(&rq_info.rq_work);
-	else
+	if (val <= 0) {
+		if (!rq_info.kernel_poll_ms)
+			cancel_delayed_work(&rq_info.rq_work);
+	} else
 		queue_delayed_work(rq_wq, &rq_info.rq_work,
 				msecs_to_jiffies(val));
 
@@ -21,6 +21,7 @@
 #include <linux/init.h>
 #include <linux/sysdev.h>
 #include <linux/suspend.h>
+#include <linux/suspend_timeline.h>
 #include <asm/hardware/gic.h>
 #include <linux/mfd/pmic8058.h>
 #include <mach/gpio.h>
@@ -40,6 +41,10 @@ module_param_named(
 
 static int msm_show_resume_irq_resume(struct sys_device *dev)
 {
+	if (suspend_timeline_active())
+		suspend_timeline_mark(SUSPEND_TL_WAKEUP_IRQ,
+				      gic_first_resume_irq(0));
+
 	if (msm_show_resume_irq_mask & MSM_SHOW_IRQ_DEBUG_RESUME) {
 		gic_show_resume_irq(0);
 		msm_gpio_show_resume_irq();
@@ -29,6 +29,7 @@
 #include <linux/proc_fs.h>
 #include <linux/smp.h>
 #include <linux/suspend.h>
+#include <linux/suspend_timeline.h>
 #include <linux/tick.h>
 #include <linux/uaccess.h>
 #include <linux/wakelock.h>
@@ -308,6 +309,155 @@ mode_sysfs_add_exit:
 	return ret;
 }
 
+/******************************************************************************
+ * Idle Duration Prediction
+ *****************************************************************************/
+
+/*
+ * The next timer is only an upper bound on the idle time, interrupts often
+ * end it much earlier. Each cpu keeps the durations of its recent idle
+ * periods that something else than the timer ended. When most recent
+ * wakeups were of that kind and their durations repeat closely enough,
+ * their average becomes the sleep time that the rpm resource level
+ * selection weighs each mode's energy overhead against.
+ */
+#define MSM_PM_IDLE_HISTORY 8
+#define MSM_PM_IDLE_MAX_US (10 * USEC_PER_SEC)
+
+struct msm_pm_idle_predictor {
+	uint32_t irq_us[MSM_PM_IDLE_HISTORY];
+	unsigned int next;
+	uint8_t recent_irq;	/* one bit per recent wakeup, set for irq */
+	uint32_t timer_us;	/* time to the next timer at prepare */
+	uint32_t predicted_us;
+
+	unsigned int timer_wakeups;
+	unsigned int irq_wakeups;
+	unsigned int predictions;
+	unsigned int too_deep;	/* left before the mode's residency */
+	unsigned int too_shallow; /* kept in swfi by a prediction, in vain */
+};
+
+static DEFINE_PER_CPU(struct msm_pm_idle_predictor, msm_pm_idle_predictors);
+
+static int msm_pm_idle_predict = 1;
+module_param_named(
+	idle_predict, msm_pm_idle_predict, int, S_IRUGO | S_IWUSR | S_IWGRP
+);
+
+/*
+ * Average of the recorded irq wakeup durations once their standard
+ * deviation is within a quarter of it, dropping the longest ones up to
+ * twice to get there. Returns 0 if there is no such pattern.
+ */
+static uint32_t msm_pm_typical_idle_us(struct msm_pm_idle_predictor *p)
+{
+	uint32_t max_us = UINT_MAX;
+	int pass;
+	int i;
+
+	for (pass = 0; pass < 3; pass++) {
+		uint64_t sum = 0;
+		uint64_t var = 0;
+		uint32_t next_max = 0;
+		unsigned int n = 0;
+		uint32_t avg;
+
+		for (i = 0; i < MSM_PM_IDLE_HISTORY; i++) {
+			uint32_t us = p->irq_us[i];
+
+			if (!us || us > max_us)
+				continue;
+			sum += us;
+			n++;
+			if (us > next_max)
+				next_max = us;
+		}
+		if (n < MSM_PM_IDLE_HISTORY / 2)
+			return 0;
+
+		do_div(sum, n);
+		avg = (uint32_t) sum;
+
+		for (i = 0; i < MSM_PM_IDLE_HISTORY; i++) {
+			int64_t d = p->irq_us[i];
+
+			if (!d || d > max_us)
+				continue;
+			d -= avg;
+			var += d * d;
+		}
+		do_div(var, n);
+
+		if (var * 16 <= (uint64_t) avg * avg)
+			return avg;
+
+		max_us = next_max - 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the sleep time to plan the idle period for, sleep_us being the
+ * time to the next timer.
+ */
+static uint32_t msm_pm_predict_idle_us(unsigned int cpu, uint32_t sleep_us)
+{
+	struct msm_pm_idle_predictor *p = &per_cpu(msm_pm_idle_predictors, cpu);
+	uint32_t typical_us;
+
+	p->timer_us = sleep_us;
+	p->predicted_us = sleep_us;
+
+	if (!msm_pm_idle_predict ||
+			hweight8(p->recent_irq) < MSM_PM_IDLE_HISTORY / 2)
+		return sleep_us;
+
+	typical_us = msm_pm_typical_idle_us(p);
+	if (typical_us && typical_us < sleep_us) {
+		p->predicted_us = typical_us;
+		p->predictions++;
+	}
+
+	return p->predicted_us;
+}
+
+/*
+ * Records how long the cpu actually stayed idle in the given mode, and
+ * whether the mode was a good pick for it.
+ */
+static void msm_pm_idle_account(enum msm_pm_sleep_mode mode, uint32_t us)
+{
+	unsigned int cpu = smp_processor_id();
+	struct msm_pm_idle_predictor *p = &per_cpu(msm_pm_idle_predictors, cpu);
+	struct msm_pm_platform_data *spc;
+	bool irq_wakeup = us + p->timer_us / 8 < p->timer_us;
+
+	if (irq_wakeup) {
+		p->irq_us[p->next] = min_t(uint32_t, us, MSM_PM_IDLE_MAX_US);
+		if (!p->irq_us[p->next])
+			p->irq_us[p->next] = 1;
+		p->next = (p->next + 1) % MSM_PM_IDLE_HISTORY;
+		p->irq_wakeups++;
+	} else {
+		p->timer_wakeups++;
+	}
+	p->recent_irq = (p->recent_irq << 1) | irq_wakeup;
+
+	if (mode != MSM_PM_SLEEP_MODE_WAIT_FOR_INTERRUPT) {
+		if (us < msm_pm_modes[MSM_PM_MODE(cpu, mode)].residency)
+			p->too_deep++;
+		return;
+	}
+
+	spc = &msm_pm_modes[MSM_PM_MODE(cpu,
+			MSM_PM_SLEEP_MODE_POWER_COLLAPSE_STANDALONE)];
+	if (p->predicted_us < p->timer_us && spc->idle_enabled &&
+			us >= spc->residency)
+		p->too_shallow++;
+}
+
 /******************************************************************************
  * CONFIG_MSM_IDLE_STATS
  *****************************************************************************/
@@ -452,6 +602,22 @@ static int msm_pm_read_proc
 			stats[id].min_time[i],
 			stats[id].max_time[i]);
 
+		if (id == MSM_PM_STAT_COUNT - 1) {
+			struct msm_pm_idle_predictor *pred =
+				&per_cpu(msm_pm_idle_predictors, cpu);
+
+			SNPRINTF(p, count,
+				"[cpu %u] idle-prediction:\n"
+				"  timer wakeups: %7u\n"
+				"  irq wakeups: %7u\n"
+				"  predictions: %7u\n"
+				"  mispredicted too deep: %7u\n"
+				"  mispredicted too shallow: %7u\n",
+				cpu, pred->timer_wakeups, pred->irq_wakeups,
+				pred->predictions, pred->too_deep,
+				pred->too_shallow);
+		}
+
 		*start = (char *) 1;
 		*eof = (off + 1 >= MSM_PM_STAT_COUNT * num_possible_cpus());
 
@@ -493,8 +659,16 @@ static int msm_pm_write_proc(struct file *file, const char __user *buffer,
 	spin_lock_irqsave(&msm_pm_stats_lock, flags);
 	for_each_possible_cpu(cpu) {
 		struct msm_pm_time_stats *stats;
+		struct msm_pm_idle_predictor *pred;
 		int i;
 
+		pred = &per_cpu(msm_pm_idle_predictors, cpu);
+		pred->timer_wakeups = 0;
+		pred->irq_wakeups = 0;
+		pred->predictions = 0;
+		pred->too_deep = 0;
+		pred->too_shallow = 0;
+
 		stats = per_cpu(msm_pm_stats, cpu).stats;
 		for (i = 0; i < MSM_PM_STAT_COUNT; i++) {
 			memset(stats[i].bucket,
@@ -763,6 +937,7 @@ int msm_pm_idle_prepare(struct cpuidle_device *dev)
 	latency_us = (uint32_t) pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
 	sleep_us = (uint32_t) ktime_to_ns(tick_nohz_get_sleep_length());
 	sleep_us = DIV_ROUND_UP(sleep_us, 1000);
+	sleep_us = msm_pm_predict_idle_us(dev->cpu, sleep_us);
 
 	for (i = 0; i < dev->state_count; i++) {
 		struct cpuidle_state *state = &dev->states[i];
@@ -920,6 +1095,7 @@ int msm_pm_idle_enter(enum msm_pm_sleep_mode sleep_mode)
 #endif
 
 	do_div(time, 1000);
+	msm_pm_idle_account(sleep_mode, (uint32_t) time);
 	return (int) time;
 
 cpuidle_enter_bail:
@@ -988,9 +1164,15 @@ static int msm_pm_enter(suspend_state_t state)
 		if (rs_limits) {
 			ret = msm_rpmrs_enter_sleep(
 				false, msm_pm_max_sleep_time, rs_limits);
+			suspend_timeline_mark(SUSPEND_TL_RPM_ENTER, ret);
 			if (!ret) {
+				suspend_timeline_mark(
+					SUSPEND_TL_COLLAPSE_ENTER, 0);
 				msm_pm_power_collapse(false);
+				suspend_timeline_mark(
+					SUSPEND_TL_COLLAPSE_EXIT, 0);
 				msm_rpmrs_exit_sleep(false, rs_limits);
+				suspend_timeline_mark(SUSPEND_TL_RPM_EXIT, 0);
 			}
 		} else {
 			pr_err("%s: cannot find the lowest power limit\n",
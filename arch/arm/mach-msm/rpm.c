@@ -19,6 +19,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/types.h>
+#include <linux/bitops.h>
 #include <linux/bug.h>
 #include <linux/completion.h>
 #include <linux/delay.h>
@@ -26,13 +27,16 @@
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/irq.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/semaphore.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <asm/hardware/gic.h>
 #include <mach/msm_iomap.h>
 #include <mach/rpm.h>
+#include "rpm_stats.h"
 
 /******************************************************************************
  * Data type and structure definitions
@@ -68,6 +72,19 @@ struct msm_rpm_notif_config {
 #define configured_iv(notif_cfg) ((notif_cfg)->iv)
 #define registered_iv(notif_cfg) ((notif_cfg)->iv + MSM_RPM_SEL_MASK_SIZE)
 
+/*
+ * Asynchronous sets waiting to be sent for one context.  Later values
+ * for a resource replace earlier ones, so that everything queued while
+ * the previous request is in flight goes out as a single request.
+ */
+struct msm_rpm_async_set {
+	DECLARE_BITMAP(ids, MSM_RPM_ID_LAST + 1);
+	uint32_t values[MSM_RPM_ID_LAST + 1];
+	uint32_t sel_masks[MSM_RPM_SEL_MASK_SIZE];
+	int nr_sets;
+	struct list_head waiters;
+};
+
 static struct msm_rpm_platform_data *msm_rpm_platform;
 static uint32_t msm_rpm_map[MSM_RPM_ID_LAST + 1];
 
@@ -83,6 +100,17 @@ static LIST_HEAD(msm_rpm_notifications);
 static struct msm_rpm_notif_config msm_rpm_notif_cfgs[MSM_RPM_CTX_SET_COUNT];
 static bool msm_rpm_init_notif_done;
 
+static DEFINE_SPINLOCK(msm_rpm_async_lock);
+static struct msm_rpm_async_set msm_rpm_async_sets[MSM_RPM_CTX_SET_COUNT];
+/* protected by <msm_rpm_mutex> */
+static struct msm_rpm_iv_pair msm_rpm_async_iv[MSM_RPM_ID_LAST + 1];
+
+static void msm_rpm_async_work_fn(struct work_struct *work);
+static DECLARE_WORK(msm_rpm_async_work, msm_rpm_async_work_fn);
+
+static DEFINE_SPINLOCK(msm_rpm_stats_lock);
+static struct msm_rpm_request_stats msm_rpm_stats;
+
 /******************************************************************************
  * Internal functions
  *****************************************************************************/
@@ -156,6 +184,37 @@ static int msm_rpm_fill_sel_masks(
 	return 0;
 }
 
+static void msm_rpm_account_ids(struct msm_rpm_iv_pair *req, int count)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&msm_rpm_stats_lock, flags);
+	for (i = 0; i < count; i++)
+		msm_rpm_stats.id_count[req[i].id]++;
+	spin_unlock_irqrestore(&msm_rpm_stats_lock, flags);
+}
+
+static void msm_rpm_account_ack(int ctx, ktime_t start)
+{
+	struct msm_rpm_ctx_stats *st = &msm_rpm_stats.ctx[ctx];
+	uint32_t us = ktime_to_us(ktime_sub(ktime_get(), start));
+	unsigned long flags;
+	int bucket = 0;
+
+	while (bucket < MSM_RPM_ACK_HIST_BUCKETS - 1 &&
+			us >= (MSM_RPM_ACK_HIST_BASE_US << bucket))
+		bucket++;
+
+	spin_lock_irqsave(&msm_rpm_stats_lock, flags);
+	st->requests++;
+	st->total_us += us;
+	if (us > st->max_us)
+		st->max_us = us;
+	st->hist[bucket]++;
+	spin_unlock_irqrestore(&msm_rpm_stats_lock, flags);
+}
+
 static inline void msm_rpm_send_req_interrupt(void)
 {
 	__raw_writel(msm_rpm_platform->msm_apps_ipc_rpm_val,
@@ -287,6 +346,7 @@ static int msm_rpm_set_exclusive(int ctx,
 {
 	DECLARE_COMPLETION_ONSTACK(ack);
 	unsigned long flags;
+	ktime_t start;
 	uint32_t ctx_mask = msm_rpm_get_ctx_mask(ctx);
 	uint32_t ctx_mask_ack;
 	uint32_t sel_masks_ack[MSM_RPM_SEL_MASK_SIZE];
@@ -298,6 +358,7 @@ static int msm_rpm_set_exclusive(int ctx,
 	msm_rpm_request_irq_mode.sel_masks_ack = sel_masks_ack;
 	msm_rpm_request_irq_mode.done = &ack;
 
+	start = ktime_get();
 	spin_lock_irqsave(&msm_rpm_lock, flags);
 	spin_lock(&msm_rpm_irq_lock);
 
@@ -321,6 +382,7 @@ static int msm_rpm_set_exclusive(int ctx,
 	spin_unlock_irqrestore(&msm_rpm_lock, flags);
 
 	wait_for_completion(&ack);
+	msm_rpm_account_ack(ctx, start);
 
 	BUG_ON((ctx_mask_ack & ~(msm_rpm_get_ctx_mask(MSM_RPM_CTX_REJECTED)))
 		!= ctx_mask);
@@ -343,6 +405,7 @@ static int msm_rpm_set_exclusive_noirq(int ctx,
 {
 	unsigned int irq = msm_rpm_platform->irq_ack;
 	unsigned long flags;
+	ktime_t start;
 	uint32_t ctx_mask = msm_rpm_get_ctx_mask(ctx);
 	uint32_t ctx_mask_ack;
 	uint32_t sel_masks_ack[MSM_RPM_SEL_MASK_SIZE];
@@ -363,6 +426,7 @@ static int msm_rpm_set_exclusive_noirq(int ctx,
 	}
 
 	msm_rpm_request = &msm_rpm_request_poll_mode;
+	start = ktime_get();
 
 	for (i = 0; i < count; i++) {
 		BUG_ON(req[i].id > MSM_RPM_ID_LAST);
@@ -379,6 +443,7 @@ static int msm_rpm_set_exclusive_noirq(int ctx,
 
 	msm_rpm_busy_wait_for_request_completion(false);
 	BUG_ON(msm_rpm_request);
+	msm_rpm_account_ack(ctx, start);
 
 	get_irq_chip(irq)->unmask(irq);
 	spin_unlock_irqrestore(&msm_rpm_irq_lock, flags);
@@ -391,6 +456,74 @@ static int msm_rpm_set_exclusive_noirq(int ctx,
 		? -ENOSPC : 0;
 }
 
+/*
+ * Send the asynchronous sets queued for <ctx> as one request.  The
+ * waiters are moved to <done> with their result; their callbacks are
+ * run by msm_rpm_complete_async() once <msm_rpm_mutex> is dropped.
+ *
+ * Note: assumes caller has acquired <msm_rpm_mutex>.
+ */
+static void msm_rpm_flush_async(int ctx, struct list_head *done)
+{
+	struct msm_rpm_async_set *set = &msm_rpm_async_sets[ctx];
+	uint32_t sel_masks[MSM_RPM_SEL_MASK_SIZE];
+	struct msm_rpm_async *a;
+	unsigned long flags;
+	int count = 0, nr_sets, id, rc;
+	LIST_HEAD(waiters);
+
+	spin_lock_irqsave(&msm_rpm_async_lock, flags);
+	for_each_set_bit(id, set->ids, MSM_RPM_ID_LAST + 1) {
+		msm_rpm_async_iv[count].id = id;
+		msm_rpm_async_iv[count].value = set->values[id];
+		count++;
+	}
+	bitmap_zero(set->ids, MSM_RPM_ID_LAST + 1);
+	memcpy(sel_masks, set->sel_masks, sizeof(sel_masks));
+	memset(set->sel_masks, 0, sizeof(set->sel_masks));
+	nr_sets = set->nr_sets;
+	set->nr_sets = 0;
+	list_splice_init(&set->waiters, &waiters);
+	spin_unlock_irqrestore(&msm_rpm_async_lock, flags);
+
+	if (!count)
+		return;
+
+	rc = msm_rpm_set_exclusive(ctx, sel_masks, msm_rpm_async_iv, count);
+
+	spin_lock_irqsave(&msm_rpm_stats_lock, flags);
+	msm_rpm_stats.ctx[ctx].async_sets += nr_sets;
+	msm_rpm_stats.ctx[ctx].async_requests++;
+	spin_unlock_irqrestore(&msm_rpm_stats_lock, flags);
+
+	list_for_each_entry(a, &waiters, list)
+		a->rc = rc;
+	list_splice_tail(&waiters, done);
+}
+
+static void msm_rpm_complete_async(struct list_head *done)
+{
+	struct msm_rpm_async *a, *tmp;
+
+	list_for_each_entry_safe(a, tmp, done, list) {
+		list_del_init(&a->list);
+		a->done(a, a->rc);
+	}
+}
+
+static void msm_rpm_async_work_fn(struct work_struct *work)
+{
+	LIST_HEAD(done);
+	int ctx;
+
+	mutex_lock(&msm_rpm_mutex);
+	for (ctx = 0; ctx < MSM_RPM_CTX_SET_COUNT; ctx++)
+		msm_rpm_flush_async(ctx, &done);
+	mutex_unlock(&msm_rpm_mutex);
+
+	msm_rpm_complete_async(&done);
+}
+
 /* Upon return, the <req> array will contain values from the ack page.
  *
  * Return value:
@@ -414,6 +547,8 @@ static int msm_rpm_set_common(
 	if (rc)
 		goto set_common_exit;
 
+	msm_rpm_account_ids(req, count);
+
 	if (noirq) {
 		unsigned long flags;
 
@@ -421,12 +556,17 @@ static int msm_rpm_set_common(
 		rc = msm_rpm_set_exclusive_noirq(ctx, sel_masks, req, count);
 		spin_unlock_irqrestore(&msm_rpm_lock, flags);
 	} else {
+		LIST_HEAD(done);
+
 		rc = mutex_lock_interruptible(&msm_rpm_mutex);
 		if (rc)
 			goto set_common_exit;
 
+		/* Keep the request ordered after earlier asynchronous sets */
+		msm_rpm_flush_async(ctx, &done);
 		rc = msm_rpm_set_exclusive(ctx, sel_masks, req, count);
 		mutex_unlock(&msm_rpm_mutex);
+		msm_rpm_complete_async(&done);
 	}
 
 set_common_exit:
@@ -456,6 +596,8 @@ static int msm_rpm_clear_common(
 	if (rc)
 		goto clear_common_exit;
 
+	msm_rpm_account_ids(req, count);
+
 	for (i = 0; i < ARRAY_SIZE(r); i++) {
 		r[i].id = MSM_RPM_ID_INVALIDATE_0 + i;
 		r[i].value = sel_masks[i];
@@ -474,12 +616,16 @@ static int msm_rpm_clear_common(
 		spin_unlock_irqrestore(&msm_rpm_lock, flags);
 		BUG_ON(rc);
 	} else {
+		LIST_HEAD(done);
+
 		rc = mutex_lock_interruptible(&msm_rpm_mutex);
 		if (rc)
 			goto clear_common_exit;
 
+		msm_rpm_flush_async(ctx, &done);
 		rc = msm_rpm_set_exclusive(ctx, sel_masks, r, ARRAY_SIZE(r));
 		mutex_unlock(&msm_rpm_mutex);
+		msm_rpm_complete_async(&done);
 		BUG_ON(rc);
 	}
 
@@ -650,6 +796,75 @@ int msm_rpm_set_noirq(int ctx, struct msm_rpm_iv_pair *req, int count)
 }
 EXPORT_SYMBOL(msm_rpm_set_noirq);
 
+/*
+ * Queue a resource request to RPM to set resource values, without
+ * waiting for the acknowledgement.
+ *
+ * Sets queued to the same context while a request is in flight are
+ * merged and sent to RPM as one request, the latest value winning for
+ * each resource.  A later msm_rpm_set() or msm_rpm_clear() to the same
+ * context is sent after the queued sets; msm_rpm_set_noirq() and
+ * msm_rpm_clear_noirq() are not ordered against them.
+ *
+ * Note: the function does not sleep and may be called from any context.
+ *
+ *       If <a> is not NULL, a->done() is called from a task context, with
+ *       no RPM driver lock held, once RPM acknowledges the request that
+ *       carried the values.  Memory for <a> must not be freed or queued
+ *       again until then.  Memory for <req> can be freed after this
+ *       function returns.  Values from the ack page are not returned.
+ *
+ * ctx: the request's context, as for msm_rpm_set()
+ * req: array of id-value pairs, as for msm_rpm_set()
+ * count: number of id-value pairs in the array
+ * a: the completion object.  Caller should initialize only the <done>
+ *    field.  <done> receives 0 on success or -ENOSPC if RPM rejected
+ *    the request.
+ *
+ * Return value:
+ *   0: success
+ *   -EINVAL: invalid <ctx> or invalid id in <req> array
+ */
+int msm_rpm_set_async(int ctx, struct msm_rpm_iv_pair *req, int count,
+	struct msm_rpm_async *a)
+{
+	uint32_t sel_masks[MSM_RPM_SEL_MASK_SIZE] = {};
+	struct msm_rpm_async_set *set;
+	unsigned long flags;
+	int rc;
+	int i;
+
+	if (ctx >= MSM_RPM_CTX_SET_COUNT || count <= 0) {
+		rc = -EINVAL;
+		goto set_async_exit;
+	}
+
+	rc = msm_rpm_fill_sel_masks(sel_masks, req, count);
+	if (rc)
+		goto set_async_exit;
+
+	msm_rpm_account_ids(req, count);
+
+	set = &msm_rpm_async_sets[ctx];
+	spin_lock_irqsave(&msm_rpm_async_lock, flags);
+	for (i = 0; i < count; i++) {
+		set_bit(req[i].id, set->ids);
+		set->values[req[i].id] = req[i].value;
+	}
+	for (i = 0; i < MSM_RPM_SEL_MASK_SIZE; i++)
+		set->sel_masks[i] |= sel_masks[i];
+	set->nr_sets++;
+	if (a)
+		list_add_tail(&a->list, &set->waiters);
+	spin_unlock_irqrestore(&msm_rpm_async_lock, flags);
+
+	schedule_work(&msm_rpm_async_work);
+
+set_async_exit:
+	return rc;
+}
+EXPORT_SYMBOL(msm_rpm_set_async);
+
 /*
  * Issue a resource request to RPM to clear resource values.  Once the
  * values are cleared, the resources revert back to their default values
@@ -797,6 +1012,29 @@ unregister_notification_exit:
 }
 EXPORT_SYMBOL(msm_rpm_unregister_notification);
 
+/*
+ * Copy the request statistics kept by the driver to <stats>.
+ */
+void msm_rpm_get_request_stats(struct msm_rpm_request_stats *stats)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&msm_rpm_stats_lock, flags);
+	memcpy(stats, &msm_rpm_stats, sizeof(*stats));
+	spin_unlock_irqrestore(&msm_rpm_stats_lock, flags);
+}
+EXPORT_SYMBOL(msm_rpm_get_request_stats);
+
+void msm_rpm_reset_request_stats(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&msm_rpm_stats_lock, flags);
+	memset(&msm_rpm_stats, 0, sizeof(msm_rpm_stats));
+	spin_unlock_irqrestore(&msm_rpm_stats_lock, flags);
+}
+EXPORT_SYMBOL(msm_rpm_reset_request_stats);
+
 static void __init msm_rpm_populate_map(void)
 {
 	int i, k;
@@ -819,9 +1057,13 @@ int __init msm_rpm_init(struct msm_rpm_platform_data *data)
 	uint32_t build;
 	unsigned int irq;
 	int rc;
+	int i;
 
 	msm_rpm_platform = data;
 
+	for (i = 0; i < MSM_RPM_CTX_SET_COUNT; i++)
+		INIT_LIST_HEAD(&msm_rpm_async_sets[i].waiters);
+
 	major = msm_rpm_read(MSM_RPM_PAGE_STATUS,
 					MSM_RPM_STATUS_ID_VERSION_MAJOR);
 	minor = msm_rpm_read(MSM_RPM_PAGE_STATUS,
@@ -19,10 +19,12 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/types.h>
 #include <linux/mm.h>
 #include <asm/uaccess.h>
+#include <asm/div64.h>
 
 #include <mach/msm_iomap.h>
 #include "rpm_stats.h"
@@ -194,6 +196,77 @@ static const struct file_operations msm_rpmstats_fops = {
 	.llseek   = no_llseek,
 };
 
+static const char *msm_rpmstats_ctx_names[MSM_RPM_CTX_SET_COUNT] = {
+	[MSM_RPM_CTX_SET_0] = "active",
+	[MSM_RPM_CTX_SET_SLEEP] = "sleep",
+};
+
+static struct dentry *msm_rpmstats_req_dent;
+
+static int msm_rpmstats_req_show(struct seq_file *m, void *unused)
+{
+	struct msm_rpm_request_stats *stats;
+	struct msm_rpm_ctx_stats *st;
+	u64 avg;
+	int ctx, i;
+
+	stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+	msm_rpm_get_request_stats(stats);
+
+	for (ctx = 0; ctx < MSM_RPM_CTX_SET_COUNT; ctx++) {
+		st = &stats->ctx[ctx];
+		avg = st->total_us;
+		if (st->requests)
+			do_div(avg, st->requests);
+
+		seq_printf(m, "%s set:\n", msm_rpmstats_ctx_names[ctx]);
+		seq_printf(m, "\trequests:%lu async requests:%lu "
+			"async sets:%lu\n", st->requests,
+			st->async_requests, st->async_sets);
+		seq_printf(m, "\tack avg:%llu us max:%u us\n", avg,
+			st->max_us);
+		for (i = 0; i < MSM_RPM_ACK_HIST_BUCKETS - 1; i++)
+			seq_printf(m, "\t  < %5u us:%lu\n",
+				MSM_RPM_ACK_HIST_BASE_US << i, st->hist[i]);
+		seq_printf(m, "\t  >=%5u us:%lu\n",
+			MSM_RPM_ACK_HIST_BASE_US <<
+			(MSM_RPM_ACK_HIST_BUCKETS - 2),
+			st->hist[MSM_RPM_ACK_HIST_BUCKETS - 1]);
+	}
+
+	seq_printf(m, "resource requests:\n");
+	for (i = 0; i <= MSM_RPM_ID_LAST; i++)
+		if (stats->id_count[i])
+			seq_printf(m, "\tid %d:%lu\n", i, stats->id_count[i]);
+
+	kfree(stats);
+	return 0;
+}
+
+static int msm_rpmstats_req_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_rpmstats_req_show, NULL);
+}
+
+/* Any write clears the request statistics */
+static ssize_t msm_rpmstats_req_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	msm_rpm_reset_request_stats();
+	return count;
+}
+
+static const struct file_operations msm_rpmstats_req_fops = {
+	.owner	  = THIS_MODULE,
+	.open	  = msm_rpmstats_req_open,
+	.read	  = seq_read,
+	.write	  = msm_rpmstats_req_write,
+	.llseek   = seq_lseek,
+	.release  = single_release,
+};
+
 static  int __devinit msm_rpmstats_probe(struct platform_device *pdev)
 {
 	struct dentry *dent;
@@ -209,6 +282,12 @@ static  int __devinit msm_rpmstats_probe(struct platform_device *pdev)
 		pr_err("%s: ERROR debugfs_create_file failed\n", __func__);
 		return -ENOMEM;
 	}
+
+	msm_rpmstats_req_dent = debugfs_create_file("rpm_requests",
+			S_IRUGO | S_IWUSR, NULL, NULL, &msm_rpmstats_req_fops);
+	if (!msm_rpmstats_req_dent)
+		pr_err("%s: ERROR creating rpm_requests failed\n", __func__);
+
 	platform_set_drvdata(pdev, dent);
 	return 0;
 }
@@ -219,6 +298,8 @@ static int __devexit msm_rpmstats_remove(struct platform_device *pdev)
 
 	dent = platform_get_drvdata(pdev);
 	debugfs_remove(dent);
+	debugfs_remove(msm_rpmstats_req_dent);
+	msm_rpmstats_req_dent = NULL;
 	platform_set_drvdata(pdev, NULL);
 	return 0;
 }
@@ -31,9 +31,32 @@
 #define __ARCH_ARM_MACH_MSM_RPM_STATS_H
 
 #include <linux/types.h>
+#include <mach/rpm.h>
 
 struct msm_rpmstats_platform_data {
 	phys_addr_t phys_addr_base;
 	u32 phys_size;
 };
+
+/* Ack latency bucket n counts acks within MSM_RPM_ACK_HIST_BASE_US << n */
+#define MSM_RPM_ACK_HIST_BUCKETS 10
+#define MSM_RPM_ACK_HIST_BASE_US 16
+
+struct msm_rpm_ctx_stats {
+	unsigned long requests;		/* requests sent to RPM */
+	unsigned long async_requests;	/* of which carried async sets */
+	unsigned long async_sets;	/* msm_rpm_set_async() calls sent */
+	u64 total_us;
+	u32 max_us;
+	unsigned long hist[MSM_RPM_ACK_HIST_BUCKETS];
+};
+
+struct msm_rpm_request_stats {
+	struct msm_rpm_ctx_stats ctx[MSM_RPM_CTX_SET_COUNT];
+	/* resource values requested by clients, before merging */
+	unsigned long id_count[MSM_RPM_ID_LAST + 1];
+};
+
+void msm_rpm_get_request_stats(struct msm_rpm_request_stats *stats);
+void msm_rpm_reset_request_stats(void);
 #endif
@@ -40,6 +40,9 @@
 #include <linux/platform_device.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
+#include <linux/hash.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include <asm/byteorder.h>
 
@@ -277,12 +280,22 @@ static int rpcrouter_send_control_msg(struct rpcrouter_xprt_info *xprt_info,
 	return 0;
 }
 
+static void rr_free_frags(struct rr_fragment *frag)
+{
+	struct rr_fragment *next;
+
+	while (frag != NULL) {
+		next = frag->next;
+		kfree(frag);
+		frag = next;
+	}
+}
+
 static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 {
 	struct msm_rpc_endpoint *ept;
 	struct rr_remote_endpoint *r_ept;
 	struct rr_packet *pkt, *tmp_pkt;
-	struct rr_fragment *frag, *next;
 	struct msm_rpc_reply *reply, *reply_tmp;
 	unsigned long flags;
 
@@ -305,6 +318,7 @@ static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 		list_for_each_entry_safe(reply, reply_tmp,
 					 &ept->reply_pend_q, list) {
 			list_del(&reply->list);
+			hlist_del(&reply->hash);
 			kfree(reply);
 		}
 		list_for_each_entry_safe(reply, reply_tmp,
@@ -328,12 +342,7 @@ static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 		list_for_each_entry_safe(pkt, tmp_pkt,
 					 &ept->incomplete, list) {
 			list_del(&pkt->list);
-			frag = pkt->first;
-			while (frag != NULL) {
-				next = frag->next;
-				kfree(frag);
-				frag = next;
-			}
+			rr_free_frags(pkt->first);
 			kfree(pkt);
 		}
 		spin_unlock(&ept->incomplete_lock);
@@ -343,12 +352,7 @@ static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 		list_for_each_entry_safe(pkt, tmp_pkt, &ept->read_q,
 					 list) {
 			list_del(&pkt->list);
-			frag = pkt->first;
-			while (frag != NULL) {
-				next = frag->next;
-				kfree(frag);
-				frag = next;
-			}
+			rr_free_frags(pkt->first);
 			kfree(pkt);
 		}
 		spin_unlock(&ept->read_q_lock);
@@ -568,6 +572,7 @@ struct msm_rpc_endpoint *msm_rpcrouter_create_local_endpoint(dev_t dev)
 {
 	struct msm_rpc_endpoint *ept;
 	unsigned long flags;
+	int i;
 
 	ept = kmalloc(sizeof(struct msm_rpc_endpoint), GFP_KERNEL);
 	if (!ept)
@@ -602,6 +607,8 @@ struct msm_rpc_endpoint *msm_rpcrouter_create_local_endpoint(dev_t dev)
 	spin_lock_init(&ept->read_q_lock);
 	INIT_LIST_HEAD(&ept->reply_avail_q);
 	INIT_LIST_HEAD(&ept->reply_pend_q);
+	for (i = 0; i < RPCROUTER_REPLY_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&ept->reply_hash[i]);
 	spin_lock_init(&ept->reply_q_lock);
 	spin_lock_init(&ept->restart_lock);
 	init_waitqueue_head(&ept->restart_wait);
@@ -649,6 +656,7 @@ int msm_rpcrouter_destroy_local_endpoint(struct msm_rpc_endpoint *ept)
 	spin_lock_irqsave(&ept->reply_q_lock, flags);
 	list_for_each_entry_safe(reply, reply_tmp, &ept->reply_pend_q, list) {
 		list_del(&reply->list);
+		hlist_del(&reply->hash);
 		kfree(reply);
 	}
 	list_for_each_entry_safe(reply, reply_tmp, &ept->reply_avail_q, list) {
@@ -1160,7 +1168,9 @@ static void do_read_data(struct work_struct *work)
 	pkt->mid = mid;
 	pkt->length = frag->length;
 	if (!PACMARK_LAST(pm)) {
+		spin_lock_irqsave(&ept->incomplete_lock, flags);
 		list_add_tail(&pkt->list, &ept->incomplete);
+		spin_unlock_irqrestore(&ept->incomplete_lock, flags);
 		goto done;
 	}
 
@@ -1428,21 +1438,37 @@ static int msm_rpc_write_pkt(
 	return needed;
 }
 
+/* Caller must hold reply_q_lock.  xid is kept in wire (be32) order;
+ * the hash only needs the bits to be spread, not host order.
+ */
+static struct msm_rpc_reply *find_pend_reply(struct msm_rpc_endpoint *ept,
+					     uint32_t xid)
+{
+	struct msm_rpc_reply *reply;
+	struct hlist_node *n;
+	struct hlist_head *head;
+
+	head = &ept->reply_hash[hash_32(xid, RPCROUTER_REPLY_HASH_BITS)];
+	hlist_for_each_entry(reply, n, head, hash) {
+		if (reply->xid == xid)
+			return reply;
+	}
+	return NULL;
+}
+
 static struct msm_rpc_reply *get_pend_reply(struct msm_rpc_endpoint *ept,
 					    uint32_t xid)
 {
 	unsigned long flags;
 	struct msm_rpc_reply *reply;
 	spin_lock_irqsave(&ept->reply_q_lock, flags);
-	list_for_each_entry(reply, &ept->reply_pend_q, list) {
-		if (reply->xid == xid) {
-			list_del(&reply->list);
-			spin_unlock_irqrestore(&ept->reply_q_lock, flags);
-			return reply;
-		}
+	reply = find_pend_reply(ept, xid);
+	if (reply) {
+		list_del(&reply->list);
+		hlist_del(&reply->hash);
 	}
 	spin_unlock_irqrestore(&ept->reply_q_lock, flags);
-	return NULL;
+	return reply;
 }
 
 void get_requesting_client(struct msm_rpc_endpoint *ept, uint32_t xid,
@@ -1455,18 +1481,14 @@ void get_requesting_client(struct msm_rpc_endpoint *ept, uint32_t xid,
 		return;
 
 	spin_lock_irqsave(&ept->reply_q_lock, flags);
-	list_for_each_entry(reply, &ept->reply_pend_q, list) {
-		if (reply->xid == xid) {
-			clnt_info->pid = reply->pid;
-			clnt_info->cid = reply->cid;
-			clnt_info->prog = reply->prog;
-			clnt_info->vers = reply->vers;
-			spin_unlock_irqrestore(&ept->reply_q_lock, flags);
-			return;
-		}
+	reply = find_pend_reply(ept, xid);
+	if (reply) {
+		clnt_info->pid = reply->pid;
+		clnt_info->cid = reply->cid;
+		clnt_info->prog = reply->prog;
+		clnt_info->vers = reply->vers;
 	}
 	spin_unlock_irqrestore(&ept->reply_q_lock, flags);
-	return;
 }
 
 static void set_avail_reply(struct msm_rpc_endpoint *ept,
@@ -1516,6 +1538,9 @@ static void set_pend_reply(struct msm_rpc_endpoint *ept,
 		D("%s: take reply lock on ept %p\n", __func__, ept);
 		wake_lock(&ept->reply_q_wake_lock);
 		list_add_tail(&reply->list, &ept->reply_pend_q);
+		hlist_add_head(&reply->hash,
+			&ept->reply_hash[hash_32(reply->xid,
+						 RPCROUTER_REPLY_HASH_BITS)]);
 		spin_unlock_irqrestore(&ept->reply_q_lock, flags);
 }
 
@@ -1691,6 +1716,85 @@ int msm_rpc_read(struct msm_rpc_endpoint *ept, void **buffer,
 }
 EXPORT_SYMBOL(msm_rpc_read);
 
+#if defined(CONFIG_DEBUG_FS)
+/* Round-trip latency of msm_rpc_call_reply(), per remote program.
+ * Bucket n counts calls that took less than (64us << n); the last
+ * bucket collects everything slower.
+ */
+#define RPC_LAT_BUCKETS		12
+#define RPC_LAT_HASH_BITS	5
+
+struct rpc_call_lat {
+	struct hlist_node node;
+	uint32_t prog;
+	uint32_t calls;
+	uint32_t errors;
+	uint32_t max_us;
+	uint64_t total_us;
+	uint32_t hist[RPC_LAT_BUCKETS];
+};
+
+static struct hlist_head rpc_lat_hash[1 << RPC_LAT_HASH_BITS];
+static DEFINE_SPINLOCK(rpc_lat_lock);
+
+static struct rpc_call_lat *rpc_lat_find(uint32_t prog)
+{
+	struct rpc_call_lat *lat;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(lat, n,
+			     &rpc_lat_hash[hash_32(prog, RPC_LAT_HASH_BITS)],
+			     node) {
+		if (lat->prog == prog)
+			return lat;
+	}
+	return NULL;
+}
+
+static void rpc_lat_record(uint32_t prog, ktime_t start, int rc)
+{
+	struct rpc_call_lat *lat, *new_lat = NULL;
+	unsigned long flags;
+	uint32_t us;
+	int b;
+
+	us = (uint32_t) ktime_to_us(ktime_sub(ktime_get(), start));
+	for (b = 0; b < RPC_LAT_BUCKETS - 1; b++)
+		if (us < (64U << b))
+			break;
+
+	spin_lock_irqsave(&rpc_lat_lock, flags);
+	lat = rpc_lat_find(prog);
+	if (!lat) {
+		spin_unlock_irqrestore(&rpc_lat_lock, flags);
+		new_lat = kzalloc(sizeof(*new_lat), GFP_KERNEL);
+		if (!new_lat)
+			return;
+		new_lat->prog = prog;
+		spin_lock_irqsave(&rpc_lat_lock, flags);
+		lat = rpc_lat_find(prog);
+		if (!lat) {
+			lat = new_lat;
+			new_lat = NULL;
+			hlist_add_head(&lat->node,
+			    &rpc_lat_hash[hash_32(prog, RPC_LAT_HASH_BITS)]);
+		}
+	}
+	lat->calls++;
+	if (rc < 0)
+		lat->errors++;
+	lat->total_us += us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+	lat->hist[b]++;
+	spin_unlock_irqrestore(&rpc_lat_lock, flags);
+
+	kfree(new_lat);
+}
+#else
+static inline void rpc_lat_record(uint32_t prog, ktime_t start, int rc) {}
+#endif
+
 int msm_rpc_call(struct msm_rpc_endpoint *ept, uint32_t proc,
 		 void *_request, int request_size,
 		 long timeout)
@@ -1708,6 +1812,9 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 {
 	struct rpc_request_hdr *req = _request;
 	struct rpc_reply_hdr *reply;
+	struct rr_fragment *frag, *f;
+	ktime_t start;
+	char *dst;
 	int rc;
 
 	if (request_size < sizeof(*req))
@@ -1723,21 +1830,30 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 	req->vers = ept->dst_vers;
 	req->procedure = cpu_to_be32(proc);
 
+	start = ktime_get();
 	rc = msm_rpc_write(ept, req, request_size);
 	if (rc < 0)
-		return rc;
+		goto out;
 
+	/* Replies are inspected in place in the received fragment
+	 * chain and gathered straight into the caller's buffer, so a
+	 * multi-fragment reply is copied once instead of being
+	 * reassembled into a bounce buffer first.
+	 */
 	for (;;) {
-		rc = msm_rpc_read(ept, (void*) &reply, -1, timeout);
+		rc = __msm_rpc_read(ept, &frag, -1, timeout);
 		if (rc < 0)
-			return rc;
+			goto out;
 		if (rc < (3 * sizeof(uint32_t))) {
+			if (rc > 0)
+				rr_free_frags(frag);
 			rc = -EIO;
-			break;
+			goto out;
 		}
+		reply = (struct rpc_reply_hdr *) frag->data;
 		/* we should not get CALL packets -- ignore them */
 		if (reply->type == 0) {
-			kfree(reply);
+			rr_free_frags(frag);
 			continue;
 		}
 		/* If an earlier call timed out, we could get the (no
@@ -1745,29 +1861,31 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 		 * we don't expect
 		 */
 		if (reply->xid != req->xid) {
-			kfree(reply);
+			rr_free_frags(frag);
 			continue;
 		}
-		if (reply->reply_stat != 0) {
-			rc = -EPERM;
-			break;
-		}
-		if (reply->data.acc_hdr.accept_stat != 0) {
-			rc = -EINVAL;
-			break;
-		}
-		if (_reply == NULL) {
-			rc = 0;
-			break;
-		}
-		if (rc > reply_size) {
-			rc = -ENOMEM;
-		} else {
-			memcpy(_reply, reply, rc);
-		}
 		break;
 	}
-	kfree(reply);
+
+	if (reply->reply_stat != 0) {
+		rc = -EPERM;
+	} else if (frag->length < sizeof(*reply) ||
+		   reply->data.acc_hdr.accept_stat != 0) {
+		rc = -EINVAL;
+	} else if (_reply == NULL) {
+		rc = 0;
+	} else if (rc > reply_size) {
+		rc = -ENOMEM;
+	} else {
+		dst = _reply;
+		for (f = frag; f != NULL; f = f->next) {
+			memcpy(dst, f->data, f->length);
+			dst += f->length;
+		}
+	}
+	rr_free_frags(frag);
+out:
+	rpc_lat_record(be32_to_cpu(ept->dst_prog), start, rc);
 	return rc;
 }
 EXPORT_SYMBOL(msm_rpc_call_reply);
@@ -2242,6 +2360,45 @@ static int dump_msm_rpc_endpoint(char *buf, int max)
 	return i;
 }
 
+static int dump_rpc_call_latency(char *buf, int max)
+{
+	int i = 0;
+	int j, b;
+	unsigned long flags;
+	struct rpc_call_lat *lat;
+	struct hlist_node *n;
+	const char *sym;
+
+	i += scnprintf(buf + i, max - i, "buckets (us): <64");
+	for (b = 1; b < RPC_LAT_BUCKETS - 1; b++)
+		i += scnprintf(buf + i, max - i, " <%u", 64U << b);
+	i += scnprintf(buf + i, max - i, " >=%u\n\n", 64U << (b - 1));
+
+	spin_lock_irqsave(&rpc_lat_lock, flags);
+	for (j = 0; j < (1 << RPC_LAT_HASH_BITS); j++) {
+		hlist_for_each_entry(lat, n, &rpc_lat_hash[j], node) {
+			i += scnprintf(buf + i, max - i, "prog: 0x%08x",
+				       lat->prog);
+			sym = smd_rpc_get_sym(lat->prog);
+			if (sym)
+				i += scnprintf(buf + i, max - i, " (%s)", sym);
+			i += scnprintf(buf + i, max - i,
+				       "\n  calls %u errors %u avg %llu us"
+				       " max %u us\n ",
+				       lat->calls, lat->errors,
+				       div_u64(lat->total_us, lat->calls),
+				       lat->max_us);
+			for (b = 0; b < RPC_LAT_BUCKETS; b++)
+				i += scnprintf(buf + i, max - i, " %u",
+					       lat->hist[b]);
+			i += scnprintf(buf + i, max - i, "\n");
+		}
+	}
+	spin_unlock_irqrestore(&rpc_lat_lock, flags);
+
+	return i;
+}
+
 #define DEBUG_BUFMAX 4096
 static char debug_buffer[DEBUG_BUFMAX];
 
@@ -2285,6 +2442,8 @@ static void debugfs_init(void)
 		     dump_remote_endpoints);
 	debug_create("dump_servers", 0444, dent,
 		     dump_servers);
+	debug_create("rpc_call_latency", 0444, dent,
+		     dump_rpc_call_latency);
 
 }
 
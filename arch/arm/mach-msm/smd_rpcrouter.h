@@ -34,6 +34,8 @@
 #define RPCROUTER_PROCESSORS_MAX		4
 #define RPCROUTER_MSGSIZE_MAX			512
 #define RPCROUTER_PEND_REPLIES_MAX		32
+#define RPCROUTER_REPLY_HASH_BITS		4
+#define RPCROUTER_REPLY_HASH_SIZE		(1 << RPCROUTER_REPLY_HASH_BITS)
 
 #define RPCROUTER_CLIENT_BCAST_ID		0xffffffff
 #define RPCROUTER_ROUTER_ADDRESS		0xfffffffe
@@ -160,6 +162,7 @@ struct rr_remote_endpoint {
 
 struct msm_rpc_reply {
 	struct list_head list;
+	struct hlist_node hash; /* on reply_hash while pending */
 	uint32_t pid;
 	uint32_t cid;
 	uint32_t prog; /* be32 */
@@ -208,6 +211,7 @@ struct msm_rpc_endpoint {
 
 	/* reply queue for inbound messages */
 	struct list_head reply_pend_q;
+	struct hlist_head reply_hash[RPCROUTER_REPLY_HASH_SIZE];
 	struct list_head reply_avail_q;
 	spinlock_t reply_q_lock;
 	uint32_t reply_cnt;
@@ -23,6 +23,7 @@
 #include <linux/pm.h>
 #include <linux/pm_runtime.h>
 #include <linux/resume-trace.h>
+#include <linux/suspend_timeline.h>
 #include <linux/interrupt.h>
 #include <linux/sched.h>
 #include <linux/async.h>
@@ -437,6 +438,7 @@ static void dpm_show_time(ktime_t starttime, pm_message_t state, char *info)
 static int device_resume_noirq(struct device *dev, pm_message_t state)
 {
 	int error = 0;
+	u64 start = suspend_timeline_clock();
 
 	TRACE_DEVICE(dev);
 	TRACE_RESUME(0);
@@ -461,6 +463,7 @@ static int device_resume_noirq(struct device *dev, pm_message_t state)
 	}
 
 End:
+	suspend_timeline_device(dev_name(dev), start, error);
 	TRACE_RESUME(error);
 	return error;
 }
@@ -523,6 +526,7 @@ static int legacy_resume(struct device *dev, int (*cb)(struct device *dev))
 static int device_resume(struct device *dev, pm_message_t state, bool async)
 {
 	int error = 0;
+	u64 start;
 
 	TRACE_DEVICE(dev);
 	TRACE_RESUME(0);
@@ -530,6 +534,7 @@ static int device_resume(struct device *dev, pm_message_t state, bool async)
 	if (dev->parent && dev->parent->power.status >= DPM_OFF)
 		dpm_wait(dev->parent, async);
 	device_lock(dev);
+	start = suspend_timeline_clock();
 
 	dev->power.status = DPM_RESUMING;
 
@@ -564,6 +569,7 @@ static int device_resume(struct device *dev, pm_message_t state, bool async)
 		}
 	}
  End:
+	suspend_timeline_device(dev_name(dev), start, error);
 	device_unlock(dev);
 	complete_all(&dev->power.completion);
 
@@ -794,6 +800,7 @@ static pm_message_t resume_event(pm_message_t sleep_state)
 static int device_suspend_noirq(struct device *dev, pm_message_t state)
 {
 	int error = 0;
+	u64 start = suspend_timeline_clock();
 
 	if (dev->class && dev->class->pm) {
 		pm_dev_dbg(dev, state, "LATE class ");
@@ -815,6 +822,7 @@ static int device_suspend_noirq(struct device *dev, pm_message_t state)
 	}
 
 End:
+	suspend_timeline_device(dev_name(dev), start, error);
 	return error;
 }
 
@@ -883,9 +891,11 @@ static int async_error;
 static int __device_suspend(struct device *dev, pm_message_t state, bool async)
 {
 	int error = 0;
+	u64 start;
 
 	dpm_wait_for_children(dev, async);
 	device_lock(dev);
+	start = suspend_timeline_clock();
 
 	if (async_error)
 		goto End;
@@ -925,6 +935,7 @@ static int __device_suspend(struct device *dev, pm_message_t state, bool async)
 		dev->power.status = DPM_OFF;
 
  End:
+	suspend_timeline_device(dev_name(dev), start, error);
 	device_unlock(dev);
 	complete_all(&dev->power.completion);
 
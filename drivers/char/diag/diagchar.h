@@ -34,6 +34,7 @@
 #include <linux/module.h>
 #include <linux/mempool.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/workqueue.h>
 #include <mach/msm_smd.h>
 #include <asm/atomic.h>
@@ -83,6 +84,8 @@ struct diag_write_device {
 	int length;
 };
 
+struct diag_ring;
+
 struct diag_client_map {
 	char name[20];
 	int pid;
@@ -177,6 +180,9 @@ struct diagchar_dev {
 	struct diag_request *write_ptr_qdsp_2;
 	int logging_mode;
 	int logging_process_id;
+	/* ring of the logging process in memory device mode, if any */
+	struct diag_ring *md_ring;
+	spinlock_t ring_lock;
 #ifdef CONFIG_DIAG_SDIO_PIPE
 	unsigned char *buf_in_sdio;
 	unsigned char *usb_buf_mdm_out;
@@ -25,6 +25,8 @@
 #include <linux/uaccess.h>
 #include <linux/diagchar.h>
 #include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
 #ifdef CONFIG_DIAG_OVER_USB
 #include <mach/usbdiag.h>
 #endif
@@ -33,6 +35,7 @@
 #include "diagmem.h"
 #include "diagchar.h"
 #include "diagfwd.h"
+#include "diagring.h"
 #ifdef CONFIG_DIAG_SDIO_PIPE
 #include "diagfwd_sdio.h"
 #endif
@@ -45,6 +48,7 @@ MODULE_VERSION("1.0");
 struct diagchar_dev *driver;
 struct diagchar_priv {
 	int pid;
+	struct diag_ring *ring;	/* protected by driver->ring_lock */
 };
 /* The following variables can be specified by module options */
  /* for copy buffer */
@@ -56,6 +60,8 @@ static unsigned int poolsize_hdlc = 8;  /*Number of items in the mempool */
 /* for write structure buffer */
 static unsigned int itemsize_write_struct = 20; /*Size of item in the mempool */
 static unsigned int poolsize_write_struct = 8; /* Num of items in the mempool */
+/* Default memory device ring size, in kB */
+static unsigned int ring_size_kb = 512;
 /* This is the max number of user-space clients supported at initialization*/
 static unsigned int max_clients = 15;
 static unsigned int threshold_client_limit = 30;
@@ -70,6 +76,7 @@ void *buf_hdlc;
 module_param(itemsize, uint, 0);
 module_param(poolsize, uint, 0);
 module_param(max_clients, uint, 0);
+module_param(ring_size_kb, uint, 0);
 
 /* delayed_rsp_id 0 represents no delay in the response. Any other number
     means that the diag packet has a delayed response. */
@@ -130,6 +137,39 @@ void diag_read_smd_qdsp_work_fn(struct work_struct *work)
 	__diag_smd_qdsp_send_req();
 }
 
+/* Returns a reference to the ring of a client, or NULL */
+static struct diag_ring *diag_priv_ring_get(struct diagchar_priv *priv)
+{
+	struct diag_ring *ring = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&driver->ring_lock, flags);
+	if (priv && priv->ring) {
+		ring = priv->ring;
+		diag_ring_get(ring);
+	}
+	spin_unlock_irqrestore(&driver->ring_lock, flags);
+
+	return ring;
+}
+
+/* Replaces the ring of a client, memory device data follows the switch */
+static void diag_priv_ring_set(struct diagchar_priv *priv,
+			       struct diag_ring *ring)
+{
+	struct diag_ring *old;
+	unsigned long flags;
+
+	spin_lock_irqsave(&driver->ring_lock, flags);
+	old = priv->ring;
+	priv->ring = ring;
+	if (old && driver->md_ring == old)
+		driver->md_ring = ring;
+	spin_unlock_irqrestore(&driver->ring_lock, flags);
+
+	diag_ring_release(old);
+}
+
 void diag_add_client(int i, struct file *file)
 {
 	struct diagchar_priv *diagpriv_data;
@@ -137,8 +177,10 @@ void diag_add_client(int i, struct file *file)
 	driver->client_map[i].pid = current->tgid;
 	diagpriv_data = kmalloc(sizeof(struct diagchar_priv),
 							GFP_KERNEL);
-	if (diagpriv_data)
+	if (diagpriv_data) {
 		diagpriv_data->pid = current->tgid;
+		diagpriv_data->ring = NULL;
+	}
 	file->private_data = diagpriv_data;
 	strncpy(driver->client_map[i].name, current->comm, 20);
 	driver->client_map[i].name[19] = '\0';
@@ -217,6 +259,8 @@ static int diagchar_close(struct inode *inode, struct file *file)
 		return -ENOMEM;
 	}
 
+	diag_priv_ring_set(diagpriv_data, NULL);
+
 #ifdef CONFIG_DIAG_OVER_USB
 	/* If the SD logging process exits, change logging to USB mode */
 	if (driver->logging_process_id == current->tgid) {
@@ -334,12 +378,33 @@ static int diagchar_ioctl(struct inode *inode, struct file *filp,
 		driver->data_ready[i] |= DEINIT_TYPE;
 		wake_up_interruptible(&driver->wait_q);
 		success = 1;
+	} else if (iocmd == DIAG_IOCTL_SET_RING_SIZE) {
+		struct diag_ring *ring = diag_ring_alloc(ioarg);
+
+		if (!ring || !filp->private_data) {
+			diag_ring_release(ring);
+			return -ENOMEM;
+		}
+		diag_priv_ring_set(filp->private_data, ring);
+		success = 0;
 	} else if (iocmd == DIAG_IOCTL_SWITCH_LOGGING) {
+		struct diagchar_priv *priv = filp->private_data;
+		unsigned long flags;
+
 		mutex_lock(&driver->diagchar_mutex);
 		temp = driver->logging_mode;
 		driver->logging_mode = (int)ioarg;
 		driver->logging_process_id = current->tgid;
 		mutex_unlock(&driver->diagchar_mutex);
+
+		/* memory device data goes to the ring of the logger */
+		if (priv && driver->logging_mode == MEMORY_DEVICE_MODE &&
+		    !priv->ring)
+			diag_priv_ring_set(priv, diag_ring_alloc(ring_size_kb));
+		spin_lock_irqsave(&driver->ring_lock, flags);
+		driver->md_ring = (priv && driver->logging_mode ==
+				   MEMORY_DEVICE_MODE) ? priv->ring : NULL;
+		spin_unlock_irqrestore(&driver->ring_lock, flags);
 		if (temp == MEMORY_DEVICE_MODE && driver->logging_mode
 							== NO_LOGGING_MODE) {
 			driver->in_busy_1 = 1;
@@ -394,8 +459,10 @@ static int diagchar_ioctl(struct inode *inode, struct file *filp,
 static int diagchar_read(struct file *file, char __user *buf, size_t count,
 			  loff_t *ppos)
 {
-	int index = -1, i = 0, ret = 0;
+	int index = -1, i = 0, ret = 0, err;
 	int num_data = 0, data_type;
+	struct diag_ring *ring;
+
 	for (i = 0; i < driver->num_clients; i++)
 		if (driver->client_map[i].pid == current->tgid)
 			index = i;
@@ -405,6 +472,13 @@ static int diagchar_read(struct file *file, char __user *buf, size_t count,
 		return -EINVAL;
 	}
 
+	ring = diag_priv_ring_get(file->private_data);
+	/* a mmap() consumer drains the ring itself */
+	if (ring && diag_ring_mapped(ring)) {
+		diag_ring_release(ring);
+		ring = NULL;
+	}
+
 	wait_event_interruptible(driver->wait_q,
 				  driver->data_ready[index]);
 	mutex_lock(&driver->diagchar_mutex);
@@ -417,6 +491,17 @@ static int diagchar_read(struct file *file, char __user *buf, size_t count,
 		/* place holder for number of data field */
 		ret += 4;
 
+		/* whole records from the client ring, as many as fit */
+		if (ring) {
+			err = diag_ring_read(ring, buf + ret, count - ret,
+					     &num_data);
+			if (err < 0) {
+				ret = err;
+				goto exit;
+			}
+			ret += err;
+		}
+
 		for (i = 0; i < driver->poolsize_write_struct; i++) {
 			if (driver->buf_tbl[i].length > 0) {
 #ifdef DIAG_DEBUG
@@ -508,6 +593,8 @@ drop:
 		COPY_USER_SPACE_OR_EXIT(buf+4, num_data, 4);
 		ret -= 4;
 		driver->data_ready[index] ^= MEMORY_DEVICE_LOG_TYPE;
+		if (ring && !diag_ring_empty(ring))
+			driver->data_ready[index] |= MEMORY_DEVICE_LOG_TYPE;
 		if (driver->ch)
 			queue_work(driver->diag_wq,
 					 &(driver->diag_read_smd_work));
@@ -572,6 +659,45 @@ drop:
 
 exit:
 	mutex_unlock(&driver->diagchar_mutex);
+	diag_ring_release(ring);
+	return ret;
+}
+
+static unsigned int diagchar_poll(struct file *file, poll_table *wait)
+{
+	struct diag_ring *ring;
+	int i, ready = 0;
+
+	poll_wait(file, &driver->wait_q, wait);
+
+	mutex_lock(&driver->diagchar_mutex);
+	for (i = 0; i < driver->num_clients; i++)
+		if (driver->client_map[i].pid == current->tgid)
+			ready = driver->data_ready[i];
+	mutex_unlock(&driver->diagchar_mutex);
+
+	/* with a ring, memory device data is pending while it is not empty */
+	ring = diag_priv_ring_get(file->private_data);
+	if (ring) {
+		ready &= ~MEMORY_DEVICE_LOG_TYPE;
+		if (!diag_ring_empty(ring))
+			ready |= MEMORY_DEVICE_LOG_TYPE;
+		diag_ring_release(ring);
+	}
+
+	return ready ? (POLLIN | POLLRDNORM) : 0;
+}
+
+static int diagchar_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct diag_ring *ring = diag_priv_ring_get(file->private_data);
+	int ret;
+
+	if (!ring)
+		return -ENODEV;
+
+	ret = diag_ring_mmap(ring, vma);
+	diag_ring_release(ring);
 	return ret;
 }
 
@@ -818,14 +944,35 @@ static const struct file_operations diagcharfops = {
 	.read = diagchar_read,
 	.write = diagchar_write,
 	.ioctl = diagchar_ioctl,
+	.poll = diagchar_poll,
+	.mmap = diagchar_mmap,
 	.open = diagchar_open,
 	.release = diagchar_close
 };
 
+static ssize_t diag_show_drops(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	int n;
+
+	n = scnprintf(buf, PAGE_SIZE, "pool %d\n", driver->dropped_count);
+	n += diag_ring_show(buf + n, PAGE_SIZE - n);
+	return n;
+}
+static DEVICE_ATTR(drops, S_IRUGO, diag_show_drops, NULL);
+
+static ssize_t diag_show_log_drops(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	return diag_log_drop_show(buf, PAGE_SIZE);
+}
+static DEVICE_ATTR(log_drops, S_IRUGO, diag_show_log_drops, NULL);
+
 static int diagchar_setup_cdev(dev_t devno)
 {
 
 	int err;
+	struct device *dev;
 
 	cdev_init(driver->cdev, &diagcharfops);
 
@@ -846,8 +993,13 @@ static int diagchar_setup_cdev(dev_t devno)
 		return -1;
 	}
 
-	device_create(driver->diagchar_class, NULL, devno,
+	dev = device_create(driver->diagchar_class, NULL, devno,
 				  (void *)driver, "diag");
+	if (!IS_ERR(dev)) {
+		if (device_create_file(dev, &dev_attr_drops) ||
+		    device_create_file(dev, &dev_attr_log_drops))
+			printk(KERN_ERR "diagchar: drop counters not created\n");
+	}
 
 	return 0;
 
@@ -875,6 +1027,8 @@ static int __init diagchar_init(void)
 	dev_t dev;
 	int error;
 
+	diag_hdlc_init();
+
 	pr_debug("diagfwd initializing ..\n");
 	driver = kzalloc(sizeof(struct diagchar_dev) + 5, GFP_KERNEL);
 
@@ -892,6 +1046,7 @@ static int __init diagchar_init(void)
 		driver->num_clients = max_clients;
 		driver->logging_mode = USB_MODE;
 		mutex_init(&driver->diagchar_mutex);
+		spin_lock_init(&driver->ring_lock);
 		init_waitqueue_head(&driver->wait_q);
 		INIT_WORK(&(driver->diag_drain_work), diag_drain_work_fn);
 		INIT_WORK(&(driver->diag_read_smd_work), diag_read_smd_work_fn);
@@ -23,6 +23,10 @@
 #include <linux/device.h>
 #include <linux/uaccess.h>
 #include <linux/crc-ccitt.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "diagchar_hdlc.h"
 
 
@@ -33,6 +37,77 @@ MODULE_LICENSE("GPL v2");
 #define CRC_16_L_STEP(xx_crc, xx_c) \
 	crc_ccitt_byte(xx_crc, xx_c)
 
+/*
+ * Slice-by-4 CRC-CCITT: diag_crc_tbl[k][x] is the CRC contribution of byte
+ * x followed by k zero bytes, so four input bytes cost four lookups.
+ * diag_crc_tbl[0] is crc_ccitt_table.
+ */
+static uint16_t diag_crc_tbl[4][256];
+
+static uint16_t diag_crc_ccitt(uint16_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 4) {
+		crc ^= p[0] | (p[1] << 8);
+		crc = diag_crc_tbl[3][crc & 0xFF] ^ diag_crc_tbl[2][crc >> 8] ^
+		      diag_crc_tbl[1][p[2]] ^ diag_crc_tbl[0][p[3]];
+		p += 4;
+		len -= 4;
+	}
+
+	while (len--)
+		crc = CRC_16_L_STEP(crc, *p++);
+
+	return crc;
+}
+
+#define HDLC_ONES	(~0UL / 0xFF)
+#define HDLC_HIGHS	(HDLC_ONES * 0x80)
+
+/* true if any byte of w is 0x7E or 0x7D */
+static inline int diag_hdlc_word_special(unsigned long w)
+{
+	unsigned long c = w ^ (HDLC_ONES * CONTROL_CHAR);
+	unsigned long e = w ^ (HDLC_ONES * ESC_CHAR);
+
+	return !!((((c - HDLC_ONES) & ~c) | ((e - HDLC_ONES) & ~e)) &
+		  HDLC_HIGHS);
+}
+
+static inline int diag_hdlc_byte_special(uint8_t b)
+{
+	return b == CONTROL_CHAR || b == ESC_CHAR;
+}
+
+/*
+ * Returns the number of leading bytes of p[0..len) which need no escaping.
+ * Aligned words are tested a word at a time.
+ */
+static size_t diag_hdlc_scan(const uint8_t *p, size_t len)
+{
+	const uint8_t *s = p, *end = p + len;
+	unsigned int i;
+
+	while (s < end && ((unsigned long)s & (sizeof(long) - 1))) {
+		if (diag_hdlc_byte_special(*s))
+			return s - p;
+		s++;
+	}
+
+	while ((size_t)(end - s) >= sizeof(long)) {
+		if (diag_hdlc_word_special(*(const unsigned long *)s)) {
+			for (i = 0; i < sizeof(long); i++)
+				if (diag_hdlc_byte_special(s[i]))
+					return s + i - p;
+		}
+		s += sizeof(long);
+	}
+
+	while (s < end && !diag_hdlc_byte_special(*s))
+		s++;
+
+	return s - p;
+}
+
 void diag_hdlc_encode(struct diag_send_desc_type *src_desc,
 		      struct diag_hdlc_dest_type *enc)
 {
@@ -44,6 +119,7 @@ void diag_hdlc_encode(struct diag_send_desc_type *src_desc,
 	unsigned char src_byte = 0;
 	enum diag_send_state_enum_type state;
 	unsigned int used = 0;
+	size_t run;
 
 	if (src_desc && enc) {
 
@@ -69,33 +145,36 @@ void diag_hdlc_encode(struct diag_send_desc_type *src_desc,
 			   of 2 dest bytes for an escaped byte */
 			while (src <= src_last && dest <= dest_last) {
 
-				src_byte = *src++;
-
-				if ((src_byte == CONTROL_CHAR) ||
-				    (src_byte == ESC_CHAR)) {
-
-					/* If the escape character is not the
-					   last byte */
-					if (dest != dest_last) {
-						crc = CRC_16_L_STEP(crc,
-								    src_byte);
+				/* Bulk copy the run up to the next
+				   byte to escape */
+				run = diag_hdlc_scan(src,
+					min(src_last - src, dest_last - dest)
+					+ 1);
+				if (run) {
+					crc = diag_crc_ccitt(crc, src, run);
+					memcpy(dest, src, run);
+					src += run;
+					dest += run;
+					used += run;
+					continue;
+				}
 
-						*dest++ = ESC_CHAR;
-						used++;
+				src_byte = *src++;
 
-						*dest++ = src_byte
-							  ^ ESC_MASK;
-						used++;
-					} else {
+				/* If the escape character is not the
+				   last byte */
+				if (dest != dest_last) {
+					crc = CRC_16_L_STEP(crc, src_byte);
 
-						src--;
-						break;
-					}
+					*dest++ = ESC_CHAR;
+					used++;
 
-				} else {
-					crc = CRC_16_L_STEP(crc, src_byte);
-					*dest++ = src_byte;
+					*dest++ = src_byte ^ ESC_MASK;
 					used++;
+				} else {
+
+					src--;
+					break;
 				}
 			}
 
@@ -172,8 +251,8 @@ int diag_hdlc_decode(struct diag_hdlc_decode_type *hdlc)
 	unsigned int src_length = 0, dest_length = 0;
 
 	unsigned int len = 0;
-	unsigned int i;
-	uint8_t src_byte;
+	unsigned int i = 0;
+	unsigned int run;
 
 	int pkt_bnd = 0;
 
@@ -189,40 +268,334 @@ int diag_hdlc_decode(struct diag_hdlc_decode_type *hdlc)
 		dest_ptr = &dest_ptr[hdlc->dest_idx];
 		dest_length = hdlc->dest_size - hdlc->dest_idx;
 
-		for (i = 0; i < src_length; i++) {
-
-			src_byte = src_ptr[i];
+		while (i < src_length) {
 
 			if (hdlc->escaping) {
-				dest_ptr[len++] = src_byte ^ ESC_MASK;
+				dest_ptr[len++] = src_ptr[i++] ^ ESC_MASK;
 				hdlc->escaping = 0;
-			} else if (src_byte == ESC_CHAR) {
-				if (i == (src_length - 1)) {
-					hdlc->escaping = 1;
-					i++;
-					break;
-				} else {
-					dest_ptr[len++] = src_ptr[++i]
+			} else {
+				/* Bulk copy up to the next special byte */
+				run = diag_hdlc_scan(&src_ptr[i],
+					min(src_length - i,
+					    dest_length - len));
+				if (run) {
+					memcpy(&dest_ptr[len], &src_ptr[i],
+					       run);
+					i += run;
+					len += run;
+				} else if (src_ptr[i] == ESC_CHAR) {
+					if (i == (src_length - 1)) {
+						hdlc->escaping = 1;
+						i++;
+						break;
+					}
+					dest_ptr[len++] = src_ptr[i + 1]
 							  ^ ESC_MASK;
+					i += 2;
+				} else {
+					/* CONTROL_CHAR */
+					dest_ptr[len++] = src_ptr[i++];
+					pkt_bnd = 1;
+					break;
 				}
-			} else if (src_byte == CONTROL_CHAR) {
-				dest_ptr[len++] = src_byte;
-				pkt_bnd = 1;
-				i++;
+			}
+
+			if (len >= dest_length)
 				break;
+		}
+
+		hdlc->src_idx += i;
+		hdlc->dest_idx += len;
+	}
+
+	return pkt_bnd;
+}
+
+#ifdef CONFIG_DIAG_HDLC_SELFTEST
+/*
+ * Byte at a time reference engine: the previous implementation, used to
+ * check and benchmark the word at a time one.
+ */
+static void diag_hdlc_encode_ref(struct diag_send_desc_type *src_desc,
+				 struct diag_hdlc_dest_type *enc)
+{
+	uint8_t *dest = enc->dest;
+	uint8_t *dest_last = enc->dest_last;
+	const uint8_t *src = src_desc->pkt;
+	const uint8_t *src_last = src_desc->last;
+	enum diag_send_state_enum_type state = src_desc->state;
+	uint16_t crc = enc->crc;
+	unsigned char src_byte;
+
+	if (state == DIAG_STATE_START) {
+		crc = CRC_16_L_SEED;
+		state++;
+	}
+
+	while (src <= src_last && dest <= dest_last) {
+		src_byte = *src++;
+		if (diag_hdlc_byte_special(src_byte)) {
+			if (dest == dest_last) {
+				src--;
+				break;
+			}
+			crc = CRC_16_L_STEP(crc, src_byte);
+			*dest++ = ESC_CHAR;
+			*dest++ = src_byte ^ ESC_MASK;
+		} else {
+			crc = CRC_16_L_STEP(crc, src_byte);
+			*dest++ = src_byte;
+		}
+	}
+
+	if (src > src_last) {
+		if (state == DIAG_STATE_BUSY) {
+			if (src_desc->terminate) {
+				crc = ~crc;
+				state++;
+			} else {
+				state = DIAG_STATE_COMPLETE;
+			}
+		}
+		while (dest <= dest_last && state >= DIAG_STATE_CRC1 &&
+		       state < DIAG_STATE_TERM) {
+			src_byte = crc & 0xFF;
+			if (diag_hdlc_byte_special(src_byte)) {
+				if (dest == dest_last)
+					break;
+				*dest++ = ESC_CHAR;
+				*dest++ = src_byte ^ ESC_MASK;
 			} else {
-				dest_ptr[len++] = src_byte;
+				*dest++ = src_byte;
 			}
+			crc >>= 8;
+			state++;
+		}
+		if (state == DIAG_STATE_TERM && dest_last >= dest) {
+			*dest++ = CONTROL_CHAR;
+			state++;
+		}
+	}
+
+	enc->dest = dest;
+	enc->crc = crc;
+	src_desc->pkt = src;
+	src_desc->state = state;
+}
+
+static int diag_hdlc_decode_ref(struct diag_hdlc_decode_type *hdlc)
+{
+	uint8_t *src_ptr = &hdlc->src_ptr[hdlc->src_idx];
+	uint8_t *dest_ptr = &hdlc->dest_ptr[hdlc->dest_idx];
+	unsigned int src_length = hdlc->src_size - hdlc->src_idx;
+	unsigned int dest_length = hdlc->dest_size - hdlc->dest_idx;
+	unsigned int len = 0, i;
+	int pkt_bnd = 0;
 
-			if (len >= dest_length) {
+	for (i = 0; i < src_length; i++) {
+		uint8_t src_byte = src_ptr[i];
+
+		if (hdlc->escaping) {
+			dest_ptr[len++] = src_byte ^ ESC_MASK;
+			hdlc->escaping = 0;
+		} else if (src_byte == ESC_CHAR) {
+			if (i == (src_length - 1)) {
+				hdlc->escaping = 1;
 				i++;
 				break;
 			}
+			dest_ptr[len++] = src_ptr[++i] ^ ESC_MASK;
+		} else if (src_byte == CONTROL_CHAR) {
+			dest_ptr[len++] = src_byte;
+			pkt_bnd = 1;
+			i++;
+			break;
+		} else {
+			dest_ptr[len++] = src_byte;
 		}
 
-		hdlc->src_idx += i;
-		hdlc->dest_idx += len;
+		if (len >= dest_length) {
+			i++;
+			break;
+		}
 	}
 
+	hdlc->src_idx += i;
+	hdlc->dest_idx += len;
 	return pkt_bnd;
 }
+
+#define HDLC_TEST_LEN		4096
+#define HDLC_TEST_OUT		(2 * HDLC_TEST_LEN + 8)
+#define HDLC_BENCH_ROUNDS	256
+
+/* Fill with random data, one byte in 2^shift being 0x7E or 0x7D */
+static void diag_hdlc_test_fill(uint8_t *buf, size_t len, int shift)
+{
+	size_t i;
+
+	get_random_bytes(buf, len);
+	for (i = 0; i < len; i++) {
+		if (diag_hdlc_byte_special(buf[i]))
+			buf[i] = 0;
+		if ((buf[i] & ((1 << shift) - 1)) == 1)
+			buf[i] = (buf[i] & 0x80) ? CONTROL_CHAR : ESC_CHAR;
+	}
+}
+
+/* Encodes len bytes in dest chunks of chunk bytes, returns encoded size */
+static size_t diag_hdlc_test_encode(int ref, const uint8_t *src, size_t len,
+				    uint8_t *out, size_t chunk)
+{
+	struct diag_send_desc_type send = { src, src + len - 1,
+					    DIAG_STATE_START, 1 };
+	struct diag_hdlc_dest_type enc = { out, NULL, 0 };
+	uint8_t *end = out + HDLC_TEST_OUT;
+
+	while (send.state != DIAG_STATE_COMPLETE && enc.dest < (void *)end) {
+		enc.dest_last = min((uint8_t *)enc.dest + chunk, end) - 1;
+		if (ref)
+			diag_hdlc_encode_ref(&send, &enc);
+		else
+			diag_hdlc_encode(&send, &enc);
+	}
+	return (uint8_t *)enc.dest - out;
+}
+
+static int diag_hdlc_test_decode(int ref, uint8_t *src, size_t len,
+				 uint8_t *out, size_t chunk, size_t *out_len)
+{
+	struct diag_hdlc_decode_type hdlc = { src, 0, 0, out, 0, 0, 0 };
+	int bnd = 0;
+
+	while (!bnd && hdlc.src_idx < len && hdlc.dest_idx < HDLC_TEST_OUT) {
+		hdlc.src_size = min(hdlc.src_idx + chunk, len);
+		hdlc.dest_size = min(hdlc.dest_idx + chunk,
+				     (size_t)HDLC_TEST_OUT);
+		if (ref)
+			bnd = diag_hdlc_decode_ref(&hdlc);
+		else
+			bnd = diag_hdlc_decode(&hdlc);
+	}
+	*out_len = hdlc.dest_idx;
+	return bnd;
+}
+
+static int __init diag_hdlc_selftest(uint8_t *raw, uint8_t *a, uint8_t *b)
+{
+	/* encoding needs room for an escaped pair, so chunks start at 2 */
+	static const size_t chunks[] = { 2, 3, 7, 64, 511, HDLC_TEST_OUT };
+	uint8_t *src, *dec = raw + HDLC_TEST_LEN;
+	size_t len, la, lb, c;
+	int shift, ba, bb;
+
+	for (shift = 1; shift <= 8; shift++) {
+		/* odd start address, to cover the unaligned head */
+		src = raw + (shift & (sizeof(long) - 1));
+
+		for (len = 1; len + sizeof(long) <= HDLC_TEST_LEN;
+		     len = len * 3 + shift) {
+			diag_hdlc_test_fill(src, len, shift);
+
+			for (c = 0; c < ARRAY_SIZE(chunks); c++) {
+				la = diag_hdlc_test_encode(0, src, len, a,
+							   chunks[c]);
+				lb = diag_hdlc_test_encode(1, src, len, b,
+							   chunks[c]);
+				if (la != lb || memcmp(a, b, la))
+					goto fail_enc;
+
+				ba = diag_hdlc_test_decode(0, a, la, dec,
+							   chunks[c], &la);
+				bb = diag_hdlc_test_decode(1, b, lb,
+							   b + HDLC_TEST_OUT,
+							   chunks[c], &lb);
+				if (ba != bb || la != lb ||
+				    memcmp(dec, b + HDLC_TEST_OUT, la) ||
+				    la < len || memcmp(dec, src, len))
+					goto fail_dec;
+			}
+		}
+	}
+	return 0;
+
+fail_enc:
+	pr_err("diag: hdlc encode self-test failed, len %zu chunk %zu\n",
+	       len, chunks[c]);
+	return -EINVAL;
+fail_dec:
+	pr_err("diag: hdlc decode self-test failed, len %zu chunk %zu\n",
+	       len, chunks[c]);
+	return -EINVAL;
+}
+
+static void __init diag_hdlc_bench(uint8_t *raw, uint8_t *out)
+{
+	static const char * const names[] = { "word", "byte" };
+	s64 enc_ns[2], dec_ns[2];
+	size_t enc_len = 0, dec_len;
+	ktime_t t;
+	int ref, i;
+
+	/* log packets: mostly payload, few bytes to escape */
+	diag_hdlc_test_fill(raw, HDLC_TEST_LEN, 7);
+
+	for (ref = 0; ref < 2; ref++) {
+		t = ktime_get();
+		for (i = 0; i < HDLC_BENCH_ROUNDS; i++)
+			enc_len = diag_hdlc_test_encode(ref, raw,
+					HDLC_TEST_LEN, out, HDLC_TEST_OUT);
+		enc_ns[ref] = ktime_to_ns(ktime_sub(ktime_get(), t));
+
+		t = ktime_get();
+		for (i = 0; i < HDLC_BENCH_ROUNDS; i++)
+			diag_hdlc_test_decode(ref, out, enc_len,
+					raw + HDLC_TEST_LEN, HDLC_TEST_OUT,
+					&dec_len);
+		dec_ns[ref] = ktime_to_ns(ktime_sub(ktime_get(), t));
+	}
+
+	for (ref = 0; ref < 2; ref++)
+		pr_info("diag: hdlc %s engine: encode %lld ns/KB, "
+			"decode %lld ns/KB\n", names[ref],
+			div_s64(enc_ns[ref], HDLC_BENCH_ROUNDS *
+				(HDLC_TEST_LEN / 1024)),
+			div_s64(dec_ns[ref], HDLC_BENCH_ROUNDS *
+				(HDLC_TEST_LEN / 1024)));
+}
+#endif /* CONFIG_DIAG_HDLC_SELFTEST */
+
+int __init diag_hdlc_init(void)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < 256; i++) {
+		diag_crc_tbl[0][i] = crc_ccitt_table[i];
+		for (k = 1; k < 4; k++)
+			diag_crc_tbl[k][i] = (diag_crc_tbl[k - 1][i] >> 8) ^
+				crc_ccitt_table[diag_crc_tbl[k - 1][i] & 0xFF];
+	}
+
+#ifdef CONFIG_DIAG_HDLC_SELFTEST
+	{
+	uint8_t *raw, *a, *b;
+	int ret;
+
+	/* raw holds the test input followed by the decoder output */
+	raw = kmalloc(HDLC_TEST_LEN + HDLC_TEST_OUT, GFP_KERNEL);
+	a = kmalloc(HDLC_TEST_OUT, GFP_KERNEL);
+	b = kmalloc(2 * HDLC_TEST_OUT, GFP_KERNEL);
+	if (raw && a && b) {
+		ret = diag_hdlc_selftest(raw, a, b);
+		if (!ret) {
+			pr_info("diag: hdlc self-test passed\n");
+			diag_hdlc_bench(raw, a);
+		}
+	}
+	kfree(raw);
+	kfree(a);
+	kfree(b);
+	}
+#endif
+	return 0;
+}
@@ -70,6 +70,8 @@ void diag_hdlc_encode(struct diag_send_desc_type *src_desc,
 
 int diag_hdlc_decode(struct diag_hdlc_decode_type *hdlc);
 
+int diag_hdlc_init(void);
+
 #define ESC_CHAR     0x7D
 #define CONTROL_CHAR 0x7E
 #define ESC_MASK     0x20
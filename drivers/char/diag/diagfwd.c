@@ -39,6 +39,7 @@
 #include "diagchar.h"
 #include "diagfwd.h"
 #include "diagchar_hdlc.h"
+#include "diagring.h"
 #ifdef CONFIG_DIAG_SDIO_PIPE
 #include "diagfwd_sdio.h"
 #endif
@@ -138,11 +139,73 @@ void __diag_smd_send_req(void)
 	}
 }
 
+/*
+ * Memory device mode with a client ring: the data is copied to the ring of
+ * the logging process and the source buffer is released right away, so the
+ * pools and SMD channels keep flowing while the logger drains in batches.
+ * Returns -ENODEV when the legacy buffer table has to be used instead.
+ */
+static int diag_md_ring_write(void *buf, int proc_num,
+			      struct diag_request *write_ptr)
+{
+	unsigned long flags;
+	int i, len, err;
+
+	if (proc_num != APPS_DATA && proc_num != MODEM_DATA &&
+	    proc_num != QDSP_DATA)
+		return -ENODEV;
+
+	len = (proc_num == APPS_DATA) ? driver->used : write_ptr->length;
+
+	spin_lock_irqsave(&driver->ring_lock, flags);
+	if (!driver->md_ring) {
+		spin_unlock_irqrestore(&driver->ring_lock, flags);
+		return -ENODEV;
+	}
+	err = diag_ring_write(driver->md_ring, proc_num, buf, len);
+	spin_unlock_irqrestore(&driver->ring_lock, flags);
+
+	if (err)
+		diag_log_drop_count(buf, len);
+
+	if (proc_num == APPS_DATA) {
+		diagmem_free(driver, buf, POOL_TYPE_HDLC);
+	} else if (proc_num == MODEM_DATA) {
+		if (write_ptr == driver->write_ptr_1)
+			driver->in_busy_1 = 0;
+		else
+			driver->in_busy_2 = 0;
+		queue_work(driver->diag_wq, &(driver->diag_read_smd_work));
+	} else {
+		if (write_ptr == driver->write_ptr_qdsp_1)
+			driver->in_busy_qdsp_1 = 0;
+		else
+			driver->in_busy_qdsp_2 = 0;
+		queue_work(driver->diag_wq,
+			   &(driver->diag_read_smd_qdsp_work));
+	}
+
+	if (!err) {
+		for (i = 0; i < driver->num_clients; i++)
+			if (driver->client_map[i].pid ==
+						 driver->logging_process_id)
+				break;
+		if (i < driver->num_clients) {
+			driver->data_ready[i] |= MEMORY_DEVICE_LOG_TYPE;
+			wake_up_interruptible(&driver->wait_q);
+		}
+	}
+
+	return 0;
+}
+
 int diag_device_write(void *buf, int proc_num, struct diag_request *write_ptr)
 {
 	int i, err = 0;
 
 	if (driver->logging_mode == MEMORY_DEVICE_MODE) {
+		if (!diag_md_ring_write(buf, proc_num, write_ptr))
+			return 0;
 		if (proc_num == APPS_DATA) {
 			for (i = 0; i < driver->poolsize_write_struct; i++)
 				if (driver->buf_tbl[i].length == 0) {
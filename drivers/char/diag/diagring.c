@@ -0,0 +1,374 @@
+/* Copyright (c) 2008-2010, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include "diagchar_hdlc.h"
+#include "diagring.h"
+
+#define DIAG_RING_MIN_KB	64
+#define DIAG_RING_MAX_KB	8192
+
+/* Command code of log packets, log code at byte 6 of the packet */
+#define DIAG_CMD_LOG		0x10
+#define DIAG_LOG_HDR_LEN	8
+
+#define DIAG_LOG_DROP_BITS	6
+#define DIAG_LOG_DROP_SLOTS	(1 << DIAG_LOG_DROP_BITS)
+
+static struct {
+	uint16_t code;
+	unsigned long count;
+} diag_log_drops[DIAG_LOG_DROP_SLOTS];
+static unsigned long diag_log_drops_other;
+static DEFINE_SPINLOCK(diag_log_drop_lock);
+
+static LIST_HEAD(diag_rings);
+static DEFINE_SPINLOCK(diag_rings_lock);
+
+struct diag_ring *diag_ring_alloc(unsigned int size_kb)
+{
+	struct diag_ring *ring;
+
+	size_kb = clamp_t(unsigned int, size_kb, DIAG_RING_MIN_KB,
+			  DIAG_RING_MAX_KB);
+	size_kb = roundup_pow_of_two(size_kb);
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return NULL;
+
+	ring->size = size_kb << 10;
+	ring->ctl = vmalloc_user(PAGE_SIZE + ring->size);
+	if (!ring->ctl) {
+		kfree(ring);
+		return NULL;
+	}
+	ring->data = (uint8_t *)ring->ctl + PAGE_SIZE;
+	ring->ctl->size = ring->size;
+	ring->ctl->data_offset = PAGE_SIZE;
+	kref_init(&ring->kref);
+
+	ring->pid = current->tgid;
+	strlcpy(ring->name, current->comm, sizeof(ring->name));
+	spin_lock(&diag_rings_lock);
+	list_add_tail(&ring->list, &diag_rings);
+	spin_unlock(&diag_rings_lock);
+
+	return ring;
+}
+
+void diag_ring_get(struct diag_ring *ring)
+{
+	kref_get(&ring->kref);
+}
+
+static void diag_ring_free(struct kref *kref)
+{
+	struct diag_ring *ring = container_of(kref, struct diag_ring, kref);
+
+	spin_lock(&diag_rings_lock);
+	list_del(&ring->list);
+	spin_unlock(&diag_rings_lock);
+
+	vfree(ring->ctl);
+	kfree(ring);
+}
+
+void diag_ring_release(struct diag_ring *ring)
+{
+	if (ring)
+		kref_put(&ring->kref, diag_ring_free);
+}
+
+/*
+ * Where the consumer is. A mmap() consumer moves ctl->tail itself, so it is
+ * only taken when it is aligned and between head - size and head; anything
+ * else makes the ring look full until the consumer writes a sane value.
+ */
+static uint32_t diag_ring_tail(struct diag_ring *ring, uint32_t head)
+{
+	uint32_t tail;
+
+	if (!diag_ring_mapped(ring))
+		return ring->tail;
+
+	tail = ACCESS_ONCE(ring->ctl->tail);
+	if (head - tail > ring->size || (tail & (DIAG_RING_ALIGN - 1)))
+		return head - ring->size;
+	return tail;
+}
+
+/*
+ * Producer side, callers are serialized by driver->ring_lock. Copies one
+ * buffer as a record, or accounts it as dropped when the ring is full.
+ */
+int diag_ring_write(struct diag_ring *ring, int type, const void *buf,
+		    int len)
+{
+	struct diag_ring_ctl *ctl = ring->ctl;
+	struct diag_ring_rec *rec;
+	uint32_t head = ring->head, tail, off, room, need, total;
+
+	tail = diag_ring_tail(ring, head);
+	/* read tail before reusing the space the consumer released */
+	smp_mb();
+
+	/*
+	 * head is always DIAG_RING_ALIGN aligned, so there is room for at
+	 * least a record header at off.
+	 */
+	need = ALIGN(sizeof(*rec) + len, DIAG_RING_ALIGN);
+	off = head & (ring->size - 1);
+	room = ring->size - off;
+	total = (need > room) ? room + need : need;
+
+	if (len < 0 || len > ring->size || need > ring->size ||
+	    head - tail + total > ring->size) {
+		ctl->drops = ++ring->drops;
+		ring->drop_bytes += len;
+		return -ENOSPC;
+	}
+
+	if (need > room) {
+		rec = (struct diag_ring_rec *)(ring->data + off);
+		rec->len = room - sizeof(*rec);
+		rec->type = DIAG_RING_PAD;
+		head += room;
+		off = 0;
+	}
+
+	rec = (struct diag_ring_rec *)(ring->data + off);
+	rec->len = len;
+	rec->type = type;
+	memcpy(rec + 1, buf, len);
+
+	/* publish the record before the new head */
+	smp_wmb();
+	ring->head = head + need;
+	ctl->head = ring->head;
+	ring->records++;
+
+	return 0;
+}
+
+int diag_ring_empty(struct diag_ring *ring)
+{
+	uint32_t head = ACCESS_ONCE(ring->head);
+
+	return head == diag_ring_tail(ring, head);
+}
+
+/*
+ * read() consumer: copies as many whole records as fit in count bytes, in
+ * the legacy memory device format (length, data), and releases them.
+ * Callers are serialized by driver->diagchar_mutex. The records sit in
+ * memory that may have been mapped, so every length is checked against
+ * head and the end of the data area; a bad one discards what is left.
+ */
+int diag_ring_read(struct diag_ring *ring, char __user *buf, int count,
+		   int *num_data)
+{
+	struct diag_ring_ctl *ctl = ring->ctl;
+	struct diag_ring_rec *rec;
+	uint32_t tail = ring->tail, head = ACCESS_ONCE(ring->head);
+	uint32_t off, len, type;
+	int ret = 0;
+
+	/* read head before the records it covers */
+	smp_rmb();
+
+	/* a mmap() consumer that went away may have left it anywhere */
+	if (head - tail > ring->size || (tail & (DIAG_RING_ALIGN - 1)))
+		tail = head;
+
+	while (tail != head) {
+		off = tail & (ring->size - 1);
+		rec = (struct diag_ring_rec *)(ring->data + off);
+		len = ACCESS_ONCE(rec->len);
+		type = ACCESS_ONCE(rec->type);
+
+		if (len > ring->size - off - sizeof(*rec) ||
+		    ALIGN(sizeof(*rec) + len, DIAG_RING_ALIGN) > head - tail) {
+			pr_err("diag: bad ring record at %u, len %u\n", off,
+			       len);
+			tail = head;
+			break;
+		}
+
+		if (type != DIAG_RING_PAD) {
+			if (ret + 4 + len > count)
+				break;
+			if (copy_to_user(buf + ret, &len, 4) ||
+			    copy_to_user(buf + ret + 4, rec + 1, len))
+				return -EFAULT;
+			ret += 4 + len;
+			(*num_data)++;
+		}
+		tail += ALIGN(sizeof(*rec) + len, DIAG_RING_ALIGN);
+	}
+
+	/* finish reading records before the producer may reuse them */
+	smp_mb();
+	ring->tail = tail;
+	ctl->tail = tail;
+
+	return ret;
+}
+
+static void diag_ring_vm_open(struct vm_area_struct *vma)
+{
+	struct diag_ring *ring = vma->vm_private_data;
+
+	atomic_inc(&ring->mapped);
+	diag_ring_get(ring);
+}
+
+static void diag_ring_vm_close(struct vm_area_struct *vma)
+{
+	struct diag_ring *ring = vma->vm_private_data;
+
+	/* read() carries on from where the mmap() consumer stopped */
+	if (atomic_read(&ring->mapped) == 1)
+		ring->tail = diag_ring_tail(ring, ACCESS_ONCE(ring->head));
+	atomic_dec(&ring->mapped);
+	diag_ring_release(ring);
+}
+
+static const struct vm_operations_struct diag_ring_vm_ops = {
+	.open = diag_ring_vm_open,
+	.close = diag_ring_vm_close,
+};
+
+/* The mapping keeps the ring alive after a resize or close */
+int diag_ring_mmap(struct diag_ring *ring, struct vm_area_struct *vma)
+{
+	int ret;
+
+	ret = remap_vmalloc_range(vma, ring->ctl, vma->vm_pgoff);
+	if (ret)
+		return ret;
+
+	vma->vm_private_data = ring;
+	vma->vm_ops = &diag_ring_vm_ops;
+	diag_ring_vm_open(vma);
+
+	return 0;
+}
+
+int diag_ring_mapped(struct diag_ring *ring)
+{
+	return atomic_read(&ring->mapped);
+}
+
+/* One line per client ring */
+int diag_ring_show(char *buf, int size)
+{
+	struct diag_ring *ring;
+	int n = 0;
+
+	spin_lock(&diag_rings_lock);
+	list_for_each_entry(ring, &diag_rings, list)
+		n += scnprintf(buf + n, size - n,
+			       "%d %s size %u records %lu drops %u "
+			       "drop_bytes %lu\n", ring->pid, ring->name,
+			       ring->size, ring->records, ring->drops,
+			       ring->drop_bytes);
+	spin_unlock(&diag_rings_lock);
+
+	return n;
+}
+
+static void diag_log_drop_add(uint16_t code)
+{
+	unsigned int i, slot = hash_32(code, DIAG_LOG_DROP_BITS);
+
+	for (i = 0; i < DIAG_LOG_DROP_SLOTS; i++) {
+		if (!diag_log_drops[slot].count) {
+			diag_log_drops[slot].code = code;
+			diag_log_drops[slot].count = 1;
+			return;
+		}
+		if (diag_log_drops[slot].code == code) {
+			diag_log_drops[slot].count++;
+			return;
+		}
+		slot = (slot + 1) & (DIAG_LOG_DROP_SLOTS - 1);
+	}
+	diag_log_drops_other++;
+}
+
+/*
+ * Accounts the log packets of a dropped buffer of HDLC frames by log
+ * code. Only the frame headers are unescaped.
+ */
+void diag_log_drop_count(const uint8_t *buf, int len)
+{
+	uint8_t hdr[DIAG_LOG_HDR_LEN];
+	unsigned long flags;
+	int i, n = 0, esc = 0;
+	uint8_t c;
+
+	spin_lock_irqsave(&diag_log_drop_lock, flags);
+	for (i = 0; i < len; i++) {
+		c = buf[i];
+		if (c == CONTROL_CHAR) {
+			n = 0;
+			esc = 0;
+			continue;
+		}
+		if (n >= DIAG_LOG_HDR_LEN)
+			continue;
+		if (esc) {
+			c ^= ESC_MASK;
+			esc = 0;
+		} else if (c == ESC_CHAR) {
+			esc = 1;
+			continue;
+		}
+		hdr[n++] = c;
+		if (n == DIAG_LOG_HDR_LEN && hdr[0] == DIAG_CMD_LOG)
+			diag_log_drop_add(hdr[6] | (hdr[7] << 8));
+	}
+	spin_unlock_irqrestore(&diag_log_drop_lock, flags);
+}
+
+int diag_log_drop_show(char *buf, int size)
+{
+	unsigned long flags;
+	int i, n = 0;
+
+	spin_lock_irqsave(&diag_log_drop_lock, flags);
+	for (i = 0; i < DIAG_LOG_DROP_SLOTS; i++)
+		if (diag_log_drops[i].count)
+			n += scnprintf(buf + n, size - n, "0x%04x %lu\n",
+				       diag_log_drops[i].code,
+				       diag_log_drops[i].count);
+	n += scnprintf(buf + n, size - n, "other %lu\n",
+		       diag_log_drops_other);
+	spin_unlock_irqrestore(&diag_log_drop_lock, flags);
+
+	return n;
+}
@@ -0,0 +1,62 @@
+/* Copyright (c) 2008-2010, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+#ifndef DIAGRING_H
+#define DIAGRING_H
+
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/diagchar.h>
+
+/* Per client memory device ring, layout in <linux/diagchar.h> */
+struct diag_ring {
+	struct diag_ring_ctl *ctl;	/* vmalloc_user(), mmap()able */
+	uint8_t *data;
+	uint32_t size;			/* data area, power of two */
+	/* authoritative indices, ctl only gets a copy of them */
+	uint32_t head;
+	uint32_t tail;			/* read() consumer only */
+	uint32_t drops;
+	unsigned long records;
+	unsigned long drop_bytes;
+	struct kref kref;
+	atomic_t mapped;		/* consumed through mmap() */
+
+	/* owner, for the drops attribute */
+	struct list_head list;
+	int pid;
+	char name[20];
+};
+
+struct diag_ring *diag_ring_alloc(unsigned int size_kb);
+void diag_ring_get(struct diag_ring *ring);
+void diag_ring_release(struct diag_ring *ring);
+int diag_ring_write(struct diag_ring *ring, int type, const void *buf,
+		    int len);
+int diag_ring_empty(struct diag_ring *ring);
+int diag_ring_read(struct diag_ring *ring, char __user *buf, int count,
+		   int *num_data);
+int diag_ring_mmap(struct diag_ring *ring, struct vm_area_struct *vma);
+int diag_ring_mapped(struct diag_ring *ring);
+
+int diag_ring_show(char *buf, int size);
+
+void diag_log_drop_count(const uint8_t *buf, int len);
+int diag_log_drop_show(char *buf, int size);
+
+#endif
@@ -28,6 +28,7 @@
 #include <linux/cpu.h>
 #include <linux/completion.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
 
 #define dprintk(msg...) cpufreq_debug_printk(CPUFREQ_DEBUG_CORE, \
 						"cpufreq-core", msg)
@@ -1870,6 +1871,41 @@ int cpufreq_unregister_notifier(struct notifier_block *nb, unsigned int list)
 EXPORT_SYMBOL(cpufreq_unregister_notifier);
 
 
+static void (*cpufreq_ramp_latency_hook)(unsigned int cpu, s64 us);
+
+/**
+ *	cpufreq_set_ramp_latency_hook - set the ramp latency accounting hook
+ *	@hook: function called by cpufreq_ramp_latency(), or NULL
+ *
+ *	Once this returns after clearing the hook, the old one is no longer
+ *	running, so a module may go away.
+ */
+void cpufreq_set_ramp_latency_hook(void (*hook)(unsigned int cpu, s64 us))
+{
+	rcu_assign_pointer(cpufreq_ramp_latency_hook, hook);
+	if (!hook)
+		synchronize_rcu();
+}
+EXPORT_SYMBOL_GPL(cpufreq_set_ramp_latency_hook);
+
+/**
+ *	cpufreq_ramp_latency - report the latency of a governor's raise
+ *	@cpu: cpu whose speed was raised
+ *	@us: time from the governor's decision to the speed change
+ */
+void cpufreq_ramp_latency(unsigned int cpu, s64 us)
+{
+	void (*hook)(unsigned int cpu, s64 us);
+
+	rcu_read_lock();
+	hook = rcu_dereference(cpufreq_ramp_latency_hook);
+	if (hook)
+		hook(cpu, us);
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL_GPL(cpufreq_ramp_latency);
+
+
 /*********************************************************************
  *                              GOVERNORS                            *
  *********************************************************************/
@@ -0,0 +1,808 @@
+/*
+ *  drivers/cpufreq/cpufreq_interactive.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * 'interactive' governor: instead of sampling every cpu on a fixed period
+ * like ondemand, a short sample timer is armed when a cpu leaves idle. If
+ * the cpu stayed busy the timer ramps it up straight away, first to
+ * hispeed_freq and then in proportion to load, and it is only allowed
+ * to come back down after min_sample_time at the same speed. Input events
+ * and a high run queue average (msm_rq_stats) count as busy.
+ *
+ * Raising the speed is done from a realtime kthread so it is not delayed
+ * behind the load that caused it; lowering it can wait on a workqueue.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/cpufreq.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/tick.h>
+#include <linux/ktime.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/input.h>
+#include <linux/slab.h>
+#include <linux/rq_stats.h>
+#include <asm/idle.h>
+
+struct cpufreq_interactive_cpuinfo {
+	struct timer_list cpu_timer;
+	int timer_idlecancel;
+	u64 time_in_idle;
+	u64 idle_exit_time;
+	u64 timer_run_time;
+	int idling;
+	u64 freq_change_time;
+	u64 freq_change_time_in_idle;
+	/* when the pending raise was decided, for ramp latency */
+	ktime_t ramp_start;
+	struct cpufreq_policy *policy;
+	struct cpufreq_frequency_table *freq_table;
+	unsigned int target_freq;
+	int governor_enabled;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
+
+/* realtime thread handles frequency scaling up */
+static struct task_struct *up_task;
+static cpumask_t up_cpumask;
+static spinlock_t up_cpumask_lock;
+
+/* workqueue handles frequency scaling down */
+static struct workqueue_struct *down_wq;
+static struct work_struct freq_scale_down_work;
+static cpumask_t down_cpumask;
+static spinlock_t down_cpumask_lock;
+
+/* serializes speed changes of cpus sharing a policy */
+static DEFINE_MUTEX(set_speed_lock);
+
+/* protects active_count, the number of policies using this governor */
+static DEFINE_MUTEX(gov_mutex);
+static unsigned int active_count;
+
+/* Go to hispeed_freq when a cpu goes busy from idle or is boosted */
+static unsigned int hispeed_freq;
+
+/* Go to hispeed_freq when cpu load at or above this value */
+#define DEFAULT_GO_HISPEED_LOAD 85
+static unsigned int go_hispeed_load;
+
+/* Time to spend at a speed before lowering it, in us */
+#define DEFAULT_MIN_SAMPLE_TIME (80 * USEC_PER_MSEC)
+static unsigned int min_sample_time;
+
+/* Sampling period while a cpu is not idle, in us */
+#define DEFAULT_TIMER_RATE (20 * USEC_PER_MSEC)
+static unsigned int timer_rate;
+
+/* How long an input event keeps cpus at hispeed_freq or above, in ms */
+#define DEFAULT_INPUT_BOOST_MS 200
+static unsigned int input_boost_ms;
+static unsigned long input_boost_until;
+
+/* Run queue average, in tenths of a task, that counts as boost. 0 = off */
+#define DEFAULT_RQ_BOOST_THRESHOLD 25
+static unsigned int rq_boost_threshold;
+
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+		unsigned int event);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+static
+#endif
+struct cpufreq_governor cpufreq_gov_interactive = {
+	.name = "interactive",
+	.governor = cpufreq_governor_interactive,
+	.max_transition_latency = 10000000,
+	.owner = THIS_MODULE,
+};
+
+static int cpufreq_interactive_boosted(void)
+{
+	if (input_boost_ms && time_before(jiffies, input_boost_until))
+		return 1;
+
+	return rq_boost_threshold && rq_stats_avg() >= rq_boost_threshold;
+}
+
+static void cpufreq_interactive_rearm(struct cpufreq_interactive_cpuinfo *pcpu,
+				      int cpu)
+{
+	pcpu->time_in_idle = get_cpu_idle_time_us(cpu, &pcpu->idle_exit_time);
+	mod_timer(&pcpu->cpu_timer, jiffies + usecs_to_jiffies(timer_rate));
+}
+
+static void cpufreq_interactive_raise(struct cpufreq_interactive_cpuinfo *pcpu,
+				      int cpu, unsigned int new_freq)
+{
+	unsigned long flags;
+
+	pcpu->target_freq = new_freq;
+	if (!pcpu->ramp_start.tv64)
+		pcpu->ramp_start = ktime_get();
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+	cpumask_set_cpu(cpu, &up_cpumask);
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+	wake_up_process(up_task);
+}
+
+static void cpufreq_interactive_timer(unsigned long data)
+{
+	unsigned int delta_idle;
+	unsigned int delta_time;
+	int cpu_load;
+	int load_since_change;
+	u64 time_in_idle;
+	u64 idle_exit_time;
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, data);
+	u64 now_idle;
+	unsigned int new_freq;
+	unsigned int index;
+	unsigned long flags;
+
+	smp_rmb();
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	/*
+	 * Once timer_run_time is at or past idle_exit_time, idle exit knows
+	 * this sample has been consumed and may start a new one. Until then
+	 * it leaves time_in_idle and idle_exit_time alone.
+	 */
+	time_in_idle = pcpu->time_in_idle;
+	idle_exit_time = pcpu->idle_exit_time;
+	now_idle = get_cpu_idle_time_us(data, &pcpu->timer_run_time);
+	smp_wmb();
+
+	/* Raced with idle entry cancelling the timer */
+	if (!idle_exit_time)
+		return;
+
+	delta_idle = (unsigned int)(now_idle - time_in_idle);
+	delta_time = (unsigned int)(pcpu->timer_run_time - idle_exit_time);
+
+	/* Too short a sample to judge, look again later */
+	if (delta_time < 1000)
+		goto rearm;
+
+	if (delta_idle > delta_time)
+		cpu_load = 0;
+	else
+		cpu_load = 100 * (delta_time - delta_idle) / delta_time;
+
+	delta_idle = (unsigned int)(now_idle - pcpu->freq_change_time_in_idle);
+	delta_time = (unsigned int)(pcpu->timer_run_time -
+				    pcpu->freq_change_time);
+
+	if (!delta_time || delta_idle > delta_time)
+		load_since_change = 0;
+	else
+		load_since_change = 100 * (delta_time - delta_idle) / delta_time;
+
+	/*
+	 * Use the greater of the load since idle exit and the load since
+	 * the last speed change, so a short idle does not undo a ramp.
+	 */
+	if (load_since_change > cpu_load)
+		cpu_load = load_since_change;
+
+	new_freq = pcpu->policy->max * cpu_load / 100;
+	if (cpu_load >= go_hispeed_load || cpufreq_interactive_boosted()) {
+		if (pcpu->target_freq < hispeed_freq ||
+		    new_freq < hispeed_freq)
+			new_freq = hispeed_freq;
+	}
+
+	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+					   new_freq, CPUFREQ_RELATION_H,
+					   &index)) {
+		pr_warning("cpufreq_interactive: cpu%lu: no table entry "
+			   "for %u\n", data, new_freq);
+		goto rearm;
+	}
+
+	new_freq = pcpu->freq_table[index].frequency;
+
+	if (pcpu->target_freq == new_freq)
+		goto rearm_if_notmax;
+
+	if (new_freq < pcpu->target_freq) {
+		/* Hold a speed for min_sample_time before lowering it */
+		if (pcpu->timer_run_time - pcpu->freq_change_time <
+		    min_sample_time)
+			goto rearm;
+
+		pcpu->target_freq = new_freq;
+		spin_lock_irqsave(&down_cpumask_lock, flags);
+		cpumask_set_cpu(data, &down_cpumask);
+		spin_unlock_irqrestore(&down_cpumask_lock, flags);
+		queue_work(down_wq, &freq_scale_down_work);
+	} else {
+		cpufreq_interactive_raise(pcpu, data, new_freq);
+	}
+
+rearm_if_notmax:
+	/* At max there is nothing to decide until the next idle exit */
+	if (pcpu->target_freq == pcpu->policy->max)
+		return;
+
+rearm:
+	if (!timer_pending(&pcpu->cpu_timer)) {
+		/*
+		 * At min speed there is nothing to decide while the cpu is
+		 * idle, so let idle entry cancel the timer.
+		 */
+		if (pcpu->target_freq == pcpu->policy->min) {
+			smp_rmb();
+
+			if (pcpu->idling)
+				return;
+
+			pcpu->timer_idlecancel = 1;
+		}
+
+		cpufreq_interactive_rearm(pcpu, data);
+	}
+}
+
+static void cpufreq_interactive_idle_start(void)
+{
+	int cpu = smp_processor_id();
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	int pending;
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	pcpu->idling = 1;
+	smp_wmb();
+	pending = timer_pending(&pcpu->cpu_timer);
+
+	if (pcpu->target_freq != pcpu->policy->min) {
+#ifdef CONFIG_SMP
+		/*
+		 * An idle cpu above min can hold a cpu sharing its clock
+		 * source up, so keep sampling it until it comes down.
+		 */
+		if (!pending) {
+			pcpu->timer_idlecancel = 0;
+			cpufreq_interactive_rearm(pcpu, cpu);
+		}
+#endif
+	} else if (pending && pcpu->timer_idlecancel) {
+		/*
+		 * At min and the cpu did not go busy: drop the timer, the
+		 * next idle exit starts a new sample.
+		 */
+		del_timer(&pcpu->cpu_timer);
+		pcpu->idle_exit_time = 0;
+		pcpu->timer_idlecancel = 0;
+	}
+}
+
+static void cpufreq_interactive_idle_end(void)
+{
+	int cpu = smp_processor_id();
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+
+	pcpu->idling = 0;
+	smp_wmb();
+
+	/*
+	 * Start a sample unless one is running, or the timer has not
+	 * consumed the previous one yet (it is racing with us and will
+	 * re-arm itself when done).
+	 */
+	if (pcpu->governor_enabled && !timer_pending(&pcpu->cpu_timer) &&
+	    pcpu->timer_run_time >= pcpu->idle_exit_time) {
+		pcpu->timer_idlecancel = 0;
+		cpufreq_interactive_rearm(pcpu, cpu);
+	}
+}
+
+static int cpufreq_interactive_idle_notifier(struct notifier_block *nb,
+					     unsigned long val, void *data)
+{
+	switch (val) {
+	case IDLE_START:
+		cpufreq_interactive_idle_start();
+		break;
+	case IDLE_END:
+		cpufreq_interactive_idle_end();
+		break;
+	}
+
+	return 0;
+}
+
+static struct notifier_block cpufreq_interactive_idle_nb = {
+	.notifier_call = cpufreq_interactive_idle_notifier,
+};
+
+static unsigned int cpufreq_interactive_policy_target(
+		struct cpufreq_policy *policy)
+{
+	unsigned int j;
+	unsigned int max_freq = 0;
+
+	for_each_cpu(j, policy->cpus) {
+		struct cpufreq_interactive_cpuinfo *pjcpu =
+			&per_cpu(cpuinfo, j);
+
+		if (pjcpu->target_freq > max_freq)
+			max_freq = pjcpu->target_freq;
+	}
+
+	return max_freq;
+}
+
+static int cpufreq_interactive_up_task(void *data)
+{
+	unsigned int cpu;
+	cpumask_t tmp_mask;
+	unsigned long flags;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_irqsave(&up_cpumask_lock, flags);
+
+		if (cpumask_empty(&up_cpumask)) {
+			spin_unlock_irqrestore(&up_cpumask_lock, flags);
+			schedule();
+
+			if (kthread_should_stop())
+				break;
+
+			spin_lock_irqsave(&up_cpumask_lock, flags);
+		}
+
+		set_current_state(TASK_RUNNING);
+		tmp_mask = up_cpumask;
+		cpumask_clear(&up_cpumask);
+		spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+		for_each_cpu(cpu, &tmp_mask) {
+			unsigned int max_freq;
+
+			pcpu = &per_cpu(cpuinfo, cpu);
+			smp_rmb();
+
+			if (!pcpu->governor_enabled)
+				continue;
+
+			mutex_lock(&set_speed_lock);
+			max_freq = cpufreq_interactive_policy_target(pcpu->policy);
+			if (max_freq != pcpu->policy->cur)
+				__cpufreq_driver_target(pcpu->policy, max_freq,
+							CPUFREQ_RELATION_H);
+			mutex_unlock(&set_speed_lock);
+
+			if (pcpu->ramp_start.tv64) {
+				cpufreq_ramp_latency(pcpu->policy->cpu,
+					ktime_to_us(ktime_sub(ktime_get(),
+							pcpu->ramp_start)));
+				pcpu->ramp_start.tv64 = 0;
+			}
+
+			pcpu->freq_change_time_in_idle =
+				get_cpu_idle_time_us(cpu,
+						     &pcpu->freq_change_time);
+		}
+	}
+
+	return 0;
+}
+
+static void cpufreq_interactive_freq_down(struct work_struct *work)
+{
+	unsigned int cpu;
+	cpumask_t tmp_mask;
+	unsigned long flags;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
+	spin_lock_irqsave(&down_cpumask_lock, flags);
+	tmp_mask = down_cpumask;
+	cpumask_clear(&down_cpumask);
+	spin_unlock_irqrestore(&down_cpumask_lock, flags);
+
+	for_each_cpu(cpu, &tmp_mask) {
+		unsigned int max_freq;
+
+		pcpu = &per_cpu(cpuinfo, cpu);
+		smp_rmb();
+
+		if (!pcpu->governor_enabled)
+			continue;
+
+		mutex_lock(&set_speed_lock);
+		max_freq = cpufreq_interactive_policy_target(pcpu->policy);
+		if (max_freq != pcpu->policy->cur)
+			__cpufreq_driver_target(pcpu->policy, max_freq,
+						CPUFREQ_RELATION_H);
+		mutex_unlock(&set_speed_lock);
+
+		pcpu->freq_change_time_in_idle =
+			get_cpu_idle_time_us(cpu, &pcpu->freq_change_time);
+	}
+}
+
+/* An input event raises every cpu below hispeed_freq right away */
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+		unsigned int type, unsigned int code, int value)
+{
+	unsigned int cpu;
+
+	if (!input_boost_ms)
+		return;
+
+	input_boost_until = jiffies + msecs_to_jiffies(input_boost_ms);
+
+	for_each_online_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+
+		smp_rmb();
+		if (!pcpu->governor_enabled ||
+		    pcpu->target_freq >= hispeed_freq)
+			continue;
+
+		cpufreq_interactive_raise(pcpu, cpu, hispeed_freq);
+	}
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+		struct input_dev *dev, const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err2;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err1;
+
+	return 0;
+err1:
+	input_unregister_handle(handle);
+err2:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+/* touchscreens and keys */
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
+#define show_one(file_name)						\
+static ssize_t show_##file_name						\
+(struct kobject *kobj, struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%u\n", file_name);				\
+}
+
+show_one(hispeed_freq);
+show_one(go_hispeed_load);
+show_one(min_sample_time);
+show_one(timer_rate);
+show_one(input_boost_ms);
+show_one(rq_boost_threshold);
+
+static ssize_t store_hispeed_freq(struct kobject *a, struct attribute *b,
+				  const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	hispeed_freq = input;
+	return count;
+}
+
+static ssize_t store_go_hispeed_load(struct kobject *a, struct attribute *b,
+				     const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1 || input > 100)
+		return -EINVAL;
+
+	go_hispeed_load = input;
+	return count;
+}
+
+static ssize_t store_min_sample_time(struct kobject *a, struct attribute *b,
+				     const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	min_sample_time = input;
+	return count;
+}
+
+static ssize_t store_timer_rate(struct kobject *a, struct attribute *b,
+				const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1 || !input)
+		return -EINVAL;
+
+	timer_rate = input;
+	return count;
+}
+
+static ssize_t store_input_boost_ms(struct kobject *a, struct attribute *b,
+				    const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	input_boost_ms = input;
+	return count;
+}
+
+static ssize_t store_rq_boost_threshold(struct kobject *a, struct attribute *b,
+					const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	rq_boost_threshold = input;
+	return count;
+}
+
+define_one_global_rw(hispeed_freq);
+define_one_global_rw(go_hispeed_load);
+define_one_global_rw(min_sample_time);
+define_one_global_rw(timer_rate);
+define_one_global_rw(input_boost_ms);
+define_one_global_rw(rq_boost_threshold);
+
+static struct attribute *interactive_attributes[] = {
+	&hispeed_freq.attr,
+	&go_hispeed_load.attr,
+	&min_sample_time.attr,
+	&timer_rate.attr,
+	&input_boost_ms.attr,
+	&rq_boost_threshold.attr,
+	NULL,
+};
+
+static struct attribute_group interactive_attr_group = {
+	.attrs = interactive_attributes,
+	.name = "interactive",
+};
+
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+		unsigned int event)
+{
+	int rc;
+	unsigned int j;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	struct cpufreq_frequency_table *freq_table;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu))
+			return -EINVAL;
+
+		freq_table = cpufreq_frequency_get_table(policy->cpu);
+		if (!freq_table)
+			return -EINVAL;
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->policy = policy;
+			pcpu->target_freq = policy->cur;
+			pcpu->freq_table = freq_table;
+			pcpu->freq_change_time_in_idle =
+				get_cpu_idle_time_us(j,
+					     &pcpu->freq_change_time);
+			pcpu->ramp_start.tv64 = 0;
+			pcpu->governor_enabled = 1;
+			smp_wmb();
+		}
+
+		if (!hispeed_freq)
+			hispeed_freq = policy->max;
+
+		/* idle hook, input handler and sysfs are shared */
+		mutex_lock(&gov_mutex);
+		if (active_count++) {
+			mutex_unlock(&gov_mutex);
+			return 0;
+		}
+
+		rc = sysfs_create_group(cpufreq_global_kobject,
+					&interactive_attr_group);
+		if (rc) {
+			active_count--;
+			mutex_unlock(&gov_mutex);
+			return rc;
+		}
+
+		rc = input_register_handler(&cpufreq_interactive_input_handler);
+		if (rc)
+			pr_warning("cpufreq_interactive: no input boost, "
+				   "error %d\n", rc);
+
+		idle_notifier_register(&cpufreq_interactive_idle_nb);
+		mutex_unlock(&gov_mutex);
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->governor_enabled = 0;
+			smp_wmb();
+			del_timer_sync(&pcpu->cpu_timer);
+
+			/*
+			 * The timer may be cancelled before it consumed the
+			 * last idle exit, do not let idle exit wait for it.
+			 */
+			pcpu->idle_exit_time = 0;
+		}
+
+		flush_work(&freq_scale_down_work);
+
+		mutex_lock(&gov_mutex);
+		if (--active_count) {
+			mutex_unlock(&gov_mutex);
+			return 0;
+		}
+
+		idle_notifier_unregister(&cpufreq_interactive_idle_nb);
+		input_unregister_handler(&cpufreq_interactive_input_handler);
+		sysfs_remove_group(cpufreq_global_kobject,
+				   &interactive_attr_group);
+		mutex_unlock(&gov_mutex);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->max, CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy,
+					policy->min, CPUFREQ_RELATION_L);
+		break;
+	}
+	return 0;
+}
+
+static int __init cpufreq_interactive_init(void)
+{
+	unsigned int i;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+
+	go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
+	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	timer_rate = DEFAULT_TIMER_RATE;
+	input_boost_ms = DEFAULT_INPUT_BOOST_MS;
+	rq_boost_threshold = DEFAULT_RQ_BOOST_THRESHOLD;
+
+	/* Initialize per-cpu timers */
+	for_each_possible_cpu(i) {
+		pcpu = &per_cpu(cpuinfo, i);
+		init_timer(&pcpu->cpu_timer);
+		pcpu->cpu_timer.function = cpufreq_interactive_timer;
+		pcpu->cpu_timer.data = i;
+	}
+
+	up_task = kthread_create(cpufreq_interactive_up_task, NULL,
+				 "kinteractiveup");
+	if (IS_ERR(up_task))
+		return PTR_ERR(up_task);
+
+	sched_setscheduler_nocheck(up_task, SCHED_FIFO, &param);
+	get_task_struct(up_task);
+
+	/* per cpu, so lowering runs where it was decided */
+	down_wq = create_workqueue("kinteractive_down");
+	if (!down_wq)
+		goto err_freeuptask;
+
+	INIT_WORK(&freq_scale_down_work, cpufreq_interactive_freq_down);
+
+	spin_lock_init(&up_cpumask_lock);
+	spin_lock_init(&down_cpumask_lock);
+
+	return cpufreq_register_governor(&cpufreq_gov_interactive);
+
+err_freeuptask:
+	put_task_struct(up_task);
+	return -ENOMEM;
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+fs_initcall(cpufreq_interactive_init);
+#else
+module_init(cpufreq_interactive_init);
+#endif
+
+static void __exit cpufreq_interactive_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_interactive);
+	kthread_stop(up_task);
+	put_task_struct(up_task);
+	destroy_workqueue(down_wq);
+}
+
+module_exit(cpufreq_interactive_exit);
+
+MODULE_DESCRIPTION("'cpufreq_interactive' - A cpufreq governor for "
+	"latency sensitive workloads");
+MODULE_LICENSE("GPL");
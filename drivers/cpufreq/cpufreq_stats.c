@@ -21,6 +21,7 @@
 #include <linux/spinlock.h>
 #include <linux/notifier.h>
 #include <asm/cputime.h>
+#include <asm/div64.h>
 
 static spinlock_t cpufreq_stats_lock;
 
@@ -42,6 +43,11 @@ struct cpufreq_stats {
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	unsigned int *trans_table;
 #endif
+	/* governor request to speed change, in us */
+	unsigned int ramp_count;
+	u64 ramp_total;
+	s64 ramp_max;
+	s64 ramp_last;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_stats *, cpufreq_stats_table);
@@ -93,6 +99,51 @@ static ssize_t show_time_in_state(struct cpufreq_policy *policy, char *buf)
 	return len;
 }
 
+static ssize_t show_ramp_latency(struct cpufreq_policy *policy, char *buf)
+{
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	unsigned int count;
+	u64 total, avg;
+	s64 max, last;
+
+	if (!stat)
+		return 0;
+	spin_lock(&cpufreq_stats_lock);
+	count = stat->ramp_count;
+	total = stat->ramp_total;
+	max = stat->ramp_max;
+	last = stat->ramp_last;
+	spin_unlock(&cpufreq_stats_lock);
+
+	avg = total;
+	if (count)
+		do_div(avg, count);
+	return sprintf(buf, "count %u\ntotal_us %llu\navg_us %llu\n"
+			"max_us %lld\nlast_us %lld\n", count, total, avg,
+			max, last);
+}
+
+/*
+ * cpufreq_ramp_latency() hook, called by governors once a raise they
+ * decided has been applied, with the time it took. Also counts raises that ended at the same speed, as
+ * the latency is then the governor's own.
+ */
+static void cpufreq_stats_ramp_latency(unsigned int cpu, s64 us)
+{
+	struct cpufreq_stats *stat;
+
+	spin_lock(&cpufreq_stats_lock);
+	stat = per_cpu(cpufreq_stats_table, cpu);
+	if (stat) {
+		stat->ramp_count++;
+		stat->ramp_total += us;
+		stat->ramp_last = us;
+		if (us > stat->ramp_max)
+			stat->ramp_max = us;
+	}
+	spin_unlock(&cpufreq_stats_lock);
+}
+
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 static ssize_t show_trans_table(struct cpufreq_policy *policy, char *buf)
 {
@@ -142,10 +193,12 @@ CPUFREQ_STATDEVICE_ATTR(trans_table, 0444, show_trans_table);
 
 CPUFREQ_STATDEVICE_ATTR(total_trans, 0444, show_total_trans);
 CPUFREQ_STATDEVICE_ATTR(time_in_state, 0444, show_time_in_state);
+CPUFREQ_STATDEVICE_ATTR(ramp_latency, 0444, show_ramp_latency);
 
 static struct attribute *default_attrs[] = {
 	&_attr_total_trans.attr,
 	&_attr_time_in_state.attr,
+	&_attr_ramp_latency.attr,
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	&_attr_trans_table.attr,
 #endif
@@ -375,12 +428,14 @@ static int __init cpufreq_stats_init(void)
 	for_each_online_cpu(cpu) {
 		cpufreq_update_policy(cpu);
 	}
+	cpufreq_set_ramp_latency_hook(cpufreq_stats_ramp_latency);
 	return 0;
 }
 static void __exit cpufreq_stats_exit(void)
 {
 	unsigned int cpu;
 
+	cpufreq_set_ramp_latency_hook(NULL);
 	cpufreq_unregister_notifier(&notifier_policy_block,
 			CPUFREQ_POLICY_NOTIFIER);
 	cpufreq_unregister_notifier(&notifier_trans_block,
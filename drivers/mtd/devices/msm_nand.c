@@ -25,6 +25,10 @@
 #include <linux/io.h>
 #include <linux/crc16.h>
 #include <linux/bitrev.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/completion.h>
 
 #include <asm/dma.h>
 #include <asm/mach/flash.h>
@@ -65,6 +69,36 @@ unsigned crci_mask;
 
 #define VERBOSE 0
 
+/*
+ * Multi page requests keep up to MSM_NAND_PIPE_DEPTH pages queued on the
+ * data mover, so the next page's command list is already waiting when the
+ * controller finishes a page and the CPU checks status in the shadow of
+ * the next transfer. Writes only build the next page's command list in
+ * the shadow of the current program; it is queued once that succeeded.
+ */
+#define MSM_NAND_PIPE_DEPTH 2
+
+static int msm_nand_pipeline = 1;
+module_param_named(pipeline, msm_nand_pipeline, int, 0644);
+
+struct msm_nand_perf {
+	u64 read_bytes;
+	u64 write_bytes;
+	u64 read_us;
+	u64 write_us;
+	unsigned read_ops;
+	unsigned write_ops;
+	unsigned read_pages;
+	unsigned write_pages;
+	unsigned queued_pages;	/* submitted behind a page in flight */
+};
+
+/* Corrected bitflips seen in an eraseblock since it was last erased */
+struct msm_nand_block_flips {
+	uint16_t corrected;	/* total, saturating */
+	uint16_t max;		/* most in a single codeword */
+};
+
 struct msm_nand_chip {
 	struct device *dev;
 	wait_queue_head_t wait_queue;
@@ -75,6 +109,10 @@ struct msm_nand_chip {
 	unsigned CFG0, CFG1, CFG0_RAW, CFG1_RAW;
 	uint32_t ecc_buf_cfg;
 	uint32_t ecc_bch_cfg;
+	spinlock_t perf_lock;
+	struct msm_nand_perf perf;
+	struct msm_nand_block_flips *block_flips;
+	unsigned nr_blocks;
 };
 
 #define CFG1_WIDE_FLASH (1U << 1)
@@ -267,6 +305,103 @@ static void msm_nand_release_dma_buffer(struct msm_nand_chip *chip,
 	wake_up(&chip->wait_queue);
 }
 
+/* Get the buffers for a page pipeline. Only the first one is waited for,
+ * the second is taken if it happens to be free, so two callers can never
+ * deadlock each holding one. Returns the number of buffers obtained.
+ */
+static unsigned msm_nand_get_pipe_buffers(struct msm_nand_chip *chip,
+					  void **buffers, size_t size,
+					  unsigned page_count)
+{
+	unsigned n;
+
+	wait_event(chip->wait_queue,
+		   (buffers[0] = msm_nand_get_dma_buffer(chip, size)));
+
+	for (n = 1; n < MSM_NAND_PIPE_DEPTH; n++) {
+		if (!msm_nand_pipeline || page_count <= n)
+			break;
+		buffers[n] = msm_nand_get_dma_buffer(chip, size);
+		if (!buffers[n])
+			break;
+	}
+	return n;
+}
+
+static void msm_nand_release_pipe_buffers(struct msm_nand_chip *chip,
+					  void **buffers, size_t size,
+					  unsigned count)
+{
+	while (count--)
+		msm_nand_release_dma_buffer(chip, buffers[count], size);
+}
+
+struct msm_nand_dmov_req {
+	struct msm_dmov_cmd dmov_cmd;
+	struct completion complete;
+	unsigned int result;
+};
+
+static void msm_nand_dmov_complete_func(struct msm_dmov_cmd *cmd,
+					unsigned int result,
+					struct msm_dmov_errdata *err)
+{
+	struct msm_nand_dmov_req *req =
+		container_of(cmd, struct msm_nand_dmov_req, dmov_cmd);
+
+	req->result = result;
+	complete(&req->complete);
+}
+
+/* Queue a command list without waiting for it, see msm_nand_dmov_wait() */
+static void msm_nand_dmov_submit(struct msm_nand_chip *chip,
+				 struct msm_nand_dmov_req *req,
+				 unsigned *cmdptr)
+{
+	req->dmov_cmd.cmdptr = DMOV_CMD_PTR_LIST |
+		DMOV_CMD_ADDR(msm_virt_to_dma(chip, cmdptr));
+	req->dmov_cmd.crci_mask = crci_mask;
+	req->dmov_cmd.complete_func = msm_nand_dmov_complete_func;
+	req->result = 0;
+	init_completion(&req->complete);
+
+	dsb();
+	msm_dmov_enqueue_cmd(chip->dma_channel, &req->dmov_cmd);
+}
+
+static void msm_nand_dmov_wait(struct msm_nand_dmov_req *req)
+{
+	wait_for_completion_io(&req->complete);
+	dsb();
+
+	if (req->result != 0x80000002)
+		pr_err("msm_nand: dmov command failed, result %x\n",
+		       req->result);
+}
+
+static void msm_nand_account(struct msm_nand_chip *chip, int write,
+			     size_t bytes, unsigned pages, unsigned queued,
+			     ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	unsigned long flags;
+
+	spin_lock_irqsave(&chip->perf_lock, flags);
+	if (write) {
+		chip->perf.write_ops++;
+		chip->perf.write_pages += pages;
+		chip->perf.write_bytes += bytes;
+		chip->perf.write_us += us;
+	} else {
+		chip->perf.read_ops++;
+		chip->perf.read_pages += pages;
+		chip->perf.read_bytes += bytes;
+		chip->perf.read_us += us;
+	}
+	chip->perf.queued_pages += queued;
+	spin_unlock_irqrestore(&chip->perf_lock, flags);
+}
+
 
 unsigned flash_rd_reg(struct msm_nand_chip *chip, unsigned addr)
 {
@@ -773,6 +908,181 @@ uint32_t flash_onfi_probe(struct msm_nand_chip *chip)
 	return err;
 }
 
+struct msm_nand_page_result {
+	uint32_t flash_status;
+	uint32_t buffer_status;
+};
+
+static void msm_nand_note_bitflips(struct msm_nand_chip *chip,
+				   unsigned block, uint32_t flips)
+{
+	struct msm_nand_block_flips *bf;
+
+	if (!chip->block_flips || block >= chip->nr_blocks)
+		return;
+
+	/* not thread safe, same as the mtd ecc_stats */
+	bf = &chip->block_flips[block];
+	if (bf->corrected <= USHRT_MAX - flips)
+		bf->corrected += flips;
+	else
+		bf->corrected = USHRT_MAX;
+	if (flips > bf->max)
+		bf->max = flips;
+}
+
+static void msm_nand_clear_bitflips(struct mtd_info *mtd, loff_t ofs)
+{
+	struct msm_nand_chip *chip = mtd->priv;
+	unsigned block = mtd_div_by_eb(ofs, mtd);
+
+	if (chip->block_flips && block < chip->nr_blocks)
+		memset(&chip->block_flips[block], 0,
+		       sizeof(chip->block_flips[block]));
+}
+
+/* Tells the filesystem how worn out by reads the block at ofs looks: the
+ * most bitflips corrected in one codeword since the block was erased.
+ */
+static int msm_nand_block_bitflips(struct mtd_info *mtd, loff_t ofs)
+{
+	struct msm_nand_chip *chip = mtd->priv;
+
+	if (!chip->block_flips)
+		return -EOPNOTSUPP;
+	if (ofs < 0 || ofs >= mtd->size)
+		return -EINVAL;
+	return chip->block_flips[mtd_div_by_eb(ofs, mtd)].max;
+}
+
+/* A read page in flight and what is needed to check it once it lands */
+struct msm_nand_read_page {
+	struct msm_nand_dmov_req req;
+	struct msm_nand_page_result *result;
+	unsigned page;
+	unsigned block;			/* eraseblock, for bitflip counts */
+	unsigned index;			/* page within the request */
+	dma_addr_t data_dma_addr;	/* start of this page's data */
+	dma_addr_t oob_dma_addr;	/* start of the oob buffer */
+	uint32_t oob_done;		/* oob bytes placed up to this page */
+};
+
+/* Work out the result of a page read once its command list completed */
+static int msm_nand_read_page_status(struct mtd_info *mtd,
+				     struct mtd_oob_ops *ops,
+				     struct msm_nand_read_page *rp,
+				     unsigned start_sector,
+				     uint32_t *total_ecc_errors, int dual)
+{
+	struct msm_nand_chip *chip = mtd->priv;
+	struct msm_nand_page_result *result = rp->result;
+	unsigned cwperpage = mtd->writesize >> 9;
+	uint32_t uncorrectable, num_err_mask, ecc_errors;
+	int pageerr, rawerr;
+	unsigned n;
+
+	if (dual) {
+		uncorrectable = MSM_NAND_BUF_STAT_UNCRCTBL_ERR;
+		num_err_mask = MSM_NAND_BUF_STAT_NUM_ERR_MASK;
+	} else {
+		uncorrectable = enable_bch_ecc ? 0x10 : 0x8;
+		num_err_mask = enable_bch_ecc ? 0xF : 0x7;
+	}
+
+	/* if any of the writes failed (0x10), or there
+	 * was a protection violation (0x100), we lose
+	 */
+	pageerr = rawerr = 0;
+	for (n = start_sector; n < cwperpage; n++) {
+		if (result[n].flash_status & 0x110) {
+			rawerr = -EIO;
+			break;
+		}
+	}
+	if (rawerr) {
+		if (ops->datbuf && ops->mode != MTD_OOB_RAW) {
+			uint8_t *datbuf = ops->datbuf +
+				rp->index * mtd->writesize;
+
+			dma_sync_single_for_cpu(chip->dev, rp->data_dma_addr,
+				mtd->writesize, DMA_BIDIRECTIONAL);
+
+			for (n = 0; n < mtd->writesize; n++) {
+				/* empty blocks read 0x54 at
+				 * these offsets
+				 */
+				if ((n % 516 == 3 ||
+				     (!dual && n % 516 == 175))
+						&& datbuf[n] == 0x54)
+					datbuf[n] = 0xff;
+				if (datbuf[n] != 0xff) {
+					pageerr = rawerr;
+					break;
+				}
+			}
+
+			dma_sync_single_for_device(chip->dev,
+				rp->data_dma_addr, mtd->writesize,
+				DMA_BIDIRECTIONAL);
+
+		}
+		if (ops->oobbuf) {
+			dma_sync_single_for_cpu(chip->dev, rp->oob_dma_addr,
+				rp->oob_done, DMA_BIDIRECTIONAL);
+
+			for (n = 0; n < ops->ooblen; n++) {
+				if (ops->oobbuf[n] != 0xff) {
+					pageerr = rawerr;
+					break;
+				}
+			}
+
+			dma_sync_single_for_device(chip->dev, rp->oob_dma_addr,
+				rp->oob_done, DMA_BIDIRECTIONAL);
+		}
+	}
+	if (pageerr) {
+		for (n = start_sector; n < cwperpage; n++) {
+			if (result[n].buffer_status & uncorrectable) {
+				/* not thread safe */
+				mtd->ecc_stats.failed++;
+				pageerr = -EBADMSG;
+				break;
+			}
+		}
+	}
+	if (!rawerr) { /* check for corretable errors */
+		for (n = start_sector; n < cwperpage; n++) {
+			ecc_errors = result[n].buffer_status & num_err_mask;
+			if (ecc_errors) {
+				*total_ecc_errors += ecc_errors;
+				/* not thread safe */
+				mtd->ecc_stats.corrected += ecc_errors;
+				msm_nand_note_bitflips(chip, rp->block,
+						       ecc_errors);
+				if (ecc_errors > 1)
+					pageerr = -EUCLEAN;
+			}
+		}
+	}
+
+#if VERBOSE
+	if (rawerr && !pageerr) {
+		pr_err("%s %llx %x %x empty page\n", __func__,
+		       (loff_t)rp->page * mtd->writesize, ops->len,
+		       ops->ooblen);
+	} else {
+		for (n = start_sector; n < cwperpage; n++)
+			pr_info("%s: flash_status[%d] = %x, "
+				"buffr_status[%d] = %x\n",
+				(dual && (n % 2)) ? "NC10" : "NC01",
+				n, result[n].flash_status,
+				n, result[n].buffer_status);
+	}
+#endif
+	return pageerr;
+}
+
 static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 			     struct mtd_oob_ops *ops)
 {
@@ -791,19 +1101,20 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 			uint32_t eccbchcfg;
 			uint32_t exec;
 			uint32_t ecccfg;
-			struct {
-				uint32_t flash_status;
-				uint32_t buffer_status;
-			} result[8];
+			struct msm_nand_page_result result[8];
 		} data;
-	} *dma_buffer;
+	} *dma_buffer, *dma_buffers[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_read_page pending[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_read_page *rp;
+	unsigned nbuffers, slot = 0, inflight = 0, queued = 0;
+	ktime_t start = ktime_get();
 	dmov_s *cmd;
 	unsigned n;
 	unsigned page = 0;
 	uint32_t oob_len;
 	uint32_t sectordatasize;
 	uint32_t sectoroobsize;
-	int err, pageerr, rawerr;
+	int err, pageerr;
 	dma_addr_t data_dma_addr = 0;
 	dma_addr_t oob_dma_addr = 0;
 	dma_addr_t data_dma_addr_curr = 0;
@@ -812,7 +1123,6 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 	unsigned page_count;
 	unsigned pages_read = 0;
 	unsigned start_sector = 0;
-	uint32_t ecc_errors;
 	uint32_t total_ecc_errors = 0;
 	unsigned cwperpage;
 #if VERBOSE
@@ -896,9 +1206,8 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 		}
 	}
 
-	wait_event(chip->wait_queue,
-		   (dma_buffer = msm_nand_get_dma_buffer(
-			    chip, sizeof(*dma_buffer))));
+	nbuffers = msm_nand_get_pipe_buffers(chip, (void **)dma_buffers,
+					    sizeof(*dma_buffer), page_count);
 
 	oob_col = start_sector * (enable_bch_ecc ? 0x214 : 0x210);
 	if (chip->CFG1 & CFG1_WIDE_FLASH)
@@ -906,6 +1215,7 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 
 	err = 0;
 	while (page_count-- > 0) {
+		dma_buffer = dma_buffers[slot];
 		cmd = dma_buffer->cmd;
 
 		/* CMD / ADDR0 / ADDR1 / CHIPSEL program values */
@@ -1047,114 +1357,54 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 			(msm_virt_to_dma(chip, dma_buffer->cmd) >> 3)
 			| CMD_PTR_LP;
 
-		dsb();
-		msm_dmov_exec_cmd(chip->dma_channel, crci_mask,
-			DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(msm_virt_to_dma(chip,
-			&dma_buffer->cmdptr)));
-		dsb();
+		rp = &pending[slot];
+		rp->result = dma_buffer->data.result;
+		rp->page = page;
+		rp->index = pages_read + inflight;
+		rp->data_dma_addr = data_dma_addr_curr - mtd->writesize;
+		rp->oob_dma_addr = oob_dma_addr;
+		rp->oob_done = ops->ooblen - oob_len;
+		rp->block = mtd_div_by_eb(from +
+				(loff_t)rp->index * mtd->writesize, mtd);
+		if (inflight)
+			queued++;
+		msm_nand_dmov_submit(chip, &rp->req, &dma_buffer->cmdptr);
+		inflight++;
+		slot = (slot + 1) % nbuffers;
+		page++;
 
-		/* if any of the writes failed (0x10), or there
-		 * was a protection violation (0x100), we lose
-		 */
-		pageerr = rawerr = 0;
-		for (n = start_sector; n < cwperpage; n++) {
-			if (dma_buffer->data.result[n].flash_status & 0x110) {
-				rawerr = -EIO;
-				break;
-			}
-		}
-		if (rawerr) {
-			if (ops->datbuf && ops->mode != MTD_OOB_RAW) {
-				uint8_t *datbuf = ops->datbuf +
-					pages_read * mtd->writesize;
-
-				dma_sync_single_for_cpu(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
-
-				for (n = 0; n < mtd->writesize; n++) {
-					/* empty blocks read 0x54 at
-					 * these offsets
-					 */
-					if ((n % 516 == 3 || n % 516 == 175)
-							&& datbuf[n] == 0x54)
-						datbuf[n] = 0xff;
-					if (datbuf[n] != 0xff) {
-						pageerr = rawerr;
-						break;
-					}
-				}
+		/* Leave a page queued while the oldest one is checked */
+		if (inflight < nbuffers && page_count > 0)
+			continue;
 
-				dma_sync_single_for_device(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
+		/* and drain the pipeline after the last one */
+		do {
+			rp = &pending[(slot + nbuffers - inflight) % nbuffers];
+			msm_nand_dmov_wait(&rp->req);
+			inflight--;
 
-			}
-			if (ops->oobbuf) {
-				dma_sync_single_for_cpu(chip->dev,
-				oob_dma_addr_curr - (ops->ooblen - oob_len),
-				ops->ooblen - oob_len, DMA_BIDIRECTIONAL);
-
-				for (n = 0; n < ops->ooblen; n++) {
-					if (ops->oobbuf[n] != 0xff) {
-						pageerr = rawerr;
-						break;
-					}
-				}
+			pageerr = msm_nand_read_page_status(mtd, ops, rp,
+					start_sector, &total_ecc_errors, 0);
+			if (pageerr && (pageerr != -EUCLEAN || err == 0))
+				err = pageerr;
 
-				dma_sync_single_for_device(chip->dev,
-				oob_dma_addr_curr - (ops->ooblen - oob_len),
-				ops->ooblen - oob_len, DMA_BIDIRECTIONAL);
-			}
-		}
-		if (pageerr) {
-			for (n = start_sector; n < cwperpage; n++) {
-				if (enable_bch_ecc ?
-			(dma_buffer->data.result[n].buffer_status & 0x10) :
-			(dma_buffer->data.result[n].buffer_status & 0x8)) {
-					/* not thread safe */
-					mtd->ecc_stats.failed++;
-					pageerr = -EBADMSG;
-					break;
-				}
-			}
-		}
-		if (!rawerr) { /* check for corretable errors */
-			for (n = start_sector; n < cwperpage; n++) {
-				ecc_errors = enable_bch_ecc ?
-			(dma_buffer->data.result[n].buffer_status & 0xF) :
-			(dma_buffer->data.result[n].buffer_status & 0x7);
-				if (ecc_errors) {
-					total_ecc_errors += ecc_errors;
-					/* not thread safe */
-					mtd->ecc_stats.corrected += ecc_errors;
-					if (ecc_errors > 1)
-						pageerr = -EUCLEAN;
-				}
-			}
-		}
-		if (pageerr && (pageerr != -EUCLEAN || err == 0))
-			err = pageerr;
+			if (err && err != -EUCLEAN && err != -EBADMSG)
+				break;
+			pages_read++;
+		} while (page_count == 0 && inflight);
 
-#if VERBOSE
-		if (rawerr && !pageerr) {
-			pr_err("msm_nand_read_oob %llx %x %x empty page\n",
-			       (loff_t)page * mtd->writesize, ops->len,
-			       ops->ooblen);
-		} else {
-			for (n = start_sector; n < cwperpage; n++)
-				pr_info("flash_status[%d] = %x,\
-				buffr_status[%d] = %x\n",
-				n, dma_buffer->data.result[n].flash_status,
-				n, dma_buffer->data.result[n].buffer_status);
-		}
-#endif
 		if (err && err != -EUCLEAN && err != -EBADMSG)
 			break;
-		pages_read++;
-		page++;
 	}
-	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
+
+	/* a failed page may still have the next one in flight */
+	while (inflight) {
+		rp = &pending[(slot + nbuffers - inflight) % nbuffers];
+		msm_nand_dmov_wait(&rp->req);
+		inflight--;
+	}
+	msm_nand_release_pipe_buffers(chip, (void **)dma_buffers,
+				      sizeof(*dma_buffer), nbuffers);
 
 	if (ops->oobbuf) {
 		dma_unmap_page(chip->dev, oob_dma_addr,
@@ -1172,6 +1422,8 @@ err_dma_map_oobbuf_failed:
 		ops->retlen = (mtd->writesize +  mtd->oobsize) *
 							pages_read;
 	ops->oobretlen = ops->ooblen - oob_len;
+	msm_nand_account(chip, 0, ops->retlen + ops->oobretlen, pages_read,
+			 queued, start);
 	if (err)
 		pr_err("msm_nand_read_oob %llx %x %x failed %d, corrected %d\n",
 		       from, ops->datbuf ? ops->len : 0, ops->ooblen, err,
@@ -1216,19 +1468,20 @@ static int msm_nand_read_oob_dualnandc(struct mtd_info *mtd, loff_t from,
 			uint32_t nc10_flash_dev_cmd1;
 			uint32_t nc10_flash_dev_cmd_vld_default;
 			uint32_t nc10_flash_dev_cmd1_default;
-			struct {
-				uint32_t flash_status;
-				uint32_t buffer_status;
-			} result[16];
+			struct msm_nand_page_result result[16];
 		} data;
-	} *dma_buffer;
+	} *dma_buffer, *dma_buffers[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_read_page pending[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_read_page *rp;
+	unsigned nbuffers, slot = 0, inflight = 0, queued = 0;
+	ktime_t start = ktime_get();
 	dmov_s *cmd;
 	unsigned n;
 	unsigned page = 0;
 	uint32_t oob_len;
 	uint32_t sectordatasize;
 	uint32_t sectoroobsize;
-	int err, pageerr, rawerr;
+	int err, pageerr;
 	dma_addr_t data_dma_addr = 0;
 	dma_addr_t oob_dma_addr = 0;
 	dma_addr_t data_dma_addr_curr = 0;
@@ -1237,7 +1490,6 @@ static int msm_nand_read_oob_dualnandc(struct mtd_info *mtd, loff_t from,
 	unsigned page_count;
 	unsigned pages_read = 0;
 	unsigned start_sector = 0;
-	uint32_t ecc_errors;
 	uint32_t total_ecc_errors = 0;
 	unsigned cwperpage;
 #if VERBOSE
@@ -1325,9 +1577,8 @@ static int msm_nand_read_oob_dualnandc(struct mtd_info *mtd, loff_t from,
 		}
 	}
 
-	wait_event(chip->wait_queue,
-		   (dma_buffer = msm_nand_get_dma_buffer(
-			    chip, sizeof(*dma_buffer))));
+	nbuffers = msm_nand_get_pipe_buffers(chip, (void **)dma_buffers,
+					    sizeof(*dma_buffer), page_count);
 
 	oob_col = start_sector * 0x210;
 	if (chip->CFG1 & CFG1_WIDE_FLASH)
@@ -1335,6 +1586,7 @@ static int msm_nand_read_oob_dualnandc(struct mtd_info *mtd, loff_t from,
 
 	err = 0;
 	while (page_count-- > 0) {
+		dma_buffer = dma_buffers[slot];
 		cmd = dma_buffer->cmd;
 
 		if (ops->mode != MTD_OOB_RAW) {
@@ -1819,126 +2071,54 @@ static int msm_nand_read_oob_dualnandc(struct mtd_info *mtd, loff_t from,
 			(msm_virt_to_dma(chip, dma_buffer->cmd) >> 3)
 			| CMD_PTR_LP;
 
-		dsb();
-		msm_dmov_exec_cmd(chip->dma_channel, crci_mask,
-			DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(msm_virt_to_dma(chip,
-			&dma_buffer->cmdptr)));
-		dsb();
+		rp = &pending[slot];
+		rp->result = dma_buffer->data.result;
+		rp->page = page;
+		rp->index = pages_read + inflight;
+		rp->data_dma_addr = data_dma_addr_curr - mtd->writesize;
+		rp->oob_dma_addr = oob_dma_addr;
+		rp->oob_done = ops->ooblen - oob_len;
+		rp->block = mtd_div_by_eb(from +
+				(loff_t)rp->index * mtd->writesize, mtd);
+		if (inflight)
+			queued++;
+		msm_nand_dmov_submit(chip, &rp->req, &dma_buffer->cmdptr);
+		inflight++;
+		slot = (slot + 1) % nbuffers;
+		page++;
 
-		/* if any of the writes failed (0x10), or there
-		 * was a protection violation (0x100), we lose
-		 */
-		pageerr = rawerr = 0;
-		for (n = start_sector; n < cwperpage; n++) {
-			if (dma_buffer->data.result[n].flash_status & 0x110) {
-				rawerr = -EIO;
-				break;
-			}
-		}
-		if (rawerr) {
-			if (ops->datbuf && ops->mode != MTD_OOB_RAW) {
-				uint8_t *datbuf = ops->datbuf +
-					pages_read * mtd->writesize;
-
-				dma_sync_single_for_cpu(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
-
-				for (n = 0; n < mtd->writesize; n++) {
-					/* empty blocks read 0x54 at
-					 * these offsets
-					 */
-					if (n % 516 == 3 && datbuf[n] == 0x54)
-						datbuf[n] = 0xff;
-					if (datbuf[n] != 0xff) {
-						pageerr = rawerr;
-						break;
-					}
-				}
+		/* Leave a page queued while the oldest one is checked */
+		if (inflight < nbuffers && page_count > 0)
+			continue;
 
-				dma_sync_single_for_device(chip->dev,
-					data_dma_addr_curr-mtd->writesize,
-					mtd->writesize, DMA_BIDIRECTIONAL);
+		/* and drain the pipeline after the last one */
+		do {
+			rp = &pending[(slot + nbuffers - inflight) % nbuffers];
+			msm_nand_dmov_wait(&rp->req);
+			inflight--;
 
-			}
-			if (ops->oobbuf) {
-				dma_sync_single_for_cpu(chip->dev,
-				oob_dma_addr_curr - (ops->ooblen - oob_len),
-				ops->ooblen - oob_len, DMA_BIDIRECTIONAL);
-
-				for (n = 0; n < ops->ooblen; n++) {
-					if (ops->oobbuf[n] != 0xff) {
-						pageerr = rawerr;
-						break;
-					}
-				}
+			pageerr = msm_nand_read_page_status(mtd, ops, rp,
+					start_sector, &total_ecc_errors, 1);
+			if (pageerr && (pageerr != -EUCLEAN || err == 0))
+				err = pageerr;
 
-				dma_sync_single_for_device(chip->dev,
-				oob_dma_addr_curr - (ops->ooblen - oob_len),
-				ops->ooblen - oob_len, DMA_BIDIRECTIONAL);
-			}
-		}
-		if (pageerr) {
-			for (n = start_sector; n < cwperpage; n++) {
-				if (dma_buffer->data.result[n].buffer_status
-					& MSM_NAND_BUF_STAT_UNCRCTBL_ERR) {
-					/* not thread safe */
-					mtd->ecc_stats.failed++;
-					pageerr = -EBADMSG;
-					break;
-				}
-			}
-		}
-		if (!rawerr) { /* check for corretable errors */
-			for (n = start_sector; n < cwperpage; n++) {
-				ecc_errors = dma_buffer->data.
-					result[n].buffer_status
-					& MSM_NAND_BUF_STAT_NUM_ERR_MASK;
-				if (ecc_errors) {
-					total_ecc_errors += ecc_errors;
-					/* not thread safe */
-					mtd->ecc_stats.corrected += ecc_errors;
-					if (ecc_errors > 1)
-						pageerr = -EUCLEAN;
-				}
-			}
-		}
-		if (pageerr && (pageerr != -EUCLEAN || err == 0))
-			err = pageerr;
+			if (err && err != -EUCLEAN && err != -EBADMSG)
+				break;
+			pages_read++;
+		} while (page_count == 0 && inflight);
 
-#if VERBOSE
-		if (rawerr && !pageerr) {
-			pr_err("msm_nand_read_oob_dualnandc "
-				"%llx %x %x empty page\n",
-			       (loff_t)page * mtd->writesize, ops->len,
-			       ops->ooblen);
-		} else {
-			for (n = start_sector; n < cwperpage; n++) {
-				if (n%2) {
-					pr_info("NC10: flash_status[%d] = %x, "
-					 "buffr_status[%d] = %x\n",
-					n, dma_buffer->
-						data.result[n].flash_status,
-					n, dma_buffer->
-						data.result[n].buffer_status);
-				} else {
-					pr_info("NC01: flash_status[%d] = %x, "
-					 "buffr_status[%d] = %x\n",
-					n, dma_buffer->
-						data.result[n].flash_status,
-					n, dma_buffer->
-						data.result[n].buffer_status);
-				}
-			}
-		}
-#endif
 		if (err && err != -EUCLEAN && err != -EBADMSG)
 			break;
-		pages_read++;
-		page++;
 	}
 
-	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
+	/* a failed page may still have the next one in flight */
+	while (inflight) {
+		rp = &pending[(slot + nbuffers - inflight) % nbuffers];
+		msm_nand_dmov_wait(&rp->req);
+		inflight--;
+	}
+	msm_nand_release_pipe_buffers(chip, (void **)dma_buffers,
+				      sizeof(*dma_buffer), nbuffers);
 
 	if (ops->oobbuf) {
 		dma_unmap_page(chip->dev, oob_dma_addr,
@@ -1956,6 +2136,8 @@ err_dma_map_oobbuf_failed:
 		ops->retlen = (mtd->writesize +  mtd->oobsize) *
 							pages_read;
 	ops->oobretlen = ops->ooblen - oob_len;
+	msm_nand_account(chip, 0, ops->retlen + ops->oobretlen, pages_read,
+			 queued, start);
 	if (err)
 		pr_err("msm_nand_read_oob_dualnandc "
 			"%llx %x %x failed %d, corrected %d\n",
@@ -1994,6 +2176,55 @@ msm_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
 	return ret;
 }
 
+/* A page program in flight */
+struct msm_nand_write_page {
+	struct msm_nand_dmov_req req;
+	uint32_t *flash_status;
+	unsigned page;
+};
+
+static int msm_nand_write_page_status(struct mtd_info *mtd,
+				      struct msm_nand_write_page *wp, int dual)
+{
+	unsigned cwperpage = mtd->writesize >> 9;
+	unsigned n;
+	int err = 0;
+
+	/* if any of the writes failed (0x10), or there was a
+	 * protection violation (0x100), or the program success
+	 * bit (0x80) is unset, we lose
+	 */
+	for (n = 0; n < cwperpage; n++) {
+		if (wp->flash_status[n] & 0x110) {
+			err = -EIO;
+			break;
+		}
+		if (!(wp->flash_status[n] & 0x80)) {
+			err = -EIO;
+			break;
+		}
+	}
+	/* check for flash status busy for the last codeword */
+	if (dual && !interleave_enable &&
+	    !(wp->flash_status[cwperpage - 1] & 0x20))
+		err = -EIO;
+
+#if VERBOSE
+	for (n = 0; n < cwperpage; n++)
+		pr_info("%s: write pg %d: flash_status[%d] = %x\n",
+			(dual && (n % 2)) ? "NC10" : "NC01",
+			wp->page, n, wp->flash_status[n]);
+#endif
+	return err;
+}
+
+static int msm_nand_write_page_wait(struct mtd_info *mtd,
+				    struct msm_nand_write_page *wp, int dual)
+{
+	msm_nand_dmov_wait(&wp->req);
+	return msm_nand_write_page_status(mtd, wp, dual);
+}
+
 static int
 msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 {
@@ -2015,7 +2246,11 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 			uint32_t clrrstatus;
 			uint32_t flash_status[8];
 		} data;
-	} *dma_buffer;
+	} *dma_buffer, *dma_buffers[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_write_page pending[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_write_page *wp;
+	unsigned nbuffers, slot = 0, inflight = 0;
+	ktime_t start = ktime_get();
 	dmov_s *cmd;
 	unsigned n;
 	unsigned page = 0;
@@ -2108,10 +2343,22 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 	else
 		page_count = ops->len / (mtd->writesize + mtd->oobsize);
 
-	wait_event(chip->wait_queue, (dma_buffer =
-			msm_nand_get_dma_buffer(chip, sizeof(*dma_buffer))));
+	nbuffers = msm_nand_get_pipe_buffers(chip, (void **)dma_buffers,
+					    sizeof(*dma_buffer), page_count);
+
+	err = 0;
 
 	while (page_count-- > 0) {
+		/* without a second buffer the page in flight still owns it */
+		if (inflight == nbuffers) {
+			err = msm_nand_write_page_wait(mtd, &pending[slot], 0);
+			inflight--;
+			if (err)
+				break;
+			pages_written++;
+		}
+
+		dma_buffer = dma_buffers[slot];
 		cmd = dma_buffer->cmd;
 
 		if (ops->mode != MTD_OOB_RAW) {
@@ -2260,39 +2507,34 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 			(msm_virt_to_dma(chip, dma_buffer->cmd) >> 3) |
 			CMD_PTR_LP;
 
-		dsb();
-		msm_dmov_exec_cmd(chip->dma_channel, crci_mask,
-			DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(
-				msm_virt_to_dma(chip, &dma_buffer->cmdptr)));
-		dsb();
-
-		/* if any of the writes failed (0x10), or there was a
-		 * protection violation (0x100), or the program success
-		 * bit (0x80) is unset, we lose
+		/* Flash must not be programmed past a failed page, so
+		 * this page only goes to the data mover once the one in
+		 * flight has programmed fine.
 		 */
-		err = 0;
-		for (n = 0; n < cwperpage; n++) {
-			if (dma_buffer->data.flash_status[n] & 0x110) {
-				err = -EIO;
-				break;
-			}
-			if (!(dma_buffer->data.flash_status[n] & 0x80)) {
-				err = -EIO;
+		if (inflight) {
+			wp = &pending[(slot + nbuffers - 1) % nbuffers];
+			err = msm_nand_write_page_wait(mtd, wp, 0);
+			inflight--;
+			if (err)
 				break;
-			}
+			pages_written++;
 		}
 
-#if VERBOSE
-		for (n = 0; n < cwperpage; n++)
-			pr_info("write pg %d: flash_status[%d] = %x\n", page,
-				n, dma_buffer->data.flash_status[n]);
-
-#endif
-		if (err)
-			break;
-		pages_written++;
+		wp = &pending[slot];
+		wp->flash_status = dma_buffer->data.flash_status;
+		wp->page = page;
+		msm_nand_dmov_submit(chip, &wp->req, &dma_buffer->cmdptr);
+		inflight++;
+		slot = (slot + 1) % nbuffers;
 		page++;
 	}
+
+	if (inflight) {
+		wp = &pending[(slot + nbuffers - 1) % nbuffers];
+		err = msm_nand_write_page_wait(mtd, wp, 0);
+		if (!err)
+			pages_written++;
+	}
 	if (ops->mode != MTD_OOB_RAW)
 		ops->retlen = mtd->writesize * pages_written;
 	else
@@ -2300,7 +2542,10 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 
 	ops->oobretlen = ops->ooblen - oob_len;
 
-	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
+	msm_nand_release_pipe_buffers(chip, (void **)dma_buffers,
+				      sizeof(*dma_buffer), nbuffers);
+	msm_nand_account(chip, 1, ops->retlen + ops->oobretlen, pages_written,
+			 0, start);
 
 	if (ops->oobbuf)
 		dma_unmap_page(chip->dev, oob_dma_addr,
@@ -2358,7 +2603,11 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 			uint32_t clrfstatus;
 			uint32_t clrrstatus;
 		} data;
-	} *dma_buffer;
+	} *dma_buffer, *dma_buffers[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_write_page pending[MSM_NAND_PIPE_DEPTH];
+	struct msm_nand_write_page *wp;
+	unsigned nbuffers, slot = 0, inflight = 0;
+	ktime_t start = ktime_get();
 	dmov_s *cmd;
 	unsigned n;
 	unsigned page = 0;
@@ -2457,26 +2706,39 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 	else
 		page_count = ops->len / (mtd->writesize + mtd->oobsize);
 
-	wait_event(chip->wait_queue, (dma_buffer =
-			msm_nand_get_dma_buffer(chip, sizeof(*dma_buffer))));
+	nbuffers = msm_nand_get_pipe_buffers(chip, (void **)dma_buffers,
+					    sizeof(*dma_buffer), page_count);
 
-	dma_buffer->data.ebi2_chip_select_cfg0 = 0x00000805;
-	dma_buffer->data.adm_mux_data_ack_req_nc01 = 0x00000A3C;
-	dma_buffer->data.adm_mux_cmd_ack_req_nc01  = 0x0000053C;
-	dma_buffer->data.adm_mux_data_ack_req_nc10 = 0x00000F28;
-	dma_buffer->data.adm_mux_cmd_ack_req_nc10  = 0x00000F14;
-	dma_buffer->data.adm_default_mux = 0x00000FC0;
-	dma_buffer->data.default_ebi2_chip_select_cfg0 = 0x00000801;
-	dma_buffer->data.nc01_flash_dev_cmd_vld = 0x9;
-	dma_buffer->data.nc10_flash_dev_cmd0 = 0x1085D060;
-	dma_buffer->data.nc01_flash_dev_cmd_vld_default = 0x1D;
-	dma_buffer->data.nc10_flash_dev_cmd0_default = 0x1080D060;
-	dma_buffer->data.clrfstatus = 0x00000020;
-	dma_buffer->data.clrrstatus = 0x000000C0;
+	err = 0;
 
 	while (page_count-- > 0) {
+		/* without a second buffer the page in flight still owns it */
+		if (inflight == nbuffers) {
+			err = msm_nand_write_page_wait(mtd, &pending[slot], 1);
+			inflight--;
+			if (err)
+				break;
+			pages_written++;
+		}
+
+		dma_buffer = dma_buffers[slot];
 		cmd = dma_buffer->cmd;
 
+		/* every slot is a separate buffer, none of it is set up yet */
+		dma_buffer->data.ebi2_chip_select_cfg0 = 0x00000805;
+		dma_buffer->data.adm_mux_data_ack_req_nc01 = 0x00000A3C;
+		dma_buffer->data.adm_mux_cmd_ack_req_nc01  = 0x0000053C;
+		dma_buffer->data.adm_mux_data_ack_req_nc10 = 0x00000F28;
+		dma_buffer->data.adm_mux_cmd_ack_req_nc10  = 0x00000F14;
+		dma_buffer->data.adm_default_mux = 0x00000FC0;
+		dma_buffer->data.default_ebi2_chip_select_cfg0 = 0x00000801;
+		dma_buffer->data.nc01_flash_dev_cmd_vld = 0x9;
+		dma_buffer->data.nc10_flash_dev_cmd0 = 0x1085D060;
+		dma_buffer->data.nc01_flash_dev_cmd_vld_default = 0x1D;
+		dma_buffer->data.nc10_flash_dev_cmd0_default = 0x1080D060;
+		dma_buffer->data.clrfstatus = 0x00000020;
+		dma_buffer->data.clrrstatus = 0x000000C0;
+
 		if (ops->mode != MTD_OOB_RAW) {
 			dma_buffer->data.cfg0 = ((chip->CFG0 & ~(7U << 6))
 				& ~(1 << 4)) | ((((cwperpage >> 1)-1)) << 6);
@@ -2855,50 +3117,34 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 		dma_buffer->cmdptr =
 		((msm_virt_to_dma(chip, dma_buffer->cmd) >> 3) | CMD_PTR_LP);
 
-		dsb();
-		msm_dmov_exec_cmd(chip->dma_channel, crci_mask,
-			DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(
-				msm_virt_to_dma(chip, &dma_buffer->cmdptr)));
-		dsb();
-
-		/* if any of the writes failed (0x10), or there was a
-		 * protection violation (0x100), or the program success
-		 * bit (0x80) is unset, we lose
+		/* Flash must not be programmed past a failed page, so
+		 * this page only goes to the data mover once the one in
+		 * flight has programmed fine.
 		 */
-		err = 0;
-		for (n = 0; n < cwperpage; n++) {
-			if (dma_buffer->data.flash_status[n] & 0x110) {
-				err = -EIO;
+		if (inflight) {
+			wp = &pending[(slot + nbuffers - 1) % nbuffers];
+			err = msm_nand_write_page_wait(mtd, wp, 1);
+			inflight--;
+			if (err)
 				break;
-			}
-			if (!(dma_buffer->data.flash_status[n] & 0x80)) {
-				err = -EIO;
-				break;
-			}
+			pages_written++;
 		}
-		/* check for flash status busy for the last codeword */
-		if (!interleave_enable)
-			if (!(dma_buffer->data.flash_status[cwperpage - 1]
-								& 0x20)) {
-				err = -EIO;
-				break;
-			}
-#if VERBOSE
-	for (n = 0; n < cwperpage; n++) {
-		if (n%2) {
-			pr_info("NC10: write pg %d: flash_status[%d] = %x\n",
-				page, n, dma_buffer->data.flash_status[n]);
-		} else {
-			pr_info("NC01: write pg %d: flash_status[%d] = %x\n",
-				page, n, dma_buffer->data.flash_status[n]);
-		}
-	}
-#endif
-		if (err)
-			break;
-		pages_written++;
+
+		wp = &pending[slot];
+		wp->flash_status = dma_buffer->data.flash_status;
+		wp->page = page;
+		msm_nand_dmov_submit(chip, &wp->req, &dma_buffer->cmdptr);
+		inflight++;
+		slot = (slot + 1) % nbuffers;
 		page++;
 	}
+
+	if (inflight) {
+		wp = &pending[(slot + nbuffers - 1) % nbuffers];
+		err = msm_nand_write_page_wait(mtd, wp, 1);
+		if (!err)
+			pages_written++;
+	}
 	if (ops->mode != MTD_OOB_RAW)
 		ops->retlen = mtd->writesize * pages_written;
 	else
@@ -2906,7 +3152,10 @@ msm_nand_write_oob_dualnandc(struct mtd_info *mtd, loff_t to,
 
 	ops->oobretlen = ops->ooblen - oob_len;
 
-	msm_nand_release_dma_buffer(chip, dma_buffer, sizeof(*dma_buffer));
+	msm_nand_release_pipe_buffers(chip, (void **)dma_buffers,
+				      sizeof(*dma_buffer), nbuffers);
+	msm_nand_account(chip, 1, ops->retlen + ops->oobretlen, pages_written,
+			 0, start);
 
 	if (ops->oobbuf)
 		dma_unmap_page(chip->dev, oob_dma_addr,
@@ -3070,6 +3319,7 @@ msm_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 		instr->fail_addr = instr->addr;
 		instr->state = MTD_ERASE_FAILED;
 	} else {
+		msm_nand_clear_bitflips(mtd, instr->addr);
 		instr->state = MTD_ERASE_DONE;
 		instr->fail_addr = 0xffffffff;
 		mtd_erase_callback(instr);
@@ -3311,6 +3561,7 @@ msm_nand_erase_dualnandc(struct mtd_info *mtd, struct erase_info *instr)
 		instr->fail_addr = instr->addr;
 		instr->state = MTD_ERASE_FAILED;
 	} else {
+		msm_nand_clear_bitflips(mtd, instr->addr);
 		instr->state = MTD_ERASE_DONE;
 		instr->fail_addr = 0xffffffff;
 		mtd_erase_callback(instr);
@@ -6804,6 +7055,7 @@ int msm_nand_scan(struct mtd_info *mtd, int maxchips)
 	mtd->erase = msm_nand_erase;
 	mtd->block_isbad = msm_nand_block_isbad;
 	mtd->block_markbad = msm_nand_block_markbad;
+	mtd->block_bitflips = msm_nand_block_bitflips;
 	mtd->point = NULL;
 	mtd->unpoint = NULL;
 	mtd->read = msm_nand_read;
@@ -6859,8 +7111,164 @@ struct msm_nand_info {
 	struct mtd_info		mtd;
 	struct mtd_partition	*parts;
 	struct msm_nand_chip	msm_nand;
+	struct dentry		*dent;
+};
+
+#if defined(CONFIG_DEBUG_FS)
+static unsigned msm_nand_kbps(u64 bytes, u64 us)
+{
+	/* bytes per us is MB/s, keep it in KB/s */
+	if (!us)
+		return 0;
+	bytes *= 1000;
+	do_div(bytes, us);
+	do_div(bytes, 1024);
+	return (unsigned)bytes;
+}
+
+static int msm_nand_perf_show(struct seq_file *m, void *unused)
+{
+	struct msm_nand_chip *chip = m->private;
+	struct msm_nand_perf perf;
+	unsigned long flags;
+
+	spin_lock_irqsave(&chip->perf_lock, flags);
+	perf = chip->perf;
+	spin_unlock_irqrestore(&chip->perf_lock, flags);
+
+	seq_printf(m, "pipeline depth: %d\n",
+		   msm_nand_pipeline ? MSM_NAND_PIPE_DEPTH : 1);
+	seq_printf(m, "queued pages:   %u\n", perf.queued_pages);
+	seq_printf(m, "       %10s %10s %14s %12s %10s\n",
+		   "ops", "pages", "bytes", "time(us)", "KB/s");
+	seq_printf(m, "read:  %10u %10u %14llu %12llu %10u\n",
+		   perf.read_ops, perf.read_pages, perf.read_bytes,
+		   perf.read_us, msm_nand_kbps(perf.read_bytes, perf.read_us));
+	seq_printf(m, "write: %10u %10u %14llu %12llu %10u\n",
+		   perf.write_ops, perf.write_pages, perf.write_bytes,
+		   perf.write_us,
+		   msm_nand_kbps(perf.write_bytes, perf.write_us));
+	return 0;
+}
+
+static int msm_nand_perf_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_nand_perf_show, inode->i_private);
+}
+
+/* Any write clears the counters */
+static ssize_t msm_nand_perf_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct msm_nand_chip *chip =
+		((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&chip->perf_lock, flags);
+	memset(&chip->perf, 0, sizeof(chip->perf));
+	spin_unlock_irqrestore(&chip->perf_lock, flags);
+	return count;
+}
+
+static const struct file_operations msm_nand_perf_fops = {
+	.open		= msm_nand_perf_open,
+	.read		= seq_read,
+	.write		= msm_nand_perf_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
 };
 
+static void msm_nand_debugfs_init(struct msm_nand_info *info)
+{
+	info->dent = debugfs_create_dir(info->mtd.name, NULL);
+	if (IS_ERR_OR_NULL(info->dent)) {
+		info->dent = NULL;
+		return;
+	}
+	debugfs_create_file("perf", 0644, info->dent, &info->msm_nand,
+			    &msm_nand_perf_fops);
+}
+
+static void msm_nand_debugfs_exit(struct msm_nand_info *info)
+{
+	debugfs_remove_recursive(info->dent);
+}
+#else
+static void msm_nand_debugfs_init(struct msm_nand_info *info) { }
+static void msm_nand_debugfs_exit(struct msm_nand_info *info) { }
+#endif
+
+static ssize_t msm_nand_show_corrected_bitflips(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct msm_nand_info *info = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", info->mtd.ecc_stats.corrected);
+}
+
+/* Blocks with corrected bitflips since their last erase, one per line */
+static ssize_t msm_nand_show_block_bitflips(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct msm_nand_info *info = dev_get_drvdata(dev);
+	struct msm_nand_chip *chip = &info->msm_nand;
+	struct msm_nand_block_flips bf;
+	ssize_t len;
+	unsigned n;
+
+	len = scnprintf(buf, PAGE_SIZE, "block corrected max\n");
+	for (n = 0; n < chip->nr_blocks; n++) {
+		bf = chip->block_flips[n];
+		if (!bf.corrected)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %u %u\n",
+				 n, bf.corrected, bf.max);
+		if (len >= PAGE_SIZE - 1)
+			break;
+	}
+	return len;
+}
+
+static DEVICE_ATTR(corrected_bitflips, 0444,
+		   msm_nand_show_corrected_bitflips, NULL);
+static DEVICE_ATTR(block_bitflips, 0444,
+		   msm_nand_show_block_bitflips, NULL);
+
+static void msm_nand_bitflips_init(struct platform_device *pdev,
+				   struct msm_nand_info *info)
+{
+	struct msm_nand_chip *chip = &info->msm_nand;
+
+	/* only the raw nand path counts per block */
+	if (!info->mtd.block_bitflips)
+		return;
+
+	chip->nr_blocks = mtd_div_by_eb(info->mtd.size, &info->mtd);
+	chip->block_flips = kcalloc(chip->nr_blocks,
+				    sizeof(*chip->block_flips), GFP_KERNEL);
+	if (!chip->block_flips) {
+		pr_err("%s: no memory for bitflip counters\n", __func__);
+		chip->nr_blocks = 0;
+		return;
+	}
+
+	if (device_create_file(&pdev->dev, &dev_attr_corrected_bitflips) ||
+	    device_create_file(&pdev->dev, &dev_attr_block_bitflips))
+		pr_err("%s: failed to create sysfs files\n", __func__);
+}
+
+static void msm_nand_bitflips_exit(struct platform_device *pdev,
+				   struct msm_nand_info *info)
+{
+	if (!info->msm_nand.block_flips)
+		return;
+
+	device_remove_file(&pdev->dev, &dev_attr_block_bitflips);
+	device_remove_file(&pdev->dev, &dev_attr_corrected_bitflips);
+	kfree(info->msm_nand.block_flips);
+	info->msm_nand.block_flips = NULL;
+}
+
 /* duplicating the NC01 XFR contents to NC10 */
 static int msm_nand_nc10_xfr_settings(struct mtd_info *mtd)
 {
@@ -7003,6 +7411,7 @@ no_dual_nand_ctlr_support:
 	info->msm_nand.dev = &pdev->dev;
 
 	init_waitqueue_head(&info->msm_nand.wait_queue);
+	spin_lock_init(&info->msm_nand.perf_lock);
 
 	info->msm_nand.dma_channel = res->start;
 	pr_info("%s: dmac 0x%x\n", __func__, info->msm_nand.dma_channel);
@@ -7043,6 +7452,8 @@ no_dual_nand_ctlr_support:
 
 	setup_mtd_device(pdev, info);
 	dev_set_drvdata(&pdev->dev, info);
+	msm_nand_debugfs_init(info);
+	msm_nand_bitflips_init(pdev, info);
 
 	return 0;
 
@@ -7063,6 +7474,7 @@ static int __devexit msm_nand_remove(struct platform_device *pdev)
 	dev_set_drvdata(&pdev->dev, NULL);
 
 	if (info) {
+		msm_nand_debugfs_exit(info);
 #ifdef CONFIG_MTD_PARTITIONS
 		if (info->parts)
 			del_mtd_partitions(&info->mtd);
@@ -7071,6 +7483,7 @@ static int __devexit msm_nand_remove(struct platform_device *pdev)
 			del_mtd_device(&info->mtd);
 
 		msm_nand_release(&info->mtd);
+		msm_nand_bitflips_exit(pdev, info);
 		dma_free_coherent(NULL, MSM_NAND_DMA_BUFFER_SIZE,
 				  info->msm_nand.dma_buffer,
 				  info->msm_nand.dma_addr);
@@ -291,6 +291,15 @@ static int part_block_isbad(struct mtd_info *mtd, loff_t ofs)
 	return part->master->block_isbad(part->master, ofs);
 }
 
+static int part_block_bitflips(struct mtd_info *mtd, loff_t ofs)
+{
+	struct mtd_part *part = PART(mtd);
+	if (ofs >= mtd->size)
+		return -EINVAL;
+	ofs += part->offset;
+	return part->master->block_bitflips(part->master, ofs);
+}
+
 static int part_block_markbad(struct mtd_info *mtd, loff_t ofs)
 {
 	struct mtd_part *part = PART(mtd);
@@ -406,6 +415,8 @@ static struct mtd_part *add_one_partition(struct mtd_info *master,
 		slave->mtd.block_isbad = part_block_isbad;
 	if (master->block_markbad)
 		slave->mtd.block_markbad = part_block_markbad;
+	if (master->block_bitflips)
+		slave->mtd.block_bitflips = part_block_bitflips;
 	slave->mtd.erase = part_erase;
 	slave->master = master;
 	slave->offset = part->offset;
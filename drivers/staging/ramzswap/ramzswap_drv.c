@@ -23,8 +23,9 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -38,6 +39,7 @@ static struct ramzswap *devices;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
+static unsigned int default_codec = RZS_CODEC_LZO;
 
 static int rzs_test_flag(struct ramzswap *rzs, u32 index,
 			enum rzs_pageflags flag)
@@ -57,21 +59,55 @@ static void rzs_clear_flag(struct ramzswap *rzs, u32 index,
 	rzs->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+#if defined(CONFIG_RAMZSWAP_STATS)
+static inline ktime_t rzs_clock(void)
+{
+	return ktime_get();
+}
+
+/* Called with stream->lock held */
+static void rzs_stream_account(struct rzs_stream *stream, ktime_t start,
+				size_t clen)
+{
+	s64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+	unsigned int bucket = 0;
+
+	if (us > 0)
+		bucket = fls((u32)min_t(s64, us, INT_MAX));
+	if (bucket >= RZS_HIST_TIME_BUCKETS)
+		bucket = RZS_HIST_TIME_BUCKETS - 1;
+	stream->time_hist[bucket]++;
+
+	bucket = clen * RZS_HIST_RATIO_BUCKETS / PAGE_SIZE;
+	if (bucket >= RZS_HIST_RATIO_BUCKETS)
+		bucket = RZS_HIST_RATIO_BUCKETS - 1;
+	stream->ratio_hist[bucket]++;
+}
+#else
+static inline ktime_t rzs_clock(void)
+{
+	return ktime_set(0, 0);
+}
+
+#define rzs_stream_account(s, t, c)
+#endif /* CONFIG_RAMZSWAP_STATS */
+
 static void ramzswap_set_disksize(struct ramzswap *rzs, size_t totalram_bytes)
 {
 	if (!rzs->disksize) {
@@ -158,6 +194,30 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
+static void ramzswap_ioctl_get_stats2(struct ramzswap *rzs,
+			struct ramzswap_ioctl_stats2 *s)
+{
+	ramzswap_ioctl_get_stats(rzs, &s->stats);
+	s->codec = rzs->codec_id;
+
+#if defined(CONFIG_RAMZSWAP_STATS)
+	{
+	unsigned int cpu, i;
+
+	s->pages_same = rzs->stats.pages_same;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+
+		for (i = 0; i < RZS_HIST_TIME_BUCKETS; i++)
+			s->compr_time_hist[i] += stream->time_hist[i];
+		for (i = 0; i < RZS_HIST_RATIO_BUCKETS; i++)
+			s->compr_ratio_hist[i] += stream->ratio_hist[i];
+	}
+	}
+#endif /* CONFIG_RAMZSWAP_STATS */
+}
+
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
 	u32 clen;
@@ -166,18 +226,26 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 	struct page *page = rzs->table[index].page;
 	u32 offset = rzs->table[index].offset;
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (rzs_test_flag(rzs, index, RZS_ZERO)) {
-			rzs_clear_flag(rzs, index, RZS_ZERO);
-			rzs_stat_dec(&rzs->stats.pages_zero);
-		}
+	/*
+	 * No memory is allocated for zero or same filled pages.
+	 * Simply clear the flag.
+	 */
+	if (rzs_test_flag(rzs, index, RZS_ZERO)) {
+		rzs_clear_flag(rzs, index, RZS_ZERO);
+		rzs_stat_dec(&rzs->stats.pages_zero);
+		return;
+	}
+
+	if (rzs_test_flag(rzs, index, RZS_SAME)) {
+		rzs_clear_flag(rzs, index, RZS_SAME);
+		rzs_stat_dec(&rzs->stats.pages_same);
+		rzs->table[index].element = 0;
 		return;
 	}
 
+	if (unlikely(!page))
+		return;
+
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
 		__free_page(page);
@@ -202,13 +270,18 @@ out:
 	rzs->table[index].offset = 0;
 }
 
-static int handle_zero_page(struct bio *bio)
+static int handle_same_page(struct bio *bio, unsigned long element)
 {
-	void *user_mem;
+	unsigned long *user_mem;
+	unsigned int pos;
 	struct page *page = bio->bi_io_vec[0].bv_page;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element)
+		memset(user_mem, 0, PAGE_SIZE);
+	else
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -276,7 +349,10 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	if (rzs_test_flag(rzs, index, RZS_ZERO))
-		return handle_zero_page(bio);
+		return handle_same_page(bio, 0);
+
+	if (rzs_test_flag(rzs, index, RZS_SAME))
+		return handle_same_page(bio, rzs->table[index].element);
 
 	/* Requested page is not present in compressed area */
 	if (!rzs->table[index].page)
@@ -292,7 +368,7 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
 
-	ret = lzo1x_decompress_safe(
+	ret = rzs->codec->decompress(
 		cmem + sizeof(*zheader),
 		xv_get_object_size(cmem) - sizeof(*zheader),
 		user_mem, &clen);
@@ -301,7 +377,7 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	kunmap_atomic(cmem, KM_USER1);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
@@ -324,7 +400,10 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	int ret;
 	u32 offset, index;
 	size_t clen;
+	ktime_t start;
+	unsigned long element;
 	struct zobj_header *zheader;
+	struct rzs_stream *stream;
 	struct page *page, *page_store;
 	unsigned char *user_mem, *cmem, *src;
 
@@ -333,33 +412,48 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
-
 	user_mem = kmap_atomic(page, KM_USER0);
-	if (page_zero_filled(user_mem)) {
+	if (page_same_filled(user_mem, &element)) {
 		kunmap_atomic(user_mem, KM_USER0);
+		mutex_lock(&rzs->lock);
+		if (!element) {
+			rzs_stat_inc(&rzs->stats.pages_zero);
+			rzs_set_flag(rzs, index, RZS_ZERO);
+		} else {
+			rzs_stat_inc(&rzs->stats.pages_same);
+			rzs_set_flag(rzs, index, RZS_SAME);
+			rzs->table[index].element = element;
+		}
 		mutex_unlock(&rzs->lock);
-		rzs_stat_inc(&rzs->stats.pages_zero);
-		rzs_set_flag(rzs, index, RZS_ZERO);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	/*
+	 * Compress outside of the device lock, in the stream of this CPU.
+	 * The stream is held until the object is copied to the pool.
+	 */
+	stream = per_cpu_ptr(rzs->streams, raw_smp_processor_id());
+	mutex_lock(&stream->lock);
+	src = stream->buffer;
 
+	start = rzs_clock();
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = rzs->codec->compress(user_mem, src, &clen, stream->workmem);
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		mutex_unlock(&stream->lock);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
+	rzs_stream_account(stream, start, clen);
+
+	mutex_lock(&rzs->lock);
 
 	/*
 	 * Page is incompressible. Store it as-is (uncompressed)
@@ -370,11 +464,10 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
-			goto out;
+			goto out_unlock;
 		}
 
 		offset = 0;
@@ -388,11 +481,10 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
 			&rzs->table[index].page, &offset,
 			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
 		pr_info("Error allocating memory for compressed "
 			"page: %u, size=%zu\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
-		goto out;
+		goto out_unlock;
 	}
 
 memstore:
@@ -423,11 +515,15 @@ memstore:
 		rzs_stat_inc(&rzs->stats.good_compress);
 
 	mutex_unlock(&rzs->lock);
+	mutex_unlock(&stream->lock);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return 0;
 
+out_unlock:
+	mutex_unlock(&rzs->lock);
+	mutex_unlock(&stream->lock);
 out:
 	bio_io_error(bio);
 	return 0;
@@ -484,6 +580,53 @@ static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
+static void free_streams(struct ramzswap *rzs)
+{
+	unsigned int cpu;
+
+	if (!rzs->streams)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+
+		kfree(stream->workmem);
+		free_pages((unsigned long)stream->buffer, 1);
+	}
+
+	free_percpu(rzs->streams);
+	rzs->streams = NULL;
+}
+
+static int alloc_streams(struct ramzswap *rzs)
+{
+	unsigned int cpu;
+
+	rzs->streams = alloc_percpu(struct rzs_stream);
+	if (!rzs->streams)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+
+		mutex_init(&stream->lock);
+
+		if (rzs->codec->workmem_size) {
+			stream->workmem = kzalloc(rzs->codec->workmem_size,
+						GFP_KERNEL);
+			if (!stream->workmem)
+				return -ENOMEM;
+		}
+
+		stream->buffer = (void *)__get_free_pages(GFP_KERNEL |
+						__GFP_ZERO, 1);
+		if (!stream->buffer)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
 static void reset_device(struct ramzswap *rzs)
 {
 	size_t index;
@@ -492,17 +635,18 @@ static void reset_device(struct ramzswap *rzs)
 	rzs->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
-
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+	free_streams(rzs);
 
 	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
+	for (index = 0; rzs->table && index < rzs->disksize >> PAGE_SHIFT;
+			index++) {
 		struct page *page;
 		u16 offset;
 
+		/* No memory behind same filled pages */
+		if (rzs_test_flag(rzs, index, RZS_SAME))
+			continue;
+
 		page = rzs->table[index].page;
 		offset = rzs->table[index].offset;
 
@@ -541,17 +685,11 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
+	rzs->codec = &rzs_codecs[rzs->codec_id];
 
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = alloc_streams(rzs);
+	if (ret) {
+		pr_err("Error allocating compression streams!\n");
 		goto fail;
 	}
 
@@ -634,6 +772,27 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		pr_info("Disk size set to %zu kB\n", disksize_kb);
 		break;
 
+	case RZSIO_SET_CODEC:
+	{
+		u32 codec;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(&codec, (void *)arg, _IOC_SIZE(cmd))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		if (codec >= __NR_RZS_CODECS) {
+			ret = -EINVAL;
+			goto out;
+		}
+		rzs->codec_id = codec;
+		pr_info("Codec set to %s\n", rzs_codecs[codec].name);
+		break;
+	}
+
 	case RZSIO_GET_STATS:
 	{
 		struct ramzswap_ioctl_stats *stats;
@@ -655,6 +814,29 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		kfree(stats);
 		break;
 	}
+
+	case RZSIO_GET_STATS2:
+	{
+		struct ramzswap_ioctl_stats2 *stats;
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		stats = kzalloc(sizeof(*stats), GFP_KERNEL);
+		if (!stats) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ramzswap_ioctl_get_stats2(rzs, stats);
+		if (copy_to_user((void *)arg, stats, sizeof(*stats))) {
+			kfree(stats);
+			ret = -EFAULT;
+			goto out;
+		}
+		kfree(stats);
+		break;
+	}
+
 	case RZSIO_INIT:
 		ret = ramzswap_ioctl_init_device(rzs);
 		break;
@@ -732,6 +914,7 @@ static int create_device(struct ramzswap *rzs, int device_id)
 	rzs->disk->fops = &ramzswap_devops;
 	rzs->disk->queue = rzs->queue;
 	rzs->disk->private_data = rzs;
+	rzs->codec_id = default_codec;
 	snprintf(rzs->disk->disk_name, 16, "ramzswap%d", device_id);
 
 	/* Actual capacity set using RZSIO_SET_DISKSIZE_KB ioctl */
@@ -770,6 +953,13 @@ static int __init ramzswap_init(void)
 		goto out;
 	}
 
+	if (default_codec >= __NR_RZS_CODECS) {
+		pr_warning("Invalid value for default_codec: %u\n",
+				default_codec);
+		ret = -EINVAL;
+		goto out;
+	}
+
 	ramzswap_major = register_blkdev(0, "ramzswap");
 	if (ramzswap_major <= 0) {
 		pr_warning("Unable to get major number\n");
@@ -829,6 +1019,9 @@ static void __exit ramzswap_exit(void)
 module_param(num_devices, uint, 0);
 MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
 
+module_param(default_codec, uint, 0);
+MODULE_PARM_DESC(default_codec, "Codec of new devices: 0 = lzo, 1 = wk");
+
 module_init(ramzswap_init);
 module_exit(ramzswap_exit);
 
@@ -17,8 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
 
 #include "ramzswap_ioctl.h"
+#include "rzs_codec.h"
 #include "xvmalloc.h"
 
 /*
@@ -71,6 +73,9 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page is filled with one repeated word (table[].element) */
+	RZS_SAME,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
@@ -81,7 +86,10 @@ enum rzs_pageflags {
  * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
+	union {
+		struct page *page;
+		unsigned long element;	/* RZS_SAME pages */
+	};
 	u16 offset;
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
@@ -100,16 +108,33 @@ struct ramzswap_stats {
 	u64 invalid_io;		/* non-swap I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other same filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 #endif
 };
 
+/*
+ * Per-CPU compression stream. Writers use the stream of the CPU they
+ * start on, so compression runs in parallel on all cores; the mutex
+ * only matters if the writer migrates or sleeps in the allocator.
+ */
+struct rzs_stream {
+	struct mutex lock;
+	void *workmem;		/* codec working memory */
+	void *buffer;		/* 2 pages: compressed output */
+#if defined(CONFIG_RAMZSWAP_STATS)
+	u32 time_hist[RZS_HIST_TIME_BUCKETS];
+	u32 ratio_hist[RZS_HIST_RATIO_BUCKETS];
+#endif
+};
+
 struct ramzswap {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct rzs_stream __percpu *streams;
+	const struct rzs_codec *codec;
+	u32 codec_id;		/* set by RZSIO_SET_CODEC */
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
 	struct mutex lock;
@@ -15,6 +15,15 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+/*
+ * Compression time histogram: bucket 0 counts pages compressed in less
+ * than 1us, bucket n in [2^(n-1), 2^n) us, the last one everything above.
+ */
+#define RZS_HIST_TIME_BUCKETS	12
+
+/* Compressed size histogram: bucket n counts sizes in [n/8, (n+1)/8) page */
+#define RZS_HIST_RATIO_BUCKETS	8
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -34,9 +43,20 @@ struct ramzswap_ioctl_stats {
 	u64 mem_used_total;
 } __attribute__ ((packed, aligned(4)));
 
+/* RZSIO_GET_STATS layout is fixed, newer fields are only returned here */
+struct ramzswap_ioctl_stats2 {
+	struct ramzswap_ioctl_stats stats;
+	u32 pages_same;		/* no. of non-zero same filled pages */
+	u32 codec;		/* enum rzs_codec_id */
+	u32 compr_time_hist[RZS_HIST_TIME_BUCKETS];
+	u32 compr_ratio_hist[RZS_HIST_RATIO_BUCKETS];
+} __attribute__ ((packed, aligned(4)));
+
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_CODEC		_IOW('z', 4, u32)
+#define RZSIO_GET_STATS2	_IOR('z', 5, struct ramzswap_ioctl_stats2)
 
 #endif
@@ -0,0 +1,210 @@
+/*
+ * Compressed RAM based swap device - compression codecs
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/hash.h>
+#include <linux/lzo.h>
+#include <linux/string.h>
+
+#include "rzs_codec.h"
+
+/*-- lzo1x */
+
+static int rzs_lzo_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	int ret;
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+	return ret == LZO_E_OK ? 0 : -EINVAL;
+}
+
+static int rzs_lzo_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+
+	*dst_len = PAGE_SIZE;
+	ret = lzo1x_decompress_safe(src, src_len, dst, dst_len);
+	return ret == LZO_E_OK ? 0 : -EINVAL;
+}
+
+/*-- wk: word based dictionary codec
+ *
+ * Swapped out pages are mostly made of pointers and small integers, so
+ * instead of searching byte matches every 32-bit word is classified
+ * against a small direct mapped dictionary of recently seen words:
+ *
+ *   tag 0: word is zero
+ *   tag 1: exact dictionary hit           (4-bit index)
+ *   tag 2: hit on the upper 22 bits       (4-bit index + 10 low bits)
+ *   tag 3: miss                           (32-bit word)
+ *
+ * Tags and payloads are packed in a single little bit stream. Worst
+ * case output is 34 bits per word, which still fits the 2 page buffer.
+ */
+
+#define WK_DICT_BITS	4
+#define WK_DICT_SIZE	(1 << WK_DICT_BITS)
+#define WK_LOW_BITS	10
+#define WK_WORDS	(PAGE_SIZE / sizeof(u32))
+
+enum {
+	WK_ZERO,
+	WK_EXACT,
+	WK_PARTIAL,
+	WK_MISS,
+};
+
+struct wk_writer {
+	u32 *out;
+	u64 acc;
+	unsigned int bits;
+};
+
+struct wk_reader {
+	const u32 *in;
+	const u32 *end;
+	u64 acc;
+	unsigned int bits;
+};
+
+static inline void wk_put(struct wk_writer *w, u32 val, unsigned int n)
+{
+	w->acc |= (u64)val << w->bits;
+	w->bits += n;
+	if (w->bits >= 32) {
+		*w->out++ = (u32)w->acc;
+		w->acc >>= 32;
+		w->bits -= 32;
+	}
+}
+
+static inline int wk_get(struct wk_reader *r, u32 *val, unsigned int n)
+{
+	if (r->bits < n) {
+		if (unlikely(r->in >= r->end))
+			return -EINVAL;
+		r->acc |= (u64)*r->in++ << r->bits;
+		r->bits += 32;
+	}
+	*val = (u32)r->acc & (n == 32 ? ~0U : (1U << n) - 1);
+	r->acc >>= n;
+	r->bits -= n;
+	return 0;
+}
+
+static inline u32 wk_index(u32 word)
+{
+	return hash_32(word >> WK_LOW_BITS, WK_DICT_BITS);
+}
+
+static int rzs_wk_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	u32 dict[WK_DICT_SIZE];
+	const u32 *in = (const u32 *)src;
+	struct wk_writer w = { .out = (u32 *)dst };
+	unsigned int i;
+
+	memset(dict, 0, sizeof(dict));
+
+	for (i = 0; i < WK_WORDS; i++) {
+		u32 word = in[i], idx;
+
+		if (!word) {
+			wk_put(&w, WK_ZERO, 2);
+			continue;
+		}
+
+		idx = wk_index(word);
+		if (dict[idx] == word) {
+			wk_put(&w, WK_EXACT | (idx << 2), 2 + WK_DICT_BITS);
+		} else if ((dict[idx] >> WK_LOW_BITS) ==
+				(word >> WK_LOW_BITS)) {
+			wk_put(&w, WK_PARTIAL | (idx << 2) |
+				((word & ((1 << WK_LOW_BITS) - 1)) <<
+				 (2 + WK_DICT_BITS)),
+				2 + WK_DICT_BITS + WK_LOW_BITS);
+			dict[idx] = word;
+		} else {
+			wk_put(&w, WK_MISS, 2);
+			wk_put(&w, word, 32);
+			dict[idx] = word;
+		}
+	}
+	if (w.bits)
+		*w.out++ = (u32)w.acc;
+
+	*dst_len = (unsigned char *)w.out - dst;
+	return 0;
+}
+
+static int rzs_wk_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	u32 dict[WK_DICT_SIZE];
+	u32 *out = (u32 *)dst;
+	struct wk_reader r = {
+		.in = (const u32 *)src,
+		.end = (const u32 *)src + src_len / sizeof(u32),
+	};
+	unsigned int i;
+	u32 tag, idx, low;
+
+	memset(dict, 0, sizeof(dict));
+
+	for (i = 0; i < WK_WORDS; i++) {
+		if (wk_get(&r, &tag, 2))
+			return -EINVAL;
+
+		switch (tag) {
+		case WK_ZERO:
+			out[i] = 0;
+			break;
+		case WK_EXACT:
+			if (wk_get(&r, &idx, WK_DICT_BITS))
+				return -EINVAL;
+			out[i] = dict[idx];
+			break;
+		case WK_PARTIAL:
+			if (wk_get(&r, &idx, WK_DICT_BITS) ||
+			    wk_get(&r, &low, WK_LOW_BITS))
+				return -EINVAL;
+			out[i] = (dict[idx] & ~((1 << WK_LOW_BITS) - 1)) | low;
+			dict[idx] = out[i];
+			break;
+		default:
+			if (wk_get(&r, &out[i], 32))
+				return -EINVAL;
+			dict[wk_index(out[i])] = out[i];
+			break;
+		}
+	}
+
+	*dst_len = PAGE_SIZE;
+	return 0;
+}
+
+const struct rzs_codec rzs_codecs[__NR_RZS_CODECS] = {
+	[RZS_CODEC_LZO] = {
+		.name		= "lzo",
+		.workmem_size	= LZO1X_MEM_COMPRESS,
+		.compress	= rzs_lzo_compress,
+		.decompress	= rzs_lzo_decompress,
+	},
+	[RZS_CODEC_WK] = {
+		.name		= "wk",
+		.workmem_size	= 0,
+		.compress	= rzs_wk_compress,
+		.decompress	= rzs_wk_decompress,
+	},
+};
@@ -0,0 +1,41 @@
+/*
+ * Compressed RAM based swap device - compression codecs
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _RZS_CODEC_H_
+#define _RZS_CODEC_H_
+
+#include <linux/types.h>
+
+/* Codec ids, as passed to RZSIO_SET_CODEC */
+enum rzs_codec_id {
+	RZS_CODEC_LZO,		/* lzo1x-1: default, best ratio */
+	RZS_CODEC_WK,		/* word dictionary: faster, lighter */
+
+	__NR_RZS_CODECS,
+};
+
+struct rzs_codec {
+	const char *name;
+	size_t workmem_size;
+
+	/*
+	 * Compress one page from src to dst. dst must be able to hold
+	 * 2 * PAGE_SIZE bytes. Both return 0 on success.
+	 */
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem);
+	/* src_len may include trailing allocator padding */
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+};
+
+extern const struct rzs_codec rzs_codecs[__NR_RZS_CODECS];
+
+#endif
@@ -1017,6 +1017,11 @@ static int android_debugfs_init(struct android_dev *dev)
 	return 0;
 }
 
+struct dentry *android_debugfs_root(void)
+{
+	return android_debug_root;
+}
+
 static void android_debugfs_cleanup(void)
 {
        debugfs_remove(android_debug_serialno);
@@ -91,6 +91,9 @@ ctrl_endpt_desc = {
 /* UDC descriptor */
 static struct ci13xxx *_udc;
 
+/* max requests retired per endpoint lock release, see isr_tr_complete_low */
+#define REAP_BATCH_MAX   16
+
 /* Interrupt statistics */
 #define ISR_MASK   0x1F
 static struct {
@@ -426,6 +429,34 @@ static int hw_ep_is_primed(int num, int dir)
 	return test_bit(hw_ep_bit(num, dir), (void *)&reg);
 }
 
+/**
+ * hw_ep_is_active: samples ENDPTSTAT using the add dTD tripwire (execute
+ *                  without interruption)
+ * @num:   endpoint number
+ * @dir:   endpoint direction
+ *
+ * Used after linking a new dTD at the tail of an endpoint list: a set bit
+ * means the controller is still walking the list and will pick the new dTD
+ * up by itself, a clear bit means the endpoint has to be primed again.
+ *
+ * This function returns true if endpoint is active
+ */
+static int hw_ep_is_active(int num, int dir)
+{
+	u32 reg;
+
+	if (hw_cread(CAP_ENDPTPRIME, BIT(hw_ep_bit(num, dir))))
+		return 1;
+
+	do {
+		hw_cwrite(CAP_USBCMD, USBCMD_ATDTW, USBCMD_ATDTW);
+		reg = hw_cread(CAP_ENDPTSTAT, BIT(hw_ep_bit(num, dir)));
+	} while (!hw_cread(CAP_USBCMD, USBCMD_ATDTW));
+	hw_cwrite(CAP_USBCMD, USBCMD_ATDTW, 0);
+
+	return reg ? 1 : 0;
+}
+
 /**
  * hw_test_and_clear_setup_status: test & clear setup status (execute without
  *                                 interruption)
@@ -1291,6 +1322,17 @@ static ssize_t show_requests(struct device *dev, struct device_attribute *attr,
 	}
 
 	spin_lock_irqsave(udc->lock, flags);
+	for (i = 0; i < hw_ep_max; i++) {
+		struct ci13xxx_ep *mEp = &udc->ci13xxx_ep[i];
+
+		if (mEp->queued == 0)
+			continue;
+		n += scnprintf(buf + n, PAGE_SIZE - n,
+			       "EP=%02i: depth %u/%u queued %lu chained %lu "
+			       "completed %lu batches %lu\n",
+			       i, mEp->qdepth, mEp->qdepth_max, mEp->queued,
+			       mEp->chained, mEp->completed, mEp->batches);
+	}
 	for (i = 0; i < hw_ep_max; i++)
 		for (k = RX; k <= TX; k++)
 			list_for_each(ptr, &udc->ci13xxx_ep[i].qh[k].queue)
@@ -1404,14 +1446,30 @@ static inline u8 _usb_addr(struct ci13xxx_ep *ep)
 }
 
 /**
- * _hardware_queue: configures a request at hardware level
+ * _hardware_last_td: returns the last dTD of a request
+ * @mReq: request
+ */
+static inline struct ci13xxx_td *_hardware_last_td(struct ci13xxx_req *mReq)
+{
+	return (mReq->zptr != NULL) ? mReq->zptr : mReq->ptr;
+}
+
+/**
+ * _hardware_enqueue: configures a request at hardware level
  * @gadget: gadget
  * @mEp:    endpoint
  *
+ * The request dTD(s) are appended to the endpoint dTD list. If the endpoint
+ * is still active the controller reaches them without being primed again,
+ * otherwise the queue head is pointed at the first request not yet done,
+ * normally this one, and the endpoint primed.
+ * Caller must hold lock and add the request to the endpoint queue afterwards.
+ *
  * This function returns an error code
  */
 static int _hardware_enqueue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 {
+	struct ci13xxx_req *mPrev, *mFirst = mReq, *mIt;
 	unsigned i;
 
 	trace("%p, %p", mEp, mReq);
@@ -1420,11 +1478,6 @@ static int _hardware_enqueue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 	if (mReq->req.status == -EALREADY)
 		return -EALREADY;
 
-	if (hw_ep_is_primed(mEp->num, mEp->dir))
-		return -EBUSY;
-
-	mReq->req.status = -EALREADY;
-
 	if (mReq->req.length && !mReq->req.dma) {
 		mReq->req.dma = \
 			dma_map_single(mEp->device, mReq->req.buf,
@@ -1436,6 +1489,31 @@ static int _hardware_enqueue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 		mReq->map = 1;
 	}
 
+	/*
+	 * The queue head ZLT setting applies to the whole list, so a requested
+	 * zero length packet is sent by a dedicated dTD instead
+	 */
+	if (mReq->req.zero && mReq->req.length && mEp->dir == TX &&
+	    (mReq->req.length % mEp->ep.maxpacket) == 0) {
+		mReq->zptr = dma_pool_alloc(mEp->td_pool, GFP_ATOMIC,
+					    &mReq->zdma);
+		if (mReq->zptr == NULL) {
+			if (mReq->map) {
+				dma_unmap_single(mEp->device, mReq->req.dma,
+						 mReq->req.length,
+						 DMA_TO_DEVICE);
+				mReq->req.dma = 0;
+				mReq->map     = 0;
+			}
+			return -ENOMEM;
+		}
+		memset(mReq->zptr, 0, sizeof(*mReq->zptr));
+		mReq->zptr->next    = TD_TERMINATE;
+		mReq->zptr->token   = TD_STATUS_ACTIVE;
+	}
+
+	mReq->req.status = -EALREADY;
+
 	/*
 	 * TD configuration
 	 * TODO - handle requests which spawns into several TDs
@@ -1444,24 +1522,51 @@ static int _hardware_enqueue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 	mReq->ptr->next    |= TD_TERMINATE;
 	mReq->ptr->token    = mReq->req.length << ffs_nr(TD_TOTAL_BYTES);
 	mReq->ptr->token   &= TD_TOTAL_BYTES;
-	mReq->ptr->token   |= TD_IOC;
 	mReq->ptr->token   |= TD_STATUS_ACTIVE;
 	mReq->ptr->page[0]  = mReq->req.dma;
 	for (i = 1; i < 5; i++)
 		mReq->ptr->page[i] =
 			(mReq->req.dma + i * PAGE_SIZE) & ~TD_RESERVED_MASK;
 
+	if (mReq->zptr != NULL)
+		mReq->ptr->next = mReq->zdma;
+
+	/*
+	 * Every request is the tail of the list when it is queued, and the
+	 * tail must interrupt or completions stop, so no_interrupt is ignored
+	 */
+	_hardware_last_td(mReq)->token |= TD_IOC;
+
+	if (!list_empty(&mEp->qh[mEp->dir].queue)) {
+		mPrev = list_entry(mEp->qh[mEp->dir].queue.prev,
+				   struct ci13xxx_req, queue);
+
+		/* link behind the tail, the controller may be reading it */
+		_hardware_last_td(mPrev)->next = mReq->dma & TD_ADDR_MASK;
+		wmb();
+
+		if (hw_ep_is_active(mEp->num, mEp->dir)) {
+			mEp->chained++;
+			return 0;
+		}
+
+		/* requests stranded behind a failed dTD go first */
+		rmb();
+		list_for_each_entry(mIt, &mEp->qh[mEp->dir].queue, queue)
+			if (mIt->ptr->token & TD_STATUS_ACTIVE) {
+				mFirst = mIt;
+				break;
+			}
+	}
+
 	/*
 	 *  QH configuration
 	 *  At this point it's guaranteed exclusive access to qhead
-	 *  (endpt is not primed) so it's no need to use tripwire
+	 *  (endpt is not active) so it's no need to use tripwire
 	 */
-	mEp->qh[mEp->dir].ptr->td.next   = mReq->dma;    /* TERMINATE = 0 */
+	mEp->qh[mEp->dir].ptr->td.next   = mFirst->dma;  /* TERMINATE = 0 */
 	mEp->qh[mEp->dir].ptr->td.token &= ~TD_STATUS;   /* clear status */
-	if (mReq->req.zero == 0)
-		mEp->qh[mEp->dir].ptr->cap |=  QH_ZLT;
-	else
-		mEp->qh[mEp->dir].ptr->cap &= ~QH_ZLT;
+	mEp->qh[mEp->dir].ptr->cap      |=  QH_ZLT;      /* see zptr above */
 
 	wmb();   /* synchronize before ep prime */
 
@@ -1469,12 +1574,33 @@ static int _hardware_enqueue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 			   mEp->type == USB_ENDPOINT_XFER_CONTROL);
 }
 
+/**
+ * _hardware_release: releases the DMA resources of a request
+ * @mEp:  endpoint
+ * @mReq: request
+ */
+static void _hardware_release(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
+{
+	if (mReq->map) {
+		dma_unmap_single(mEp->device, mReq->req.dma, mReq->req.length,
+				 mEp->dir ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+		mReq->req.dma = 0;
+		mReq->map     = 0;
+	}
+
+	if (mReq->zptr != NULL) {
+		dma_pool_free(mEp->td_pool, mReq->zptr, mReq->zdma);
+		mReq->zptr = NULL;
+	}
+}
+
 /**
  * _hardware_dequeue: handles a request at hardware level
  * @gadget: gadget
  * @mEp:    endpoint
  *
- * This function returns an error code
+ * This function returns an error code, -EBUSY while the controller still
+ * owns the request dTD(s)
  */
 static int _hardware_dequeue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 {
@@ -1483,17 +1609,10 @@ static int _hardware_dequeue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 	if (mReq->req.status != -EALREADY)
 		return -EINVAL;
 
-	if (hw_ep_is_primed(mEp->num, mEp->dir))
-		hw_ep_flush(mEp->num, mEp->dir);
-
-	mReq->req.status = 0;
+	if ((_hardware_last_td(mReq)->token & TD_STATUS_ACTIVE) != 0)
+		return -EBUSY;
 
-	if (mReq->map) {
-		dma_unmap_single(mEp->device, mReq->req.dma, mReq->req.length,
-				 mEp->dir ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
-		mReq->req.dma = 0;
-		mReq->map     = 0;
-	}
+	_hardware_release(mEp, mReq);
 
 	mReq->req.status = mReq->ptr->token & TD_STATUS;
 	if      ((TD_STATUS_ACTIVE & mReq->req.status) != 0)
@@ -1513,6 +1632,125 @@ static int _hardware_dequeue(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
 	return mReq->req.actual;
 }
 
+/**
+ * _hardware_restart: relinks the endpoint dTD list and primes it again
+ * @mEp:   endpoint
+ * @mNext: first request behind the cancelled one, NULL if there is none
+ *
+ * Used after the request the controller was working on was cancelled; the
+ * endpoint must be flushed. Requests ahead of @mNext are retired and only
+ * wait for the completion handler. Requests from @mNext on were never
+ * touched by the controller, so priming there sends nothing twice.
+ * Caller must hold lock.
+ *
+ * This function returns an error code
+ */
+static int _hardware_restart(struct ci13xxx_ep *mEp,
+			     struct ci13xxx_req *mNext)
+{
+	struct ci13xxx_req *mReq, *mPrev = NULL, *mFirst = NULL;
+
+	list_for_each_entry(mReq, &mEp->qh[mEp->dir].queue, queue) {
+		if (mPrev != NULL)
+			_hardware_last_td(mPrev)->next =
+				mReq->dma & TD_ADDR_MASK;
+		if (mReq == mNext)
+			mFirst = mReq;
+		mPrev = mReq;
+	}
+	if (mPrev != NULL)
+		_hardware_last_td(mPrev)->next = TD_TERMINATE;
+
+	if (mFirst == NULL)
+		return 0;
+
+	mEp->qh[mEp->dir].ptr->td.next   = mFirst->dma;
+	mEp->qh[mEp->dir].ptr->td.token &= ~TD_STATUS;
+
+	wmb();   /* synchronize before ep prime */
+
+	return hw_ep_prime(mEp->num, mEp->dir,
+			   mEp->type == USB_ENDPOINT_XFER_CONTROL);
+}
+
+/**
+ * _hardware_cancel: takes a request the controller may own off the dTD list
+ * @mEp:  endpoint
+ * @mReq: request, still on the endpoint queue
+ *
+ * A retired @mReq is simply dropped. While an earlier request is still
+ * active the controller has not reached @mReq, which is unlinked without
+ * disturbing the transfer in progress. Otherwise the endpoint is flushed
+ * and primed again behind @mReq.
+ * Caller must hold lock.
+ */
+static void _hardware_cancel(struct ci13xxx_ep *mEp, struct ci13xxx_req *mReq)
+{
+	struct list_head *queue = &mEp->qh[mEp->dir].queue;
+	struct ci13xxx_req *mPrev = NULL, *mNext = NULL, *mIt;
+	int busy_ahead = 0;
+	u32 curr;
+
+	list_for_each_entry(mIt, queue, queue) {
+		if (mIt == mReq)
+			break;
+		if (_hardware_last_td(mIt)->token & TD_STATUS_ACTIVE)
+			busy_ahead = 1;
+		mPrev = mIt;
+	}
+	if (!list_is_last(&mReq->queue, queue))
+		mNext = list_entry(mReq->queue.next, struct ci13xxx_req, queue);
+
+	/* already retired, the controller is past it */
+	if (!(_hardware_last_td(mReq)->token & TD_STATUS_ACTIVE)) {
+		list_del_init(&mReq->queue);
+		_hardware_release(mEp, mReq);
+		return;
+	}
+
+	if (busy_ahead) {
+		_hardware_last_td(mPrev)->next = _hardware_last_td(mReq)->next;
+		wmb();
+
+		/* make sure the controller did not move on to it meanwhile */
+		do {
+			hw_cwrite(CAP_USBCMD, USBCMD_ATDTW, USBCMD_ATDTW);
+			curr = mEp->qh[mEp->dir].ptr->curr & TD_ADDR_MASK;
+		} while (!hw_cread(CAP_USBCMD, USBCMD_ATDTW));
+		hw_cwrite(CAP_USBCMD, USBCMD_ATDTW, 0);
+
+		if (curr != (mReq->dma & TD_ADDR_MASK) &&
+		    (mReq->zptr == NULL ||
+		     curr != (mReq->zdma & TD_ADDR_MASK))) {
+			list_del_init(&mReq->queue);
+			_hardware_release(mEp, mReq);
+			return;
+		}
+	}
+
+	hw_ep_flush(mEp->num, mEp->dir);
+	list_del_init(&mReq->queue);
+	_hardware_release(mEp, mReq);
+	_hardware_restart(mEp, mNext);
+}
+
+/**
+ * _req_completes: tells if the gadget completion callback has to be called
+ * @mEp:  endpoint
+ * @mReq: request
+ *
+ * no_interrupt suppresses completions on the control endpoint only (used
+ * for the internal status request), on data endpoints it is ignored.
+ */
+static inline int _req_completes(struct ci13xxx_ep *mEp,
+				 struct ci13xxx_req *mReq)
+{
+	if (mReq->req.complete == NULL)
+		return 0;
+	return mEp->type != USB_ENDPOINT_XFER_CONTROL ||
+		!mReq->req.no_interrupt;
+}
+
 /**
  * _ep_nuke: dequeues all endpoint requests
  * @mEp: endpoint
@@ -1538,9 +1776,12 @@ __acquires(mEp->lock)
 			list_entry(mEp->qh[mEp->dir].queue.next,
 				   struct ci13xxx_req, queue);
 		list_del_init(&mReq->queue);
+		_hardware_release(mEp, mReq);
 		mReq->req.status = -ESHUTDOWN;
+		if (mEp->qdepth)
+			mEp->qdepth--;
 
-		if (!mReq->req.no_interrupt && mReq->req.complete != NULL) {
+		if (_req_completes(mEp, mReq)) {
 			spin_unlock(mEp->lock);
 			mReq->req.complete(&mEp->ep, &mReq->req);
 			spin_lock(mEp->lock);
@@ -1761,48 +2002,79 @@ __acquires(mEp->lock)
  * isr_tr_complete_low: transaction complete low level handler
  * @mEp: endpoint
  *
- * This function returns an error code
+ * Retires every request the controller is done with, in order, and runs
+ * their completions with a single unlock of the endpoint lock per batch.
+ *
+ * This function returns an error code, or the length of the last retired
+ * request
  * Caller must hold lock
  */
 static int isr_tr_complete_low(struct ci13xxx_ep *mEp)
 __releases(mEp->lock)
 __acquires(mEp->lock)
 {
-	struct ci13xxx_req *mReq;
-	int retval;
+	struct ci13xxx_req *mReq, *done[REAP_BATCH_MAX];
+	unsigned i, n;
+	int retval, last = 0;
 
 	trace("%p", mEp);
 
 	if (list_empty(&mEp->qh[mEp->dir].queue))
 		return -EINVAL;
 
-	/* pop oldest request */
-	mReq = list_entry(mEp->qh[mEp->dir].queue.next,
-			  struct ci13xxx_req, queue);
-	list_del_init(&mReq->queue);
+	do {
+		n = 0;
+		while (n < REAP_BATCH_MAX &&
+		       !list_empty(&mEp->qh[mEp->dir].queue)) {
+			/* oldest request first */
+			mReq = list_entry(mEp->qh[mEp->dir].queue.next,
+					  struct ci13xxx_req, queue);
+
+			retval = _hardware_dequeue(mEp, mReq);
+			if (retval == -EBUSY)
+				break;
 
-	retval = _hardware_dequeue(mEp, mReq);
-	if (retval < 0) {
-		dbg_event(_usb_addr(mEp), "DONE", retval);
-		goto done;
-	}
+			list_del_init(&mReq->queue);
+			if (mEp->qdepth)
+				mEp->qdepth--;
+			last = retval;
+			if (retval < 0) {
+				dbg_event(_usb_addr(mEp), "DONE", retval);
+				continue;
+			}
+
+			dbg_done(_usb_addr(mEp), mReq->ptr->token, retval);
+			done[n++] = mReq;
+		}
+		if (n == 0)
+			break;
 
-	dbg_done(_usb_addr(mEp), mReq->ptr->token, retval);
+		mEp->completed += n;
+		mEp->batches++;
 
-	if (!mReq->req.no_interrupt && mReq->req.complete != NULL) {
 		spin_unlock(mEp->lock);
-		mReq->req.complete(&mEp->ep, &mReq->req);
+		for (i = 0; i < n; i++)
+			if (_req_completes(mEp, done[i]))
+				done[i]->req.complete(&mEp->ep, &done[i]->req);
 		spin_lock(mEp->lock);
-	}
+	} while (n == REAP_BATCH_MAX);
 
-	if (!list_empty(&mEp->qh[mEp->dir].queue)) {
+	/*
+	 * A halted or failed dTD stops the endpoint with the requests behind
+	 * it still active; nothing else would prime it at them again
+	 */
+	if (!list_empty(&mEp->qh[mEp->dir].queue) &&
+	    !hw_ep_is_active(mEp->num, mEp->dir)) {
+		rmb();   /* endpoint idle before looking at its dTDs */
 		mReq = list_entry(mEp->qh[mEp->dir].queue.next,
 				  struct ci13xxx_req, queue);
-		_hardware_enqueue(mEp, mReq);
+		if (mReq->ptr->token & TD_STATUS_ACTIVE) {
+			dbg_event(_usb_addr(mEp), "RESTART", 0);
+			_hardware_restart(mEp, mReq);
+		}
 	}
 
- done:
-	return retval;
+	return last;
 }
 
 /**
@@ -2165,12 +2437,19 @@ static int ep_queue(struct usb_ep *ep, struct usb_request *req,
 
 	dbg_queue(_usb_addr(mEp), req, retval);
 
-	/* push request */
+	/* push request, linked behind the requests already queued */
 	mReq->req.status = -EINPROGRESS;
 	mReq->req.actual = 0;
-	list_add_tail(&mReq->queue, &mEp->qh[mEp->dir].queue);
 
 	retval = _hardware_enqueue(mEp, mReq);
+	if (retval == -ENOMEM)
+		goto done;
+	list_add_tail(&mReq->queue, &mEp->qh[mEp->dir].queue);
+
+	mEp->queued++;
+	if (++mEp->qdepth > mEp->qdepth_max)
+		mEp->qdepth_max = mEp->qdepth;
+
 	if (retval == -EALREADY || retval == -EBUSY) {
 		dbg_event(_usb_addr(mEp), "QUEUE", retval);
 		retval = 0;
@@ -2202,14 +2481,16 @@ static int ep_dequeue(struct usb_ep *ep, struct usb_request *req)
 
 	dbg_event(_usb_addr(mEp), "DEQUEUE", 0);
 
-	if (mReq->req.status == -EALREADY)
-		_hardware_dequeue(mEp, mReq);
-
 	/* pop request */
-	list_del_init(&mReq->queue);
+	if (mReq->req.status == -EALREADY)
+		_hardware_cancel(mEp, mReq);
+	else
+		list_del_init(&mReq->queue);
+	if (mEp->qdepth)
+		mEp->qdepth--;
 	req->status = -ECONNRESET;
 
-	if (!mReq->req.no_interrupt && mReq->req.complete != NULL) {
+	if (_req_completes(mEp, mReq)) {
 		spin_unlock(mEp->lock);
 		mReq->req.complete(&mEp->ep, &mReq->req);
 		spin_lock(mEp->lock);
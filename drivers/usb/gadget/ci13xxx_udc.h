@@ -32,6 +32,7 @@ struct ci13xxx_td {
 	/* 0 */
 	u32 next;
 #define TD_TERMINATE          BIT(0)
+#define TD_ADDR_MASK          (0x7FFFFFFUL << 5)
 	/* 1 */
 	u32 token;
 #define TD_STATUS             (0x00FFUL <<  0)
@@ -73,6 +74,8 @@ struct ci13xxx_req {
 	struct list_head     queue;
 	struct ci13xxx_td   *ptr;
 	dma_addr_t           dma;
+	struct ci13xxx_td   *zptr;     /* trailing zero length dTD, if any */
+	dma_addr_t           zdma;
 };
 
 /* Extension of usb_ep */
@@ -91,6 +94,14 @@ struct ci13xxx_ep {
 	struct usb_request                    *status;
 	int                                    wedge;
 
+	/* queue statistics, reported by the "requests" attribute */
+	unsigned                               qdepth;
+	unsigned                               qdepth_max;
+	unsigned long                          queued;
+	unsigned long                          chained;
+	unsigned long                          completed;
+	unsigned long                          batches;
+
 	/* global resources */
 	spinlock_t                            *lock;
 	struct device                         *device;
@@ -130,6 +141,7 @@ struct ci13xxx {
 #define USBCMD_RS             BIT(0)
 #define USBCMD_RST            BIT(1)
 #define USBCMD_SUTW           BIT(13)
+#define USBCMD_ATDTW          BIT(14)
 
 /* USBSTS & USBINTR */
 #define USBi_UI               BIT(0)
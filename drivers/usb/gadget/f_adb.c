@@ -29,13 +29,39 @@
 #include <linux/types.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
 
 #include <linux/usb/android_composite.h>
 
 #define BULK_BUFFER_SIZE           4096
+#define BULK_BUFFER_SIZE_MAX       16384
 
 /* number of tx requests to allocate */
-#define TX_REQ_MAX 4
+#define TX_REQ_DEFAULT 4
+#define TX_REQ_MAX 32
+
+/* Request ring geometry, sampled when the function binds.  Request
+ * sizes are rounded down to a multiple of the high speed bulk packet
+ * size so that a payload split across requests reaches the host as a
+ * single transfer.
+ */
+static unsigned int adb_tx_reqs = TX_REQ_DEFAULT;
+module_param(adb_tx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(adb_tx_reqs, "number of bulk IN requests");
+
+static unsigned int adb_tx_req_len = BULK_BUFFER_SIZE;
+module_param(adb_tx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(adb_tx_req_len, "size of each bulk IN request buffer");
+
+static unsigned int adb_rx_req_len = BULK_BUFFER_SIZE;
+module_param(adb_rx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(adb_rx_req_len, "size of the bulk OUT request buffer");
 
 static const char shortname[] = "android_adb";
 
@@ -60,6 +86,28 @@ struct adb_dev {
 	wait_queue_head_t write_wq;
 	struct usb_request *rx_req;
 	int rx_done;
+	/* pages backing rx_req->buf, and the part of the last transfer
+	 * that has not been read or spliced yet
+	 */
+	struct page *rx_page;
+	unsigned int rx_order;
+	unsigned int rx_off;
+	unsigned int rx_avail;
+
+	unsigned int tx_reqs;
+	unsigned int tx_req_len;
+	unsigned int rx_req_len;
+
+	/* throughput counters, see debugfs android/adb_stats */
+	unsigned long rx_count;
+	unsigned long tx_count;
+	u64 rx_bytes;
+	u64 tx_bytes;
+	u64 splice_rx_bytes;
+	u64 splice_tx_bytes;
+	s64 rx_usecs;
+	s64 tx_usecs;
+	struct dentry *debugfs_stats;
 };
 
 static struct usb_interface_descriptor adb_interface_desc = {
@@ -152,6 +200,44 @@ static void adb_request_free(struct usb_request *req, struct usb_ep *ep)
 	}
 }
 
+/* The OUT buffer is made of individually refcounted pages so that
+ * splice_read can hand them to a pipe. While a pipe still holds one of
+ * them the next transfer goes to a fresh buffer.
+ */
+static int adb_rx_buf_alloc(struct adb_dev *dev)
+{
+	struct page *page = alloc_pages(GFP_KERNEL, dev->rx_order);
+
+	if (!page)
+		return -ENOMEM;
+	split_page(page, dev->rx_order);
+	dev->rx_page = page;
+	dev->rx_req->buf = page_address(page);
+	return 0;
+}
+
+static void adb_rx_buf_free(struct adb_dev *dev)
+{
+	unsigned int i;
+
+	if (!dev->rx_page)
+		return;
+	for (i = 0; i < (1 << dev->rx_order); i++)
+		put_page(dev->rx_page + i);
+	dev->rx_page = NULL;
+	dev->rx_req->buf = NULL;
+}
+
+static int adb_rx_buf_busy(struct adb_dev *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < (1 << dev->rx_order); i++)
+		if (page_count(dev->rx_page + i) > 1)
+			return 1;
+	return 0;
+}
+
 static inline int _lock(atomic_t *excl)
 {
 	if (atomic_inc_return(excl) == 1) {
@@ -198,11 +284,18 @@ struct usb_request *req_get(struct adb_dev *dev, struct list_head *head)
 static void adb_complete_in(struct usb_ep *ep, struct usb_request *req)
 {
 	struct adb_dev *dev = _adb_dev;
+	unsigned long flags;
 
 	if (req->status != 0)
 		atomic_set(&dev->error, 1);
 
-	req_put(dev, &dev->tx_idle, req);
+	spin_lock_irqsave(&dev->lock, flags);
+	if (req->status == 0) {
+		dev->tx_count++;
+		dev->tx_bytes += req->actual;
+	}
+	list_add_tail(&req->list, &dev->tx_idle);
+	spin_unlock_irqrestore(&dev->lock, flags);
 
 	wake_up(&dev->write_wq);
 }
@@ -214,6 +307,10 @@ static void adb_complete_out(struct usb_ep *ep, struct usb_request *req)
 	dev->rx_done = 1;
 	if (req->status != 0)
 		atomic_set(&dev->error, 1);
+	else {
+		dev->rx_count++;
+		dev->rx_bytes += req->actual;
+	}
 
 	wake_up(&dev->read_wq);
 }
@@ -247,15 +344,24 @@ static int __init create_bulk_endpoints(struct adb_dev *dev,
 	ep->driver_data = dev;		/* claim the endpoint */
 	dev->ep_out = ep;
 
+	dev->tx_reqs = clamp_t(unsigned int, adb_tx_reqs, 2, TX_REQ_MAX);
+	dev->tx_req_len = clamp_t(unsigned int, adb_tx_req_len,
+				  BULK_BUFFER_SIZE, BULK_BUFFER_SIZE_MAX) & ~511;
+	dev->rx_req_len = clamp_t(unsigned int, adb_rx_req_len,
+				  BULK_BUFFER_SIZE, BULK_BUFFER_SIZE_MAX) & ~511;
+
 	/* now allocate requests for our endpoints */
-	req = adb_request_new(dev->ep_out, BULK_BUFFER_SIZE);
+	req = usb_ep_alloc_request(dev->ep_out, GFP_KERNEL);
 	if (!req)
 		goto fail;
 	req->complete = adb_complete_out;
 	dev->rx_req = req;
+	dev->rx_order = get_order(dev->rx_req_len);
+	if (adb_rx_buf_alloc(dev))
+		goto fail;
 
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = adb_request_new(dev->ep_in, BULK_BUFFER_SIZE);
+	for (i = 0; i < dev->tx_reqs; i++) {
+		req = adb_request_new(dev->ep_in, dev->tx_req_len);
 		if (!req)
 			goto fail;
 		req->complete = adb_complete_in;
@@ -269,50 +375,57 @@ fail:
 	return -1;
 }
 
-static ssize_t adb_read(struct file *fp, char __user *buf,
-				size_t count, loff_t *pos)
+static inline void adb_account(s64 *usecs, ktime_t start)
 {
-	struct adb_dev *dev = fp->private_data;
-	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *req;
-	int r = count, xfer;
-	int ret;
-
-	DBG(cdev, "adb_read(%d)\n", count);
-
-	if (count > BULK_BUFFER_SIZE)
-		return -EINVAL;
+	*usecs += ktime_to_us(ktime_sub(ktime_get(), start));
+}
 
-	if (_lock(&dev->read_excl))
-		return -EBUSY;
+/* Wait for the function to come online.  Called with read_excl held. */
+static int adb_wait_online(struct adb_dev *dev)
+{
+	int ret;
 
-	/* we will block until we're online */
 	while (!(atomic_read(&dev->online) || atomic_read(&dev->error))) {
-		DBG(cdev, "adb_read: waiting for online state\n");
+		DBG(dev->cdev, "adb_read: waiting for online state\n");
 		ret = wait_event_interruptible(dev->read_wq,
 			(atomic_read(&dev->online) ||
 			atomic_read(&dev->error)));
-		if (ret < 0) {
-			_unlock(&dev->read_excl);
+		if (ret < 0)
 			return ret;
-		}
 	}
-	if (atomic_read(&dev->error)) {
-		r = -EIO;
-		goto done;
+	if (atomic_read(&dev->error))
+		return -EIO;
+	return 0;
+}
+
+/* Make sure there is received data at dev->rx_off: unless some of the
+ * last transfer is left, queue the OUT request for exactly @count bytes
+ * and wait for it. Returns the number of bytes available, at most @count.
+ */
+static int adb_rx_req(struct adb_dev *dev, size_t count)
+{
+	struct usb_composite_dev *cdev = dev->cdev;
+	struct usb_request *req = dev->rx_req;
+	int ret;
+
+	if (dev->rx_avail)
+		return min_t(size_t, count, dev->rx_avail);
+
+	if (adb_rx_buf_busy(dev)) {
+		adb_rx_buf_free(dev);
+		if (adb_rx_buf_alloc(dev))
+			return -ENOMEM;
 	}
 
 requeue_req:
 	/* queue a request */
-	req = dev->rx_req;
 	req->length = count;
 	dev->rx_done = 0;
 	ret = usb_ep_queue(dev->ep_out, req, GFP_ATOMIC);
 	if (ret < 0) {
 		DBG(cdev, "adb_read: failed to queue req %p (%d)\n", req, ret);
-		r = -EIO;
 		atomic_set(&dev->error, 1);
-		goto done;
+		return -EIO;
 	} else {
 		DBG(cdev, "rx %p queue\n", req);
 	}
@@ -321,21 +434,57 @@ requeue_req:
 	ret = wait_event_interruptible(dev->read_wq, dev->rx_done);
 	if (ret < 0) {
 		atomic_set(&dev->error, 1);
-		r = ret;
 		usb_ep_fifo_flush(dev->ep_out);
-		goto done;
+		return ret;
 	}
-	if (!atomic_read(&dev->error)) {
-		/* If we got a 0-len packet, throw it back and try again. */
-		if (req->actual == 0)
-			goto requeue_req;
-
-		DBG(cdev, "rx %p %d\n", req, req->actual);
-		xfer = (req->actual < count) ? req->actual : count;
-		if (copy_to_user(buf, req->buf, xfer))
+	if (atomic_read(&dev->error))
+		return -EIO;
+
+	/* If we got a 0-len packet, throw it back and try again. */
+	if (req->actual == 0)
+		goto requeue_req;
+
+	DBG(cdev, "rx %p %d\n", req, req->actual);
+	dev->rx_off = 0;
+	dev->rx_avail = req->actual;
+	return min_t(size_t, count, dev->rx_avail);
+}
+
+static void adb_rx_consume(struct adb_dev *dev, size_t count)
+{
+	dev->rx_off += count;
+	dev->rx_avail -= count;
+}
+
+static ssize_t adb_read(struct file *fp, char __user *buf,
+				size_t count, loff_t *pos)
+{
+	struct adb_dev *dev = fp->private_data;
+	struct usb_composite_dev *cdev = dev->cdev;
+	ktime_t start;
+	int r;
+
+	DBG(cdev, "adb_read(%d)\n", count);
+
+	if (count > dev->rx_req_len)
+		return -EINVAL;
+
+	if (_lock(&dev->read_excl))
+		return -EBUSY;
+
+	r = adb_wait_online(dev);
+	if (r < 0)
+		goto done;
+
+	start = ktime_get();
+	r = adb_rx_req(dev, count);
+	if (r > 0) {
+		if (copy_to_user(buf, dev->rx_req->buf + dev->rx_off, r))
 			r = -EFAULT;
-	} else
-		r = -EIO;
+		else
+			adb_rx_consume(dev, r);
+	}
+	adb_account(&dev->rx_usecs, start);
 
 done:
 	_unlock(&dev->read_excl);
@@ -351,12 +500,14 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 	struct usb_request *req = 0;
 	int r = count, xfer;
 	int ret;
+	ktime_t start;
 
 	DBG(cdev, "adb_write(%d)\n", count);
 
 	if (_lock(&dev->write_excl))
 		return -EBUSY;
 
+	start = ktime_get();
 	while (count > 0) {
 		if (atomic_read(&dev->error)) {
 			DBG(cdev, "adb_write dev->error\n");
@@ -376,8 +527,8 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 		}
 
 		if (req != 0) {
-			if (count > BULK_BUFFER_SIZE)
-				xfer = BULK_BUFFER_SIZE;
+			if (count > dev->tx_req_len)
+				xfer = dev->tx_req_len;
 			else
 				xfer = count;
 			if (copy_from_user(req->buf, buf, xfer)) {
@@ -405,11 +556,198 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 	if (req)
 		req_put(dev, &dev->tx_idle, req);
 
+	adb_account(&dev->tx_usecs, start);
 	_unlock(&dev->write_excl);
 	DBG(cdev, "adb_write returning %d\n", r);
 	return r;
 }
 
+static void adb_spd_release_page(struct splice_pipe_desc *spd, unsigned int i)
+{
+	put_page(spd->pages[i]);
+}
+
+static const struct pipe_buf_operations adb_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = generic_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+/* Hand the pages of the received OUT transfer to @pipe, without copying,
+ * e.g. for adbd to splice a pushed file straight into the page cache.
+ * Whatever the pipe has no room for is kept for the next read.
+ */
+static ssize_t adb_splice_read(struct file *fp, loff_t *ppos,
+			       struct pipe_inode_info *pipe, size_t len,
+			       unsigned int flags)
+{
+	struct adb_dev *dev = fp->private_data;
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.flags = flags,
+		.ops = &adb_pipe_buf_ops,
+		.spd_release = adb_spd_release_page,
+	};
+	ktime_t start;
+	size_t this_len, off, end;
+	ssize_t r;
+
+	len = min_t(size_t, len, dev->rx_req_len);
+	if (!len)
+		return 0;
+
+	if (_lock(&dev->read_excl))
+		return -EBUSY;
+
+	r = adb_wait_online(dev);
+	if (r < 0)
+		goto done;
+
+	start = ktime_get();
+	r = adb_rx_req(dev, len);
+	if (r <= 0)
+		goto account;
+
+	end = dev->rx_off + r;
+	for (off = dev->rx_off; off < end && spd.nr_pages < PIPE_DEF_BUFFERS;
+	     off += this_len) {
+		struct page *page = dev->rx_page + (off >> PAGE_SHIFT);
+
+		this_len = min_t(size_t, end - off,
+				 PAGE_SIZE - (off & ~PAGE_MASK));
+		get_page(page);
+		pages[spd.nr_pages] = page;
+		partial[spd.nr_pages].offset = off & ~PAGE_MASK;
+		partial[spd.nr_pages].len = this_len;
+		spd.nr_pages++;
+	}
+
+	r = splice_to_pipe(pipe, &spd);
+	if (r > 0) {
+		adb_rx_consume(dev, r);
+		dev->splice_rx_bytes += r;
+	}
+account:
+	adb_account(&dev->rx_usecs, start);
+done:
+	_unlock(&dev->read_excl);
+	return r;
+}
+
+struct adb_splice_state {
+	struct adb_dev *dev;
+	struct usb_request *req;
+};
+
+static int adb_queue_tx(struct adb_dev *dev, struct usb_request *req)
+{
+	int ret;
+
+	ret = usb_ep_queue(dev->ep_in, req, GFP_ATOMIC);
+	if (ret < 0) {
+		DBG(dev->cdev, "adb_splice_write: xfer error %d\n", ret);
+		atomic_set(&dev->error, 1);
+		req_put(dev, &dev->tx_idle, req);
+		return -EIO;
+	}
+	return 0;
+}
+
+/* splice actor: pack pipe buffers into full IN requests */
+static int adb_pipe_to_req(struct pipe_inode_info *pipe,
+			   struct pipe_buffer *buf, struct splice_desc *sd)
+{
+	struct adb_splice_state *st = sd->u.data;
+	struct adb_dev *dev = st->dev;
+	struct usb_request *req;
+	unsigned int this_len;
+	char *src;
+	int ret;
+
+	if (atomic_read(&dev->error))
+		return -EIO;
+
+	if (!st->req) {
+		ret = wait_event_interruptible(dev->write_wq,
+			((st->req = req_get(dev, &dev->tx_idle)) ||
+			 atomic_read(&dev->error)));
+		if (ret < 0)
+			return ret;
+		if (!st->req)
+			return -EIO;
+		st->req->length = 0;
+	}
+	req = st->req;
+
+	this_len = min_t(unsigned int, sd->len,
+			 dev->tx_req_len - req->length);
+	src = buf->ops->map(pipe, buf, 0);
+	memcpy(req->buf + req->length, src + buf->offset, this_len);
+	buf->ops->unmap(pipe, buf, src);
+	req->length += this_len;
+
+	if (req->length == dev->tx_req_len) {
+		st->req = NULL;
+		ret = adb_queue_tx(dev, req);
+		if (ret < 0)
+			return ret;
+	}
+	return this_len;
+}
+
+static ssize_t adb_splice_write(struct pipe_inode_info *pipe,
+				struct file *fp, loff_t *ppos, size_t len,
+				unsigned int flags)
+{
+	struct adb_dev *dev = fp->private_data;
+	struct adb_splice_state st = {
+		.dev = dev,
+		.req = NULL,
+	};
+	struct splice_desc sd = {
+		.total_len = len,
+		.flags = flags,
+		.pos = *ppos,
+		.u.data = &st,
+	};
+	ktime_t start;
+	ssize_t r;
+	int ret;
+
+	if (_lock(&dev->write_excl))
+		return -EBUSY;
+
+	start = ktime_get();
+	pipe_lock(pipe);
+	r = __splice_from_pipe(pipe, &sd, adb_pipe_to_req);
+	pipe_unlock(pipe);
+
+	/* send whatever is left over as a short transfer */
+	if (st.req) {
+		if (st.req->length && r > 0) {
+			ret = adb_queue_tx(dev, st.req);
+			if (ret < 0)
+				r = ret;
+		} else
+			req_put(dev, &dev->tx_idle, st.req);
+	}
+	if (r > 0) {
+		*ppos += r;
+		dev->splice_tx_bytes += r;
+	}
+
+	adb_account(&dev->tx_usecs, start);
+	_unlock(&dev->write_excl);
+	return r;
+}
+
 static int adb_open(struct inode *ip, struct file *fp)
 {
 	pr_debug("adb_open\n");
@@ -420,6 +758,8 @@ static int adb_open(struct inode *ip, struct file *fp)
 
 	/* clear the error latch */
 	atomic_set(&_adb_dev->error, 0);
+	/* and drop anything left from the last session */
+	_adb_dev->rx_avail = 0;
 
 	return 0;
 }
@@ -436,6 +776,8 @@ static struct file_operations adb_fops = {
 	.owner = THIS_MODULE,
 	.read = adb_read,
 	.write = adb_write,
+	.splice_read = adb_splice_read,
+	.splice_write = adb_splice_write,
 	.open = adb_open,
 	.release = adb_release,
 };
@@ -479,6 +821,86 @@ static struct miscdevice adb_enable_device = {
 	.fops = &adb_enable_fops,
 };
 
+#if defined(CONFIG_DEBUG_FS)
+/* throughput in KB/s */
+static unsigned long adb_kbps(u64 bytes, s64 usecs)
+{
+	if (usecs <= 0)
+		return 0;
+	return (unsigned long)div64_u64(bytes * 1000000ULL,
+					(u64)usecs * 1024);
+}
+
+static ssize_t adb_debugfs_stats_read(struct file *file, char __user *ubuf,
+				      size_t count, loff_t *ppos)
+{
+	struct adb_dev *dev = file->private_data;
+	char buf[512];
+	int temp;
+
+	temp = scnprintf(buf, sizeof(buf),
+		"tx requests: %u x %u bytes\n"
+		"rx request:  %u bytes\n"
+		"tx: %lu reqs %llu bytes (%llu spliced) %lu KB/s\n"
+		"rx: %lu reqs %llu bytes (%llu spliced) %lu KB/s\n",
+		dev->tx_reqs, dev->tx_req_len, dev->rx_req_len,
+		dev->tx_count, dev->tx_bytes, dev->splice_tx_bytes,
+		adb_kbps(dev->tx_bytes, dev->tx_usecs),
+		dev->rx_count, dev->rx_bytes, dev->splice_rx_bytes,
+		adb_kbps(dev->rx_bytes, dev->rx_usecs));
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, temp);
+}
+
+static ssize_t adb_debugfs_stats_reset(struct file *file,
+				       const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct adb_dev *dev = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	dev->rx_count = dev->tx_count = 0;
+	dev->rx_bytes = dev->tx_bytes = 0;
+	dev->splice_rx_bytes = dev->splice_tx_bytes = 0;
+	dev->rx_usecs = dev->tx_usecs = 0;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	return count;
+}
+
+static int adb_debugfs_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations adb_debugfs_stats_ops = {
+	.open = adb_debugfs_open,
+	.read = adb_debugfs_stats_read,
+	.write = adb_debugfs_stats_reset,
+};
+
+static void adb_debugfs_init(struct adb_dev *dev)
+{
+	struct dentry *root = android_debugfs_root();
+
+	if (!root)
+		return;
+	dev->debugfs_stats = debugfs_create_file("adb_stats", 0644, root,
+						 dev, &adb_debugfs_stats_ops);
+}
+
+static void adb_debugfs_remove(struct adb_dev *dev)
+{
+	debugfs_remove(dev->debugfs_stats);
+	dev->debugfs_stats = NULL;
+}
+#else
+static void adb_debugfs_init(struct adb_dev *dev) {}
+static void adb_debugfs_remove(struct adb_dev *dev) {}
+#endif
+
 static int
 adb_function_bind(struct usb_configuration *c, struct usb_function *f)
 {
@@ -524,7 +946,8 @@ adb_function_unbind(struct usb_configuration *c, struct usb_function *f)
 
 	spin_lock_irq(&dev->lock);
 
-	adb_request_free(dev->rx_req, dev->ep_out);
+	adb_rx_buf_free(dev);
+	usb_ep_free_request(dev->ep_out, dev->rx_req);
 	while ((req = req_get(dev, &dev->tx_idle)))
 		adb_request_free(req, dev->ep_in);
 
@@ -532,6 +955,7 @@ adb_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	atomic_set(&dev->error, 1);
 	spin_unlock_irq(&dev->lock);
 
+	adb_debugfs_remove(dev);
 	misc_deregister(&adb_device);
 	misc_deregister(&adb_enable_device);
 	kfree(_adb_dev);
@@ -632,6 +1056,7 @@ static int adb_bind_config(struct usb_configuration *c)
 	if (ret)
 		goto err3;
 
+	adb_debugfs_init(dev);
 	return 0;
 
 err3:
@@ -32,6 +32,10 @@
 #include <linux/file.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
 
 #include <linux/usb.h>
 #include <linux/usb_usual.h>
@@ -40,6 +44,7 @@
 #include <linux/usb/f_mtp.h>
 
 #define BULK_BUFFER_SIZE           16384
+#define BULK_BUFFER_SIZE_MAX       131072
 #define INTR_BUFFER_SIZE           28
 
 /* String IDs */
@@ -53,9 +58,29 @@
 #define STATE_ERROR                 4   /* error from completion routine */
 
 /* number of tx and rx requests to allocate */
-#define TX_REQ_MAX 4
+#define TX_REQ_DEFAULT 4
+#define TX_REQ_MAX 16
 #define RX_REQ_MAX 2
 
+/* number of completed file transfers kept for debugfs */
+#define MTP_XFER_HISTORY 8
+
+/* Request sizes and tx queue depth, sampled when the function binds.
+ * Larger requests fall back to BULK_BUFFER_SIZE if the buffers cannot
+ * be allocated.
+ */
+static unsigned int mtp_tx_req_len = BULK_BUFFER_SIZE;
+module_param(mtp_tx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_req_len, "size of each bulk IN request buffer");
+
+static unsigned int mtp_rx_req_len = BULK_BUFFER_SIZE;
+module_param(mtp_rx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_rx_req_len, "size of each bulk OUT request buffer");
+
+static unsigned int mtp_tx_reqs = TX_REQ_DEFAULT;
+module_param(mtp_tx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_reqs, "number of bulk IN requests");
+
 /* IO Thread commands */
 #define ANDROID_THREAD_QUIT				1
 #define ANDROID_THREAD_SEND_FILE		2
@@ -76,6 +101,13 @@
 
 static const char shortname[] = "mtp_usb";
 
+struct mtp_xfer_stat {
+	int		receive;	/* 0 for MTP_SEND_FILE */
+	int		result;
+	size_t		bytes;
+	s64		usecs;
+};
+
 struct mtp_dev {
 	struct usb_function function;
 	struct usb_composite_dev *cdev;
@@ -102,6 +134,11 @@ struct mtp_dev {
 	struct usb_request *intr_req;
 	int rx_done;
 
+	/* bulk request geometry chosen at bind time */
+	unsigned int tx_req_len;
+	unsigned int rx_req_len;
+	unsigned int tx_reqs;
+
 	/* synchronize access to interrupt endpoint */
 	struct mutex intr_mutex;
 	/* true if interrupt endpoint is busy */
@@ -118,6 +155,17 @@ struct mtp_dev {
 	struct completion			thread_wait;
 	/* result from current command */
 	int							thread_result;
+
+	/* file transfer throughput, see debugfs usb_mtp/status */
+	struct mtp_xfer_stat	xfer_hist[MTP_XFER_HISTORY];
+	unsigned int		xfer_hist_idx;
+	unsigned long		tx_files;
+	unsigned long		rx_files;
+	u64			tx_bytes;
+	u64			rx_bytes;
+	s64			tx_usecs;
+	s64			rx_usecs;
+	struct dentry		*debugfs_dent;
 };
 
 static struct usb_interface_descriptor mtp_interface_desc = {
@@ -438,21 +486,49 @@ static int __init create_bulk_endpoints(struct mtp_dev *dev,
 	ep->driver_data = dev;		/* claim the endpoint */
 	dev->ep_intr = ep;
 
+	dev->tx_req_len = clamp_t(unsigned int, mtp_tx_req_len,
+				  BULK_BUFFER_SIZE, BULK_BUFFER_SIZE_MAX);
+	dev->rx_req_len = clamp_t(unsigned int, mtp_rx_req_len,
+				  BULK_BUFFER_SIZE, BULK_BUFFER_SIZE_MAX);
+	/* mtp_send_file() needs one request on the wire while it
+	 * fills the next one
+	 */
+	dev->tx_reqs = clamp_t(unsigned int, mtp_tx_reqs, 2, TX_REQ_MAX);
+
 	/* now allocate requests for our endpoints */
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_in, BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+retry_tx_alloc:
+	for (i = 0; i < dev->tx_reqs; i++) {
+		req = mtp_request_new(dev->ep_in, dev->tx_req_len);
+		if (!req) {
+			if (dev->tx_req_len <= BULK_BUFFER_SIZE)
+				goto fail;
+			while ((req = req_get(dev, &dev->tx_idle)))
+				mtp_request_free(req, dev->ep_in);
+			dev->tx_req_len = BULK_BUFFER_SIZE;
+			dev->tx_reqs = TX_REQ_DEFAULT;
+			goto retry_tx_alloc;
+		}
 		req->complete = mtp_complete_in;
 		req_put(dev, &dev->tx_idle, req);
 	}
+retry_rx_alloc:
 	for (i = 0; i < RX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_out, BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+		req = mtp_request_new(dev->ep_out, dev->rx_req_len);
+		if (!req) {
+			if (dev->rx_req_len <= BULK_BUFFER_SIZE)
+				goto fail;
+			while (i-- > 0) {
+				mtp_request_free(dev->rx_req[i], dev->ep_out);
+				dev->rx_req[i] = NULL;
+			}
+			dev->rx_req_len = BULK_BUFFER_SIZE;
+			goto retry_rx_alloc;
+		}
 		req->complete = mtp_complete_out;
 		dev->rx_req[i] = req;
 	}
+	DBG(cdev, "tx %u x %u bytes, rx %u x %u bytes\n", dev->tx_reqs,
+		dev->tx_req_len, RX_REQ_MAX, dev->rx_req_len);
 	req = mtp_request_new(dev->ep_intr, INTR_BUFFER_SIZE);
 	if (!req)
 		goto fail;
@@ -477,7 +553,7 @@ static ssize_t mtp_read(struct file *fp, char __user *buf,
 
 	DBG(cdev, "mtp_read(%d)\n", count);
 
-	if (count > BULK_BUFFER_SIZE)
+	if (count > dev->rx_req_len)
 		return -EINVAL;
 
 	/* we will block until we're online */
@@ -584,8 +660,8 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 			break;
 		}
 
-		if (count > BULK_BUFFER_SIZE)
-			xfer = BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 		if (copy_from_user(req->buf, buf, xfer)) {
@@ -622,16 +698,43 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 	return r;
 }
 
+/* Start reading [offset, offset + count) into the page cache without
+ * waiting for it, so the next vfs_read() in mtp_send_file() finds its
+ * data cached while the previous requests are still on the wire.
+ */
+static void mtp_prefetch(struct file *filp, loff_t offset, size_t count)
+{
+	struct address_space *mapping = filp->f_mapping;
+	pgoff_t index, end;
+
+	if (!count || !mapping || !mapping->a_ops->readpage)
+		return;
+
+	index = offset >> PAGE_CACHE_SHIFT;
+	end = (offset + count - 1) >> PAGE_CACHE_SHIFT;
+	force_page_cache_readahead(mapping, filp, index, end - index + 1);
+}
+
 static int mtp_send_file(struct mtp_dev *dev, struct file *filp,
 	loff_t offset, size_t count)
 {
 	struct usb_composite_dev *cdev = dev->cdev;
 	struct usb_request *req = 0;
 	int r = count, xfer, ret;
+	/* keep two requests' worth of file data read ahead of us */
+	size_t window = 2 * dev->tx_req_len;
+	loff_t ra_end = offset;
 
 	DBG(cdev, "mtp_send_file(%lld %d)\n", offset, count);
 
 	while (count > 0) {
+		if (ra_end - offset < dev->tx_req_len) {
+			size_t ra_len = offset + min(count, window) - ra_end;
+
+			mtp_prefetch(filp, ra_end, ra_len);
+			ra_end += ra_len;
+		}
+
 		/* get an idle tx request to use */
 		req = 0;
 		ret = wait_event_interruptible(dev->write_wq,
@@ -642,8 +745,8 @@ static int mtp_send_file(struct mtp_dev *dev, struct file *filp,
 			break;
 		}
 
-		if (count > BULK_BUFFER_SIZE)
-			xfer = BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 		ret = vfs_read(filp, req->buf, xfer, &offset);
@@ -692,8 +795,8 @@ static int mtp_receive_file(struct mtp_dev *dev, struct file *filp,
 			read_req = dev->rx_req[cur_buf];
 			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
 
-			read_req->length = (count > BULK_BUFFER_SIZE
-					? BULK_BUFFER_SIZE : count);
+			read_req->length = (count > dev->rx_req_len
+					? dev->rx_req_len : count);
 			dev->rx_done = 0;
 			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
 			if (ret < 0) {
@@ -735,11 +838,40 @@ static int mtp_receive_file(struct mtp_dev *dev, struct file *filp,
 	return r;
 }
 
+static void mtp_xfer_stat_add(struct mtp_dev *dev, int receive,
+	size_t bytes, int result, ktime_t start)
+{
+	struct mtp_xfer_stat *st;
+	s64 usecs = ktime_to_us(ktime_sub(ktime_get(), start));
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	st = &dev->xfer_hist[dev->xfer_hist_idx];
+	dev->xfer_hist_idx = (dev->xfer_hist_idx + 1) % MTP_XFER_HISTORY;
+	st->receive = receive;
+	st->result = result;
+	st->bytes = bytes;
+	st->usecs = usecs;
+	if (result >= 0) {
+		if (receive) {
+			dev->rx_files++;
+			dev->rx_bytes += bytes;
+			dev->rx_usecs += usecs;
+		} else {
+			dev->tx_files++;
+			dev->tx_bytes += bytes;
+			dev->tx_usecs += usecs;
+		}
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+}
+
 /* Kernel thread for handling file IO operations */
 static int mtp_thread(void *data)
 {
 	struct mtp_dev *dev = (struct mtp_dev *)data;
 	struct usb_composite_dev *cdev = dev->cdev;
+	ktime_t start;
 	int flags;
 
 	DBG(cdev, "mtp_thread started\n");
@@ -766,16 +898,21 @@ static int mtp_thread(void *data)
 		else
 			flags = O_WRONLY | O_LARGEFILE | O_CREAT;
 
+		start = ktime_get();
 		if (dev->thread_command == ANDROID_THREAD_SEND_FILE) {
 			dev->thread_result = mtp_send_file(dev,
 				dev->thread_file,
 				dev->thread_file_offset,
 				dev->thread_file_length);
+			mtp_xfer_stat_add(dev, 0, dev->thread_file_length,
+				dev->thread_result, start);
 		} else {
 			dev->thread_result = mtp_receive_file(dev,
 				dev->thread_file,
 				dev->thread_file_offset,
 				dev->thread_file_length);
+			mtp_xfer_stat_add(dev, 1, dev->thread_file_length,
+				dev->thread_result, start);
 		}
 
 		if (dev->thread_file) {
@@ -973,6 +1110,114 @@ static struct miscdevice mtp_device = {
 	.fops = &mtp_fops,
 };
 
+#if defined(CONFIG_DEBUG_FS)
+static char debug_buffer[PAGE_SIZE];
+
+/* throughput in KB/s */
+static unsigned long mtp_kbps(u64 bytes, s64 usecs)
+{
+	if (usecs <= 0)
+		return 0;
+	return (unsigned long)div64_u64(bytes * 1000000ULL,
+					(u64)usecs * 1024);
+}
+
+static ssize_t debug_read_stats(struct file *file, char __user *ubuf,
+		size_t count, loff_t *ppos)
+{
+	struct mtp_dev *dev = file->private_data;
+	char *buf = debug_buffer;
+	int temp = 0;
+	unsigned long flags;
+	unsigned int i, idx;
+	struct mtp_xfer_stat *st;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	temp += scnprintf(buf + temp, PAGE_SIZE - temp,
+			"tx requests: %u x %u bytes\n"
+			"rx requests: %u x %u bytes\n"
+			"files sent:     %lu (%llu bytes, %lu KB/s)\n"
+			"files received: %lu (%llu bytes, %lu KB/s)\n"
+			"last transfers:\n",
+			dev->tx_reqs, dev->tx_req_len,
+			RX_REQ_MAX, dev->rx_req_len,
+			dev->tx_files, dev->tx_bytes,
+			mtp_kbps(dev->tx_bytes, dev->tx_usecs),
+			dev->rx_files, dev->rx_bytes,
+			mtp_kbps(dev->rx_bytes, dev->rx_usecs));
+	for (i = 0; i < MTP_XFER_HISTORY; i++) {
+		idx = (dev->xfer_hist_idx + i) % MTP_XFER_HISTORY;
+		st = &dev->xfer_hist[idx];
+		if (!st->usecs)
+			continue;
+		temp += scnprintf(buf + temp, PAGE_SIZE - temp,
+			"  %s %zu bytes in %lld us (%lu KB/s) result %d\n",
+			st->receive ? "rx" : "tx", st->bytes, st->usecs,
+			mtp_kbps(st->bytes, st->usecs), st->result);
+	}
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, temp);
+}
+
+static ssize_t debug_reset_stats(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct mtp_dev *dev = file->private_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	memset(dev->xfer_hist, 0, sizeof(dev->xfer_hist));
+	dev->xfer_hist_idx = 0;
+	dev->tx_files = dev->rx_files = 0;
+	dev->tx_bytes = dev->rx_bytes = 0;
+	dev->tx_usecs = dev->rx_usecs = 0;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	return count;
+}
+
+static int debug_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations debug_fmtp_ops = {
+	.open = debug_open,
+	.read = debug_read_stats,
+	.write = debug_reset_stats,
+};
+
+static void mtp_debugfs_init(struct mtp_dev *dev)
+{
+	struct dentry *dent;
+
+	dent = debugfs_create_dir("usb_mtp", 0);
+	if (IS_ERR_OR_NULL(dent))
+		return;
+
+	debugfs_create_file("status", 0644, dent, dev, &debug_fmtp_ops);
+	dev->debugfs_dent = dent;
+}
+
+static void mtp_debugfs_remove(struct mtp_dev *dev)
+{
+	debugfs_remove_recursive(dev->debugfs_dent);
+	dev->debugfs_dent = NULL;
+}
+#else
+static void mtp_debugfs_init(struct mtp_dev *dev)
+{
+	return;
+}
+
+static void mtp_debugfs_remove(struct mtp_dev *dev)
+{
+	return;
+}
+#endif
+
 static int
 mtp_function_bind(struct usb_configuration *c, struct usb_function *f)
 {
@@ -1027,6 +1272,7 @@ mtp_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	spin_unlock_irq(&dev->lock);
 	wake_up(&dev->intr_wq);
 
+	mtp_debugfs_remove(dev);
 	misc_deregister(&mtp_device);
 	kfree(_mtp_dev);
 	_mtp_dev = NULL;
@@ -1249,6 +1495,7 @@ static int mtp_bind_config(struct usb_configuration *c)
 	if (ret)
 		goto err2;
 
+	mtp_debugfs_init(dev);
 	return 0;
 
 err2:
@@ -51,6 +51,8 @@ extern const char *yaffs_guts_c_version;
 #include <linux/interrupt.h>
 #include <linux/string.h>
 #include <linux/ctype.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 
 #include "asm/div64.h"
 
@@ -121,16 +123,25 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
+unsigned int yaffs_bg_gc = 1;
+unsigned int yaffs_cache_chunks = 128;
+unsigned int yaffs_refresh_bitflips = 3;
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 module_param(yaffs_traceMask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
+module_param(yaffs_bg_gc, uint, 0644);
+module_param(yaffs_cache_chunks, uint, 0644);
+module_param(yaffs_refresh_bitflips, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
 MODULE_PARM(yaffs_auto_checkpoint, "i");
+MODULE_PARM(yaffs_bg_gc, "i");
+MODULE_PARM(yaffs_cache_chunks, "i");
+MODULE_PARM(yaffs_refresh_bitflips, "i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25))
@@ -369,19 +380,259 @@ static const struct super_operations yaffs_super_ops = {
 	.write_super = yaffs_write_super,
 };
 
-static void yaffs_GrossLock(yaffs_Device *dev)
+/* The gross lock serializes everything that touches yaffs_guts. Wait and
+ * hold times are accounted here and reported in /proc/yaffs, together
+ * with the caller of the longest hold.
+ */
+static noinline void yaffs_GrossLock(yaffs_Device *dev)
 {
+	ktime_t start = ktime_get();
+	int contended = 0;
+	__u32 waited;
+
 	T(YAFFS_TRACE_OS, ("yaffs locking %p\n", current));
-	down(&dev->grossLock);
+	if (down_trylock(&dev->grossLock)) {
+		down(&dev->grossLock);
+		contended = 1;
+	}
 	T(YAFFS_TRACE_OS, ("yaffs locked %p\n", current));
+
+	dev->grossLockedAt = ktime_get();
+	dev->grossLockHolder = __builtin_return_address(0);
+	waited = ktime_us_delta(dev->grossLockedAt, start);
+
+	dev->grossLocks++;
+	dev->grossLockContended += contended;
+	dev->grossWaitTotal += waited;
+	if (waited > dev->grossWaitMax)
+		dev->grossWaitMax = waited;
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
+	__u32 held = ktime_us_delta(ktime_get(), dev->grossLockedAt);
+
+	dev->grossHoldTotal += held;
+	if (held > dev->grossHoldMax) {
+		dev->grossHoldMax = held;
+		dev->grossHoldMaxAt = dev->grossLockHolder;
+	}
+
 	T(YAFFS_TRACE_OS, ("yaffs unlocking %p\n", current));
 	up(&dev->grossLock);
 }
 
+/*-----------------------------------------------------------------*/
+/* Object data I/O is serialized per object by a hashed I/O lock, while
+ * the gross lock is only held for one chunk at a time. Long transfers and
+ * gc slices then interleave with operations on other objects instead of
+ * holding them off until done.
+ *
+ * Lock order is page lock, I/O lock, gross lock.
+ */
+
+static struct mutex *yaffs_ObjectIOLock(yaffs_Object *obj)
+{
+	return &obj->myDev->ioLock[obj->objectId & (YAFFS_N_IO_LOCKS - 1)];
+}
+
+static int yaffs_ReadObjectData(yaffs_Object *obj, __u8 *buffer,
+				loff_t offset, int nBytes)
+{
+	yaffs_Device *dev = obj->myDev;
+	int nDone = 0;
+	int n;
+
+	dev->bgGcLastIo = jiffies;
+
+	while (nDone < nBytes) {
+		n = min(nBytes - nDone, dev->nDataBytesPerChunk);
+
+		yaffs_GrossLock(dev);
+		n = yaffs_ReadDataFromFile(obj, buffer + nDone,
+					offset + nDone, n);
+		yaffs_GrossUnlock(dev);
+
+		if (n <= 0)
+			break;
+		nDone += n;
+	}
+
+	return nDone;
+}
+
+static int yaffs_WriteObjectData(yaffs_Object *obj, const __u8 *buffer,
+				loff_t offset, int nBytes)
+{
+	yaffs_Device *dev = obj->myDev;
+	int nDone = 0;
+	int n, nWritten;
+
+	dev->bgGcLastIo = jiffies;
+
+	while (nDone < nBytes) {
+		n = min(nBytes - nDone, dev->nDataBytesPerChunk);
+
+		yaffs_GrossLock(dev);
+		nWritten = yaffs_WriteDataToFile(obj, buffer + nDone,
+					offset + nDone, n, 0);
+		yaffs_GrossUnlock(dev);
+
+		if (nWritten > 0)
+			nDone += nWritten;
+		if (nWritten != n)
+			break;
+	}
+
+	return nDone;
+}
+
+/* Reclaim space ahead of a write, so that the write itself does not have
+ * to collect a whole block with the gross lock held. Normally that is
+ * left to the background thread; only once writes would collect inline
+ * is it done here, in slices, and accounted as a write stall. gcLock
+ * keeps the collectors from working on top of each other.
+ */
+#define YAFFS_GC_SLICES_MAX	16
+
+static void yaffs_GarbageCollectAhead(yaffs_Device *dev)
+{
+	int slices = 0;
+	int urgency;
+	int more = 1;
+	ktime_t start;
+
+	yaffs_GrossLock(dev);
+	urgency = yaffs_GcUrgency(dev);
+	yaffs_GrossUnlock(dev);
+
+	if (urgency < YAFFS_GC_URGENCY_SOON)
+		return;
+
+	if (dev->bgGcThread) {
+		wake_up_process(dev->bgGcThread);
+		if (urgency < YAFFS_GC_URGENCY_NOW)
+			return;
+	}
+
+	start = ktime_get();
+
+	mutex_lock(&dev->gcLock);
+	while (more && slices++ < YAFFS_GC_SLICES_MAX) {
+		yaffs_GrossLock(dev);
+		urgency = yaffs_GcUrgency(dev);
+		more = urgency >= YAFFS_GC_URGENCY_SOON &&
+			yaffs_GarbageCollectSlice(dev, urgency, 0);
+		yaffs_GrossUnlock(dev);
+	}
+	mutex_unlock(&dev->gcLock);
+
+	yaffs_GrossLock(dev);
+	yaffs_AccountGcStall(dev, ktime_us_delta(ktime_get(), start));
+	yaffs_GrossUnlock(dev);
+}
+
+/* Background gc thread, one per mount.
+ * Collects in slices, dropping the locks in between, and paces itself by
+ * urgency. Blocks that are mostly garbage are only collected once the
+ * mount has seen no data I/O for YAFFS_BG_IDLE_DELAY.
+ */
+#define YAFFS_BG_IDLE_DELAY	(HZ / 2)
+
+static long yaffs_BackgroundGcTimeout(yaffs_Device *dev, int urgency)
+{
+	switch (urgency) {
+	case YAFFS_GC_URGENCY_NOW:
+		return 0;
+	case YAFFS_GC_URGENCY_SOON:
+		return HZ / 50;
+	case YAFFS_GC_URGENCY_IDLE:
+		if (time_before(jiffies, dev->bgGcLastIo + YAFFS_BG_IDLE_DELAY))
+			return YAFFS_BG_IDLE_DELAY;
+		return HZ / 10;
+	default:
+		return 5 * HZ;
+	}
+}
+
+static int yaffs_BackgroundGc(void *data)
+{
+	yaffs_Device *dev = data;
+	int urgency;
+	int more;
+	long timeout;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		try_to_freeze();
+
+		more = 0;
+		mutex_lock(&dev->gcLock);
+		yaffs_GrossLock(dev);
+		urgency = yaffs_GcUrgency(dev);
+		if (urgency != YAFFS_GC_URGENCY_IDLE ||
+		    time_after_eq(jiffies, dev->bgGcLastIo + YAFFS_BG_IDLE_DELAY))
+			more = yaffs_GarbageCollectSlice(dev, urgency, 1);
+		yaffs_GrossUnlock(dev);
+		mutex_unlock(&dev->gcLock);
+
+		/* nothing could be collected, don't spin on it */
+		if (!more && urgency == YAFFS_GC_URGENCY_NOW)
+			urgency = YAFFS_GC_URGENCY_SOON;
+		else if (!more && dev->gcBlock <= 0 &&
+			 urgency == YAFFS_GC_URGENCY_IDLE)
+			urgency = YAFFS_GC_URGENCY_NONE;
+
+		timeout = yaffs_BackgroundGcTimeout(dev, urgency);
+		if (!timeout) {
+			cond_resched();
+			continue;
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule_timeout(timeout);
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static void yaffs_StartBackgroundGc(struct super_block *sb, yaffs_Device *dev)
+{
+	struct task_struct *task;
+
+	if (!yaffs_bg_gc)
+		return;
+
+	task = kthread_run(yaffs_BackgroundGc, dev, "yaffs-bg-%s", sb->s_id);
+	if (IS_ERR(task)) {
+		T(YAFFS_TRACE_ALWAYS,
+			("yaffs: could not start background gc, %ld\n",
+			PTR_ERR(task)));
+		return;
+	}
+
+	yaffs_GrossLock(dev);
+	dev->bgGcThread = task;
+	dev->bgGcRunning = 1;
+	yaffs_GrossUnlock(dev);
+}
+
+static void yaffs_StopBackgroundGc(yaffs_Device *dev)
+{
+	if (!dev->bgGcThread)
+		return;
+
+	kthread_stop(dev->bgGcThread);
+
+	yaffs_GrossLock(dev);
+	dev->bgGcThread = NULL;
+	dev->bgGcRunning = 0;
+	yaffs_GrossUnlock(dev);
+}
+
 
 /*-----------------------------------------------------------------*/
 /* Directory search context allows us to unlock access to yaffs during
@@ -744,13 +995,11 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
-
-	ret = yaffs_ReadDataFromFile(obj, pg_buf,
+	mutex_lock(yaffs_ObjectIOLock(obj));
+	ret = yaffs_ReadObjectData(obj, pg_buf,
 				pg->index << PAGE_CACHE_SHIFT,
 				PAGE_CACHE_SIZE);
-
-	yaffs_GrossUnlock(dev);
+	mutex_unlock(yaffs_ObjectIOLock(obj));
 
 	if (ret >= 0)
 		ret = 0;
@@ -829,7 +1078,7 @@ static int yaffs_writepage(struct page *page)
 	buffer = kmap(page);
 
 	obj = yaffs_InodeToObject(inode);
-	yaffs_GrossLock(obj->myDev);
+	mutex_lock(yaffs_ObjectIOLock(obj));
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_writepage at %08x, size %08x\n",
@@ -838,14 +1087,14 @@ static int yaffs_writepage(struct page *page)
 		("writepag0: obj = %05x, ino = %05x\n",
 		(int)obj->variant.fileVariant.fileSize, (int)inode->i_size));
 
-	nWritten = yaffs_WriteDataToFile(obj, buffer,
-			page->index << PAGE_CACHE_SHIFT, nBytes, 0);
+	nWritten = yaffs_WriteObjectData(obj, buffer,
+			page->index << PAGE_CACHE_SHIFT, nBytes);
 
 	T(YAFFS_TRACE_OS,
 		("writepag1: obj = %05x, ino = %05x\n",
 		(int)obj->variant.fileVariant.fileSize, (int)inode->i_size));
 
-	yaffs_GrossUnlock(obj->myDev);
+	mutex_unlock(yaffs_ObjectIOLock(obj));
 
 	kunmap(page);
 	SetPageUptodate(page);
@@ -1161,7 +1410,7 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 
 	dev = obj->myDev;
 
-	yaffs_GrossLock(dev);
+	mutex_lock(yaffs_ObjectIOLock(obj));
 
 	inode = f->f_dentry->d_inode;
 
@@ -1179,7 +1428,7 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 			"to object %d at %d\n",
 			n, obj->objectId, ipos));
 
-	nWritten = yaffs_WriteDataToFile(obj, buf, ipos, n, 0);
+	nWritten = yaffs_WriteObjectData(obj, buf, ipos, n);
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_file_write writing %zu bytes, %d written at %d\n",
@@ -1199,7 +1448,7 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 		}
 
 	}
-	yaffs_GrossUnlock(dev);
+	mutex_unlock(yaffs_ObjectIOLock(obj));
 	return (nWritten == 0) && (n > 0) ? -ENOSPC : nWritten;
 }
 
@@ -1219,6 +1468,8 @@ static ssize_t yaffs_hold_space(struct file *f)
 
 	dev = obj->myDev;
 
+	yaffs_GarbageCollectAhead(dev);
+
 	yaffs_GrossLock(dev);
 
 	nFreeChunks = yaffs_GetNumberOfFreeChunks(dev);
@@ -1656,7 +1907,9 @@ static int yaffs_setattr(struct dentry *dentry, struct iattr *attr)
 
 	error = inode_change_ok(inode, attr);
 	if (error == 0) {
+		/* a size change must not interleave with data I/O */
 		dev = yaffs_InodeToObject(inode)->myDev;
+		mutex_lock(yaffs_ObjectIOLock(yaffs_InodeToObject(inode)));
 		yaffs_GrossLock(dev);
 		if (yaffs_SetAttributes(yaffs_InodeToObject(inode), attr) ==
 				YAFFS_OK) {
@@ -1665,6 +1918,7 @@ static int yaffs_setattr(struct dentry *dentry, struct iattr *attr)
 			error = -EPERM;
 		}
 		yaffs_GrossUnlock(dev);
+		mutex_unlock(yaffs_ObjectIOLock(yaffs_InodeToObject(inode)));
 		if (!error)
 			error = inode_setattr(inode, attr);
 	}
@@ -1867,6 +2121,8 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 		T(YAFFS_TRACE_OS,
 			("yaffs_remount_fs: %s: RO\n", dev->name));
 
+		yaffs_StopBackgroundGc(dev);
+
 		yaffs_GrossLock(dev);
 
 		yaffs_FlushEntireDeviceCache(dev);
@@ -1880,6 +2136,9 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 	} else {
 		T(YAFFS_TRACE_OS,
 			("yaffs_remount_fs: %s: RW\n", dev->name));
+
+		if (!dev->bgGcThread)
+			yaffs_StartBackgroundGc(sb, dev);
 	}
 
 	return 0;
@@ -1892,6 +2151,8 @@ static void yaffs_put_super(struct super_block *sb)
 
 	T(YAFFS_TRACE_OS, ("yaffs_put_super\n"));
 
+	yaffs_StopBackgroundGc(dev);
+
 	yaffs_GrossLock(dev);
 
 	yaffs_FlushEntireDeviceCache(dev);
@@ -1944,6 +2205,8 @@ typedef struct {
 	int no_cache;
 	int empty_lost_and_found_overridden;
 	int empty_lost_and_found;
+	int no_summary;
+	int summary;
 } yaffs_options;
 
 #define MAX_OPT_LEN 20
@@ -1987,6 +2250,10 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 		} else if (!strcmp(cur_opt, "empty-lost-and-found-enable")) {
 			options->empty_lost_and_found = 1;
 			options->empty_lost_and_found_overridden = 1;
+		} else if (!strcmp(cur_opt, "no-summary")) {
+			options->no_summary = 1;
+		} else if (!strcmp(cur_opt, "summary")) {
+			options->summary = 1;
 		} else {
 			printk(KERN_INFO "yaffs: Bad mount option \"%s\"\n",
 					cur_opt);
@@ -2002,6 +2269,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 						void *data, int silent)
 {
 	int nBlocks;
+	int i;
+	ktime_t mountStart;
 	struct inode *inode = NULL;
 	struct dentry *root;
 	yaffs_Device *dev = 0;
@@ -2198,7 +2467,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	dev->nShortOpCaches = (options.no_cache) ? 0 : yaffs_cache_chunks;
 	dev->inbandTags = options.inband_tags;
 
 	/* ... and the functions. */
@@ -2209,6 +2478,12 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_ReadChunkWithTagsFromNAND;
 		dev->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		dev->queryNANDBlock = nandmtd2_QueryNANDBlock;
+		if (!options.inband_tags)
+			dev->readChunksFromNAND = nandmtd2_ReadChunksFromNAND;
+		if (mtd->block_bitflips) {
+			dev->queryBlockBitflips = nandmtd2_QueryBlockBitflips;
+			dev->refreshThreshold = yaffs_refresh_bitflips;
+		}
 		dev->spareBuffer = YMALLOC(mtd->oobsize);
 		dev->isYaffs2 = 1;
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
@@ -2257,6 +2532,14 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 
 	dev->skipCheckpointRead = options.skip_checkpoint_read;
 	dev->skipCheckpointWrite = options.skip_checkpoint_write;
+	dev->disableSummary = options.no_summary;
+#ifdef CONFIG_YAFFS_WRITE_SUMMARY
+	dev->writeSummary = 1;
+#endif
+	if (options.summary)
+		dev->writeSummary = 1;
+	if (options.no_summary)
+		dev->writeSummary = 0;
 
 	/* we assume this is protected by lock_kernel() in mount/umount */
 	ylist_add_tail(&dev->devList, &yaffs_dev_list);
@@ -2266,15 +2549,27 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         dev->removeObjectCallback = yaffs_RemoveObjectCallback;
 
 	init_MUTEX(&dev->grossLock);
+	mutex_init(&dev->gcLock);
+	for (i = 0; i < YAFFS_N_IO_LOCKS; i++)
+		mutex_init(&dev->ioLock[i]);
 
 	yaffs_GrossLock(dev);
 
+	mountStart = ktime_get();
 	err = yaffs_GutsInitialise(dev);
 
 	T(YAFFS_TRACE_OS,
 	  ("yaffs_read_super: guts initialised %s\n",
 	   (err == YAFFS_OK) ? "OK" : "FAILED"));
 
+	if (err == YAFFS_OK) {
+		dev->mountTime = ktime_to_ms(ktime_sub(ktime_get(), mountStart));
+		printk(KERN_INFO "yaffs: %s mounted in %u ms, %d chunks read, "
+			"%d blocks from summaries, %d scanned\n",
+			dev->name, dev->mountTime, dev->mountChunkReads,
+			dev->nSummaryBlocks, dev->nScannedBlocks);
+	}
+
 	/* Release lock before yaffs_get_inode() */
 	yaffs_GrossUnlock(dev);
 
@@ -2304,6 +2599,9 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs_read_super: isCheckpointed %d\n", dev->isCheckpointed));
 
+	if (!(sb->s_flags & MS_RDONLY))
+		yaffs_StartBackgroundGc(sb, dev);
+
 	T(YAFFS_TRACE_OS, ("yaffs_read_super: done\n"));
 	return sb;
 }
@@ -2407,6 +2705,8 @@ static struct proc_dir_entry *my_proc_entry;
 
 static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 {
+	__u64 avgWait, avgHold, avgStall, hitRatio;
+
 	buf += sprintf(buf, "startBlock......... %d\n", dev->startBlock);
 	buf += sprintf(buf, "endBlock........... %d\n", dev->endBlock);
 	buf += sprintf(buf, "totalBytesPerChunk. %d\n", dev->totalBytesPerChunk);
@@ -2428,6 +2728,15 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "garbageCollections. %d\n", dev->garbageCollections);
 	buf += sprintf(buf, "passiveGCs......... %d\n",
 		    dev->passiveGarbageCollections);
+	buf += sprintf(buf, "gcSlices........... %d\n", dev->gcSlices);
+	buf += sprintf(buf, "fgGCs.............. %d\n",
+		    dev->fgGarbageCollections);
+	buf += sprintf(buf, "bgGCs.............. %d\n",
+		    dev->bgGarbageCollections);
+	buf += sprintf(buf, "bgGcThread......... %s\n",
+		    dev->bgGcRunning ? "running" : "off");
+	buf += sprintf(buf, "gcQueueLength...... %d%s\n", dev->gcQueueLength,
+		    dev->gcQueueOverflow ? " (overflowed)" : "");
 	buf += sprintf(buf, "nRetriedWrites..... %d\n", dev->nRetriedWrites);
 	buf += sprintf(buf, "nShortOpCaches..... %d\n", dev->nShortOpCaches);
 	buf += sprintf(buf, "nRetireBlocks...... %d\n", dev->nRetiredBlocks);
@@ -2435,7 +2744,19 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "eccUnfixed......... %d\n", dev->eccUnfixed);
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
-	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "refreshThreshold... %d\n", dev->refreshThreshold);
+	buf += sprintf(buf, "nRefreshes......... %d%s\n", dev->nRefreshes,
+		    dev->refreshPending ? " (pending)" : "");
+	hitRatio = (__u64)dev->cacheHits * 100;
+	if (dev->cacheLookups)
+		do_div(hitRatio, dev->cacheLookups);
+	buf += sprintf(buf, "cacheSets x ways... %d x %d\n", dev->nCacheSets,
+		    dev->nCacheWays);
+	buf += sprintf(buf, "cacheLookups....... %d\n", dev->cacheLookups);
+	buf += sprintf(buf, "cacheHits.......... %d (%llu%%)\n", dev->cacheHits,
+		    hitRatio);
+	buf += sprintf(buf, "readaheadChunks.... %d\n", dev->raChunks);
+	buf += sprintf(buf, "readaheadNANDReads. %d\n", dev->raReads);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
@@ -2443,6 +2764,35 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "useNANDECC......... %d\n", dev->useNANDECC);
 	buf += sprintf(buf, "isYaffs2........... %d\n", dev->isYaffs2);
 	buf += sprintf(buf, "inbandTags......... %d\n", dev->inbandTags);
+	buf += sprintf(buf, "summaries.......... %s\n",
+		    dev->sumTags ? "on" : "off");
+	buf += sprintf(buf, "summaryWrites...... %d\n", dev->nSummaryWrites);
+	buf += sprintf(buf, "mountTime (ms)..... %u\n", dev->mountTime);
+	buf += sprintf(buf, "mountChunkReads.... %d\n", dev->mountChunkReads);
+	buf += sprintf(buf, "mountSummaryBlocks. %d\n", dev->nSummaryBlocks);
+	buf += sprintf(buf, "mountScannedBlocks. %d\n", dev->nScannedBlocks);
+
+	avgWait = dev->grossWaitTotal;
+	avgHold = dev->grossHoldTotal;
+	if (dev->grossLocks) {
+		do_div(avgWait, dev->grossLocks);
+		do_div(avgHold, dev->grossLocks);
+	}
+	buf += sprintf(buf, "grossLocks......... %u\n", dev->grossLocks);
+	buf += sprintf(buf, "lockContended...... %u\n",
+		    dev->grossLockContended);
+	buf += sprintf(buf, "lockWaitAvg (us)... %llu\n", avgWait);
+	buf += sprintf(buf, "lockWaitMax (us)... %u\n", dev->grossWaitMax);
+	buf += sprintf(buf, "lockHoldAvg (us)... %llu\n", avgHold);
+	buf += sprintf(buf, "lockHoldMax (us)... %u %pS\n", dev->grossHoldMax,
+		    dev->grossHoldMaxAt);
+
+	avgStall = dev->gcStallTotal;
+	if (dev->gcStalls)
+		do_div(avgStall, dev->gcStalls);
+	buf += sprintf(buf, "writeStalls........ %u\n", dev->gcStalls);
+	buf += sprintf(buf, "stallAvg (us)...... %llu\n", avgStall);
+	buf += sprintf(buf, "stallMax (us)...... %u\n", dev->gcStallMax);
 
 	return buf;
 }
@@ -104,6 +104,8 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId);
 
 static void yaffs_InvalidateCheckpoint(yaffs_Device *dev);
 
+static void yaffs_GcQueueUpdate(yaffs_Device *dev, int blockNo);
+
 static int yaffs_FindChunkInFile(yaffs_Object *in, int chunkInInode,
 				yaffs_ExtendedTags *tags);
 
@@ -918,6 +920,160 @@ static int yaffs_CheckChunkErased(struct yaffs_DeviceStruct *dev,
 
 }
 
+/*------------------------- Block summaries -------------------------------*/
+
+/* When summaries are written (dev->writeSummary, off by default since
+ * older yaffs2 takes the summary chunk for file data), the tags of every
+ * chunk written to the allocation block are collected in dev->sumTags. Once its data chunks are used up the
+ * summary goes into the block's last chunk. If a block was not started
+ * with summaries (e.g. resumed from a checkpoint) or a write to it fails,
+ * it is filled with data instead and gets scanned chunk by chunk.
+ * The summary chunk is never live: it counts as a discarded chunk, both
+ * here and in the scan, and goes away with the block.
+ */
+
+static int yaffs_SummaryBytes(yaffs_Device *dev)
+{
+	return sizeof(yaffs_SummaryHeader) +
+		(dev->nChunksPerBlock - 1) * sizeof(yaffs_SummaryTags);
+}
+
+static __u32 yaffs_SummarySum(const yaffs_SummaryTags *st, int nTags)
+{
+	const __u32 *p = (const __u32 *)st;
+	int n = nTags * sizeof(yaffs_SummaryTags) / sizeof(__u32);
+	__u32 sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum = ((sum << 1) | (sum >> 31)) ^ p[i];
+
+	return sum;
+}
+
+/* Chunks of the allocation block that may hold data */
+static int yaffs_DataChunksInBlock(yaffs_Device *dev)
+{
+	if (dev->sumTags && dev->sumBlock == dev->allocationBlock)
+		return dev->nChunksPerBlock - 1;
+	return dev->nChunksPerBlock;
+}
+
+static void yaffs_SummaryStart(yaffs_Device *dev, int blk)
+{
+	if (!dev->sumTags || !dev->writeSummary)
+		return;
+
+	memset(dev->sumTags, 0xFF,
+		(dev->nChunksPerBlock - 1) * sizeof(yaffs_SummaryTags));
+	dev->sumBlock = blk;
+}
+
+static void yaffs_SummaryWrite(yaffs_Device *dev, int blk)
+{
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blk);
+	yaffs_SummaryHeader *hdr;
+	yaffs_ExtendedTags tags;
+	int nTags = dev->nChunksPerBlock - 1;
+	int chunk;
+	__u8 *buffer;
+
+	buffer = yaffs_GetTempBuffer(dev, __LINE__);
+	memset(buffer, 0xFF, dev->nDataBytesPerChunk);
+
+	hdr = (yaffs_SummaryHeader *)buffer;
+	hdr->magic = YAFFS_SUMMARY_MAGIC;
+	hdr->sequenceNumber = bi->sequenceNumber;
+	hdr->nTags = nTags;
+	hdr->sum = yaffs_SummarySum(dev->sumTags, nTags);
+	memcpy(hdr + 1, dev->sumTags, nTags * sizeof(yaffs_SummaryTags));
+
+	yaffs_InitialiseTags(&tags);
+	tags.objectId = YAFFS_OBJECTID_SUMMARY;
+	tags.chunkId = 1;
+	tags.byteCount = yaffs_SummaryBytes(dev);
+
+	/* A bad summary only costs a full scan of this block, but the block
+	 * is retired like after any other failed write.
+	 */
+	chunk = blk * dev->nChunksPerBlock + nTags;
+	if (yaffs_WriteChunkWithTagsToNAND(dev, chunk, buffer, &tags) == YAFFS_OK) {
+		dev->nSummaryWrites++;
+	} else {
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs: block %d summary write failed" TENDSTR), blk));
+		/* The chunk was never allocated, account it so that
+		 * yaffs_HandleWriteChunkError() can delete it.
+		 */
+		bi->pagesInUse++;
+		yaffs_SetChunkBit(dev, blk, nTags);
+		dev->nFreeChunks--;
+		yaffs_HandleWriteChunkError(dev, chunk, 1);
+	}
+
+	yaffs_ReleaseTempBuffer(dev, buffer, __LINE__);
+}
+
+static void yaffs_SummaryAdd(yaffs_Device *dev, const yaffs_ExtendedTags *tags,
+				int chunkInNAND)
+{
+	int blk = chunkInNAND / dev->nChunksPerBlock;
+	int c = chunkInNAND % dev->nChunksPerBlock;
+	yaffs_PackedTags2TagsPart pt;
+
+	if (!dev->sumTags || blk != dev->sumBlock)
+		return;
+
+	yaffs_PackTags2TagsPart(&pt, tags);
+	dev->sumTags[c].objectId = pt.objectId;
+	dev->sumTags[c].chunkId = pt.chunkId;
+	dev->sumTags[c].byteCount = pt.byteCount;
+
+	if (c == dev->nChunksPerBlock - 2) {
+		yaffs_SummaryWrite(dev, blk);
+		dev->sumBlock = -1;
+	}
+}
+
+/* Reads the summary chunk of a block about to be scanned, into buffer.
+ * The chunk's tags are returned as well, so the scan need not read it
+ * again. Returns 1 if the summary is good.
+ */
+static int yaffs_SummaryRead(yaffs_Device *dev, int blk, __u8 *buffer,
+				yaffs_ExtendedTags *tags)
+{
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blk);
+	yaffs_SummaryHeader *hdr = (yaffs_SummaryHeader *)buffer;
+	int nTags = dev->nChunksPerBlock - 1;
+
+	yaffs_ReadChunkWithTagsFromNAND(dev, blk * dev->nChunksPerBlock + nTags,
+					buffer, tags);
+
+	return tags->chunkUsed &&
+		tags->eccResult <= YAFFS_ECC_RESULT_FIXED &&
+		tags->objectId == YAFFS_OBJECTID_SUMMARY &&
+		hdr->magic == YAFFS_SUMMARY_MAGIC &&
+		hdr->sequenceNumber == bi->sequenceNumber &&
+		hdr->nTags == nTags &&
+		hdr->sum == yaffs_SummarySum((yaffs_SummaryTags *)(hdr + 1), nTags);
+}
+
+static void yaffs_SummaryGetTags(const __u8 *buffer, int c, __u32 seq,
+				yaffs_ExtendedTags *tags)
+{
+	const yaffs_SummaryTags *st =
+		(const yaffs_SummaryTags *)((const yaffs_SummaryHeader *)buffer + 1) + c;
+	yaffs_PackedTags2TagsPart pt;
+
+	pt.sequenceNumber = (st->objectId == 0xFFFFFFFF) ? 0xFFFFFFFF : seq;
+	pt.objectId = st->objectId;
+	pt.chunkId = st->chunkId;
+	pt.byteCount = st->byteCount;
+
+	yaffs_UnpackTags2TagsPart(tags, &pt);
+	tags->eccResult = YAFFS_ECC_RESULT_NO_ERROR;
+}
+
 static int yaffs_WriteNewChunkWithTagsToNAND(struct yaffs_DeviceStruct *dev,
 					const __u8 *data,
 					yaffs_ExtendedTags *tags,
@@ -986,6 +1142,9 @@ static int yaffs_WriteNewChunkWithTagsToNAND(struct yaffs_DeviceStruct *dev,
 		writeOk = yaffs_WriteChunkWithTagsToNAND(dev, chunk,
 				data, tags);
 		if (writeOk != YAFFS_OK) {
+			/* no summary for a block that is going to be retired */
+			if (chunk / dev->nChunksPerBlock == dev->sumBlock)
+				dev->sumBlock = -1;
 			yaffs_HandleWriteChunkError(dev, chunk, erasedOk);
 			/* try another chunk */
 			continue;
@@ -994,6 +1153,8 @@ static int yaffs_WriteNewChunkWithTagsToNAND(struct yaffs_DeviceStruct *dev,
 		/* Copy the data into the robustification buffer */
 		yaffs_HandleWriteChunkOk(dev, chunk, data, tags);
 
+		yaffs_SummaryAdd(dev, tags, chunk);
+
 	} while (writeOk != YAFFS_OK &&
 		(yaffs_wr_attempts <= 0 || attempts <= yaffs_wr_attempts));
 
@@ -1083,6 +1244,33 @@ void yaffs_HandleChunkError(yaffs_Device *dev, yaffs_BlockInfo *bi)
 	}
 }
 
+/* A read needed ECC correction but got good data. With a driver that
+ * tracks bitflips per block that is a sign of read disturb rather than a
+ * failing block, so no strike: the block is only refreshed once it gets
+ * close to what the ECC can correct.
+ */
+void yaffs_HandleChunkBitflips(yaffs_Device *dev, int blockInNAND,
+				yaffs_BlockInfo *bi)
+{
+	int flips = yaffs_QueryBlockBitflips(dev, blockInNAND);
+
+	if (flips < 0) {
+		yaffs_HandleChunkError(dev, bi);
+		return;
+	}
+
+	if (flips < dev->refreshThreshold || bi->gcPrioritise)
+		return;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: refreshing block %d, %d bitflips" TENDSTR),
+	   blockInNAND, flips));
+	bi->gcPrioritise = 1;
+	dev->hasPendingPrioritisedGCs = 1;
+	dev->refreshPending = 1;
+	dev->nRefreshes++;
+}
+
 static void yaffs_HandleWriteChunkError(yaffs_Device *dev, int chunkInNAND,
 		int erasedOk)
 {
@@ -1665,6 +1853,7 @@ static void yaffs_SoftDeleteChunk(yaffs_Device *dev, int chunk)
 	if (theBlock) {
 		theBlock->softDeletions++;
 		dev->nFreeChunks++;
+		yaffs_GcQueueUpdate(dev, chunk / dev->nChunksPerBlock);
 	}
 }
 
@@ -2622,6 +2811,137 @@ static int yaffs_BlockNotDisqualifiedFromGC(yaffs_Device *dev,
 	return (bi->sequenceNumber <= dev->oldestDirtySequence);
 }
 
+/* gc candidate queue.
+ * FULL blocks holding discarded chunks are kept in gcQueue, ordered by the
+ * number of chunks still live, so picking a victim does not need a scan of
+ * every block. The live count of a FULL block only goes down, and every
+ * place that changes it calls yaffs_GcQueueUpdate(), so the order holds.
+ * Blocks that leave the FULL state are dropped when next seen.
+ * If the queue overflows, the dirtiest blocks are kept and the queue is
+ * rebuilt from a full scan the next time it runs dry.
+ */
+
+static int yaffs_GcLiveChunks(yaffs_Device *dev, int blockNo)
+{
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blockNo);
+
+	return bi->pagesInUse - bi->softDeletions;
+}
+
+static void yaffs_GcQueueRemove(yaffs_Device *dev, int pos)
+{
+	dev->gcQueueLength--;
+	memmove(&dev->gcQueue[pos], &dev->gcQueue[pos + 1],
+		(dev->gcQueueLength - pos) * sizeof(dev->gcQueue[0]));
+}
+
+static void yaffs_GcQueueUpdate(yaffs_Device *dev, int blockNo)
+{
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blockNo);
+	int live = bi->pagesInUse - bi->softDeletions;
+	int i;
+
+	for (i = 0; i < dev->gcQueueLength; i++) {
+		if (dev->gcQueue[i] == blockNo) {
+			yaffs_GcQueueRemove(dev, i);
+			break;
+		}
+	}
+
+	if (bi->blockState != YAFFS_BLOCK_STATE_FULL ||
+	    live >= dev->nChunksPerBlock)
+		return;
+
+	for (i = 0; i < dev->gcQueueLength; i++) {
+		if (live < yaffs_GcLiveChunks(dev, dev->gcQueue[i]))
+			break;
+	}
+
+	if (dev->gcQueueLength == YAFFS_GC_QUEUE_SIZE) {
+		dev->gcQueueOverflow = 1;
+		if (i == YAFFS_GC_QUEUE_SIZE)
+			return;
+		dev->gcQueueLength--;
+	}
+
+	memmove(&dev->gcQueue[i + 1], &dev->gcQueue[i],
+		(dev->gcQueueLength - i) * sizeof(dev->gcQueue[0]));
+	dev->gcQueue[i] = blockNo;
+	dev->gcQueueLength++;
+}
+
+static void yaffs_GcQueueRebuild(yaffs_Device *dev)
+{
+	int i;
+
+	dev->gcQueueLength = 0;
+	dev->gcQueueOverflow = 0;
+
+	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++)
+		yaffs_GcQueueUpdate(dev, i);
+}
+
+/* Returns the dirtiest block that may be collected and has fewer than
+ * maxLive live chunks, or -1.
+ */
+static int yaffs_GcQueuePick(yaffs_Device *dev, int maxLive)
+{
+	yaffs_BlockInfo *bi;
+	int i = 0;
+	int rebuilt = 0;
+
+	while (1) {
+		if (i >= dev->gcQueueLength) {
+			if (!dev->gcQueueOverflow || rebuilt)
+				return -1;
+			yaffs_GcQueueRebuild(dev);
+			rebuilt = 1;
+			i = 0;
+			continue;
+		}
+
+		bi = yaffs_GetBlockInfo(dev, dev->gcQueue[i]);
+		if (bi->blockState != YAFFS_BLOCK_STATE_FULL) {
+			yaffs_GcQueueRemove(dev, i);
+			continue;
+		}
+
+		if (bi->pagesInUse - bi->softDeletions >= maxLive)
+			return -1;
+
+		if (yaffs_BlockNotDisqualifiedFromGC(dev, bi))
+			return dev->gcQueue[i];
+		i++;
+	}
+}
+
+/* Read only variant of yaffs_GcQueuePick() for yaffs_GcUrgency(): says
+ * whether a block with fewer than maxLive live chunks may be collectible.
+ * Stale entries are skipped, not dropped, and the queue is not rebuilt.
+ * A yaffs2 block with a shrink header counts unless the cached
+ * oldestDirtySequence already rules it out; the pick decides for real.
+ */
+static int yaffs_GcQueuePeek(yaffs_Device *dev, int maxLive)
+{
+	yaffs_BlockInfo *bi;
+	int i;
+
+	for (i = 0; i < dev->gcQueueLength; i++) {
+		bi = yaffs_GetBlockInfo(dev, dev->gcQueue[i]);
+		if (bi->blockState != YAFFS_BLOCK_STATE_FULL)
+			continue;
+		if (bi->pagesInUse - bi->softDeletions >= maxLive)
+			return 0;
+		if (!dev->isYaffs2 || !bi->hasShrinkHeader ||
+		    !dev->oldestDirtySequence ||
+		    bi->sequenceNumber <= dev->oldestDirtySequence)
+			return 1;
+	}
+
+	/* only a rebuild can tell */
+	return dev->gcQueueOverflow;
+}
+
 /* FindDiretiestBlock is used to select the dirtiest block (or close enough)
  * for garbage collection.
  */
@@ -2629,10 +2949,7 @@ static int yaffs_BlockNotDisqualifiedFromGC(yaffs_Device *dev,
 static int yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 					int aggressive)
 {
-	int b = dev->currentDirtyChecker;
-
 	int i;
-	int iterations;
 	int dirtiest = -1;
 	int pagesInUse = 0;
 	int prioritised = 0;
@@ -2662,8 +2979,7 @@ static int yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 			dev->hasPendingPrioritisedGCs = 0;
 	}
 
-	/* If we're doing aggressive GC then we are happy to take a less-dirty block, and
-	 * search harder.
+	/* If we're doing aggressive GC then we are happy to take a less-dirty block.
 	 * else (we're doing a leasurely gc), then we only bother to do this if the
 	 * block has only a few pages in use.
 	 */
@@ -2673,44 +2989,13 @@ static int yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 	if (!aggressive && (dev->nonAggressiveSkip > 0))
 		return -1;
 
-	if (!prioritised)
-		pagesInUse =
-			(aggressive) ? dev->nChunksPerBlock : YAFFS_PASSIVE_GC_CHUNKS + 1;
-
-	if (aggressive)
-		iterations =
-		    dev->internalEndBlock - dev->internalStartBlock + 1;
-	else {
-		iterations =
-		    dev->internalEndBlock - dev->internalStartBlock + 1;
-		iterations = iterations / 16;
-		if (iterations > 200)
-			iterations = 200;
-	}
-
-	for (i = 0; i <= iterations && pagesInUse > 0 && !prioritised; i++) {
-		b++;
-		if (b < dev->internalStartBlock || b > dev->internalEndBlock)
-			b = dev->internalStartBlock;
-
-		if (b < dev->internalStartBlock || b > dev->internalEndBlock) {
-			T(YAFFS_TRACE_ERROR,
-			  (TSTR("**>> Block %d is not valid" TENDSTR), b));
-			YBUG();
-		}
-
-		bi = yaffs_GetBlockInfo(dev, b);
-
-		if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
-			(bi->pagesInUse - bi->softDeletions) < pagesInUse &&
-				yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
-			dirtiest = b;
-			pagesInUse = (bi->pagesInUse - bi->softDeletions);
-		}
+	if (!prioritised) {
+		dirtiest = yaffs_GcQueuePick(dev, (aggressive) ?
+				dev->nChunksPerBlock : YAFFS_PASSIVE_GC_CHUNKS + 1);
+		if (dirtiest > 0)
+			pagesInUse = yaffs_GcLiveChunks(dev, dirtiest);
 	}
 
-	dev->currentDirtyChecker = b;
-
 	if (dirtiest > 0) {
 		T(YAFFS_TRACE_GC,
 		  (TSTR("GC Selected block %d with %d free, prioritised:%d" TENDSTR), dirtiest,
@@ -2905,6 +3190,8 @@ static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		/* Get next block to allocate off */
 		dev->allocationBlock = yaffs_FindBlockForAllocation(dev);
 		dev->allocationPage = 0;
+		if (dev->allocationBlock >= 0)
+			yaffs_SummaryStart(dev, dev->allocationBlock);
 	}
 
 	if (!useReserve && !yaffs_CheckSpaceForAllocation(dev)) {
@@ -2932,8 +3219,9 @@ static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		dev->nFreeChunks--;
 
 		/* If the block is full set the state to full */
-		if (dev->allocationPage >= dev->nChunksPerBlock) {
+		if (dev->allocationPage >= yaffs_DataChunksInBlock(dev)) {
 			bi->blockState = YAFFS_BLOCK_STATE_FULL;
+			yaffs_GcQueueUpdate(dev, dev->allocationBlock);
 			dev->allocationBlock = -1;
 		}
 
@@ -3228,6 +3516,7 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	int aggressive;
 	int gcOk = YAFFS_OK;
 	int maxTries = 0;
+	__u64 start;
 
 	int checkpointBlockAdjust;
 
@@ -3255,6 +3544,10 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 			aggressive = 0;
 		}
 
+		/* Passive gc is left to the background thread when there is one */
+		if (!aggressive && dev->bgGcRunning)
+			return YAFFS_OK;
+
 		if (dev->gcBlock <= 0) {
 			dev->gcBlock = yaffs_FindBlockForGarbageCollection(dev, aggressive);
 			dev->gcChunk = 0;
@@ -3264,6 +3557,7 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 
 		if (block > 0) {
 			dev->garbageCollections++;
+			dev->fgGarbageCollections++;
 			if (!aggressive)
 				dev->passiveGarbageCollections++;
 
@@ -3272,7 +3566,9 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 			   ("yaffs: GC erasedBlocks %d aggressive %d" TENDSTR),
 			   dev->nErasedBlocks, aggressive));
 
+			start = Y_TIME_US();
 			gcOk = yaffs_GarbageCollectBlock(dev, block, aggressive);
+			yaffs_AccountGcStall(dev, Y_TIME_US() - start);
 		}
 
 		if (dev->nErasedBlocks < (dev->nReservedBlocks) && block > 0) {
@@ -3288,6 +3584,100 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	return aggressive ? gcOk : YAFFS_OK;
 }
 
+void yaffs_AccountGcStall(yaffs_Device *dev, __u32 us)
+{
+	dev->gcStalls++;
+	dev->gcStallTotal += us;
+	if (us > dev->gcStallMax)
+		dev->gcStallMax = us;
+}
+
+/* How badly the device needs gc. Writes start collecting whole blocks
+ * inline at YAFFS_GC_URGENCY_NOW; the levels below it are for callers
+ * that can collect ahead of them. Leaves the gc state alone.
+ */
+int yaffs_GcUrgency(yaffs_Device *dev)
+{
+	int checkpointBlockAdjust;
+	int threshold;
+
+	checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
+	if (checkpointBlockAdjust < 0)
+		checkpointBlockAdjust = 0;
+
+	threshold = dev->nReservedBlocks + checkpointBlockAdjust + 2;
+
+	if (dev->nErasedBlocks < threshold)
+		return YAFFS_GC_URGENCY_NOW;
+	if (dev->nErasedBlocks < threshold + YAFFS_GC_SLICE_MARGIN)
+		return YAFFS_GC_URGENCY_SOON;
+	if (dev->gcBlock > 0 || dev->refreshPending)
+		return YAFFS_GC_URGENCY_IDLE;
+
+	return yaffs_GcQueuePeek(dev, YAFFS_PASSIVE_GC_CHUNKS + 1) ?
+		YAFFS_GC_URGENCY_IDLE : YAFFS_GC_URGENCY_NONE;
+}
+
+/* Picks a full block flagged for refresh, if any is left */
+static int yaffs_FindRefreshBlock(yaffs_Device *dev)
+{
+	yaffs_BlockInfo *bi;
+	int i;
+
+	if (!dev->refreshPending)
+		return -1;
+
+	for (i = dev->internalStartBlock; i <= dev->internalEndBlock; i++) {
+		bi = yaffs_GetBlockInfo(dev, i);
+		if (bi->gcPrioritise &&
+		    bi->blockState == YAFFS_BLOCK_STATE_FULL &&
+		    yaffs_BlockNotDisqualifiedFromGC(dev, bi))
+			return i;
+	}
+
+	dev->refreshPending = 0;
+	return -1;
+}
+
+/* Incremental gc for callers outside the write path.
+ * Copies off a handful of chunks of the current gc block, or of a new
+ * one picked for the given urgency: at YAFFS_GC_URGENCY_IDLE only blocks
+ * that are almost all garbage, or flagged for refresh, are taken. At
+ * YAFFS_GC_URGENCY_NOW the whole block is collected. Callers drop the device lock between slices
+ * so that other operations are not held off for a whole block.
+ * background tells the gc thread from writes collecting ahead, for the
+ * fg/bg statistics. Returns 1 if another slice is wanted.
+ */
+int yaffs_GarbageCollectSlice(yaffs_Device *dev, int urgency, int background)
+{
+	if (dev->isDoingGC || urgency == YAFFS_GC_URGENCY_NONE)
+		return 0;
+
+	if (dev->gcBlock <= 0) {
+		if (urgency == YAFFS_GC_URGENCY_IDLE) {
+			dev->gcBlock = yaffs_FindRefreshBlock(dev);
+			if (dev->gcBlock <= 0)
+				dev->gcBlock = yaffs_GcQueuePick(dev,
+						YAFFS_PASSIVE_GC_CHUNKS + 1);
+		} else
+			dev->gcBlock = yaffs_FindBlockForGarbageCollection(dev, 1);
+		dev->gcChunk = 0;
+		dev->oldestDirtySequence = 0;
+		if (dev->gcBlock <= 0)
+			return 0;
+		dev->garbageCollections++;
+		if (background)
+			dev->bgGarbageCollections++;
+		else
+			dev->fgGarbageCollections++;
+	}
+
+	dev->gcSlices++;
+
+	return yaffs_GarbageCollectBlock(dev, dev->gcBlock,
+			urgency == YAFFS_GC_URGENCY_NOW) == YAFFS_OK;
+}
+
 /*-------------------------  TAGS --------------------------------*/
 
 static int yaffs_TagsMatch(const yaffs_ExtendedTags *tags, int objectId,
@@ -3621,6 +4011,7 @@ void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn)
 			yaffs_BlockBecameDirty(dev, block);
 		}
 
+		yaffs_GcQueueUpdate(dev, block);
 	}
 
 }
@@ -3855,8 +4246,10 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The cache is set associative: a chunk can only live in the set picked by
+ *   hashing its object and chunk id, so a lookup only searches nCacheWays
+ *   entries however big the cache is. Sequential readers are detected and
+ *   the chunks ahead of them are loaded into the cache (see ReadAhead below).
  */
 
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
@@ -3958,74 +4351,69 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 }
 
 
-/* Grab us a cache chunk for use.
- * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
- */
-static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
+static inline int yaffs_CacheSet(yaffs_Device *dev, int objectId, int chunkId)
 {
-	int i;
-
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
-	}
+	return (((__u32)objectId * 0x9E3779B1U) + (__u32)chunkId) %
+		(__u32)dev->nCacheSets;
+}
 
-	return NULL;
+/* Wrap safe "a was used before b" */
+static inline int yaffs_CacheOlder(const yaffs_ChunkCache *a,
+				   const yaffs_ChunkCache *b)
+{
+	return (int)((__u32)a->lastUse - (__u32)b->lastUse) < 0;
 }
 
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
+/* Grab us a cache chunk for use in the set the chunk maps to.
+ * First look for an empty one.
+ * Then look for the least recently used non-dirty one.
+ * Then, unless only clean entries may be used (readahead), write back the
+ * least recently used dirty one and reuse it.
+ * Returns NULL if nothing could be had, callers must cope with that.
+ */
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Object *obj, int chunkId,
+					      int cleanOnly)
 {
-	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
+	yaffs_Device *dev = obj->myDev;
+	yaffs_ChunkCache *set;
+	yaffs_ChunkCache *clean = NULL;
+	yaffs_ChunkCache *dirty = NULL;
 	int i;
-	int pushout;
-
-	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
-		cache = yaffs_GrabChunkCacheWorker(dev);
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	if (dev->nShortOpCaches < 1)
+		return NULL;
 
-			/* With locking we can't assume we can use entry zero */
+	set = &dev->srCache[yaffs_CacheSet(dev, obj->objectId, chunkId) *
+			    dev->nCacheWays];
 
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+	for (i = 0; i < dev->nCacheWays; i++) {
+		yaffs_ChunkCache *cache = &set[i];
 
-			for (i = 0; i < dev->nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
+		if (!cache->object)
+			return cache;
+		if (cache->locked)
+			continue;
+		if (!cache->dirty) {
+			if (!clean || yaffs_CacheOlder(cache, clean))
+				clean = cache;
+		} else if (!dirty || yaffs_CacheOlder(cache, dirty))
+			dirty = cache;
+	}
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+	if (clean || cleanOnly)
+		return clean;
 
-		}
-		return cache;
-	} else
-		return NULL;
+	if (dirty) {
+		/* Push the dirty chunk out and take its place */
+		if (yaffs_WriteChunkDataToObject(dirty->object, dirty->chunkId,
+						 dirty->data, dirty->nBytes,
+						 1) <= 0)
+			return NULL;
+		dirty->dirty = 0;
+		dirty->object = NULL;
+	}
 
+	return dirty;
 }
 
 /* Find a cached chunk */
@@ -4033,15 +4421,16 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
+	yaffs_ChunkCache *set;
 	int i;
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
 
-				return &dev->srCache[i];
-			}
+	if (dev->nShortOpCaches > 0) {
+		set = &dev->srCache[yaffs_CacheSet(dev, obj->objectId, chunkId) *
+				    dev->nCacheWays];
+		for (i = 0; i < dev->nCacheWays; i++) {
+			if (set[i].object == obj &&
+			    set[i].chunkId == chunkId)
+				return &set[i];
 		}
 	}
 	return NULL;
@@ -4051,20 +4440,14 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 				int isAWrite)
 {
+	int set;
 
 	if (dev->nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
-		}
+		set = (cache - dev->srCache) / dev->nCacheWays;
 
-		dev->srLastUse++;
+		dev->srSetClock[set]++;
 
-		cache->lastUse = dev->srLastUse;
+		cache->lastUse = dev->srSetClock[set];
 
 		if (isAWrite)
 			cache->dirty = 1;
@@ -4100,6 +4483,158 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 				dev->srCache[i].object = NULL;
 		}
 	}
+
+	for (i = 0; i < YAFFS_READAHEAD_STREAMS; i++) {
+		if (dev->raStream[i].object == in)
+			dev->raStream[i].object = NULL;
+	}
+}
+
+/*------------------------ Readahead ----------------------------------------
+ * A handful of streams remember where recent readers are expected to read
+ * next. Once a reader has taken YAFFS_READAHEAD_MIN_RUN chunks in a row the
+ * next YAFFS_READAHEAD_CHUNKS chunks are loaded into clean cache entries,
+ * and the window is topped up when the reader is half way through it.
+ * Chunks that sit next to each other in NAND are fetched with one multi
+ * chunk read when the driver offers one.
+ * The stream's object pointer is only ever compared, never followed.
+ */
+
+static void yaffs_ReadAheadLoad(yaffs_Object *in, int chunkId, int chunkInNAND,
+				const __u8 *data)
+{
+	yaffs_Device *dev = in->myDev;
+	yaffs_ChunkCache *cache = yaffs_GrabChunkCache(in, chunkId, 1);
+
+	if (!cache)
+		return;
+
+	if (data)
+		memcpy(cache->data, data, dev->nDataBytesPerChunk);
+	else
+		yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND, cache->data,
+						NULL);
+
+	cache->object = in;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+	cache->nBytes = 0;
+	yaffs_UseChunkCache(dev, cache, 0);
+	dev->raChunks++;
+}
+
+/* Load nChunks chunks, starting at chunkId, that live in consecutive NAND
+ * chunks starting at chunkInNAND.
+ */
+static void yaffs_ReadAheadRun(yaffs_Object *in, int chunkId, int chunkInNAND,
+				int nChunks)
+{
+	yaffs_Device *dev = in->myDev;
+	int i;
+
+	if (nChunks > 1 && dev->raBuffer &&
+	    yaffs_ReadChunksFromNAND(dev, chunkInNAND, nChunks,
+				     dev->raBuffer) == YAFFS_OK) {
+		dev->raReads++;
+		for (i = 0; i < nChunks; i++)
+			yaffs_ReadAheadLoad(in, chunkId + i, chunkInNAND + i,
+				dev->raBuffer + i * dev->totalBytesPerChunk);
+		return;
+	}
+
+	/* Either a single chunk or the multi chunk read had a problem */
+	for (i = 0; i < nChunks; i++)
+		yaffs_ReadAheadLoad(in, chunkId + i, chunkInNAND + i, NULL);
+}
+
+static void yaffs_ReadAheadFill(yaffs_Object *in, int first, int last)
+{
+	int chunk;
+	int nand;
+	int runChunk = 0;
+	int runNAND = 0;
+	int runLength = 0;
+
+	for (chunk = first; chunk <= last; chunk++) {
+		if (yaffs_FindChunkCache(in, chunk)) {
+			nand = -1;
+		} else {
+			nand = yaffs_FindChunkInFile(in, chunk, NULL);
+			if (nand < 0)
+				break;	/* A hole, stop here */
+		}
+
+		if (runLength > 0 && nand == runNAND + runLength) {
+			runLength++;
+			continue;
+		}
+
+		if (runLength > 0)
+			yaffs_ReadAheadRun(in, runChunk, runNAND, runLength);
+		runLength = 0;
+
+		if (nand >= 0) {
+			runChunk = chunk;
+			runNAND = nand;
+			runLength = 1;
+		}
+	}
+
+	if (runLength > 0)
+		yaffs_ReadAheadRun(in, runChunk, runNAND, runLength);
+}
+
+/* Note that chunkId of the file was just read */
+static void yaffs_ReadAhead(yaffs_Object *in, int chunkId)
+{
+	yaffs_Device *dev = in->myDev;
+	yaffs_ReadAheadStream *stream = NULL;
+	int nChunks;
+	int first;
+	int last;
+	int i;
+
+	if (dev->nShortOpCaches < 1)
+		return;
+
+	for (i = 0; i < YAFFS_READAHEAD_STREAMS && !stream; i++) {
+		if (dev->raStream[i].object != in)
+			continue;
+		if (dev->raStream[i].nextChunk == chunkId)
+			stream = &dev->raStream[i];
+		else if (dev->raStream[i].nextChunk == chunkId + 1)
+			return;	/* Same chunk again */
+	}
+
+	if (stream) {
+		stream->run++;
+	} else {
+		stream = &dev->raStream[dev->raVictim];
+		dev->raVictim = (dev->raVictim + 1) % YAFFS_READAHEAD_STREAMS;
+		stream->object = in;
+		stream->run = 1;
+		stream->aheadTo = 0;
+	}
+	stream->nextChunk = chunkId + 1;
+
+	if (stream->run < YAFFS_READAHEAD_MIN_RUN ||
+	    stream->aheadTo - chunkId > YAFFS_READAHEAD_CHUNKS / 2)
+		return;
+
+	nChunks = (in->variant.fileVariant.fileSize +
+		   dev->nDataBytesPerChunk - 1) / dev->nDataBytesPerChunk;
+
+	first = chunkId + 1;
+	if (first < stream->aheadTo)
+		first = stream->aheadTo;
+	last = chunkId + YAFFS_READAHEAD_CHUNKS;
+	if (last > nChunks)
+		last = nChunks;
+
+	if (first <= last)
+		yaffs_ReadAheadFill(in, first, last);
+	stream->aheadTo = last + 1;
 }
 
 /*--------------------- Checkpointing --------------------*/
@@ -4709,17 +5244,21 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 		cache = yaffs_FindChunkCache(in, chunk);
 
+		if (dev->nShortOpCaches > 0) {
+			dev->cacheLookups++;
+			if (cache)
+				dev->cacheHits++;
+		}
+
 		/* If the chunk is already in the cache or it is less than a whole chunk
 		 * or we're using inband tags then use the cache (if there is caching)
 		 * else bypass the cache.
 		 */
 		if (cache || nToCopy != dev->nDataBytesPerChunk || dev->inbandTags) {
-			if (dev->nShortOpCaches > 0) {
-
-				/* If we can't find the data in the cache, then load it up. */
-
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
+			/* If we can't find the data in the cache, then load it up. */
+			if (!cache) {
+				cache = yaffs_GrabChunkCache(in, chunk, 0);
+				if (cache) {
 					cache->object = in;
 					cache->chunkId = chunk;
 					cache->dirty = 0;
@@ -4729,7 +5268,9 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 								      data);
 					cache->nBytes = 0;
 				}
+			}
 
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -4760,6 +5301,8 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 		}
 
+		yaffs_ReadAhead(in, chunk);
+
 		n -= nToCopy;
 		offset += nToCopy;
 		buffer += nToCopy;
@@ -4849,14 +5392,15 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_ReadChunkDataFromObject(in, chunk,
-								      cache->
-								      data);
+					cache = yaffs_GrabChunkCache(in, chunk, 0);
+					if (cache) {
+						cache->object = in;
+						cache->chunkId = chunk;
+						cache->dirty = 0;
+						cache->locked = 0;
+						yaffs_ReadChunkDataFromObject(in,
+							chunk, cache->data);
+					}
 				} else if (cache &&
 					!cache->dirty &&
 					!yaffs_CheckSpaceForAllocation(in->myDev)) {
@@ -6108,6 +6652,10 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
 	int itsUnlinked;
 	__u8 *chunkData;
+	__u8 *summaryData = NULL;
+	yaffs_ExtendedTags lastTags;
+	int haveLastTags;
+	int haveSummary;
 
 	int fileSize;
 	int isShrink;
@@ -6149,6 +6697,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	dev->blocksInCheckpoint = 0;
 
 	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
+	if (dev->sumTags)
+		summaryData = yaffs_GetTempBuffer(dev, __LINE__);
 
 	/* Scan all the blocks to determine their state */
 	for (blk = dev->internalStartBlock; blk <= dev->internalEndBlock; blk++) {
@@ -6265,6 +6815,19 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		/* A full block with a good summary needs only that one chunk read */
+		haveLastTags = 0;
+		haveSummary = 0;
+		if (summaryData && state == YAFFS_BLOCK_STATE_NEEDS_SCANNING) {
+			haveSummary = yaffs_SummaryRead(dev, blk, summaryData,
+							&lastTags);
+			haveLastTags = 1;
+		}
+		if (haveSummary)
+			dev->nSummaryBlocks++;
+		else
+			dev->nScannedBlocks++;
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->nChunksPerBlock - 1;
@@ -6277,8 +6840,14 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (haveLastTags && c == dev->nChunksPerBlock - 1)
+				tags = lastTags;
+			else if (haveSummary)
+				yaffs_SummaryGetTags(summaryData, c,
+						bi->sequenceNumber, &tags);
+			else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+						chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -6338,6 +6907,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 				  dev->nFreeChunks++;
 
+			} else if (tags.objectId == YAFFS_OBJECTID_SUMMARY) {
+				/* Block summary, never live */
+				foundChunksInBlock = 1;
+				dev->nFreeChunks++;
+
 			} else if (tags.chunkId > 0) {
 				/* chunkId > 0 so it is a data chunk... */
 				unsigned int endpos;
@@ -6741,6 +7315,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 
 	yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+	if (summaryData)
+		yaffs_ReleaseTempBuffer(dev, summaryData, __LINE__);
 
 	if (alloc_failed)
 		return YAFFS_FAIL;
@@ -7438,7 +8014,13 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
-	dev->currentDirtyChecker = 0;
+	dev->gcQueueLength = 0;
+	dev->gcQueueOverflow = 0;
+	dev->fgGarbageCollections = 0;
+	dev->bgGarbageCollections = 0;
+	dev->gcStalls = 0;
+	dev->gcStallTotal = 0;
+	dev->gcStallMax = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
 	dev->nDeletedFiles = 0;
@@ -7458,18 +8040,43 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->srSetClock = NULL;
+	dev->raBuffer = NULL;
 	dev->gcCleanupList = NULL;
+	memset(dev->raStream, 0, sizeof(dev->raStream));
+	dev->raVictim = 0;
 
 
 	if (!init_failed &&
 	    dev->nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		/* Small caches are a single fully associative set, bigger
+		 * ones are cut into sets of YAFFS_CACHE_WAYS.
+		 */
+		if (dev->nShortOpCaches <= 2 * YAFFS_CACHE_WAYS) {
+			dev->nCacheWays = dev->nShortOpCaches;
+			dev->nCacheSets = 1;
+		} else {
+			dev->nCacheWays = YAFFS_CACHE_WAYS;
+			dev->nCacheSets = dev->nShortOpCaches / YAFFS_CACHE_WAYS;
+			dev->nShortOpCaches = dev->nCacheSets * YAFFS_CACHE_WAYS;
+		}
+
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+
+		dev->srSetClock = YMALLOC(dev->nCacheSets * sizeof(__u32));
+		if (dev->srSetClock)
+			memset(dev->srSetClock, 0,
+				dev->nCacheSets * sizeof(__u32));
+		else
+			init_failed = 1;
+
 		dev->srCache =  YMALLOC(srCacheBytes);
 
 		buf = (__u8 *) dev->srCache;
@@ -7486,10 +8093,16 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		if (!buf)
 			init_failed = 1;
 
-		dev->srLastUse = 0;
+		/* Readahead copes without the buffer, just more slowly */
+		if (dev->readChunksFromNAND)
+			dev->raBuffer = YMALLOC_DMA(YAFFS_READAHEAD_CHUNKS *
+						    dev->totalBytesPerChunk);
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheLookups = 0;
+	dev->raChunks = 0;
+	dev->raReads = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
@@ -7497,6 +8110,21 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 			init_failed = 1;
 	}
 
+	dev->sumTags = NULL;
+	dev->sumBlock = -1;
+	dev->nSummaryBlocks = 0;
+	dev->nScannedBlocks = 0;
+	dev->nSummaryWrites = 0;
+
+	if (!init_failed && dev->isYaffs2 && !dev->disableSummary &&
+	    dev->nChunksPerBlock > 1 &&
+	    yaffs_SummaryBytes(dev) <= dev->nDataBytesPerChunk) {
+		dev->sumTags = YMALLOC((dev->nChunksPerBlock - 1) *
+				sizeof(yaffs_SummaryTags));
+		if (!dev->sumTags)
+			init_failed = 1;
+	}
+
 	if (dev->isYaffs2)
 		dev->useHeaderFileSize = 1;
 
@@ -7566,6 +8194,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		return YAFFS_FAIL;
 	}
 
+	dev->mountChunkReads = dev->nPageReads;
+
 	/* Zero out stats */
 	dev->nPageReads = 0;
 	dev->nPageWrites = 0;
@@ -7578,6 +8208,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	yaffs_VerifyFreeChunks(dev);
 	yaffs_VerifyBlocks(dev);
 
+	/* Block states came from a scan or a checkpoint, seed the gc queue */
+	yaffs_GcQueueRebuild(dev);
+
 	/* Clean up any aborted checkpoint data */
 	if (!dev->isCheckpointed && dev->blocksInCheckpoint > 0)
 		yaffs_InvalidateCheckpoint(dev);
@@ -7609,8 +8242,19 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			dev->srCache = NULL;
 		}
 
+		if (dev->srSetClock)
+			YFREE(dev->srSetClock);
+		dev->srSetClock = NULL;
+		if (dev->raBuffer)
+			YFREE(dev->raBuffer);
+		dev->raBuffer = NULL;
+
 		YFREE(dev->gcCleanupList);
 
+		if (dev->sumTags)
+			YFREE(dev->sumTags);
+		dev->sumTags = NULL;
+
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			YFREE(dev->tempBuffer[i].buffer);
 
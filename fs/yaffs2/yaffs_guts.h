@@ -86,12 +86,39 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
+/* Pseudo object id for block summary chunks */
+#define YAFFS_OBJECTID_SUMMARY		0x30
+#define YAFFS_SUMMARY_MAGIC		0x59534d31
+
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	1024
+
+/* The chunk cache is set associative, a lookup searches one set */
+#define YAFFS_CACHE_WAYS		8
+
+/* Sequential read detection and readahead into the chunk cache */
+#define YAFFS_READAHEAD_STREAMS		4
+#define YAFFS_READAHEAD_MIN_RUN		2	/* chunks in a row to start */
+#define YAFFS_READAHEAD_CHUNKS		8	/* chunks kept ahead */
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
+/* Number of hashed per object data I/O locks, must be a power of 2 */
+#define YAFFS_N_IO_LOCKS		16
+
+/* Background gc slices start this many blocks before gc turns aggressive */
+#define YAFFS_GC_SLICE_MARGIN		4
+
+/* Number of gc candidate blocks kept sorted by dirtiness */
+#define YAFFS_GC_QUEUE_SIZE		32
+
+/* gc urgency, from the number of erased blocks left */
+#define YAFFS_GC_URGENCY_NONE		0	/* nothing cheap to reclaim */
+#define YAFFS_GC_URGENCY_IDLE		1	/* mostly garbage blocks only */
+#define YAFFS_GC_URGENCY_SOON		2	/* within the slice margin */
+#define YAFFS_GC_URGENCY_NOW		3	/* writes collect inline */
+
 /* We limit the number attempts at sucessfully saving a chunk of data.
  * Small-page devices have 32 pages per block; large-page devices have 64.
  * Default to something in the order of 5 to 10 blocks worth of chunks.
@@ -126,6 +153,14 @@ typedef struct {
 #endif
 } yaffs_ChunkCache;
 
+/* A sequential reader being read ahead of */
+typedef struct {
+	struct yaffs_ObjectStruct *object;
+	int nextChunk;		/* Chunk the reader is expected to want next */
+	int run;		/* Chunks read in a row so far */
+	int aheadTo;		/* Chunks below this have been read ahead */
+} yaffs_ReadAheadStream;
+
 
 
 /* Tags structures in RAM
@@ -530,6 +565,26 @@ typedef struct {
 	int maxLine;
 } yaffs_TempBuffer;
 
+/*
+ * Block summaries (yaffs2 only).
+ * The last chunk of a block records the tags of the chunks before it, in
+ * packed tags form less the sequence number, so that a scan can rebuild
+ * the block from one chunk. Unwritten entries are all ones.
+ */
+
+typedef struct {
+	__u32 objectId;
+	__u32 chunkId;
+	__u32 byteCount;
+} yaffs_SummaryTags;
+
+typedef struct {
+	__u32 magic;
+	__u32 sequenceNumber;
+	__u32 nTags;
+	__u32 sum;		/* over the tags that follow */
+} yaffs_SummaryHeader;
+
 /*----------------- Device ---------------------------------*/
 
 struct yaffs_DeviceStruct {
@@ -560,6 +615,10 @@ struct yaffs_DeviceStruct {
 
 	int emptyLostAndFound;  /* Flasg to determine if lst+found should be emptied on init */
 
+	int disableSummary;	/* Flag to not write or use block summaries */
+	int writeSummary;	/* Flag to write block summaries, older yaffs2
+				 * takes them for file data */
+
 	int useNANDECC;		/* Flag to decide whether or not to use NANDECC */
 
 	void *genericDevice;	/* Pointer to device context
@@ -590,6 +649,13 @@ struct yaffs_DeviceStruct {
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
+	/* Optional, reads the data of consecutive chunks in one go */
+	int (*readChunksFromNAND) (struct yaffs_DeviceStruct *dev,
+				   int chunkInNAND, int nChunks, __u8 *data);
+	/* Optional, most bitflips the driver corrected in one ECC step of
+	 * the block since it was erased. Negative if it does not know.
+	 */
+	int (*queryBlockBitflips) (struct yaffs_DeviceStruct *dev, int blockNo);
 #endif
 
 	int isYaffs2;
@@ -637,7 +703,22 @@ struct yaffs_DeviceStruct {
 
 	struct semaphore sem;	/* Semaphore for waiting on erasure.*/
 	struct semaphore grossLock;	/* Gross locking semaphore */
+	struct mutex gcLock;		/* Serializes gc slices */
+	struct mutex ioLock[YAFFS_N_IO_LOCKS]; /* Object data I/O */
+	struct task_struct *bgGcThread;	/* Background gc, if running */
+	unsigned long bgGcLastIo;	/* jiffies of the last data I/O */
 	struct rw_semaphore dirLock; /* Lock the directory structure */
+
+	/* grossLock statistics, times in microseconds */
+	ktime_t grossLockedAt;
+	void *grossLockHolder;
+	void *grossHoldMaxAt;
+	__u32 grossLocks;
+	__u32 grossLockContended;
+	__u64 grossWaitTotal;
+	__u32 grossWaitMax;
+	__u64 grossHoldTotal;
+	__u32 grossHoldMax;
 	__u8 *spareBuffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 
@@ -712,7 +793,11 @@ struct yaffs_DeviceStruct {
 
 	int nFreeChunks;
 
-	int currentDirtyChecker;	/* Used to find current dirtiest block */
+	/* gc candidates, FULL blocks ordered by fewest live chunks first */
+	int gcQueue[YAFFS_GC_QUEUE_SIZE];
+	int gcQueueLength;
+	int gcQueueOverflow;	/* a candidate was dropped, rescan on miss */
+	int bgGcRunning;	/* leave passive gc to the background */
 
 	__u32 *gcCleanupList;	/* objects to delete at the end of a GC. */
 	int nonAggressiveSkip;	/* GC state/mode */
@@ -725,6 +810,12 @@ struct yaffs_DeviceStruct {
 	int nGCCopies;
 	int garbageCollections;
 	int passiveGarbageCollections;
+	int gcSlices;
+	int fgGarbageCollections;	/* blocks collected by writes */
+	int bgGarbageCollections;	/* blocks collected by the gc thread */
+	__u32 gcStalls;			/* writes that had to collect */
+	__u64 gcStallTotal;		/* in microseconds */
+	__u32 gcStallMax;
 	int nRetriedWrites;
 	int nRetiredBlocks;
 	int eccFixed;
@@ -736,6 +827,13 @@ struct yaffs_DeviceStruct {
 
 	int hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 
+	/* Blocks whose corrected bitflips reach refreshThreshold are copied
+	 * off and erased before the errors become uncorrectable. 0 disables.
+	 */
+	int refreshThreshold;
+	int refreshPending;
+	int nRefreshes;
+
 	/* Special directories */
 	yaffs_Object *rootDir;
 	yaffs_Object *lostNFoundDir;
@@ -748,10 +846,19 @@ struct yaffs_DeviceStruct {
 	int bufferedBlock;	/* Which block is buffered here? */
 	int doingBufferedBlockRewrite;
 
-	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	yaffs_ChunkCache *srCache;	/* nCacheSets sets of nCacheWays */
+	__u32 *srSetClock;		/* Per set LRU clock */
+	int nCacheSets;
+	int nCacheWays;
 
 	int cacheHits;
+	int cacheLookups;
+
+	yaffs_ReadAheadStream raStream[YAFFS_READAHEAD_STREAMS];
+	int raVictim;
+	__u8 *raBuffer;		/* For multi chunk reads, may be NULL */
+	int raChunks;		/* Chunks read ahead */
+	int raReads;		/* Multi chunk NAND reads issued */
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -773,6 +880,16 @@ struct yaffs_DeviceStruct {
 	unsigned sequenceNumber;	/* Sequence number of currently allocating block */
 	unsigned oldestDirtySequence;
 
+	/* Block summary of the allocation block, NULL if summaries are off */
+	yaffs_SummaryTags *sumTags;
+	int sumBlock;		/* Block sumTags belongs to, or -1 */
+
+	/* Mount statistics */
+	int mountChunkReads;	/* Chunks read to restore or scan */
+	int nSummaryBlocks;	/* Blocks scanned from their summary */
+	int nScannedBlocks;	/* Blocks scanned chunk by chunk */
+	int nSummaryWrites;
+	__u32 mountTime;	/* in milliseconds, set by the OS glue */
 };
 
 typedef struct yaffs_DeviceStruct yaffs_Device;
@@ -823,6 +940,9 @@ int yaffs_GutsInitialise(yaffs_Device *dev);
 void yaffs_Deinitialise(yaffs_Device *dev);
 
 int yaffs_GetNumberOfFreeChunks(yaffs_Device *dev);
+int yaffs_GcUrgency(yaffs_Device *dev);
+int yaffs_GarbageCollectSlice(yaffs_Device *dev, int urgency, int background);
+void yaffs_AccountGcStall(yaffs_Device *dev, __u32 us);
 
 int yaffs_RenameObject(yaffs_Object *oldDir, const YCHAR *oldName,
 		       yaffs_Object *newDir, const YCHAR *newName);
@@ -905,6 +1025,8 @@ void yaffs_InitialiseTags(yaffs_ExtendedTags *tags);
 void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn);
 int yaffs_CheckFF(__u8 *buffer, int nBytes);
 void yaffs_HandleChunkError(yaffs_Device *dev, yaffs_BlockInfo *bi);
+void yaffs_HandleChunkBitflips(yaffs_Device *dev, int blockInNAND,
+				yaffs_BlockInfo *bi);
 
 __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo);
 void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer, int lineNo);
@@ -187,6 +187,33 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+/* Read the data of nChunks consecutive chunks with a single mtd read.
+ * The driver is free to pipeline the pages. Any ECC event, even a fixed
+ * one, is reported as a failure since it can not be pinned on a chunk;
+ * the caller then falls back to reading the chunks one by one.
+ */
+int nandmtd2_ReadChunksFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 *data)
+{
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	size_t len = nChunks * dev->totalBytesPerChunk;
+	size_t dummy = 0;
+	int retval;
+
+	loff_t addr = ((loff_t) chunkInNAND) * dev->totalBytesPerChunk;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadChunksFromNAND chunk %d n %d" TENDSTR),
+	   chunkInNAND, nChunks));
+
+	retval = mtd->read(mtd, addr, len, &dummy, data);
+
+	if (retval == 0 && dummy == len)
+		return YAFFS_OK;
+	else
+		return YAFFS_FAIL;
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
@@ -206,6 +233,15 @@ int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 
 }
 
+int nandmtd2_QueryBlockBitflips(struct yaffs_DeviceStruct *dev, int blockNo)
+{
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+
+	return mtd->block_bitflips(mtd,
+				   (loff_t)blockNo * dev->nChunksPerBlock *
+				   dev->totalBytesPerChunk);
+}
+
 int nandmtd2_QueryNANDBlock(struct yaffs_DeviceStruct *dev, int blockNo,
 			    yaffs_BlockState *state, __u32 *sequenceNumber)
 {
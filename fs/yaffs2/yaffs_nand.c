@@ -46,13 +46,39 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 	if (tags &&
 	   tags->eccResult > YAFFS_ECC_RESULT_NO_ERROR) {
 
-		yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, chunkInNAND/dev->nChunksPerBlock);
-		yaffs_HandleChunkError(dev, bi);
+		int blockInNAND = chunkInNAND/dev->nChunksPerBlock;
+		yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, blockInNAND);
+
+		if (tags->eccResult == YAFFS_ECC_RESULT_FIXED &&
+		    dev->queryBlockBitflips && dev->refreshThreshold > 0)
+			yaffs_HandleChunkBitflips(dev, blockInNAND, bi);
+		else
+			yaffs_HandleChunkError(dev, bi);
 	}
 
 	return result;
 }
 
+int yaffs_QueryBlockBitflips(yaffs_Device *dev, int blockNo)
+{
+	if (!dev->queryBlockBitflips)
+		return -1;
+
+	return dev->queryBlockBitflips(dev, blockNo - dev->blockOffset);
+}
+
+int yaffs_ReadChunksFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 *buffer)
+{
+	if (!dev->readChunksFromNAND)
+		return YAFFS_FAIL;
+
+	dev->nPageReads += nChunks;
+
+	return dev->readChunksFromNAND(dev, chunkInNAND - dev->chunkOffset,
+					nChunks, buffer);
+}
+
 int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						   int chunkInNAND,
 						   const __u8 *buffer,
@@ -44,6 +44,8 @@
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
 #include <linux/string.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
@@ -80,6 +82,7 @@
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 #define Y_CURRENT_TIME CURRENT_TIME.tv_sec
 #define Y_TIME_CONVERT(x) (x).tv_sec
+#define Y_TIME_US() ktime_to_us(ktime_get())
 #else
 #define Y_CURRENT_TIME CURRENT_TIME
 #define Y_TIME_CONVERT(x) (x)
@@ -200,4 +203,9 @@ extern unsigned int yaffs_wr_attempts;
 #define YBUG() do {T(YAFFS_TRACE_BUG, (TSTR("==>> yaffs bug: " __FILE__ " %d" TENDSTR), __LINE__)); } while (0)
 #endif
 
+/* Microsecond clock for gc statistics, optional */
+#ifndef Y_TIME_US
+#define Y_TIME_US() 0
+#endif
+
 #endif
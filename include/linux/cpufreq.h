@@ -369,6 +369,9 @@ extern struct cpufreq_governor cpufreq_gov_ondemand;
 #elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_CONSERVATIVE)
 extern struct cpufreq_governor cpufreq_gov_conservative;
 #define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_conservative)
+#elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE)
+extern struct cpufreq_governor cpufreq_gov_interactive;
+#define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_interactive)
 #endif
 
 
@@ -410,6 +413,13 @@ void cpufreq_frequency_table_get_attr(struct cpufreq_frequency_table *table,
 
 void cpufreq_frequency_table_put_attr(unsigned int cpu);
 
+/*
+ * governors report how long a requested raise took to take effect, the
+ * stats driver (possibly a module) sets the hook that accounts it
+ */
+void cpufreq_ramp_latency(unsigned int cpu, s64 us);
+void cpufreq_set_ramp_latency_hook(void (*hook)(unsigned int cpu, s64 us));
+
 
 /*********************************************************************
  *                     UNIFIED DEBUG HELPERS                         *
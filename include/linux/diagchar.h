@@ -52,6 +52,32 @@
 #define DIAG_IOCTL_SWITCH_LOGGING	7
 #define DIAG_IOCTL_GET_DELAYED_RSP_ID 	8
 #define DIAG_IOCTL_LSM_DEINIT		9
+#define DIAG_IOCTL_SET_RING_SIZE	10
+
+/*
+ * Memory device mode ring, sized with DIAG_IOCTL_SET_RING_SIZE (in kB) and
+ * optionally mapped with mmap(). The control block is followed, at
+ * data_offset, by size bytes of records. Each record is a struct
+ * diag_ring_rec followed by len bytes of HDLC framed data, padded to
+ * DIAG_RING_ALIGN. Records never wrap: a DIAG_RING_PAD record fills the
+ * end of the area instead. head and tail are free running byte counts;
+ * a mmap consumer advances tail itself once it is done with a record.
+ */
+struct diag_ring_ctl {
+	uint32_t size;
+	uint32_t data_offset;
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile uint32_t drops;
+};
+
+struct diag_ring_rec {
+	uint32_t len;
+	uint32_t type;		/* DIAG_RING_PAD or source processor */
+};
+
+#define DIAG_RING_ALIGN			8
+#define DIAG_RING_PAD			0
 
 /* Machine ID and corresponding PC Tools IDs */
 #define APQ8060_MACHINE_ID	86
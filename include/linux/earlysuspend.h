@@ -29,6 +29,10 @@
  * the suspend handlers have already been called without a matching call to the
  * resume handlers, the suspend handler will be called directly from
  * register_early_suspend. This direct call can violate the normal level order.
+ * Handlers of the same level may run concurrently. A handler that needs
+ * another one of its level sets after to it: its suspend handler then runs
+ * once that one's has returned, and its resume handler before that one's.
+ * The handler pointed to must already be registered.
  */
 enum {
 	EARLY_SUSPEND_LEVEL_BLANK_SCREEN = 50,
@@ -41,6 +45,12 @@ struct early_suspend {
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	struct early_suspend *after;
+
+	/* private to earlysuspend.c */
+	int done;
+	unsigned suspend_us, suspend_max_us;
+	unsigned resume_us, resume_max_us;
 #endif
 };
 
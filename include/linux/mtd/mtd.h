@@ -224,6 +224,9 @@ struct mtd_info {
 	/* Bad block management functions */
 	int (*block_isbad) (struct mtd_info *mtd, loff_t ofs);
 	int (*block_markbad) (struct mtd_info *mtd, loff_t ofs);
+	/* Most bitflips corrected in one ECC step of the block since it
+	 * was last erased, or a negative error code */
+	int (*block_bitflips) (struct mtd_info *mtd, loff_t ofs);
 
 	struct notifier_block reboot_notifier;  /* default mode before reboot */
 
@@ -0,0 +1,33 @@
+/* include/linux/rq_stats.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _LINUX_RQ_STATS_H
+#define _LINUX_RQ_STATS_H
+
+#ifdef CONFIG_MSM_SLEEP_STATS
+/* Average number of runnable tasks, in tenths of a task */
+unsigned int rq_stats_avg(void);
+/* Keep sampling every ms even when userspace does not poll, 0 stops */
+void rq_stats_kernel_poll(unsigned int ms);
+#else
+static inline unsigned int rq_stats_avg(void) { return 0; }
+static inline void rq_stats_kernel_poll(unsigned int ms) { }
+#endif
+
+#ifdef CONFIG_MSM_RQ_HOTPLUG
+/* Fed every run queue sample, in tenths of a task */
+void msm_rq_hotplug_sample(unsigned int nr);
+#else
+static inline void msm_rq_hotplug_sample(unsigned int nr) { }
+#endif
+
+#endif
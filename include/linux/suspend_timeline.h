@@ -0,0 +1,66 @@
+/*
+ * Suspend/resume timeline recorder
+ *
+ * Copyright (c) 2011, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _LINUX_SUSPEND_TIMELINE_H
+#define _LINUX_SUSPEND_TIMELINE_H
+
+#include <linux/types.h>
+
+enum suspend_timeline_event {
+	SUSPEND_TL_START,
+	SUSPEND_TL_SYNC_BEGIN,
+	SUSPEND_TL_SYNC_END,
+	SUSPEND_TL_SYNC_WAIT,
+	SUSPEND_TL_FREEZE_BEGIN,
+	SUSPEND_TL_FREEZE_END,
+	SUSPEND_TL_DEV_SUSPEND_BEGIN,
+	SUSPEND_TL_DEV_SUSPEND_END,
+	SUSPEND_TL_DEV_SUSPEND_NOIRQ,
+	SUSPEND_TL_DEV_SLOW,
+	SUSPEND_TL_DEV_FAILED,
+	SUSPEND_TL_ENTER,
+	SUSPEND_TL_RPM_ENTER,
+	SUSPEND_TL_COLLAPSE_ENTER,
+	SUSPEND_TL_COLLAPSE_EXIT,
+	SUSPEND_TL_RPM_EXIT,
+	SUSPEND_TL_WAKEUP_IRQ,
+	SUSPEND_TL_EXIT,
+	SUSPEND_TL_DEV_RESUME_NOIRQ,
+	SUSPEND_TL_DEV_RESUME_BEGIN,
+	SUSPEND_TL_DEV_RESUME_END,
+	SUSPEND_TL_THAW,
+	SUSPEND_TL_END,
+	SUSPEND_TL_NR_EVENTS
+};
+
+#ifdef CONFIG_SUSPEND_TIMELINE
+void suspend_timeline_begin(void);
+void suspend_timeline_end(int error);
+int suspend_timeline_active(void);
+void suspend_timeline_mark(enum suspend_timeline_event event, int val);
+u64 suspend_timeline_clock(void);
+void suspend_timeline_device(const char *name, u64 start, int error);
+#else
+static inline void suspend_timeline_begin(void) {}
+static inline void suspend_timeline_end(int error) {}
+static inline int suspend_timeline_active(void) { return 0; }
+static inline void suspend_timeline_mark(enum suspend_timeline_event event,
+					 int val) {}
+static inline u64 suspend_timeline_clock(void) { return 0; }
+static inline void suspend_timeline_device(const char *name, u64 start,
+					   int error) {}
+#endif
+
+#endif /* _LINUX_SUSPEND_TIMELINE_H */
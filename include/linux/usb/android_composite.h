@@ -115,5 +115,15 @@ extern void android_register_function(struct android_usb_function *f);
 
 extern void android_enable_function(struct usb_function *f, int enable);
 
+/* debugfs directory for per-function statistics, or NULL */
+struct dentry;
+#ifdef CONFIG_DEBUG_FS
+extern struct dentry *android_debugfs_root(void);
+#else
+static inline struct dentry *android_debugfs_root(void)
+{
+	return NULL;
+}
+#endif
 
 #endif	/* __LINUX_USB_ANDROID_H */
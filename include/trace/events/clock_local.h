@@ -0,0 +1,67 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM clock_local
+
+#if !defined(_TRACE_CLOCK_LOCAL_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CLOCK_LOCAL_H
+
+#include <linux/tracepoint.h>
+
+/* The branch of a local clock was turned on or off in hardware */
+DECLARE_EVENT_CLASS(clock_local_toggle,
+
+	TP_PROTO(unsigned int id),
+
+	TP_ARGS(id),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	id		)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+	),
+
+	TP_printk("id=%u", __entry->id)
+);
+
+DEFINE_EVENT(clock_local_toggle, clock_local_enable,
+
+	TP_PROTO(unsigned int id),
+
+	TP_ARGS(id)
+);
+
+DEFINE_EVENT(clock_local_toggle, clock_local_disable,
+
+	TP_PROTO(unsigned int id),
+
+	TP_ARGS(id)
+);
+
+/* A local clock was switched from old_hz to new_hz */
+TRACE_EVENT(clock_local_set_rate,
+
+	TP_PROTO(unsigned int id, unsigned int old_hz, unsigned int new_hz),
+
+	TP_ARGS(id, old_hz, new_hz),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	id		)
+		__field(	unsigned int,	old_hz		)
+		__field(	unsigned int,	new_hz		)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->old_hz = old_hz;
+		__entry->new_hz = new_hz;
+	),
+
+	TP_printk("id=%u old_hz=%u new_hz=%u", __entry->id,
+		  __entry->old_hz, __entry->new_hz)
+);
+
+#endif /* _TRACE_CLOCK_LOCAL_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
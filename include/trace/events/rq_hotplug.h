@@ -0,0 +1,61 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rq_hotplug
+
+#if !defined(_TRACE_RQ_HOTPLUG_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_RQ_HOTPLUG_H
+
+#include <linux/tracepoint.h>
+
+/* A cpu is to be brought up (up=1) or down, given the run queue average */
+TRACE_EVENT(rq_hotplug_decision,
+
+	TP_PROTO(int up, unsigned int rq_avg, unsigned int online),
+
+	TP_ARGS(up, rq_avg, online),
+
+	TP_STRUCT__entry(
+		__field(	int,		up		)
+		__field(	unsigned int,	rq_avg		)
+		__field(	unsigned int,	online		)
+	),
+
+	TP_fast_assign(
+		__entry->up = up;
+		__entry->rq_avg = rq_avg;
+		__entry->online = online;
+	),
+
+	TP_printk("%s rq_avg=%u.%u online=%u", __entry->up ? "up" : "down",
+		  __entry->rq_avg / 10, __entry->rq_avg % 10, __entry->online)
+);
+
+/* The decision was carried out on cpu, latency_us after it was made */
+TRACE_EVENT(rq_hotplug_done,
+
+	TP_PROTO(unsigned int cpu, int up, int ret, s64 latency_us),
+
+	TP_ARGS(cpu, up, ret, latency_us),
+
+	TP_STRUCT__entry(
+		__field(	unsigned int,	cpu		)
+		__field(	int,		up		)
+		__field(	int,		ret		)
+		__field(	s64,		latency_us	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->up = up;
+		__entry->ret = ret;
+		__entry->latency_us = latency_us;
+	),
+
+	TP_printk("cpu=%u %s ret=%d latency_us=%lld", __entry->cpu,
+		  __entry->up ? "up" : "down", __entry->ret,
+		  (long long)__entry->latency_us)
+);
+
+#endif /* _TRACE_RQ_HOTPLUG_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -13,10 +13,14 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
+#include <linux/wait.h>
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
 
@@ -28,6 +32,16 @@ enum {
 };
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
+/* Off unless the board says its handlers declare their .after dependencies:
+ * without them every handler of a level runs concurrently with the others.
+ */
+#ifdef CONFIG_EARLYSUSPEND_ASYNC
+static int async_handlers = 1;
+#else
+static int async_handlers;
+#endif
+module_param_named(async_handlers, async_handlers, int,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
 
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
@@ -43,17 +57,33 @@ enum {
 };
 static int state;
 
+/* Handlers of one level run concurrently in this domain */
+static LIST_HEAD(early_suspend_domain);
+static DECLARE_WAIT_QUEUE_HEAD(handler_wait);
+static int resuming;
+static unsigned last_suspend_us, last_resume_us;
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
+	int after_found = 0;
 
 	mutex_lock(&early_suspend_lock);
 	list_for_each(pos, &early_suspend_handlers) {
 		struct early_suspend *e;
 		e = list_entry(pos, struct early_suspend, link);
+		if (e == handler->after)
+			after_found = 1;
 		if (e->level > handler->level)
 			break;
 	}
+	/* Registration order then is a valid order for the dependencies */
+	if (handler->after && (!after_found ||
+			       handler->after->level != handler->level)) {
+		pr_err("register_early_suspend: %pf: bad dependency on %pf\n",
+		       handler->suspend, handler->after->suspend);
+		handler->after = NULL;
+	}
 	list_add_tail(&handler->link, pos);
 	if ((state & SUSPENDED) && handler->suspend)
 		handler->suspend(handler);
@@ -63,15 +93,109 @@ EXPORT_SYMBOL(register_early_suspend);
 
 void unregister_early_suspend(struct early_suspend *handler)
 {
+	struct early_suspend *pos;
+
 	mutex_lock(&early_suspend_lock);
 	list_del(&handler->link);
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		if (pos->after == handler)
+			pos->after = NULL;
 	mutex_unlock(&early_suspend_lock);
 }
 EXPORT_SYMBOL(unregister_early_suspend);
 
-static void early_suspend(struct work_struct *work)
+/* Waits for the handlers of the same level this one has to follow */
+static void wait_for_dependencies(struct early_suspend *handler)
+{
+	struct early_suspend *pos;
+
+	if (!resuming) {
+		if (handler->after)
+			wait_event(handler_wait, handler->after->done);
+		return;
+	}
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		if (pos->after == handler)
+			wait_event(handler_wait, pos->done);
+}
+
+static void call_handler(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *handler = data;
+	ktime_t start;
+	unsigned us;
+
+	wait_for_dependencies(handler);
+
+	start = ktime_get();
+	if (resuming)
+		handler->resume(handler);
+	else
+		handler->suspend(handler);
+	us = ktime_us_delta(ktime_get(), start);
+
+	if (resuming) {
+		handler->resume_us = us;
+		if (us > handler->resume_max_us)
+			handler->resume_max_us = us;
+	} else {
+		handler->suspend_us = us;
+		if (us > handler->suspend_max_us)
+			handler->suspend_max_us = us;
+	}
+	if (debug_mask & DEBUG_SUSPEND)
+		pr_info("%s: %pf took %u us\n",
+			resuming ? "late_resume" : "early_suspend",
+			resuming ? (void *)handler->resume :
+				   (void *)handler->suspend, us);
+
+	handler->done = 1;
+	wake_up_all(&handler_wait);
+}
+
+static void schedule_handler(struct early_suspend *handler, int *level)
+{
+	if (handler->level != *level) {
+		async_synchronize_full_domain(&early_suspend_domain);
+		*level = handler->level;
+	}
+	if (handler->done)
+		return;
+	if (async_handlers)
+		async_schedule_domain(call_handler, handler,
+				      &early_suspend_domain);
+	else
+		call_handler(handler, 0);
+}
+
+/* Runs the handlers level by level, the ones of a level concurrently. List
+ * order is a valid order for the dependencies, so a handler is never
+ * scheduled ahead of one it waits for. Caller holds early_suspend_lock.
+ */
+static unsigned call_handlers(int resume)
 {
 	struct early_suspend *pos;
+	int level = INT_MIN;
+	ktime_t start = ktime_get();
+
+	resuming = resume;
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		pos->done = resume ? !pos->resume : !pos->suspend;
+
+	if (resume) {
+		list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
+			schedule_handler(pos, &level);
+	} else {
+		list_for_each_entry(pos, &early_suspend_handlers, link)
+			schedule_handler(pos, &level);
+	}
+	async_synchronize_full_domain(&early_suspend_domain);
+
+	return ktime_us_delta(ktime_get(), start);
+}
+
+static void early_suspend(struct work_struct *work)
+{
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -92,13 +216,10 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
-	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL)
-			pos->suspend(pos);
-	}
+	last_suspend_us = call_handlers(0);
 	mutex_unlock(&early_suspend_lock);
 
-	suspend_sys_sync_queue();
+	suspend_sys_sync_background();
 abort:
 	spin_lock_irqsave(&state_lock, irqflags);
 	if (state == SUSPEND_REQUESTED_AND_SUSPENDED)
@@ -108,7 +229,6 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -127,11 +247,9 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
-		if (pos->resume != NULL)
-			pos->resume(pos);
+	last_resume_us = call_handlers(1);
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("late_resume: done\n");
+		pr_info("late_resume: done in %u us\n", last_resume_us);
 abort:
 	mutex_unlock(&early_suspend_lock);
 }
@@ -172,3 +290,43 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_timing_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(m, "last early_suspend %u us, last late_resume %u us\n",
+		   last_suspend_us, last_resume_us);
+	seq_printf(m, "level\tsuspend_us\tmax_us\tresume_us\tmax_us\t"
+		   "handler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(m, "%d\t%u\t\t%u\t%u\t\t%u\t%pf/%pf\n",
+			   pos->level, pos->suspend_us, pos->suspend_max_us,
+			   pos->resume_us, pos->resume_max_us,
+			   pos->suspend, pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_timing_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_timing_show, NULL);
+}
+
+static const struct file_operations early_suspend_timing_fops = {
+	.open = early_suspend_timing_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init early_suspend_debugfs_init(void)
+{
+	debugfs_create_file("early_suspend_timing", S_IRUGO, NULL, NULL,
+			    &early_suspend_timing_fops);
+	return 0;
+}
+late_initcall(early_suspend_debugfs_init);
+#endif
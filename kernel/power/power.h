@@ -240,10 +240,12 @@ extern struct workqueue_struct *suspend_work_queue;
 extern struct wake_lock main_wake_lock;
 extern suspend_state_t requested_suspend_state;
 extern void suspend_sys_sync_queue(void);
-extern int suspend_sys_sync_wait(void);
+extern void suspend_sys_sync_background(void);
+extern int suspend_sys_sync_wait(int budget);
 #else
 static inline void suspend_sys_sync_queue(void) {}
-static inline int suspend_sys_sync_wait(void) { return 0; }
+static inline void suspend_sys_sync_background(void) {}
+static inline int suspend_sys_sync_wait(int budget) { return 0; }
 #endif
 
 #ifdef CONFIG_USER_WAKELOCK
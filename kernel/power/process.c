@@ -11,6 +11,7 @@
 #include <linux/interrupt.h>
 #include <linux/oom.h>
 #include <linux/suspend.h>
+#include <linux/suspend_timeline.h>
 #include <linux/module.h>
 #include <linux/syscalls.h>
 #include <linux/freezer.h>
@@ -133,7 +134,8 @@ int freeze_processes(void)
 		goto Exit;
 	printk("done.\n");
 
-	error = suspend_sys_sync_wait();
+	error = suspend_sys_sync_wait(0);
+	suspend_timeline_mark(SUSPEND_TL_SYNC_WAIT, error);
 	if (error)
 		goto Exit;
 
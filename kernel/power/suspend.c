@@ -22,6 +22,7 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/suspend.h>
+#include <linux/suspend_timeline.h>
 
 #include "power.h"
 
@@ -102,7 +103,9 @@ static int suspend_prepare(void)
 	if (error)
 		goto Finish;
 
+	suspend_timeline_mark(SUSPEND_TL_FREEZE_BEGIN, 0);
 	error = suspend_freeze_processes();
+	suspend_timeline_mark(SUSPEND_TL_FREEZE_END, error);
 	if (!error)
 		return 0;
 
@@ -143,6 +146,7 @@ static int suspend_enter(suspend_state_t state)
 	}
 
 	error = dpm_suspend_noirq(PMSG_SUSPEND);
+	suspend_timeline_mark(SUSPEND_TL_DEV_SUSPEND_NOIRQ, error);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to power down\n");
 		goto Platfrom_finish;
@@ -166,8 +170,11 @@ static int suspend_enter(suspend_state_t state)
 
 	error = sysdev_suspend(PMSG_SUSPEND);
 	if (!error) {
-		if (!suspend_test(TEST_CORE))
+		if (!suspend_test(TEST_CORE)) {
+			suspend_timeline_mark(SUSPEND_TL_ENTER, 0);
 			error = suspend_ops->enter(state);
+			suspend_timeline_mark(SUSPEND_TL_EXIT, error);
+		}
 		sysdev_resume();
 	}
 
@@ -183,6 +190,7 @@ static int suspend_enter(suspend_state_t state)
 
  Power_up_devices:
 	dpm_resume_noirq(PMSG_RESUME);
+	suspend_timeline_mark(SUSPEND_TL_DEV_RESUME_NOIRQ, 0);
 
  Platfrom_finish:
 	if (suspend_ops->finish)
@@ -211,7 +219,9 @@ int suspend_devices_and_enter(suspend_state_t state)
 	suspend_console();
 	pm_restrict_gfp_mask();
 	suspend_test_start();
+	suspend_timeline_mark(SUSPEND_TL_DEV_SUSPEND_BEGIN, 0);
 	error = dpm_suspend_start(PMSG_SUSPEND);
+	suspend_timeline_mark(SUSPEND_TL_DEV_SUSPEND_END, error);
 	if (error) {
 		printk(KERN_ERR "PM: Some devices failed to suspend\n");
 		goto Recover_platform;
@@ -224,7 +234,9 @@ int suspend_devices_and_enter(suspend_state_t state)
 
  Resume_devices:
 	suspend_test_start();
+	suspend_timeline_mark(SUSPEND_TL_DEV_RESUME_BEGIN, 0);
 	dpm_resume_end(PMSG_RESUME);
+	suspend_timeline_mark(SUSPEND_TL_DEV_RESUME_END, 0);
 	suspend_test_finish("resume devices");
 	pm_restore_gfp_mask();
 	resume_console();
@@ -248,6 +260,7 @@ int suspend_devices_and_enter(suspend_state_t state)
 static void suspend_finish(void)
 {
 	suspend_thaw_processes();
+	suspend_timeline_mark(SUSPEND_TL_THAW, 0);
 	usermodehelper_enable();
 	pm_notifier_call_chain(PM_POST_SUSPEND);
 	pm_restore_console();
@@ -273,8 +286,15 @@ int enter_state(suspend_state_t state)
 	if (!mutex_trylock(&pm_mutex))
 		return -EBUSY;
 
+	suspend_timeline_begin();
 	suspend_sys_sync_queue();
 
+	/* back off a slow sync before anything is frozen */
+	error = suspend_sys_sync_wait(1);
+	suspend_timeline_mark(SUSPEND_TL_SYNC_WAIT, error);
+	if (error)
+		goto Unlock;
+
 	pr_debug("PM: Preparing system for %s sleep\n", pm_states[state]);
 	error = suspend_prepare();
 	if (error)
@@ -290,6 +310,7 @@ int enter_state(suspend_state_t state)
 	pr_debug("PM: Finishing wakeup.\n");
 	suspend_finish();
  Unlock:
+	suspend_timeline_end(error);
 	mutex_unlock(&pm_mutex);
 	return error;
 }
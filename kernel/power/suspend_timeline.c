@@ -0,0 +1,265 @@
+/*
+ * kernel/power/suspend_timeline.c - Suspend/resume timeline recorder
+ *
+ * Copyright (c) 2011, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Every suspend attempt, from enter_state() until it returns, is one
+ * cycle. Phases of the cycle mark events in it, and only devices whose
+ * callbacks fail or take longer than slow_dev_us are recorded on their
+ * own. The last SUSPEND_TL_CYCLES cycles are kept in a ring and shown in
+ * debugfs suspend_timeline, oldest first. Timestamps come from
+ * sched_clock() since timekeeping is suspended for most of the cycle.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/debugfs.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/suspend_timeline.h>
+#include <asm/div64.h>
+
+#define SUSPEND_TL_CYCLES	8
+#define SUSPEND_TL_EVENTS	48
+#define SUSPEND_TL_NAME_LEN	16
+
+static unsigned int slow_dev_us = 10000;
+module_param(slow_dev_us, uint, S_IRUGO | S_IWUSR);
+
+struct suspend_tl_entry {
+	u64 ts;
+	int val;
+	u8 event;
+	char name[SUSPEND_TL_NAME_LEN];
+};
+
+struct suspend_tl_cycle {
+	int error;
+	unsigned int nr;
+	unsigned int dropped;
+	struct suspend_tl_entry entry[SUSPEND_TL_EVENTS];
+};
+
+static const char * const suspend_tl_names[SUSPEND_TL_NR_EVENTS] = {
+	[SUSPEND_TL_START]		= "start",
+	[SUSPEND_TL_SYNC_BEGIN]		= "sync_begin",
+	[SUSPEND_TL_SYNC_END]		= "sync_end",
+	[SUSPEND_TL_SYNC_WAIT]		= "sync_wait",
+	[SUSPEND_TL_FREEZE_BEGIN]	= "freeze_begin",
+	[SUSPEND_TL_FREEZE_END]		= "freeze_end",
+	[SUSPEND_TL_DEV_SUSPEND_BEGIN]	= "dev_suspend_begin",
+	[SUSPEND_TL_DEV_SUSPEND_END]	= "dev_suspend_end",
+	[SUSPEND_TL_DEV_SUSPEND_NOIRQ]	= "dev_suspend_noirq",
+	[SUSPEND_TL_DEV_SLOW]		= "dev_slow",
+	[SUSPEND_TL_DEV_FAILED]		= "dev_failed",
+	[SUSPEND_TL_ENTER]		= "enter",
+	[SUSPEND_TL_RPM_ENTER]		= "rpm_enter",
+	[SUSPEND_TL_COLLAPSE_ENTER]	= "collapse_enter",
+	[SUSPEND_TL_COLLAPSE_EXIT]	= "collapse_exit",
+	[SUSPEND_TL_RPM_EXIT]		= "rpm_exit",
+	[SUSPEND_TL_WAKEUP_IRQ]		= "wakeup_irq",
+	[SUSPEND_TL_EXIT]		= "exit",
+	[SUSPEND_TL_DEV_RESUME_NOIRQ]	= "dev_resume_noirq",
+	[SUSPEND_TL_DEV_RESUME_BEGIN]	= "dev_resume_begin",
+	[SUSPEND_TL_DEV_RESUME_END]	= "dev_resume_end",
+	[SUSPEND_TL_THAW]		= "thaw",
+	[SUSPEND_TL_END]		= "end",
+};
+
+static DEFINE_SPINLOCK(suspend_tl_lock);
+static struct suspend_tl_cycle suspend_tl_ring[SUSPEND_TL_CYCLES];
+/* next slot to fill, and how many slots hold a cycle */
+static unsigned int suspend_tl_head;
+static unsigned int suspend_tl_count;
+static struct suspend_tl_cycle *suspend_tl_cur;
+
+u64 suspend_timeline_clock(void)
+{
+	return sched_clock();
+}
+
+static void suspend_tl_add_locked(enum suspend_timeline_event event, int val,
+				  const char *name, u64 ts)
+{
+	struct suspend_tl_cycle *c = suspend_tl_cur;
+	struct suspend_tl_entry *e;
+
+	if (c->nr >= SUSPEND_TL_EVENTS) {
+		c->dropped++;
+		return;
+	}
+	e = &c->entry[c->nr++];
+	e->ts = ts;
+	e->val = val;
+	e->event = event;
+	if (name)
+		strlcpy(e->name, name, sizeof(e->name));
+	else
+		e->name[0] = '\0';
+}
+
+static void suspend_tl_add(enum suspend_timeline_event event, int val,
+			   const char *name)
+{
+	unsigned long flags;
+	u64 ts = sched_clock();
+
+	spin_lock_irqsave(&suspend_tl_lock, flags);
+	if (suspend_tl_cur)
+		suspend_tl_add_locked(event, val, name, ts);
+	spin_unlock_irqrestore(&suspend_tl_lock, flags);
+}
+
+void suspend_timeline_begin(void)
+{
+	unsigned long flags;
+	u64 ts = sched_clock();
+
+	spin_lock_irqsave(&suspend_tl_lock, flags);
+	suspend_tl_cur = &suspend_tl_ring[suspend_tl_head];
+	memset(suspend_tl_cur, 0, sizeof(*suspend_tl_cur));
+	suspend_tl_head = (suspend_tl_head + 1) % SUSPEND_TL_CYCLES;
+	if (suspend_tl_count < SUSPEND_TL_CYCLES)
+		suspend_tl_count++;
+	suspend_tl_add_locked(SUSPEND_TL_START, 0, NULL, ts);
+	spin_unlock_irqrestore(&suspend_tl_lock, flags);
+}
+
+void suspend_timeline_end(int error)
+{
+	unsigned long flags;
+	u64 ts = sched_clock();
+
+	spin_lock_irqsave(&suspend_tl_lock, flags);
+	if (suspend_tl_cur) {
+		suspend_tl_add_locked(SUSPEND_TL_END, error, NULL, ts);
+		suspend_tl_cur->error = error;
+		suspend_tl_cur = NULL;
+	}
+	spin_unlock_irqrestore(&suspend_tl_lock, flags);
+}
+
+/* Lets callers skip gathering data for a mark outside of a cycle */
+int suspend_timeline_active(void)
+{
+	return suspend_tl_cur != NULL;
+}
+
+void suspend_timeline_mark(enum suspend_timeline_event event, int val)
+{
+	if (suspend_tl_cur)
+		suspend_tl_add(event, val, NULL);
+}
+
+/* @start is the suspend_timeline_clock() value taken before the callback */
+void suspend_timeline_device(const char *name, u64 start, int error)
+{
+	u64 delta;
+
+	if (!suspend_tl_cur)
+		return;
+
+	if (error) {
+		suspend_tl_add(SUSPEND_TL_DEV_FAILED, error, name);
+		return;
+	}
+
+	delta = sched_clock() - start;
+	do_div(delta, NSEC_PER_USEC);
+	if (delta >= slow_dev_us)
+		suspend_tl_add(SUSPEND_TL_DEV_SLOW, (int)min_t(u64, delta,
+							   INT_MAX), name);
+}
+
+static int suspend_tl_show(struct seq_file *m, void *unused)
+{
+	struct suspend_tl_cycle *ring;
+	struct suspend_tl_entry *e;
+	unsigned long flags;
+	unsigned int head, count, i, j;
+	u64 start, off;
+
+	ring = kmalloc(sizeof(suspend_tl_ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&suspend_tl_lock, flags);
+	memcpy(ring, suspend_tl_ring, sizeof(suspend_tl_ring));
+	head = suspend_tl_head;
+	count = suspend_tl_count;
+	spin_unlock_irqrestore(&suspend_tl_lock, flags);
+
+	for (i = 0; i < count; i++) {
+		struct suspend_tl_cycle *c;
+
+		c = &ring[(head + SUSPEND_TL_CYCLES - count + i) %
+			  SUSPEND_TL_CYCLES];
+		if (!c->nr)
+			continue;
+		start = c->entry[0].ts;
+		seq_printf(m, "cycle %u: error %d, %u events, %u dropped\n",
+			   i, c->error, c->nr, c->dropped);
+		for (j = 0; j < c->nr; j++) {
+			e = &c->entry[j];
+			off = e->ts - start;
+			do_div(off, NSEC_PER_USEC);
+			seq_printf(m, "  %10llu us  %-18s %d %s\n", off,
+				   suspend_tl_names[e->event], e->val,
+				   e->name);
+		}
+	}
+
+	kfree(ring);
+	return 0;
+}
+
+static int suspend_tl_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_tl_show, NULL);
+}
+
+/* Any write drops the recorded cycles */
+static ssize_t suspend_tl_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&suspend_tl_lock, flags);
+	if (!suspend_tl_cur) {
+		suspend_tl_head = 0;
+		suspend_tl_count = 0;
+	}
+	spin_unlock_irqrestore(&suspend_tl_lock, flags);
+	return count;
+}
+
+static const struct file_operations suspend_tl_fops = {
+	.open = suspend_tl_open,
+	.read = seq_read,
+	.write = suspend_tl_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init suspend_timeline_init(void)
+{
+	debugfs_create_file("suspend_timeline", 0644, NULL, NULL,
+			    &suspend_tl_fops);
+	return 0;
+}
+late_initcall(suspend_timeline_init);
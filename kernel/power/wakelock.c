@@ -14,11 +14,19 @@
  */
 
 #include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/percpu.h>
 #include <linux/platform_device.h>
 #include <linux/rtc.h>
 #include <linux/suspend.h>
+#include <linux/suspend_timeline.h>
 #include <linux/syscalls.h> /* sys_sync */
+#include <linux/vmstat.h>
 #include <linux/wakelock.h>
+#include <linux/writeback.h>
+#if defined(CONFIG_WAKELOCK_STAT) || defined(CONFIG_DEBUG_FS)
+#include <linux/seq_file.h>
+#endif
 #ifdef CONFIG_WAKELOCK_STAT
 #include <linux/proc_fs.h>
 #endif
@@ -43,8 +51,17 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+/* Active locks with a timeout, ordered by expiry, and a count of the rest,
+ * so that has_wake_lock does not have to walk the active lists.
+ */
+static struct rb_root expire_trees[WAKE_LOCK_TYPE_COUNT];
+static int active_no_timeout[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
-static int suspend_sys_sync_count;
+/* Sync generations: requested by suspend attempts, and covered by the last
+ * sync to finish, which covers every request made before it started.
+ */
+static unsigned int suspend_sys_sync_req;
+static unsigned int suspend_sys_sync_done;
 static DEFINE_SPINLOCK(suspend_sys_sync_lock);
 static struct workqueue_struct *suspend_sys_sync_work_queue;
 static DECLARE_COMPLETION(suspend_sys_sync_comp);
@@ -53,6 +70,54 @@ struct wake_lock main_wake_lock;
 suspend_state_t requested_suspend_state = PM_SUSPEND_MEM;
 static struct wake_lock unknown_wakeup;
 
+#ifdef CONFIG_DEBUG_FS
+enum {
+	WAKELOCK_COST_LOCK,
+	WAKELOCK_COST_UNLOCK,
+	WAKELOCK_COST_HAS_LOCK,
+	WAKELOCK_COST_COUNT
+};
+
+static const char *wakelock_cost_names[WAKELOCK_COST_COUNT] = {
+	[WAKELOCK_COST_LOCK] = "wake_lock",
+	[WAKELOCK_COST_UNLOCK] = "wake_unlock",
+	[WAKELOCK_COST_HAS_LOCK] = "has_wake_lock",
+};
+
+struct wakelock_cost {
+	unsigned long count;
+	u64 total_ns;
+	u32 max_ns;
+};
+static DEFINE_PER_CPU(struct wakelock_cost [WAKELOCK_COST_COUNT],
+		      wakelock_costs);
+
+/* Time from entry, lock contention included, to just before the list_lock
+ * is dropped. Caller must hold the list_lock, so interrupts are off.
+ */
+static void wakelock_cost_locked(int op, ktime_t start)
+{
+	struct wakelock_cost *cost = &__get_cpu_var(wakelock_costs)[op];
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	cost->count++;
+	cost->total_ns += ns;
+	if (ns > cost->max_ns)
+		cost->max_ns = ns;
+}
+
+static inline ktime_t wakelock_cost_start(void)
+{
+	return ktime_get();
+}
+#else
+static inline void wakelock_cost_locked(int op, ktime_t start) {}
+static inline ktime_t wakelock_cost_start(void)
+{
+	return ktime_set(0, 0);
+}
+#endif
+
 #ifdef CONFIG_WAKELOCK_STAT
 static struct wake_lock deleted_wake_locks;
 static ktime_t last_sleep_time_update;
@@ -196,12 +261,46 @@ static void update_sleep_wait_stats_locked(int done)
 }
 #endif
 
+/* Caller must acquire the list_lock spinlock */
+static void expire_tree_insert(struct wake_lock *lock, int type)
+{
+	struct rb_node **p = &expire_trees[type].rb_node;
+	struct rb_node *parent = NULL;
+	struct wake_lock *l;
+
+	while (*p) {
+		parent = *p;
+		l = rb_entry(parent, struct wake_lock, expire_node);
+		if (time_before(lock->expires, l->expires))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&lock->expire_node, parent, p);
+	rb_insert_color(&lock->expire_node, &expire_trees[type]);
+}
+
+/* Takes the lock out of the expire tree or the no timeout count, whichever
+ * it is accounted in. Caller must acquire the list_lock spinlock.
+ */
+static void deactivate_wake_lock(struct wake_lock *lock)
+{
+	int type = lock->flags & WAKE_LOCK_TYPE_MASK;
+
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		return;
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		rb_erase(&lock->expire_node, &expire_trees[type]);
+	else
+		active_no_timeout[type]--;
+}
 
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	deactivate_wake_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -277,64 +376,161 @@ EXPORT_SYMBOL(debug_print_active_locks);
 
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct rb_node *node;
+	struct wake_lock *lock;
+	unsigned long now = jiffies;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	while ((node = rb_first(&expire_trees[type]))) {
+		lock = rb_entry(node, struct wake_lock, expire_node);
+		if ((long)(lock->expires - now) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+	if (active_no_timeout[type])
+		return -1;
+	node = rb_last(&expire_trees[type]);
+	if (!node)
+		return 0;
+	lock = rb_entry(node, struct wake_lock, expire_node);
+	return lock->expires - now;
 }
 
 long has_wake_lock(int type)
 {
 	long ret;
 	unsigned long irqflags;
+	ktime_t start = wakelock_cost_start();
+
 	spin_lock_irqsave(&list_lock, irqflags);
 	ret = has_wake_lock_locked(type);
 	if (ret && (debug_mask & DEBUG_SUSPEND) && type == WAKE_LOCK_SUSPEND)
 		print_active_locks(type);
+	wakelock_cost_locked(WAKELOCK_COST_HAS_LOCK, start);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 	return ret;
 }
 
 
+#ifdef CONFIG_WAKELOCK_STAT
+/* Never locked, it reports the suspend syncs in /proc/wakelocks: count is
+ * the number of syncs, expire_count the suspend attempts that gave up
+ * waiting for one, and last_change the end of the last sync.
+ */
+static struct wake_lock sys_sync_stat;
+
+static void sys_sync_stat_add(ktime_t now, ktime_t duration)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	sys_sync_stat.stat.count++;
+	sys_sync_stat.stat.total_time =
+		ktime_add(sys_sync_stat.stat.total_time, duration);
+	if (ktime_to_ns(duration) > ktime_to_ns(sys_sync_stat.stat.max_time))
+		sys_sync_stat.stat.max_time = duration;
+	sys_sync_stat.stat.last_time = now;
+	spin_unlock_irqrestore(&list_lock, irqflags);
+}
+
+static void sys_sync_stat_expired(void)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	sys_sync_stat.stat.expire_count++;
+	spin_unlock_irqrestore(&list_lock, irqflags);
+}
+#else
+static inline void sys_sync_stat_add(ktime_t now, ktime_t duration) {}
+static inline void sys_sync_stat_expired(void) {}
+#endif
+
+/* Skip the sync when no more than this many pages are dirty or under
+ * writeback. Off by default: filesystems that cache data outside the page
+ * cache, such as yaffs2, are not visible in these counters.
+ */
+static int sys_sync_skip_pages = -1;
+module_param(sys_sync_skip_pages, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
+/* How long a suspend attempt waits for the sync before it backs off, 0 to
+ * wait for as long as no wake lock is taken. The wait happens before any
+ * task is frozen, so backing off costs no thaw and refreeze.
+ */
+static unsigned int sys_sync_budget_ms = 2000;
+module_param(sys_sync_budget_ms, uint, S_IRUGO | S_IWUSR | S_IWGRP);
+
 static void suspend_sys_sync(struct work_struct *work)
 {
+	unsigned long dirty;
+	unsigned int gen;
+	ktime_t start, now;
+
+	spin_lock(&suspend_sys_sync_lock);
+	gen = suspend_sys_sync_req;
+	spin_unlock(&suspend_sys_sync_lock);
+
+	dirty = global_page_state(NR_FILE_DIRTY) +
+		global_page_state(NR_WRITEBACK) +
+		global_page_state(NR_UNSTABLE_NFS);
+	if (sys_sync_skip_pages >= 0 &&
+	    dirty <= (unsigned long)sys_sync_skip_pages) {
+		if (debug_mask & DEBUG_SUSPEND)
+			pr_info("PM: %lu dirty pages, skipping sync\n", dirty);
+		goto done;
+	}
+
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("PM: Syncing filesystems...\n");
+		pr_info("PM: Syncing filesystems, %lu dirty pages...\n", dirty);
 
+	suspend_timeline_mark(SUSPEND_TL_SYNC_BEGIN, 0);
+	start = ktime_get();
 	sys_sync();
+	now = ktime_get();
+	sys_sync_stat_add(now, ktime_sub(now, start));
+	suspend_timeline_mark(SUSPEND_TL_SYNC_END, 0);
 
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("sync done.\n");
+		pr_info("sync done in %lld us.\n",
+			ktime_to_us(ktime_sub(now, start)));
 
+done:
 	spin_lock(&suspend_sys_sync_lock);
-	suspend_sys_sync_count--;
+	suspend_sys_sync_done = gen;
 	spin_unlock(&suspend_sys_sync_lock);
 }
 static DECLARE_WORK(suspend_sys_sync_work, suspend_sys_sync);
 
-void suspend_sys_sync_queue(void)
+/* Lockless, the timer handler polls it */
+static int suspend_sys_sync_pending(void)
 {
-	int ret;
+	return ACCESS_ONCE(suspend_sys_sync_done) !=
+		ACCESS_ONCE(suspend_sys_sync_req);
+}
 
+/* A sync that is still running started before this request and may miss
+ * data dirtied since, so another one is queued behind it. Requests made
+ * while one is queued and not started yet share it.
+ */
+void suspend_sys_sync_queue(void)
+{
 	spin_lock(&suspend_sys_sync_lock);
-	ret = queue_work(suspend_sys_sync_work_queue, &suspend_sys_sync_work);
-	if (ret)
-		suspend_sys_sync_count++;
+	suspend_sys_sync_req++;
+	queue_work(suspend_sys_sync_work_queue, &suspend_sys_sync_work);
 	spin_unlock(&suspend_sys_sync_lock);
 }
 
-static bool suspend_sys_sync_abort;
+/* Called when the screen turns off: start writing back dirty inodes without
+ * waiting for them, so the sync of the first suspend attempt finds less to do.
+ */
+void suspend_sys_sync_background(void)
+{
+	wakeup_flusher_threads(0);
+}
+
+static int suspend_sys_sync_abort;
+static int suspend_sys_sync_budget;
+static unsigned long suspend_sys_sync_deadline;
 static void suspend_sys_sync_handler(unsigned long);
 static DEFINE_TIMER(suspend_sys_sync_timer, suspend_sys_sync_handler, 0, 0);
 /* value should be less then half of input event wake lock timeout value
@@ -343,10 +539,14 @@ static DEFINE_TIMER(suspend_sys_sync_timer, suspend_sys_sync_handler, 0, 0);
 #define SUSPEND_SYS_SYNC_TIMEOUT (HZ/4)
 static void suspend_sys_sync_handler(unsigned long arg)
 {
-	if (suspend_sys_sync_count == 0) {
+	if (!suspend_sys_sync_pending()) {
 		complete(&suspend_sys_sync_comp);
 	} else if (has_wake_lock(WAKE_LOCK_SUSPEND)) {
-		suspend_sys_sync_abort = true;
+		suspend_sys_sync_abort = -EAGAIN;
+		complete(&suspend_sys_sync_comp);
+	} else if (suspend_sys_sync_budget && sys_sync_budget_ms &&
+		   time_after_eq(jiffies, suspend_sys_sync_deadline)) {
+		suspend_sys_sync_abort = -EBUSY;
 		complete(&suspend_sys_sync_comp);
 	} else {
 		mod_timer(&suspend_sys_sync_timer, jiffies +
@@ -354,21 +554,30 @@ static void suspend_sys_sync_handler(unsigned long arg)
 	}
 }
 
-int suspend_sys_sync_wait(void)
+/* @budget: give up after sys_sync_budget_ms, for callers that have not
+ * frozen anything yet.
+ */
+int suspend_sys_sync_wait(int budget)
 {
-	suspend_sys_sync_abort = false;
+	suspend_sys_sync_abort = 0;
+	suspend_sys_sync_budget = budget;
 
-	if (suspend_sys_sync_count != 0) {
+	if (suspend_sys_sync_pending()) {
+		suspend_sys_sync_deadline = jiffies +
+			msecs_to_jiffies(sys_sync_budget_ms);
 		mod_timer(&suspend_sys_sync_timer, jiffies +
 				SUSPEND_SYS_SYNC_TIMEOUT);
 		wait_for_completion(&suspend_sys_sync_comp);
 	}
-	if (suspend_sys_sync_abort) {
+	if (suspend_sys_sync_abort == -EAGAIN) {
 		pr_info("suspend aborted....while waiting for sys_sync\n");
-		return -EAGAIN;
+	} else if (suspend_sys_sync_abort == -EBUSY) {
+		pr_info("suspend aborted....sys_sync over %u ms budget\n",
+			sys_sync_budget_ms);
+		sys_sync_stat_expired();
 	}
 
-	return 0;
+	return suspend_sys_sync_abort;
 }
 
 static void suspend(struct work_struct *work)
@@ -491,7 +700,9 @@ void wake_lock_destroy(struct wake_lock *lock)
 #endif
 
 	spin_lock_irqsave(&list_lock, irqflags);
-	lock->flags &= ~WAKE_LOCK_INITIALIZED;
+	deactivate_wake_lock(lock);
+	lock->flags &= ~(WAKE_LOCK_INITIALIZED | WAKE_LOCK_ACTIVE |
+			 WAKE_LOCK_AUTO_EXPIRE);
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
 		deleted_wake_locks.stat.count += lock->stat.count;
@@ -518,6 +729,7 @@ static void wake_lock_internal(
 	int type;
 	unsigned long irqflags;
 	long expire_in;
+	ktime_t start = wakelock_cost_start();
 
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
@@ -536,6 +748,7 @@ static void wake_lock_internal(
 		lock->stat.last_time = ktime_get();
 	}
 #endif
+	deactivate_wake_lock(lock);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
@@ -551,12 +764,14 @@ static void wake_lock_internal(
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
 		list_add_tail(&lock->link, &active_wake_locks[type]);
+		expire_tree_insert(lock, type);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 		list_add(&lock->link, &active_wake_locks[type]);
+		active_no_timeout[type]++;
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
@@ -584,6 +799,7 @@ static void wake_lock_internal(
 				queue_work(suspend_work_queue, &suspend_work);
 		}
 	}
+	wakelock_cost_locked(WAKELOCK_COST_LOCK, start);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 
@@ -603,6 +819,8 @@ void wake_unlock(struct wake_lock *lock)
 {
 	int type;
 	unsigned long irqflags;
+	ktime_t start = wakelock_cost_start();
+
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 #ifdef CONFIG_WAKELOCK_STAT
@@ -610,6 +828,7 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	deactivate_wake_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -636,6 +855,7 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 		}
 	}
+	wakelock_cost_locked(WAKELOCK_COST_UNLOCK, start);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_unlock);
@@ -659,6 +879,78 @@ static const struct file_operations wakelock_stats_fops = {
 	.release = single_release,
 };
 
+#ifdef CONFIG_DEBUG_FS
+static int wakelock_cost_show(struct seq_file *m, void *unused)
+{
+	struct wakelock_cost cost[WAKELOCK_COST_COUNT];
+	unsigned long irqflags;
+	int no_timeout[WAKE_LOCK_TYPE_COUNT];
+	int cpu, op;
+	u64 avg;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	memcpy(no_timeout, active_no_timeout, sizeof(no_timeout));
+	spin_unlock_irqrestore(&list_lock, irqflags);
+
+	seq_printf(m, "active without timeout: suspend %d, idle %d\n",
+		   no_timeout[WAKE_LOCK_SUSPEND], no_timeout[WAKE_LOCK_IDLE]);
+	seq_printf(m, "cpu\top\t\tcount\ttotal_ns\tavg_ns\tmax_ns\n");
+	for_each_possible_cpu(cpu) {
+		spin_lock_irqsave(&list_lock, irqflags);
+		memcpy(cost, per_cpu(wakelock_costs, cpu), sizeof(cost));
+		spin_unlock_irqrestore(&list_lock, irqflags);
+
+		for (op = 0; op < WAKELOCK_COST_COUNT; op++) {
+			if (!cost[op].count)
+				continue;
+			avg = cost[op].total_ns;
+			do_div(avg, cost[op].count);
+			seq_printf(m, "%d\t%-13s\t%lu\t%llu\t%llu\t%u\n", cpu,
+				   wakelock_cost_names[op], cost[op].count,
+				   cost[op].total_ns, avg, cost[op].max_ns);
+		}
+	}
+	return 0;
+}
+
+static int wakelock_cost_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wakelock_cost_show, NULL);
+}
+
+/* Any write clears the counters */
+static ssize_t wakelock_cost_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	unsigned long irqflags;
+	int cpu;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu(wakelock_costs, cpu), 0,
+		       sizeof(per_cpu(wakelock_costs, cpu)));
+	spin_unlock_irqrestore(&list_lock, irqflags);
+	return count;
+}
+
+static const struct file_operations wakelock_cost_fops = {
+	.open = wakelock_cost_open,
+	.read = seq_read,
+	.write = wakelock_cost_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* debugfs is not up yet when wakelocks_init runs */
+static int __init wakelock_debugfs_init(void)
+{
+	debugfs_create_file("wakelock_cost", 0644, NULL, NULL,
+			    &wakelock_cost_fops);
+	return 0;
+}
+late_initcall(wakelock_debugfs_init);
+#endif
+
 static int __init wakelocks_init(void)
 {
 	int ret;
@@ -670,6 +962,7 @@ static int __init wakelocks_init(void)
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
 			"deleted_wake_locks");
+	wake_lock_init(&sys_sync_stat, WAKE_LOCK_SUSPEND, "suspend_sys_sync");
 #endif
 	wake_lock_init(&main_wake_lock, WAKE_LOCK_SUSPEND, "main");
 	wake_lock(&main_wake_lock);
@@ -715,6 +1008,7 @@ err_platform_device_register:
 	wake_lock_destroy(&unknown_wakeup);
 	wake_lock_destroy(&main_wake_lock);
 #ifdef CONFIG_WAKELOCK_STAT
+	wake_lock_destroy(&sys_sync_stat);
 	wake_lock_destroy(&deleted_wake_locks);
 #endif
 	return ret;
@@ -732,6 +1026,7 @@ static void  __exit wakelocks_exit(void)
 	wake_lock_destroy(&unknown_wakeup);
 	wake_lock_destroy(&main_wake_lock);
 #ifdef CONFIG_WAKELOCK_STAT
+	wake_lock_destroy(&sys_sync_stat);
 	wake_lock_destroy(&deleted_wake_locks);
 #endif
 }